@@ -2,11 +2,13 @@
 // Includes required to build the sketch (including ext. dependencies)
 #include <ArduinoMFReader.h>
 #include <SPI.h>
+#include <EEPROM.h>
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
 // Summary of available objects:
 // cardCheckTimer (acp.common.timer)
+// commandTimer (acp.common.timer)
 // cardReader (acp.rfid.mfrc522)
 // messenger (acp.messenger.gep_stream_messenger)
 //----------------------------------------------------------------------
@@ -14,9 +16,90 @@
 // Maximal length of response
 #define MAX_RESPONSE_LENGTH 30
 
+// Number of responses kept for replaying responses to repeated commands
+#define RESPONSE_CACHE_SIZE 4
+
+// Length of cached response indicating that the response cannot be replayed
+#define NOT_REPLAYABLE 0xFF
+
+// Time in milliseconds without received frames after which cached responses are discarded (a new
+// session of a client starts, the client retransmits commands within a shorter time)
+#define RESPONSE_CACHE_LIFETIME 5000
+
+// Maximal number of pages read by a single command (4 bytes per page must fit in a response)
+#define MAX_PAGES_PER_RESPONSE 12
+
+// Maximal number of bytes of NDEF message sent in a single response chunk
+#define MAX_NDEF_CHUNK_SIZE 44
+
+// Maximal length of a command (must match MaxMessageSize of the messenger)
+#define MAX_COMMAND_LENGTH 50
+
+// Number of command codes
+#define COMMAND_COUNT 30
+
+// Flag of command whose payload consists of 2B address and data of whole blocks
+#define COMMAND_BLOCK_DATA 0x01
+
+// Flag of GET_STATS command that resets statistics of the command after reading
+#define STATS_RESET 0x01
+
+// Address of the stored macro in EEPROM: [LENGTH 1B][FLAGS 1B][BYTECODE]
+#define MACRO_EEPROM_ADDRESS EEPROM_USAGE
+
+// Maximal length of macro bytecode
+#define MAX_MACRO_LENGTH 200
+
+// Maximal number of instructions executed by a single run of macro (protects against infinite loops)
+#define MAX_MACRO_STEPS 500
+
+// Maximal number of bytes emitted by a macro (the output must fit in a cached response)
+#define MAX_MACRO_OUTPUT (MAX_RESPONSE_LENGTH - 2)
+
+// Flag of macro that is executed automatically when a card is detected
+#define MACRO_AUTORUN 0x01
+
+// Address of the persisted link speed in EEPROM: [BAUD RATE 4B big endian]
+#define LINK_SPEED_EEPROM_ADDRESS (MACRO_EEPROM_ADDRESS + 2 + MAX_MACRO_LENGTH)
+
+// Link speed used when no valid link speed is persisted and after failed switch of link speed
+#define DEFAULT_LINK_SPEED 9600
+
+// Range of supported link speeds
+#define MIN_LINK_SPEED 9600
+#define MAX_LINK_SPEED 1000000
+
+// Time in milliseconds to receive a valid message after switch of link speed (otherwise the link
+// speed falls back to DEFAULT_LINK_SPEED)
+#define LINK_SPEED_TIMEOUT 1000
+
+// Flag of SET_LINK_SPEED command that persists the link speed (after it is confirmed by a valid message)
+#define LINK_SPEED_PERSIST 0x01
+
+// Size of receive buffer of the serial port (bytes the client can send while a command is executed)
+#define SERIAL_RX_CAPACITY 64
+
+// Length of credits appended to responses when flow control is enabled: [1B free slots][1B free bytes]
+#define CREDITS_LENGTH 2
+
+// Length of header of a message coalesced into envelope: [LENGTH 1B][TAG 2B]
+#define ENVELOPE_ITEM_HEADER 3
+
 // Identification of the other GEP endpoint (0 - point-to-point connection is assumed).
 #define ENDPOINT_ID 0
 
+// Number of events kept in the trace, each event takes 6 bytes of RAM (0 - tracing is compiled out)
+#define TRACE_SIZE 32
+
+// Flag of TRACE_DUMP command that clears the trace after it is sent
+#define TRACE_CLEAR 0x01
+
+// Length of an event in response to TRACE_DUMP: [TIME 4B big endian][EVENT 1B][DATA 1B]
+#define TRACE_RECORD_LENGTH 6
+
+// Maximal number of events sent in a single response chunk
+#define MAX_TRACE_RECORDS_PER_CHUNK ((MAX_COMMAND_LENGTH - 5) / TRACE_RECORD_LENGTH)
+
 // Command codes
 enum CommandCode: byte {
   RESET = 1,
@@ -24,7 +107,31 @@ enum CommandCode: byte {
   READ_BLOCK = 3,
   WRITE_BLOCK = 4,
   READ_SECTOR_TRAILER = 5,
-  WRITE_SECTOR_TRAILER = 6
+  WRITE_SECTOR_TRAILER = 6,
+  VALUE_GET = 7,
+  VALUE_SET = 8,
+  VALUE_ADD = 9,
+  VALUE_SUB = 10,
+  VALUE_COPY = 11,
+  VALUE_DEBIT = 12,
+  READ_PAGES = 13,
+  WRITE_PAGE = 14,
+  PAGE_AUTH = 15,
+  READ_NDEF = 16,
+  READ_BLOCKS = 17,
+  WRITE_BLOCKS = 18,
+  DIGEST = 19,
+  SYNC_BLOCKS = 20,
+  GET_STATS = 21,
+  MACRO_WRITE = 22,
+  MACRO_SETUP = 23,
+  MACRO_RUN = 24,
+  SET_LINK_SPEED = 25,
+  FRAGMENT = 26,
+  SET_COALESCING = 27,
+  SET_FLOW_CONTROL = 28,
+  GET_LINK_STATS = 29,
+  TRACE_DUMP = 30
 };
 
 // Codes of messages sent by the reader
@@ -32,7 +139,71 @@ enum ReaderMsgCode: byte {
   COMMAND_OK = 1,
   COMMAND_FAILED = 2,
   CARD_DETECTED = 3,
-  CARD_REMOVED = 4
+  CARD_REMOVED = 4,
+  MACRO_EXECUTED = 5,
+  ENVELOPE = 6,
+  CREDITS = 7,
+  // COMMAND_OK and COMMAND_FAILED with credits appended to the response
+  COMMAND_OK_CREDITS = 8,
+  COMMAND_FAILED_CREDITS = 9
+};
+
+// Events recorded in the trace (data of the event follows the event name)
+enum TraceEvent: byte {
+  // command code of a received frame (when the frame is dispatched by the messenger)
+  TRACE_FRAME_RECEIVED = 1,
+  // command code of a command whose execution starts
+  TRACE_COMMAND_DISPATCHED = 2,
+  // authentication command sent to the card
+  TRACE_AUTH_START = 3,
+  // status code of authentication
+  TRACE_AUTH_END = 4,
+  // the first byte sent to the card
+  TRACE_TRANSCEIVE_START = 5,
+  // status code of the exchange with the card
+  TRACE_TRANSCEIVE_END = 6,
+  // the first byte (code) of a message queued for transmission
+  TRACE_RESPONSE_QUEUED = 7,
+  // all queued messages have been written to the serial port
+  TRACE_RESPONSE_FLUSHED = 8,
+  // 1 if a card has been detected, 0 otherwise (consecutive polls without a card are merged)
+  TRACE_CARD_POLL = 9
+};
+
+// Instructions of macro bytecode (operands follow the instruction code)
+enum MacroOp: byte {
+  // stop execution with success
+  OP_END = 0,
+  // stop execution with failure
+  OP_FAIL = 1,
+  // [1B key type][6B key] set key for authentication
+  OP_KEY = 2,
+  // [1B block] read block to the data register
+  OP_READ = 3,
+  // [1B block] write the data register to block
+  OP_WRITE = 4,
+  // [1B offset][1B length][data] store data to the data register
+  OP_LOAD = 5,
+  // [1B offset][1B length][data] set condition flag if the data register contains the data
+  OP_COMPARE = 6,
+  // [1B target] continue at the target offset
+  OP_JUMP = 7,
+  // [1B target] continue at the target offset if the condition flag is set
+  OP_JUMP_IF = 8,
+  // [1B target] continue at the target offset if the condition flag is not set
+  OP_JUMP_IF_NOT = 9,
+  // [1B block] read value block to the value register
+  OP_VALUE_GET = 10,
+  // [4B value] set condition flag if the value register is greater than or equal to the value
+  OP_VALUE_COMPARE = 11,
+  // [1B block][4B delta] increment value block
+  OP_VALUE_ADD = 12,
+  // [1B block][4B delta] decrement value block
+  OP_VALUE_SUB = 13,
+  // [1B offset][1B length] append bytes of the data register to output
+  OP_EMIT = 14,
+  // append the value register to output
+  OP_EMIT_VALUE = 15
 };
 
 // Codes of messages sent by the reader
@@ -45,9 +216,59 @@ enum CardType: byte {
     PICC_TYPE_MIFARE_4K = 5,
     PICC_TYPE_MIFARE_UL = 6,
     PICC_TYPE_MIFARE_PLUS = 7,
-    PICC_TYPE_TNP3XXX = 8
+    PICC_TYPE_TNP3XXX = 8,
+    PICC_TYPE_NTAG = 9
+};
+
+// Group of consecutive MIFARE Classic sectors with the same number of blocks
+struct SectorGroup {
+  byte firstSector;
+  int firstBlock;
+  byte blocksPerSector;
 };
 
+// Layout of sectors: 32 sectors with 4 blocks followed by 8 sectors with 16 blocks
+constexpr SectorGroup SECTOR_GROUPS[] = {
+  {0, 0, 4},
+  {32, 128, 16}
+};
+
+// Number of sector groups
+constexpr byte SECTOR_GROUP_COUNT = sizeof(SECTOR_GROUPS) / sizeof(SECTOR_GROUPS[0]);
+
+// Maximal number of sectors of MIFARE Classic card
+constexpr byte MAX_SECTOR_COUNT = 40;
+
+// Geometry of a MIFARE Classic compatible card
+struct CardGeometry {
+  CardType cardType;
+  byte sectorCount;
+  int blockCount;
+};
+
+// Geometries of supported cards (MIFARE Plus 2K in security level 1 reports SAK of 1K card and it is
+// accessed as 1K card)
+constexpr CardGeometry CARD_GEOMETRIES[] = {
+  {CardType::PICC_TYPE_MIFARE_MINI, 5, 20},
+  {CardType::PICC_TYPE_MIFARE_1K, 16, 64},
+  {CardType::PICC_TYPE_MIFARE_4K, 40, 256}
+};
+
+// Number of card geometries
+constexpr byte CARD_GEOMETRY_COUNT = sizeof(CARD_GEOMETRIES) / sizeof(CARD_GEOMETRIES[0]);
+
+// Maximal number of blocks read or written by a single command
+#define MAX_BLOCKS_PER_COMMAND 2
+
+// Maximal number of blocks transferred by a fragmented command or a chunked response (the largest sector)
+#define MAX_BLOCKS_PER_STREAM 16
+
+// Maximal number of sector digests (4 bytes per digest) sent in a response
+#define MAX_DIGESTS_PER_RESPONSE 12
+
+// Flag of DIGEST command: sector trailers are not included in digests
+#define DIGEST_SKIP_TRAILERS 0x01
+
 // Type of key
 enum KeyType: byte {
   NONE = 0,
@@ -55,6 +276,160 @@ enum KeyType: byte {
   KEY_B = 2
 };
 
+// Command whose payload is received in fragments
+struct FragmentedCommand {
+  byte code;
+  int totalLength;
+  int receivedLength;
+};
+
+// Fragmented command being received (code 0 if there is no such command)
+FragmentedCommand fragmentedCommand;
+
+// Block of fragmented WRITE_BLOCKS or SYNC_BLOCKS command being assembled
+byte streamBlock[16];
+
+// Number of bytes in the assembled block
+byte streamBlockLength = 0;
+
+// Block id of the assembled block
+int streamBlockId = 0;
+
+// Index of the assembled block in the fragmented command
+byte streamBlockIndex = 0;
+
+// Bit mask of blocks changed by fragmented SYNC_BLOCKS command
+unsigned int streamChangedBlocks = 0;
+
+// Handler of a block assembled from fragments, returns whether the block has been processed successfully
+typedef bool (*StreamBlockHandler)(int blockId, byte blockIndex, const byte* data);
+
+// Maximal length of data appended to the response of the last fragment
+#define MAX_FRAGMENT_RESULT_LENGTH 2
+
+// Results of synchronization of a block
+enum SyncResult: byte {
+  SYNC_FAILED = 0,
+  SYNC_UNCHANGED = 1,
+  SYNC_WRITTEN = 2
+};
+
+// Response to a command kept for replaying (a repeated command must match the tag and the CRC of command)
+struct CachedResponse {
+  long tag;
+  uint32_t commandCRC;
+  byte length;
+  char data[MAX_RESPONSE_LENGTH];
+};
+
+// Ring buffer of responses to the recently executed commands
+CachedResponse responseCache[RESPONSE_CACHE_SIZE];
+
+// Index of the oldest response in the cache
+byte responseCacheNext = 0;
+
+// CRC of the executed command
+uint32_t executedCommandCRC = 0;
+
+// Time when the last frame was received
+unsigned long lastFrameTime = 0;
+
+// Handler of a command (payload without command code)
+typedef void (*CommandHandler)(const byte* message, int messageLength, long messageTag);
+
+// Handler of a fragment of command payload (fragments are delivered in order), returns whether
+// the fragment has been processed successfully. Data appended to the response of the fragment
+// (up to MAX_FRAGMENT_RESULT_LENGTH bytes) are stored to result.
+typedef bool (*FragmentHandler)(const byte* data, int dataLength, int offset, int totalLength, byte* result, byte* resultLength);
+
+// Description of a command
+struct CommandDescriptor {
+  CommandCode code;
+  CommandHandler handler;
+  byte minLength;
+  byte maxLength;
+  byte flags;
+  // handler of fragmented payload (NULL if the command cannot be fragmented)
+  FragmentHandler fragmentHandler;
+};
+
+// Statistics of execution of a command (counters saturate at 65535 to save RAM)
+struct CommandStats {
+  uint16_t count;
+  uint16_t failures;
+  unsigned long totalTime;
+  unsigned long maxTime;
+};
+
+// Statistics of execution of commands (indexed by command code - 1)
+CommandStats commandStats[COMMAND_COUNT];
+
+// Indicates whether the executed command responded with failure
+boolean commandFailed = false;
+
+// Indicates whether credits are sent with responses to commands
+boolean flowControl = false;
+
+// Indicates whether credits have not been sent with the last response (the response did not fit)
+boolean creditsPending = false;
+
+#if TRACE_SIZE > 0
+// Event recorded in the trace
+struct TraceRecord {
+  unsigned long time;
+  TraceEvent event;
+  byte data;
+};
+
+// Ring buffer of the recent events
+TraceRecord traceBuffer[TRACE_SIZE];
+
+// Index of the oldest event in the trace
+byte traceStart = 0;
+
+// Number of events in the trace
+byte traceCount = 0;
+
+// Indicates whether recording of events is suspended (while the trace is sent)
+boolean traceSuspended = false;
+
+// Indicates whether a queued message waits for transmission
+boolean traceFlushPending = false;
+
+#define TRACE(event, data) traceEvent(event, data)
+#define TRACE_TRANSMISSION() traceTransmission()
+#else
+#define TRACE(event, data)
+#define TRACE_TRANSMISSION()
+#endif
+
+// Time window in milliseconds for coalescing messages into an envelope (0 - coalescing is disabled)
+byte coalescingWindow = 0;
+
+// Envelope with coalesced messages: [ENVELOPE] followed by [LENGTH 1B][TAG 2B][MESSAGE] for each message
+char envelope[MAX_COMMAND_LENGTH];
+
+// Length of the envelope (0 if there is no coalesced message)
+byte envelopeLength = 0;
+
+// Number of messages in the envelope
+byte envelopeCount = 0;
+
+// Time (in milliseconds) when the first message was coalesced into the envelope
+unsigned long envelopeStartTime = 0;
+
+// Current speed of the serial link
+unsigned long linkSpeed = DEFAULT_LINK_SPEED;
+
+// Indicates whether the link speed waits for confirmation by a valid message
+boolean linkSpeedPending = false;
+
+// Indicates whether the pending link speed should be persisted after confirmation
+boolean linkSpeedPersist = false;
+
+// Time (in milliseconds) when the link speed was switched
+unsigned long linkSpeedSwitchTime = 0;
+
 // Indicates whether a card is activated
 boolean activeCard = false;
 
@@ -62,7 +437,22 @@ boolean activeCard = false;
 CardType cardType = CardType::UNKNOWN;
 
 // Number of available blocks on active card
-byte blockCount = 0;
+int blockCount = 0;
+
+// Number of available sectors on active card
+byte sectorCount = 0;
+
+// Number of available pages on active Ultralight or NTAG card
+byte pageCount = 0;
+
+// Indicates whether active card supports the FAST_READ command
+boolean fastReadSupported = false;
+
+// First of 4 pages stored in page cache (-1 if the cache is empty)
+int cachedPage = -1;
+
+// Cache with data of the last page read of Ultralight card
+byte pageCache[16];
 
 // Indicates whether reset of card is required
 boolean resetRequired = false;
@@ -85,11 +475,117 @@ int authenticatedSector = -1;
 //----------------------------------------------------------------------
 // Event callback for Program.OnStart
 void onStart() {
-  Serial.begin(9600);
+  clearResponseCache();
+
+  linkSpeed = readPersistedLinkSpeed();
+  Serial.begin(linkSpeed);
   messenger.setStream(Serial);
   
   SPI.begin();			
   cardReader.PCD_Init();
+#if TRACE_SIZE > 0
+  cardReader.communicationHook = traceCommunication;
+#endif
+}
+
+#if TRACE_SIZE > 0
+//----------------------------------------------------------------------
+// Records an event with the current time in the trace (the oldest event is overwritten if the
+// trace is full)
+void traceEvent(TraceEvent event, byte data) {
+  if (traceSuspended) {
+    return;
+  }
+
+  if (event == TRACE_RESPONSE_QUEUED) {
+    traceFlushPending = true;
+    commandTimer.enable();
+  }
+
+  // polls without a card are merged, i.e., idle polls do not push other events out of the trace
+  if ((event == TRACE_CARD_POLL) && (data == 0) && (traceCount > 0)) {
+    TraceRecord& lastRecord = traceBuffer[(traceStart + traceCount - 1) % TRACE_SIZE];
+    if ((lastRecord.event == TRACE_CARD_POLL) && (lastRecord.data == 0)) {
+      lastRecord.time = micros();
+      return;
+    }
+  }
+
+  TraceRecord* record;
+  if (traceCount < TRACE_SIZE) {
+    record = &traceBuffer[(traceStart + traceCount) % TRACE_SIZE];
+    traceCount++;
+  } else {
+    record = &traceBuffer[traceStart];
+    traceStart = (traceStart + 1) % TRACE_SIZE;
+  }
+
+  record->time = micros();
+  record->event = event;
+  record->data = data;
+}
+
+//----------------------------------------------------------------------
+// Records exchange of the MFRC522 with the active card (exchanges of card polls are not recorded)
+void traceCommunication(byte command, bool completed, byte value) {
+  if (!activeCard) {
+    return;
+  }
+
+  if (command == MFRC522::PCD_MFAuthent) {
+    traceEvent(completed ? TRACE_AUTH_END : TRACE_AUTH_START, value);
+  } else {
+    traceEvent(completed ? TRACE_TRANSCEIVE_END : TRACE_TRANSCEIVE_START, value);
+  }
+}
+
+//----------------------------------------------------------------------
+// Records that queued messages have been written to the serial port
+void traceTransmission() {
+  if (traceFlushPending && (envelopeLength == 0) && (messenger.getPendingLength() == 0)) {
+    traceFlushPending = false;
+    traceEvent(TRACE_RESPONSE_FLUSHED, 0);
+  }
+}
+#endif
+
+//----------------------------------------------------------------------
+// Returns whether the link speed is supported
+bool isValidLinkSpeed(unsigned long speed) {
+  return (speed >= MIN_LINK_SPEED) && (speed <= MAX_LINK_SPEED);
+}
+
+//----------------------------------------------------------------------
+// Returns link speed stored in EEPROM (or DEFAULT_LINK_SPEED if no valid link speed is stored)
+unsigned long readPersistedLinkSpeed() {
+  unsigned long speed = 0;
+  for (byte i = 0; i < 4; i++) {
+    speed = (speed << 8) | EEPROM.read(LINK_SPEED_EEPROM_ADDRESS + i);
+  }
+
+  return isValidLinkSpeed(speed) ? speed : DEFAULT_LINK_SPEED;
+}
+
+//----------------------------------------------------------------------
+// Switches speed of the serial link after all pending messages are transmitted
+void switchLinkSpeed(unsigned long speed) {
+  flushEnvelope();
+  messenger.flushMessages();
+  Serial.flush();
+  Serial.end();
+  Serial.begin(speed);
+  linkSpeed = speed;
+}
+
+//----------------------------------------------------------------------
+// Confirms the pending link speed (a valid message has been received at the new speed)
+void confirmLinkSpeed() {
+  linkSpeedPending = false;
+  if (linkSpeedPersist) {
+    for (byte i = 0; i < 4; i++) {
+      EEPROM.update(LINK_SPEED_EEPROM_ADDRESS + i, (byte)(linkSpeed >> (24 - 8 * i)));
+    }
+  }
 }
 
 //----------------------------------------------------------------------
@@ -105,27 +601,192 @@ void stopCard() {
   activeCard = false;
   keyType = KeyType::NONE;
   authenticatedSector = -1;
+  pageCount = 0;
+  fastReadSupported = false;
+  cachedPage = -1;
   cardFailed = false;
 }
 
 
+//----------------------------------------------------------------------
+// Updates CRC-32 (IEEE 802.3) checksum with given data
+uint32_t updateCRC32(uint32_t crc, const byte* data, byte dataLength) {
+  while (dataLength > 0) {
+    crc ^= *data;
+    for (byte i = 8; i > 0; i--) {
+      crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320UL : 0);
+    }
+
+    dataLength--;
+    data++;
+  }
+
+  return crc;
+}
+
+//----------------------------------------------------------------------
+// Computes CRC-32 of a command
+uint32_t computeCommandCRC(const char* message, int messageLength) {
+  return ~updateCRC32(0xFFFFFFFFUL, (const byte*)message, messageLength);
+}
+
+//----------------------------------------------------------------------
+// Discards all cached responses
+void clearResponseCache() {
+  for (byte i = 0; i < RESPONSE_CACHE_SIZE; i++) {
+    responseCache[i].tag = -1;
+  }
+}
+
+//----------------------------------------------------------------------
+// Returns cached response to command with given tag and CRC (or NULL if there is no such response)
+CachedResponse* findCachedResponse(long messageTag, uint32_t commandCRC) {
+  for (byte i = 0; i < RESPONSE_CACHE_SIZE; i++) {
+    if ((responseCache[i].tag == messageTag) && (responseCache[i].commandCRC == commandCRC)) {
+      return &responseCache[i];
+    }
+  }
+
+  return NULL;
+}
+
+//----------------------------------------------------------------------
+// Returns the transmit slot of messenger for constructing a response in place (with status
+// byte set to COMMAND_OK). The response is sent by commitResponse.
+byte* beginResponse() {
+  byte* response = (byte*)messenger.beginMessage();
+  response[0] = ReaderMsgCode::COMMAND_OK;
+  return response;
+}
+
+//----------------------------------------------------------------------
+// Sends response constructed in the transmit slot and stores it to the response cache. Responses
+// longer than MAX_RESPONSE_LENGTH and responses sent in multiple messages are not replayed, i.e.
+// the command is executed again when repeated (only read commands produce such responses).
+void commitResponse(int responseLength, long messageTag) {
+  const char* response = messenger.beginMessage();
+  CachedResponse* cachedResponse = findCachedResponse(messageTag, executedCommandCRC);
+  if (cachedResponse != NULL) {
+    cachedResponse->length = NOT_REPLAYABLE;
+  } else {
+    cachedResponse = &responseCache[responseCacheNext];
+    responseCacheNext = (responseCacheNext + 1) % RESPONSE_CACHE_SIZE;
+    cachedResponse->tag = messageTag;
+    cachedResponse->commandCRC = executedCommandCRC;
+    if (responseLength <= MAX_RESPONSE_LENGTH) {
+      cachedResponse->length = responseLength;
+      memcpy(cachedResponse->data, response, responseLength);
+    } else {
+      cachedResponse->length = NOT_REPLAYABLE;
+    }
+  }
+
+  commandFailed = (response[0] == ReaderMsgCode::COMMAND_FAILED);
+  commitMessage(responseLength, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Sends notification constructed in the transmit slot (messages without a command have tag 0)
+void commitNotification(int notificationLength) {
+  commitMessage(notificationLength, 0);
+}
+
+//----------------------------------------------------------------------
+// Sends message constructed in the transmit slot or coalesces it into the envelope. Transmission
+// of pending messages is awaited only if the transmit buffer is full (commands are executed when
+// a response fits, i.e. only chunked responses wait).
+void commitMessage(int messageLength, long messageTag) {
+  char* message = messenger.beginMessage();
+  TRACE(TRACE_RESPONSE_QUEUED, message[0]);
+
+  // append credits to responses if they fit
+  if (flowControl && (messageTag > 0)
+      && ((message[0] == ReaderMsgCode::COMMAND_OK) || (message[0] == ReaderMsgCode::COMMAND_FAILED))) {
+    creditsPending = (messageLength + CREDITS_LENGTH > MAX_COMMAND_LENGTH);
+    if (!creditsPending) {
+      message[0] = (message[0] == ReaderMsgCode::COMMAND_OK) ? ReaderMsgCode::COMMAND_OK_CREDITS : ReaderMsgCode::COMMAND_FAILED_CREDITS;
+      writeCredits(&message[messageLength]);
+      messageLength += CREDITS_LENGTH;
+    }
+  }
+
+  if ((coalescingWindow > 0) && coalesceMessage(message, messageLength, messageTag)) {
+    return;
+  }
+
+  if (!messenger.commitMessage(ENDPOINT_ID, messageLength, messageTag)) {
+    messenger.flushMessages();
+    messenger.commitMessage(ENDPOINT_ID, messageLength, messageTag);
+  }
+
+  TRACE_TRANSMISSION();
+}
+
+//----------------------------------------------------------------------
+// Appends message to the envelope and returns whether the message has been coalesced (messages
+// that do not fit into an empty envelope must be sent separately)
+bool coalesceMessage(const char* message, int messageLength, long messageTag) {
+  if (1 + ENVELOPE_ITEM_HEADER + messageLength > MAX_COMMAND_LENGTH) {
+    flushEnvelope();
+    return false;
+  }
+
+  if (envelopeLength + ENVELOPE_ITEM_HEADER + messageLength > MAX_COMMAND_LENGTH) {
+    flushEnvelope();
+  }
+
+  if (envelopeLength == 0) {
+    envelope[0] = ReaderMsgCode::ENVELOPE;
+    envelopeLength = 1;
+    envelopeCount = 0;
+    envelopeStartTime = millis();
+    commandTimer.enable();
+  }
+
+  envelope[envelopeLength] = messageLength;
+  envelope[envelopeLength + 1] = messageTag / 256;
+  envelope[envelopeLength + 2] = messageTag % 256;
+  memcpy(&envelope[envelopeLength + ENVELOPE_ITEM_HEADER], message, messageLength);
+  envelopeLength += ENVELOPE_ITEM_HEADER + messageLength;
+  envelopeCount++;
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Sends coalesced messages (a single message is sent without envelope)
+void flushEnvelope() {
+  if (envelopeLength == 0) {
+    return;
+  }
+
+  const char* message = envelope;
+  byte messageLength = envelopeLength;
+  long messageTag = 0;
+  if (envelopeCount == 1) {
+    message = &envelope[1 + ENVELOPE_ITEM_HEADER];
+    messageLength = envelope[1];
+    messageTag = (byte)envelope[2] * 256L + (byte)envelope[3];
+  }
+
+  if (!messenger.sendMessage(ENDPOINT_ID, message, messageLength, messageTag)) {
+    messenger.flushMessages();
+    messenger.sendMessage(ENDPOINT_ID, message, messageLength, messageTag);
+  }
+
+  envelopeLength = 0;
+}
+
 //----------------------------------------------------------------------
 // Send response with notification that command failed.
 void sendSimpleCommandResponse(long messageTag, bool success) {
-   char response[1];
+   byte* response = beginResponse();
    response[0] = success ? ReaderMsgCode::COMMAND_OK : ReaderMsgCode::COMMAND_FAILED;
-   messenger.sendMessage(ENDPOINT_ID, response, 1, messageTag); 
+   commitResponse(1, messageTag);
 }
 
 //----------------------------------------------------------------------
 // Handle command that sets active key.
 void handleSetKeyCommand(const byte* message, int messageLength, long messageTag) {
-  // validate message
-  if (messageLength != MFRC522::MIFARE_Misc::MF_KEY_SIZE+1) {
-    sendSimpleCommandResponse(messageTag, false);
-    return;    
-  }
-
   // determine key type
   if (message[0] == 1) {
     keyType = KeyType::KEY_A; 
@@ -152,26 +813,42 @@ void handleSetKeyCommand(const byte* message, int messageLength, long messageTag
 
 //----------------------------------------------------------------------
 // Returns trailer block of a sector
-int getTrailerBlockOfSector(byte sectorId) {
-  if (sectorId < 32) {
-    return sectorId * 4 + 3;  
-  } 
+int getTrailerBlockOfSector(int sectorId) {
+  if ((sectorId < 0) || (sectorId >= MAX_SECTOR_COUNT)) {
+    return -1;
+  }
 
-  if (sectorId < 40) {
-    return 128 + (sectorId - 32) * 16 + 15;
+  byte groupIdx = SECTOR_GROUP_COUNT - 1;
+  while (sectorId < SECTOR_GROUPS[groupIdx].firstSector) {
+    groupIdx--;
   }
 
-  return -1;
+  const SectorGroup& group = SECTOR_GROUPS[groupIdx];
+  return group.firstBlock + (sectorId - group.firstSector + 1) * group.blocksPerSector - 1;
 }
 
 //----------------------------------------------------------------------
 // Returns sector to which the block belongs.
-byte getSectorOfBlock(byte blockId) {
-  if (blockId < 128) {
-    return blockId / 4;   
-  } else {
-    return 32 + (blockId - 128) / 16;
-  } 
+int getSectorOfBlock(int blockId) {
+  byte groupIdx = SECTOR_GROUP_COUNT - 1;
+  while (blockId < SECTOR_GROUPS[groupIdx].firstBlock) {
+    groupIdx--;
+  }
+
+  const SectorGroup& group = SECTOR_GROUPS[groupIdx];
+  return group.firstSector + (blockId - group.firstBlock) / group.blocksPerSector;
+}
+
+//----------------------------------------------------------------------
+// Returns the first block of a sector
+int getFirstBlockOfSector(int sectorId) {
+  return (sectorId == 0) ? 0 : getTrailerBlockOfSector(sectorId - 1) + 1;
+}
+
+//----------------------------------------------------------------------
+// Decodes block or sector id sent as 1 byte or as 2 bytes (big endian)
+int decodeAddress(const byte* data, byte length) {
+  return (length == 2) ? data[0] * 256 + data[1] : data[0];
 }
 
 //----------------------------------------------------------------------
@@ -188,7 +865,7 @@ bool prepareCardBlock(int blockId) {
   } 
 
   // determine sector id
-  byte sectorId = getSectorOfBlock(blockId); 
+  int sectorId = getSectorOfBlock(blockId); 
   
   // check authetication state
   if (authenticatedSector == sectorId) {
@@ -218,23 +895,16 @@ bool prepareCardBlock(int blockId) {
 //----------------------------------------------------------------------
 // Handle command that reads a block
 void handleReadBlockCommand(const byte* message, int messageLength, long messageTag) {
-  // validate message
-  if (messageLength != 1) {
-    sendSimpleCommandResponse(messageTag, false);
-    return;    
-  }
-
   // determine block id and prepare card for reading/writing the block
-  int blockId = *message;
+  int blockId = decodeAddress(message, messageLength);
   if (!prepareCardBlock(blockId)) {
     sendSimpleCommandResponse(messageTag, false);      
     return;
   }
 
   // 1 byte for status, 16 bytes block data, 2 bytes overhead for CRC checksum
-  byte response[1 + 18];
-  response[0] = ReaderMsgCode::COMMAND_OK;
-  byte byteCount = sizeof(response) - 1;
+  byte* response = beginResponse();
+  byte byteCount = 16 + 2;
   MFRC522::StatusCode status = cardReader.MIFARE_Read(blockId, &response[1], &byteCount);
   if (status != MFRC522::STATUS_OK) {
     sendSimpleCommandResponse(messageTag, false);  
@@ -242,40 +912,27 @@ void handleReadBlockCommand(const byte* message, int messageLength, long message
     return;
   }
   
-  messenger.sendMessage(ENDPOINT_ID, response, 1 + byteCount - 2, messageTag); 
+  commitResponse(1 + byteCount - 2, messageTag);
 }
 
 //----------------------------------------------------------------------
-// Handle command that writes a block
-void handleWriteBlockCommand(const byte* message, int messageLength, long messageTag) {
-  // validate message
-  if ((messageLength < 1) || (messageLength > 1 + 16)) {
-    sendSimpleCommandResponse(messageTag, false);
-    return;    
-  }
-
-  // determine block id and prepare card for reading/writing the block
-  int blockId = *message; 
+// Writes data to a block (except trailer blocks) and validates the write.
+// Returns whether operation completed successfully.
+bool writeCardBlock(int blockId, const byte* data, byte dataLength) {
   if (!prepareCardBlock(blockId)) {
-    sendSimpleCommandResponse(messageTag, false);      
-    return;
+    return false;
   }
 
-  // trailer block cannot be written using this command
+  // trailer block cannot be written using this method
   if (blockId == getTrailerBlockOfSector(getSectorOfBlock(blockId))) {
-    sendSimpleCommandResponse(messageTag, false);      
-    return;
+    return false;
   }
 
-  message++;
-  messageLength--;
-
-  // write block data
-  MFRC522::StatusCode status = (MFRC522::StatusCode) cardReader.MIFARE_Write(blockId, message, messageLength);
+  // write block data (the driver does not modify the data)
+  MFRC522::StatusCode status = (MFRC522::StatusCode) cardReader.MIFARE_Write(blockId, const_cast<byte*>(data), dataLength);
   if (status != MFRC522::STATUS_OK) {
-    sendSimpleCommandResponse(messageTag, false);   
     cardFailed = true;
-    return;  
+    return false;
   }
   
   // validate write
@@ -283,37 +940,316 @@ void handleWriteBlockCommand(const byte* message, int messageLength, long messag
   byte byteCount = sizeof(buffer);
   status = cardReader.MIFARE_Read(blockId, buffer, &byteCount);
   if (status != MFRC522::STATUS_OK) {
-    sendSimpleCommandResponse(messageTag, false);  
     cardFailed = true;
-    return;
+    return false;
   }
 
-  bool allMatch = true;
-  if (messageLength != byteCount - 2) {
-    allMatch = false;
-  } else {
-    for (byte i=0; i<messageLength; i++) {
-      if (buffer[i] != message[i]) {
-        allMatch = false;
-        break;
-      }
-    }
-  } 
-  
-  sendSimpleCommandResponse(messageTag, allMatch);  
-}
+  if (dataLength != byteCount - 2) {
+    return false;
+  }
+
+  for (byte i=0; i<dataLength; i++) {
+    if (buffer[i] != data[i]) {
+      return false;
+    }
+  }
+
+  return true;
+}
 
 //----------------------------------------------------------------------
-// Handle command that reads sector trailer.
-void handleReadSectorTrailerCommand(const byte* message, int messageLength, long messageTag) {
-  // validate message
-  if (messageLength != 1) {
+// Handle command that writes a block (1B or 2B block followed by 16B data)
+void handleWriteBlockCommand(const byte* message, int messageLength, long messageTag) {
+  byte addressLength = (messageLength == 2 + 16) ? 2 : 1;
+  sendSimpleCommandResponse(messageTag, writeCardBlock(decodeAddress(message, addressLength), &message[addressLength], messageLength - addressLength));
+}
+
+//----------------------------------------------------------------------
+// Sends consecutive blocks in chunks [2B total length][2B offset][data] of MAX_BLOCKS_PER_COMMAND blocks.
+void sendBlocksChunked(int blockId, byte count, long messageTag) {
+  byte* response = beginResponse();
+  response[1] = (16 * count) / 256;
+  response[2] = (16 * count) % 256;
+  for (byte sent = 0; sent < count; sent += MAX_BLOCKS_PER_COMMAND) {
+    byte chunkSize = (count - sent < MAX_BLOCKS_PER_COMMAND) ? count - sent : MAX_BLOCKS_PER_COMMAND;
+    for (byte i = 0; i < chunkSize; i++) {
+      byte byteCount = 18;
+      if (!prepareCardBlock(blockId + sent + i)) {
+        sendSimpleCommandResponse(messageTag, false);
+        return;
+      }
+
+      // 2 bytes overhead for CRC checksum fit in the transmit slot (MAX_COMMAND_LENGTH)
+      MFRC522::StatusCode status = cardReader.MIFARE_Read(blockId + sent + i, &response[5 + 16 * i], &byteCount);
+      if (status != MFRC522::STATUS_OK) {
+        sendSimpleCommandResponse(messageTag, false);
+        cardFailed = true;
+        return;
+      }
+    }
+
+    response[3] = (16 * sent) / 256;
+    response[4] = (16 * sent) % 256;
+    commitResponse(5 + 16 * chunkSize, messageTag);
+  }
+}
+
+//----------------------------------------------------------------------
+// Handle command that reads consecutive blocks (authentication is performed once per sector).
+// More than MAX_BLOCKS_PER_COMMAND blocks are sent in chunks.
+void handleReadBlocksCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 2B first block 1B number of blocks
+  if ((message[2] == 0) || (message[2] > MAX_BLOCKS_PER_STREAM)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  int blockId = decodeAddress(message, 2);
+  byte count = message[2];
+  if (count > MAX_BLOCKS_PER_COMMAND) {
+    sendBlocksChunked(blockId, count, messageTag);
+    return;
+  }
+
+  // 1 byte for status, 16 bytes per block, 2 bytes overhead for CRC checksum of the last block
+  byte* response = beginResponse();
+  for (byte i = 0; i < count; i++) {
+    if (!prepareCardBlock(blockId + i)) {
+      sendSimpleCommandResponse(messageTag, false);
+      return;
+    }
+
+    byte byteCount = 18;
+    MFRC522::StatusCode status = cardReader.MIFARE_Read(blockId + i, &response[1 + 16 * i], &byteCount);
+    if (status != MFRC522::STATUS_OK) {
+      sendSimpleCommandResponse(messageTag, false);
+      cardFailed = true;
+      return;
+    }
+  }
+
+  commitResponse(1 + 16 * count, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Handle command that writes consecutive blocks (authentication is performed once per sector).
+void handleWriteBlocksCommand(const byte* message, int messageLength, long messageTag) {
+  // message 2B first block and 16B data for each block
+  int blockId = decodeAddress(message, 2);
+  byte count = (messageLength - 2) / 16;
+  message += 2;
+  for (byte i = 0; i < count; i++) {
+    if (!writeCardBlock(blockId + i, &message[16 * i], 16)) {
+      sendSimpleCommandResponse(messageTag, false);
+      return;
+    }
+  }
+
+  sendSimpleCommandResponse(messageTag, true);
+}
+
+//----------------------------------------------------------------------
+// Assembles blocks of fragmented payload (2B first block and 16B data for each block) and passes
+// each complete block to the block handler. Returns whether the fragment has been processed successfully.
+bool assembleStreamBlocks(const byte* data, int dataLength, int offset, int totalLength, StreamBlockHandler blockHandler) {
+  // validate payload 2B first block and 16B data for each block
+  if (offset == 0) {
+    if ((dataLength < 2) || (totalLength < 2 + 16) || (totalLength > 2 + 16 * MAX_BLOCKS_PER_STREAM)
+        || ((totalLength - 2) % 16 != 0)) {
+      return false;
+    }
+
+    streamBlockId = decodeAddress(data, 2);
+    streamBlockLength = 0;
+    streamBlockIndex = 0;
+    data += 2;
+    dataLength -= 2;
+  }
+
+  while (dataLength > 0) {
+    byte length = (dataLength < 16 - streamBlockLength) ? dataLength : 16 - streamBlockLength;
+    memcpy(&streamBlock[streamBlockLength], data, length);
+    streamBlockLength += length;
+    data += length;
+    dataLength -= length;
+    if (streamBlockLength == 16) {
+      if (!blockHandler(streamBlockId, streamBlockIndex, streamBlock)) {
+        return false;
+      }
+
+      streamBlockId++;
+      streamBlockIndex++;
+      streamBlockLength = 0;
+    }
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Writes a block assembled from fragments of WRITE_BLOCKS command
+bool writeStreamBlock(int blockId, byte blockIndex, const byte* data) {
+  return writeCardBlock(blockId, data, 16);
+}
+
+//----------------------------------------------------------------------
+// Handle fragment of WRITE_BLOCKS command: blocks are written as soon as their data are received.
+bool handleWriteBlocksFragment(const byte* data, int dataLength, int offset, int totalLength, byte* result, byte* resultLength) {
+  return assembleStreamBlocks(data, dataLength, offset, totalLength, writeStreamBlock);
+}
+
+//----------------------------------------------------------------------
+// Handle command that computes CRC-32 digests of sectors. Blocks are digested one by one
+// as they are read from the card, so the sector is never stored as a whole.
+void handleDigestCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 1B first sector 1B number of sectors [1B flags]
+  if ((message[1] == 0) || (message[1] > MAX_DIGESTS_PER_RESPONSE)
+      || (message[0] + message[1] > sectorCount)) {
     sendSimpleCommandResponse(messageTag, false);
-    return;    
+    return;
+  }
+
+  byte flags = (messageLength == 3) ? message[2] : 0;
+
+  // 1 byte for status, 4 bytes (big endian) per sector
+  byte* response = beginResponse();
+  byte* digestPtr = &response[1];
+  for (int sectorId = message[0]; sectorId < message[0] + message[1]; sectorId++) {
+    uint32_t crc = 0xFFFFFFFFUL;
+    int lastBlockId = getTrailerBlockOfSector(sectorId);
+    if (flags & DIGEST_SKIP_TRAILERS) {
+      lastBlockId--;
+    }
+
+    for (int blockId = getFirstBlockOfSector(sectorId); blockId <= lastBlockId; blockId++) {
+      if (!prepareCardBlock(blockId)) {
+        sendSimpleCommandResponse(messageTag, false);
+        return;
+      }
+
+      // 16 bytes block data, 2 bytes overhead for CRC checksum
+      byte buffer[18];
+      byte byteCount = sizeof(buffer);
+      MFRC522::StatusCode status = cardReader.MIFARE_Read(blockId, buffer, &byteCount);
+      if (status != MFRC522::STATUS_OK) {
+        sendSimpleCommandResponse(messageTag, false);
+        cardFailed = true;
+        return;
+      }
+
+      crc = updateCRC32(crc, buffer, 16);
+    }
+
+    crc = ~crc;
+    digestPtr[0] = crc >> 24;
+    digestPtr[1] = crc >> 16;
+    digestPtr[2] = crc >> 8;
+    digestPtr[3] = crc;
+    digestPtr += 4;
+  }
+
+  commitResponse(1 + 4 * message[1], messageTag);
+}
+
+//----------------------------------------------------------------------
+// Synchronizes a block with the target content. Sector trailers are skipped (access bits and keys
+// are changed by WRITE_SECTOR_TRAILER only), other blocks are written (and validated) only if their
+// content differs.
+SyncResult syncCardBlock(int blockId, const byte* data) {
+  if (!prepareCardBlock(blockId)) {
+    return SYNC_FAILED;
+  }
+
+  if (blockId == getTrailerBlockOfSector(getSectorOfBlock(blockId))) {
+    return SYNC_UNCHANGED;
+  }
+
+  // 16 bytes block data, 2 bytes overhead for CRC checksum
+  byte buffer[18];
+  byte byteCount = sizeof(buffer);
+  MFRC522::StatusCode status = cardReader.MIFARE_Read(blockId, buffer, &byteCount);
+  if (status != MFRC522::STATUS_OK) {
+    cardFailed = true;
+    return SYNC_FAILED;
+  }
+
+  if (memcmp(buffer, data, 16) == 0) {
+    return SYNC_UNCHANGED;
+  }
+
+  // manufacturer block cannot be changed
+  if ((blockId == 0) || !writeCardBlock(blockId, data, 16)) {
+    return SYNC_FAILED;
+  }
+
+  return SYNC_WRITTEN;
+}
+
+//----------------------------------------------------------------------
+// Handle command that synchronizes consecutive blocks with the target content. Only blocks
+// with different content are written (and validated), sector trailers are skipped. The response
+// contains a 2B bit mask of changed blocks (bit i is set, if the i-th block was written).
+void handleSyncBlocksCommand(const byte* message, int messageLength, long messageTag) {
+  // message 2B first block and 16B target data for each block
+  int blockId = decodeAddress(message, 2);
+  byte count = (messageLength - 2) / 16;
+  message += 2;
+  unsigned int changedBlocks = 0;
+  for (byte i = 0; i < count; i++, blockId++, message += 16) {
+    SyncResult result = syncCardBlock(blockId, message);
+    if (result == SYNC_FAILED) {
+      sendSimpleCommandResponse(messageTag, false);
+      return;
+    }
+
+    if (result == SYNC_WRITTEN) {
+      changedBlocks |= 1 << i;
+    }
+  }
+
+  byte* response = beginResponse();
+  response[1] = changedBlocks >> 8;
+  response[2] = changedBlocks;
+  commitResponse(3, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Synchronizes a block assembled from fragments of SYNC_BLOCKS command
+bool syncStreamBlock(int blockId, byte blockIndex, const byte* data) {
+  SyncResult result = syncCardBlock(blockId, data);
+  if (result == SYNC_WRITTEN) {
+    streamChangedBlocks |= 1 << blockIndex;
+  }
+
+  return result != SYNC_FAILED;
+}
+
+//----------------------------------------------------------------------
+// Handle fragment of SYNC_BLOCKS command: blocks are synchronized as soon as their data are received,
+// the response of the last fragment contains 2B bit mask of changed blocks.
+bool handleSyncBlocksFragment(const byte* data, int dataLength, int offset, int totalLength, byte* result, byte* resultLength) {
+  if (offset == 0) {
+    streamChangedBlocks = 0;
+  }
+
+  if (!assembleStreamBlocks(data, dataLength, offset, totalLength, syncStreamBlock)) {
+    return false;
+  }
+
+  if (offset + dataLength == totalLength) {
+    result[0] = streamChangedBlocks >> 8;
+    result[1] = streamChangedBlocks;
+    *resultLength = 2;
   }
 
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Handle command that reads sector trailer.
+void handleReadSectorTrailerCommand(const byte* message, int messageLength, long messageTag) {
   // determine trailer block of sector and prepare card for reading/writing this block
-  int trailerBlockId = getTrailerBlockOfSector(*message);
+  int trailerBlockId = getTrailerBlockOfSector(decodeAddress(message, messageLength));
   if (!prepareCardBlock(trailerBlockId)) {
     sendSimpleCommandResponse(messageTag, false);      
     return;
@@ -330,8 +1266,7 @@ void handleReadSectorTrailerCommand(const byte* message, int messageLength, long
   }
 
   // prepare response as 1B COMMAND STATUS, 4B ACCESS-BITS, 6B KEY A, 6B KEY B, 1B GPB (total 18B)
-  byte response[1+4+6+6+1];
-  response[0] = ReaderMsgCode::COMMAND_OK;
+  byte* response = beginResponse();
   byte c1  = trailerReadBuffer[7] >> 4;
   byte c2  = trailerReadBuffer[8] & 0xF;
   byte c3  = trailerReadBuffer[8] >> 4;
@@ -363,27 +1298,22 @@ void handleReadSectorTrailerCommand(const byte* message, int messageLength, long
   response[17] = trailerReadBuffer[9];
 
   // send response
-  messenger.sendMessage(ENDPOINT_ID, response, sizeof(response), messageTag); 
+  commitResponse(1+4+6+6+1, messageTag);
 }
 
 //----------------------------------------------------------------------
 // Handle command that writes a sector trailer.
 void handleWriteSectorTrailerCommand(const byte* message, int messageLength, long messageTag) {
-  // validate message 1B sector 4B access bits 6B KeyA 6B KeyB 1B GPB
-  if (messageLength != 18) {
-    sendSimpleCommandResponse(messageTag, false);
-    return;    
-  }
-
   // determine trailer block of sector and prepare card for reading/writing this block
-  int trailerBlockId = getTrailerBlockOfSector(*message);
+  byte addressLength = messageLength - 17;
+  int trailerBlockId = getTrailerBlockOfSector(decodeAddress(message, addressLength));
   if (!prepareCardBlock(trailerBlockId)) {
     sendSimpleCommandResponse(messageTag, false);      
     return;
   }
 
-  message++;
-  messageLength--;
+  message += addressLength;
+  messageLength -= addressLength;
 
   // prepare bufferes
   byte trailerWriteBuffer[16];
@@ -444,117 +1374,1284 @@ void handleWriteSectorTrailerCommand(const byte* message, int messageLength, lon
 }
 
 //----------------------------------------------------------------------
-// Event callback for messenger.OnMessageReceived
-void onMessageReceived(const char* message, int messageLength, long messageTag) {
-  // ignore malformed messages, i.e. messages without data or without tag.
-  if ((messageLength == 0) || (messageTag < 0)) {
-    return;
+// Decodes a 32-bit value stored in little endian order (the byte order of value blocks).
+long decodeValue(const byte* data) {
+  return ((long)data[3] << 24) | ((long)data[2] << 16) | ((long)data[1] << 8) | (long)data[0];
+}
+
+//----------------------------------------------------------------------
+// Encodes a 32-bit value in little endian order (the byte order of value blocks).
+void encodeValue(byte* data, long value) {
+  data[0] = value & 0xFF;
+  data[1] = (value >> 8) & 0xFF;
+  data[2] = (value >> 16) & 0xFF;
+  data[3] = (value >> 24) & 0xFF;
+}
+
+//----------------------------------------------------------------------
+// Prepares value block for an operation and returns whether operation completed successfully
+bool prepareValueBlock(int blockId) {
+  if (!prepareCardBlock(blockId)) {
+    return false;
   }
 
-  // retrieve command code
-  CommandCode commandCode = message[0];
-  messageLength--;
-  message++;
+  // manufacturer block and trailer blocks cannot be value blocks
+  if ((blockId == 0) || (blockId == getTrailerBlockOfSector(getSectorOfBlock(blockId)))) {
+    return false;
+  }
 
-  // dispatch commands
-  cardFailed = false;
-  if (commandCode == CommandCode::SET_KEY) {
-    handleSetKeyCommand((byte*)message, messageLength, messageTag);
-  } else if (commandCode == CommandCode::READ_BLOCK) {
-    handleReadBlockCommand((byte*)message, messageLength, messageTag);
-  } else if (commandCode == CommandCode::WRITE_BLOCK) {
-    handleWriteBlockCommand((byte*)message, messageLength, messageTag);
-  } else if (commandCode == CommandCode::READ_SECTOR_TRAILER) {
-    handleReadSectorTrailerCommand((byte*)message, messageLength, messageTag);
-  } else if (commandCode == CommandCode::WRITE_SECTOR_TRAILER) {
-    handleWriteSectorTrailerCommand((byte*)message, messageLength, messageTag);
-  } else if (commandCode == CommandCode::RESET) {
-    stopCard();
-    sendSimpleCommandResponse(messageTag, true);      
-    onCardCheck();
-  } else {
-    // unknown command
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Sends response with value of a value block or failure, if the value cannot be read.
+void sendValueResponse(int blockId, long messageTag) {
+  long value;
+  MFRC522::StatusCode status = cardReader.MIFARE_GetValue(blockId, &value);
+  if (status != MFRC522::STATUS_OK) {
     sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
+    return;
   }
+
+  // 1 byte for status, 4 bytes value
+  byte* response = beginResponse();
+  encodeValue(&response[1], value);
+  commitResponse(1 + 4, messageTag);
 }
 
 //----------------------------------------------------------------------
-// Realizes setup for card of given type
-void setupCard(MFRC522::PICC_Type piccType) {
-  blockCount = 0;
-  cardType = CardType::UNKNOWN;
-    
-  switch (piccType) {
-    case MFRC522::PICC_Type::PICC_TYPE_ISO_14443_4: 
-      cardType = CardType::PICC_TYPE_ISO_14443_4;
-      return;
-    case MFRC522::PICC_Type::PICC_TYPE_ISO_18092: 
-      cardType = CardType::PICC_TYPE_ISO_18092;
-      return;
-    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_MINI: 
-      cardType = CardType::PICC_TYPE_MIFARE_MINI;      
-      blockCount = 20;    
-      return;
-    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_1K: 
-      cardType = CardType::PICC_TYPE_MIFARE_1K;  
-      blockCount = 64;    
-      return;
-    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_4K: 
-      cardType = CardType::PICC_TYPE_MIFARE_4K;      
-      blockCount = 255;
-      return;
-    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_UL: 
-      cardType = CardType::PICC_TYPE_MIFARE_UL;      
-      return;
-    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_PLUS: 
-      cardType = CardType::PICC_TYPE_MIFARE_PLUS;
-      return;
-    case MFRC522::PICC_Type::PICC_TYPE_TNP3XXX: 
-      cardType = CardType::PICC_TYPE_TNP3XXX;                                                                  
-      return;
+// Handle command that reads value of a value block.
+void handleValueGetCommand(const byte* message, int messageLength, long messageTag) {
+  int blockId = *message;
+  if (!prepareValueBlock(blockId)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
   }
+
+  sendValueResponse(blockId, messageTag);
 }
 
 //----------------------------------------------------------------------
-// Event callback for cardCheckTimer.OnTick
-void onCardCheck() {
-  if (resetRequired) {
-    stopCard();
-   
-    // notify client that card has been removed
-    char response[1];
-    response[0] = ReaderMsgCode::CARD_REMOVED;
-    messenger.sendMessage(ENDPOINT_ID, response, 1, 0); 
+// Handle command that formats a block as value block with given value.
+void handleValueSetCommand(const byte* message, int messageLength, long messageTag) {
+  int blockId = *message;
+  if (!prepareValueBlock(blockId)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
   }
 
-  if (activeCard) {
+  long value = decodeValue(&message[1]);
+  MFRC522::StatusCode status = cardReader.MIFARE_SetValue(blockId, value);
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
     return;
   }
-  
-  if (!cardReader.PICC_IsNewCardPresent()) {
+
+  // validate write
+  long storedValue;
+  status = cardReader.MIFARE_GetValue(blockId, &storedValue);
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
     return;
   }
 
-  if (!cardReader.PICC_ReadCardSerial()) {
-    return;  
+  sendSimpleCommandResponse(messageTag, storedValue == value);
+}
+
+//----------------------------------------------------------------------
+// Handle commands that increment or decrement a value block and transfer the result
+// to the same block or to another block of the same sector.
+void handleValueChangeCommand(const byte* message, int messageLength, long messageTag, bool increment) {
+  int blockId = message[0];
+  int targetBlockId = (messageLength == 1 + 4 + 1) ? message[5] : blockId;
+  long delta = decodeValue(&message[1]);
+  if ((delta < 0) || (getSectorOfBlock(blockId) != getSectorOfBlock(targetBlockId))) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
   }
 
-  // initialize and setup new active card
-  activeCard = true;
-  cardPresentFails = 0;
-  setupCard(cardReader.PICC_GetType(cardReader.uid.sak));
-  byte uidLen = cardReader.uid.size;
-  if (uidLen > 10) {
-    uidLen = 10;
+  if (!prepareValueBlock(blockId) || !prepareValueBlock(targetBlockId)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
   }
-  
-  // notify client that a card is detected with a message:
-  // [CODE 1B][CARD TYPE 1B][NUMBER OF BLOCKS 1B][UUID 4-10B]
-  char response[3+10];
-  response[0] = ReaderMsgCode::CARD_DETECTED;
-  response[1] = cardType;
-  response[2] = blockCount;
-  memcpy(&response[3], cardReader.uid.uidByte, uidLen);
-  messenger.sendMessage(ENDPOINT_ID, response, 3+uidLen, 0);  
+
+  MFRC522::StatusCode status;
+  if (increment) {
+    status = cardReader.MIFARE_Increment(blockId, delta);
+  } else {
+    status = cardReader.MIFARE_Decrement(blockId, delta);
+  }
+
+  if (status == MFRC522::STATUS_OK) {
+    status = cardReader.MIFARE_Transfer(targetBlockId);
+  }
+
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
+    return;
+  }
+
+  sendSimpleCommandResponse(messageTag, true);
 }
-
+
+//----------------------------------------------------------------------
+// Handle command that copies value block to another block of the same sector.
+void handleValueCopyCommand(const byte* message, int messageLength, long messageTag) {
+  int blockId = message[0];
+  int targetBlockId = message[1];
+  if (getSectorOfBlock(blockId) != getSectorOfBlock(targetBlockId)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  if (!prepareValueBlock(blockId) || !prepareValueBlock(targetBlockId)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  MFRC522::StatusCode status = cardReader.MIFARE_Restore(blockId);
+  if (status == MFRC522::STATUS_OK) {
+    status = cardReader.MIFARE_Transfer(targetBlockId);
+  }
+
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
+    return;
+  }
+
+  sendSimpleCommandResponse(messageTag, true);
+}
+
+//----------------------------------------------------------------------
+// Handle command that debits a value block (if the balance is sufficient)
+// and responds with the new balance.
+void handleValueDebitCommand(const byte* message, int messageLength, long messageTag) {
+  int blockId = *message;
+  long amount = decodeValue(&message[1]);
+  if (amount < 0) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  if (!prepareValueBlock(blockId)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // check balance
+  long balance;
+  MFRC522::StatusCode status = cardReader.MIFARE_GetValue(blockId, &balance);
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
+    return;
+  }
+
+  if (balance < amount) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // debit and store the result
+  status = cardReader.MIFARE_Decrement(blockId, amount);
+  if (status == MFRC522::STATUS_OK) {
+    status = cardReader.MIFARE_Transfer(blockId);
+  }
+
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
+    return;
+  }
+
+  // read back the new balance
+  sendValueResponse(blockId, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Reads pages of Ultralight or NTAG card to buffer and returns whether operation completed successfully
+bool readPages(byte startPage, byte count, byte* buffer) {
+  if (!activeCard || resetRequired || (count == 0) || (startPage + count > pageCount)) {
+    return false;
+  }
+
+  // 16 bytes data, 2 bytes overhead for CRC checksum (or up to MAX_PAGES_PER_RESPONSE pages with FAST_READ)
+  byte readBuffer[4 * MAX_PAGES_PER_RESPONSE + 2];
+  byte byteCount;
+  MFRC522::StatusCode status;
+
+  if (fastReadSupported) {
+    byteCount = sizeof(readBuffer);
+    status = cardReader.MIFARE_Ultralight_FastRead(startPage, startPage + count - 1, readBuffer, &byteCount);
+    if (status != MFRC522::STATUS_OK) {
+      cardFailed = true;
+      return false;
+    }
+
+    memcpy(buffer, readBuffer, 4 * count);
+    return true;
+  }
+
+  // read 4 pages at once and reuse cached pages
+  for (byte page = startPage; page < startPage + count; page++) {
+    if ((cachedPage < 0) || (page < cachedPage) || (page >= cachedPage + 4)) {
+      cachedPage = -1;
+      byteCount = sizeof(readBuffer);
+      status = cardReader.MIFARE_Read(page, readBuffer, &byteCount);
+      if (status != MFRC522::STATUS_OK) {
+        cardFailed = true;
+        return false;
+      }
+
+      memcpy(pageCache, readBuffer, sizeof(pageCache));
+      cachedPage = page;
+    }
+
+    memcpy(buffer, &pageCache[4 * (page - cachedPage)], 4);
+    buffer += 4;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Handle command that reads pages of Ultralight or NTAG card.
+void handleReadPagesCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 1B start page 1B number of pages
+  if ((message[1] == 0) || (message[1] > MAX_PAGES_PER_RESPONSE)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // 1 byte for status, 4 bytes per page
+  byte* response = beginResponse();
+  if (!readPages(message[0], message[1], &response[1])) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  commitResponse(1 + 4 * message[1], messageTag);
+}
+
+//----------------------------------------------------------------------
+// Handle command that writes a page of Ultralight or NTAG card.
+void handleWritePageCommand(const byte* message, int messageLength, long messageTag) {
+  // pages with UID and lock bytes cannot be written using this command
+  byte page = message[0];
+  if (!activeCard || resetRequired || (page < 3) || (page >= pageCount)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  message++;
+  messageLength--;
+
+  // write page data
+  cachedPage = -1;
+  MFRC522::StatusCode status = cardReader.MIFARE_Ultralight_Write(page, const_cast<byte*>(message), messageLength);
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
+    return;
+  }
+
+  // validate write
+  byte buffer[4];
+  if (!readPages(page, 1, buffer)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  sendSimpleCommandResponse(messageTag, memcmp(buffer, message, sizeof(buffer)) == 0);
+}
+
+//----------------------------------------------------------------------
+// Handle command that authenticates to password protected Ultralight EV1 or NTAG card.
+void handlePageAuthCommand(const byte* message, int messageLength, long messageTag) {
+  // validate state
+  if (!activeCard || resetRequired || (pageCount == 0)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // 1 byte for status, 2 bytes PACK
+  byte* response = beginResponse();
+  byte password[4];
+  memcpy(password, message, sizeof(password));
+  cachedPage = -1;
+  MFRC522::StatusCode status = cardReader.PCD_NTAG216_AUTH(password, &response[1]);
+  if (status != MFRC522::STATUS_OK) {
+    sendSimpleCommandResponse(messageTag, false);
+    cardFailed = true;
+    return;
+  }
+
+  commitResponse(1 + 2, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Reads bytes from data area of NFC Forum Type 2 tag (offset 0 is the first byte of page 4)
+bool readTagData(int offset, byte* buffer, byte count) {
+  byte firstPage = 4 + offset / 4;
+  byte lastPage = 4 + (offset + count - 1) / 4;
+  if (lastPage - firstPage + 1 > MAX_PAGES_PER_RESPONSE) {
+    return false;
+  }
+
+  byte pages[4 * MAX_PAGES_PER_RESPONSE];
+  if (!readPages(firstPage, lastPage - firstPage + 1, pages)) {
+    return false;
+  }
+
+  memcpy(buffer, &pages[offset % 4], count);
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Reads a byte of TLV area using a window of 4 pages (returns -1 if reading failed)
+int readTlvByte(int offset, int dataSize, byte* window, int* windowOffset) {
+  if (offset >= dataSize) {
+    return -1;
+  }
+
+  if ((*windowOffset < 0) || (offset < *windowOffset) || (offset >= *windowOffset + 16)) {
+    // read whole pages from the page containing the byte, i.e. 16 bytes by a single MIFARE_Read
+    int start = offset - offset % 4;
+    byte count = (dataSize - start < 16) ? dataSize - start : 16;
+    if (!readTagData(start, window, count)) {
+      *windowOffset = -1;
+      return -1;
+    }
+    *windowOffset = start;
+  }
+
+  return window[offset - *windowOffset];
+}
+
+//----------------------------------------------------------------------
+// Handle command that reads NDEF message from NFC Forum Type 2 tag (Ultralight or NTAG).
+// The message is sent in chunks: [STATUS 1B][TOTAL LENGTH 2B][OFFSET 2B][DATA]
+void handleReadNdefCommand(const byte* message, int messageLength, long messageTag) {
+  // validate state
+  if (pageCount == 0) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // read capability container
+  byte cc[4];
+  if (!readPages(3, 1, cc) || (cc[0] != 0xE1)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // size of data area (limited by size of card)
+  int dataSize = cc[2] * 8;
+  if (dataSize > (pageCount - 4) * 4) {
+    dataSize = (pageCount - 4) * 4;
+  }
+
+  // walk TLV blocks and find NDEF message TLV
+  byte window[16];
+  int windowOffset = -1;
+  int offset = 0;
+  int ndefOffset = -1;
+  int ndefLength = 0;
+  while (offset < dataSize) {
+    int type = readTlvByte(offset++, dataSize, window, &windowOffset);
+    if (type < 0) {
+      break;
+    }
+
+    // NULL TLV has no length
+    if (type == 0x00) {
+      continue;
+    }
+
+    // terminator TLV
+    if (type == 0xFE) {
+      break;
+    }
+
+    int length = readTlvByte(offset++, dataSize, window, &windowOffset);
+    if (length == 0xFF) {
+      int lengthHigh = readTlvByte(offset++, dataSize, window, &windowOffset);
+      int lengthLow = readTlvByte(offset++, dataSize, window, &windowOffset);
+      length = ((lengthHigh < 0) || (lengthLow < 0)) ? -1 : lengthHigh * 256 + lengthLow;
+    }
+
+    if (length < 0) {
+      break;
+    }
+
+    if (type == 0x03) {
+      ndefOffset = offset;
+      ndefLength = length;
+      break;
+    }
+
+    offset += length;
+  }
+
+  if ((ndefOffset < 0) || (ndefOffset + ndefLength > dataSize)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // stream the message (at least one chunk is sent)
+  byte* response = beginResponse();
+  response[1] = ndefLength / 256;
+  response[2] = ndefLength % 256;
+  int sent = 0;
+  do {
+    byte chunkSize = (ndefLength - sent < MAX_NDEF_CHUNK_SIZE) ? ndefLength - sent : MAX_NDEF_CHUNK_SIZE;
+    if ((chunkSize > 0) && !readTagData(ndefOffset + sent, &response[5], chunkSize)) {
+      sendSimpleCommandResponse(messageTag, false);
+      return;
+    }
+
+    response[3] = sent / 256;
+    response[4] = sent % 256;
+    commitResponse(5 + chunkSize, messageTag);
+    sent += chunkSize;
+  } while (sent < ndefLength);
+}
+
+//----------------------------------------------------------------------
+// Event callback for messenger.OnMessageReceived
+void onMessageReceived(const char* message, int messageLength, long messageTag) {
+  TRACE(TRACE_FRAME_RECEIVED, (messageLength > 0) ? message[0] : 0);
+
+  // any valid message confirms the switched link speed
+  if (linkSpeedPending) {
+    confirmLinkSpeed();
+  }
+
+  // ignore malformed messages, i.e. messages without data or without tag.
+  if ((messageLength == 0) || (messageTag < 0)) {
+    return;
+  }
+
+  // responses of a previous session are not replayed (clients start tags from random values)
+  if (millis() - lastFrameTime >= RESPONSE_CACHE_LIFETIME) {
+    clearResponseCache();
+  }
+
+  lastFrameTime = millis();
+
+  // replay response to a repeated command
+  CachedResponse* cachedResponse = findCachedResponse(messageTag, computeCommandCRC(message, messageLength));
+  if ((cachedResponse != NULL) && (cachedResponse->length != NOT_REPLAYABLE)) {
+    memcpy(messenger.beginMessage(), cachedResponse->data, cachedResponse->length);
+    commitMessage(cachedResponse->length, messageTag);
+    return;
+  }
+
+  // execute the command, commands waiting for execution stay in the receive queue of the messenger
+  // (the messenger dispatches a command only when its response fits in the transmit buffer)
+  // credits are sent separately only if they did not fit in the last response
+  creditsPending = true;
+  executeCommand(message, messageLength, messageTag);
+  if (flowControl && creditsPending) {
+    sendCredits(messageTag);
+  }
+}
+
+//----------------------------------------------------------------------
+// Event callback for commandTimer.OnTick
+void onCommandProcess() {
+  // send coalesced messages when the coalescing window elapsed
+  if ((envelopeLength > 0) && (millis() - envelopeStartTime >= coalescingWindow)) {
+    flushEnvelope();
+  }
+
+  TRACE_TRANSMISSION();
+
+  // fall back to the default link speed if the client did not follow the switch of link speed
+  if (linkSpeedPending && (millis() - linkSpeedSwitchTime >= LINK_SPEED_TIMEOUT)) {
+    linkSpeedPending = false;
+    switchLinkSpeed(DEFAULT_LINK_SPEED);
+  }
+
+  // the timer is disabled when there is nothing to process (the board sleeps until the next card
+  // check or received byte), it is enabled again when a message or link speed switch waits
+  if (isCommandProcessingIdle()) {
+    commandTimer.disable();
+  }
+}
+
+//----------------------------------------------------------------------
+// Returns whether no work waits for commandTimer
+bool isCommandProcessingIdle() {
+#if TRACE_SIZE > 0
+  if (traceFlushPending) {
+    return false;
+  }
+#endif
+  return (envelopeLength == 0) && !linkSpeedPending;
+}
+
+//----------------------------------------------------------------------
+// Writes credits available to the client:
+// [1B free slots of the receive queue][1B free bytes of serial receive buffer]
+void writeCredits(char* credits) {
+  int freeBytes = SERIAL_RX_CAPACITY - Serial.available();
+  credits[0] = messenger.getFreeReceiveSlots();
+  credits[1] = (freeBytes > 0) ? freeBytes : 0;
+}
+
+//----------------------------------------------------------------------
+// Sends credits available to the client after execution of command with given tag (used when
+// the credits do not fit in the response): [CREDITS][2B tag][CREDITS_LENGTH credits]
+void sendCredits(long messageTag) {
+  char* credits = messenger.beginMessage();
+  credits[0] = ReaderMsgCode::CREDITS;
+  credits[1] = messageTag / 256;
+  credits[2] = messageTag % 256;
+  writeCredits(&credits[3]);
+  commitNotification(3 + CREDITS_LENGTH);
+}
+
+//----------------------------------------------------------------------
+// Returns length of the stored macro
+byte getMacroLength() {
+  byte length = EEPROM.read(MACRO_EEPROM_ADDRESS);
+  return (length > MAX_MACRO_LENGTH) ? 0 : length;
+}
+
+//----------------------------------------------------------------------
+// Reads operands of macro instruction and moves the program counter (returns false if
+// the operands exceed the macro)
+bool fetchMacroOperands(int* pc, int length, byte* operands, byte count) {
+  if (*pc + count > length) {
+    return false;
+  }
+
+  for (byte i = 0; i < count; i++) {
+    operands[i] = EEPROM.read(MACRO_EEPROM_ADDRESS + 2 + *pc + i);
+  }
+
+  *pc += count;
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Changes value block by a delta and stores the result to the same block
+bool changeValueBlock(int blockId, long delta, bool increment) {
+  if ((delta < 0) || !prepareValueBlock(blockId)) {
+    return false;
+  }
+
+  MFRC522::StatusCode status;
+  if (increment) {
+    status = cardReader.MIFARE_Increment(blockId, delta);
+  } else {
+    status = cardReader.MIFARE_Decrement(blockId, delta);
+  }
+
+  if (status == MFRC522::STATUS_OK) {
+    status = cardReader.MIFARE_Transfer(blockId);
+  }
+
+  if (status != MFRC522::STATUS_OK) {
+    cardFailed = true;
+    return false;
+  }
+
+  return true;
+}
+
+//----------------------------------------------------------------------
+// Executes the stored macro and returns whether it completed successfully. Emitted bytes
+// are stored to output.
+bool runMacro(byte* output, byte* outputLength) {
+  int length = getMacroLength();
+  int pc = 0;
+  byte data[16];
+  long value = 0;
+  bool condition = false;
+  *outputLength = 0;
+  memset(data, 0, sizeof(data));
+
+  for (int step = 0; step < MAX_MACRO_STEPS; step++) {
+    // reaching end of bytecode is equivalent to OP_END
+    byte op;
+    if (!fetchMacroOperands(&pc, length, &op, 1)) {
+      return true;
+    }
+
+    // operands of the longest instruction (OP_LOAD and OP_COMPARE with 16 bytes of data)
+    byte operands[2 + 16];
+    switch (op) {
+      case MacroOp::OP_END:
+        return true;
+
+      case MacroOp::OP_KEY:
+        if (!fetchMacroOperands(&pc, length, operands, 1 + MFRC522::MIFARE_Misc::MF_KEY_SIZE)
+            || ((operands[0] != KeyType::KEY_A) && (operands[0] != KeyType::KEY_B))) {
+          return false;
+        }
+
+        keyType = (KeyType)operands[0];
+        memcpy(key.keyByte, &operands[1], MFRC522::MIFARE_Misc::MF_KEY_SIZE);
+        authenticatedSector = -1;
+        break;
+
+      case MacroOp::OP_READ: {
+        if (!fetchMacroOperands(&pc, length, operands, 1) || !prepareCardBlock(operands[0])) {
+          return false;
+        }
+
+        // 16 bytes block data, 2 bytes overhead for CRC checksum
+        byte buffer[18];
+        byte byteCount = sizeof(buffer);
+        if (cardReader.MIFARE_Read(operands[0], buffer, &byteCount) != MFRC522::STATUS_OK) {
+          cardFailed = true;
+          return false;
+        }
+
+        memcpy(data, buffer, sizeof(data));
+        break;
+      }
+
+      case MacroOp::OP_WRITE:
+        if (!fetchMacroOperands(&pc, length, operands, 1) || !writeCardBlock(operands[0], data, sizeof(data))) {
+          return false;
+        }
+        break;
+
+      case MacroOp::OP_LOAD:
+      case MacroOp::OP_COMPARE:
+        if (!fetchMacroOperands(&pc, length, operands, 2) || (operands[0] + operands[1] > sizeof(data))
+            || !fetchMacroOperands(&pc, length, &operands[2], operands[1])) {
+          return false;
+        }
+
+        if (op == MacroOp::OP_LOAD) {
+          memcpy(&data[operands[0]], &operands[2], operands[1]);
+        } else {
+          condition = (memcmp(&data[operands[0]], &operands[2], operands[1]) == 0);
+        }
+        break;
+
+      case MacroOp::OP_JUMP:
+      case MacroOp::OP_JUMP_IF:
+      case MacroOp::OP_JUMP_IF_NOT:
+        if (!fetchMacroOperands(&pc, length, operands, 1)) {
+          return false;
+        }
+
+        if ((op == MacroOp::OP_JUMP) || ((op == MacroOp::OP_JUMP_IF) == condition)) {
+          pc = operands[0];
+        }
+        break;
+
+      case MacroOp::OP_VALUE_GET:
+        if (!fetchMacroOperands(&pc, length, operands, 1) || !prepareValueBlock(operands[0])) {
+          return false;
+        }
+
+        if (cardReader.MIFARE_GetValue(operands[0], &value) != MFRC522::STATUS_OK) {
+          cardFailed = true;
+          return false;
+        }
+        break;
+
+      case MacroOp::OP_VALUE_COMPARE:
+        if (!fetchMacroOperands(&pc, length, operands, 4)) {
+          return false;
+        }
+
+        condition = (value >= decodeValue(operands));
+        break;
+
+      case MacroOp::OP_VALUE_ADD:
+      case MacroOp::OP_VALUE_SUB:
+        if (!fetchMacroOperands(&pc, length, operands, 1 + 4)
+            || !changeValueBlock(operands[0], decodeValue(&operands[1]), op == MacroOp::OP_VALUE_ADD)) {
+          return false;
+        }
+        break;
+
+      case MacroOp::OP_EMIT:
+        if (!fetchMacroOperands(&pc, length, operands, 2) || (operands[0] + operands[1] > sizeof(data))
+            || (*outputLength + operands[1] > MAX_MACRO_OUTPUT)) {
+          return false;
+        }
+
+        memcpy(&output[*outputLength], &data[operands[0]], operands[1]);
+        *outputLength += operands[1];
+        break;
+
+      case MacroOp::OP_EMIT_VALUE:
+        if (*outputLength + 4 > MAX_MACRO_OUTPUT) {
+          return false;
+        }
+
+        encodeValue(&output[*outputLength], value);
+        *outputLength += 4;
+        break;
+
+      default:
+        // OP_FAIL and unknown instructions
+        return false;
+    }
+  }
+
+  return false;
+}
+
+//----------------------------------------------------------------------
+// Handle command that stores a part of macro bytecode to EEPROM.
+void handleMacroWriteCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 1B offset and bytecode
+  byte offset = message[0];
+  message++;
+  messageLength--;
+  if (offset + messageLength > MAX_MACRO_LENGTH) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  for (byte i = 0; i < messageLength; i++) {
+    EEPROM.update(MACRO_EEPROM_ADDRESS + 2 + offset + i, message[i]);
+  }
+
+  sendSimpleCommandResponse(messageTag, true);
+}
+
+//----------------------------------------------------------------------
+// Handle command that sets length and flags of the stored macro (length 0 disables the macro).
+void handleMacroSetupCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 1B length 1B flags
+  if (message[0] > MAX_MACRO_LENGTH) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  EEPROM.update(MACRO_EEPROM_ADDRESS, message[0]);
+  EEPROM.update(MACRO_EEPROM_ADDRESS + 1, message[1]);
+  sendSimpleCommandResponse(messageTag, true);
+}
+
+//----------------------------------------------------------------------
+// Handle command that executes the stored macro and responds with the emitted bytes.
+void handleMacroRunCommand(const byte* message, int messageLength, long messageTag) {
+  byte* response = beginResponse();
+  byte outputLength;
+  if ((getMacroLength() == 0) || !runMacro(&response[1], &outputLength)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  commitResponse(1 + outputLength, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Handle command that increments a value block.
+void handleValueAddCommand(const byte* message, int messageLength, long messageTag) {
+  handleValueChangeCommand(message, messageLength, messageTag, true);
+}
+
+//----------------------------------------------------------------------
+// Handle command that decrements a value block.
+void handleValueSubCommand(const byte* message, int messageLength, long messageTag) {
+  handleValueChangeCommand(message, messageLength, messageTag, false);
+}
+
+//----------------------------------------------------------------------
+// Handle command that resets the active card.
+void handleResetCommand(const byte* message, int messageLength, long messageTag) {
+  stopCard();
+  clearResponseCache();
+  sendSimpleCommandResponse(messageTag, true);
+  onCardCheck();
+}
+
+//----------------------------------------------------------------------
+// Handle command that returns execution statistics of a command: number of executions, number
+// of failures (both saturate at 65535), total and maximal execution time in microseconds (4B big
+// endian each).
+void handleGetStatsCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 1B command code [1B flags]
+  if ((message[0] == 0) || (message[0] > COMMAND_COUNT)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  CommandStats& stats = commandStats[message[0] - 1];
+  const unsigned long values[] = {stats.count, stats.failures, stats.totalTime, stats.maxTime};
+  byte* response = beginResponse();
+  for (byte i = 0; i < 4; i++) {
+    response[1 + 4 * i] = values[i] >> 24;
+    response[2 + 4 * i] = values[i] >> 16;
+    response[3 + 4 * i] = values[i] >> 8;
+    response[4 + 4 * i] = values[i];
+  }
+
+  if ((messageLength == 2) && (message[1] & STATS_RESET)) {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+  commitResponse(1 + 4 * 4, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Handle command that switches speed of the serial link. The response is sent at the current speed,
+// the new speed must be confirmed by a valid message within LINK_SPEED_TIMEOUT.
+void handleSetLinkSpeedCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 4B baud rate (big endian) [1B flags]
+  unsigned long speed = 0;
+  for (byte i = 0; i < 4; i++) {
+    speed = (speed << 8) | message[i];
+  }
+
+  if (!isValidLinkSpeed(speed)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  sendSimpleCommandResponse(messageTag, true);
+  switchLinkSpeed(speed);
+  linkSpeedPersist = (messageLength == 5) && (message[4] & LINK_SPEED_PERSIST);
+  linkSpeedPending = true;
+  linkSpeedSwitchTime = millis();
+  commandTimer.enable();
+}
+
+//----------------------------------------------------------------------
+// Handle command that sets time window for coalescing responses and notifications into envelopes.
+void handleSetCoalescingCommand(const byte* message, int messageLength, long messageTag) {
+  // message 1B window in milliseconds (0 disables coalescing)
+  sendSimpleCommandResponse(messageTag, true);
+  flushEnvelope();
+  coalescingWindow = message[0];
+}
+
+//----------------------------------------------------------------------
+// Handle command that enables sending of credits with responses to commands (flow control).
+void handleSetFlowControlCommand(const byte* message, int messageLength, long messageTag) {
+  // message 1B enabled
+  sendSimpleCommandResponse(messageTag, true);
+  flowControl = (message[0] != 0);
+}
+
+//----------------------------------------------------------------------
+// Handle command that returns statistics of the link: number of received frames dropped because the
+// receive queue was full, number of malformed frames and number of rejected commands (4B big endian each).
+void handleGetLinkStatsCommand(const byte* message, int messageLength, long messageTag) {
+  // commands are not rejected (the receive queue of the messenger applies backpressure), the counter of
+  // rejected commands is kept for compatibility of the response
+  const unsigned long values[] = {messenger.getReceiveOverflowCount(), messenger.getMalformedFrameCount(), 0};
+  byte* response = beginResponse();
+  for (byte i = 0; i < 3; i++) {
+    response[1 + 4 * i] = values[i] >> 24;
+    response[2 + 4 * i] = values[i] >> 16;
+    response[3 + 4 * i] = values[i] >> 8;
+    response[4 + 4 * i] = values[i];
+  }
+
+  commitResponse(1 + 3 * 4, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Handle command that sends the trace as chunked response with 6 bytes per event, the oldest
+// event first: [TIME 4B big endian (micros)][EVENT 1B][DATA 1B]
+void handleTraceDumpCommand(const byte* message, int messageLength, long messageTag) {
+  // message [1B flags]
+  byte* response = beginResponse();
+#if TRACE_SIZE > 0
+  // messages of the dump are not recorded
+  traceSuspended = true;
+  const int totalLength = traceCount * TRACE_RECORD_LENGTH;
+  response[1] = totalLength / 256;
+  response[2] = totalLength % 256;
+  byte sent = 0;
+  do {
+    byte chunkSize = (traceCount - sent < MAX_TRACE_RECORDS_PER_CHUNK) ? traceCount - sent : MAX_TRACE_RECORDS_PER_CHUNK;
+    for (byte i = 0; i < chunkSize; i++) {
+      const TraceRecord& record = traceBuffer[(traceStart + sent + i) % TRACE_SIZE];
+      byte* data = &response[5 + TRACE_RECORD_LENGTH * i];
+      data[0] = record.time >> 24;
+      data[1] = record.time >> 16;
+      data[2] = record.time >> 8;
+      data[3] = record.time;
+      data[4] = record.event;
+      data[5] = record.data;
+    }
+
+    response[3] = (sent * TRACE_RECORD_LENGTH) / 256;
+    response[4] = (sent * TRACE_RECORD_LENGTH) % 256;
+    commitResponse(5 + TRACE_RECORD_LENGTH * chunkSize, messageTag);
+    sent += chunkSize;
+  } while (sent < traceCount);
+
+  if ((messageLength == 1) && (message[0] & TRACE_CLEAR)) {
+    traceCount = 0;
+  }
+
+  traceSuspended = false;
+#else
+  // tracing is compiled out, the trace is empty
+  memset(&response[1], 0, 4);
+  commitResponse(5, messageTag);
+#endif
+}
+
+void handleFragmentCommand(const byte* message, int messageLength, long messageTag);
+
+// Commands indexed by command code - 1 (lengths of payload without command code), the table is stored
+// in flash memory and descriptors are read by readCommandDescriptor
+constexpr CommandDescriptor COMMANDS[] PROGMEM = {
+  {CommandCode::RESET, handleResetCommand, 0, 0, 0, NULL},
+  // 1B key type 6B key
+  {CommandCode::SET_KEY, handleSetKeyCommand, 1 + MFRC522::MIFARE_Misc::MF_KEY_SIZE, 1 + MFRC522::MIFARE_Misc::MF_KEY_SIZE, 0, NULL},
+  // 1B or 2B block
+  {CommandCode::READ_BLOCK, handleReadBlockCommand, 1, 2, 0, NULL},
+  // 1B or 2B block 16B data
+  {CommandCode::WRITE_BLOCK, handleWriteBlockCommand, 1, 2 + 16, 0, NULL},
+  // 1B or 2B sector
+  {CommandCode::READ_SECTOR_TRAILER, handleReadSectorTrailerCommand, 1, 2, 0, NULL},
+  // 1B or 2B sector 4B access bits 6B KeyA 6B KeyB 1B GPB
+  {CommandCode::WRITE_SECTOR_TRAILER, handleWriteSectorTrailerCommand, 18, 19, 0, NULL},
+  // value commands address blocks by 1B (blocks of the largest card, MIFARE Classic 4K, are 0-255),
+  // the optional 1B target block of VALUE_ADD and VALUE_SUB excludes longer addresses
+  // 1B block
+  {CommandCode::VALUE_GET, handleValueGetCommand, 1, 1, 0, NULL},
+  // 1B block 4B value
+  {CommandCode::VALUE_SET, handleValueSetCommand, 1 + 4, 1 + 4, 0, NULL},
+  // 1B block 4B delta [1B target block]
+  {CommandCode::VALUE_ADD, handleValueAddCommand, 1 + 4, 1 + 4 + 1, 0, NULL},
+  {CommandCode::VALUE_SUB, handleValueSubCommand, 1 + 4, 1 + 4 + 1, 0, NULL},
+  // 1B source block 1B target block
+  {CommandCode::VALUE_COPY, handleValueCopyCommand, 2, 2, 0, NULL},
+  // 1B block 4B amount
+  {CommandCode::VALUE_DEBIT, handleValueDebitCommand, 1 + 4, 1 + 4, 0, NULL},
+  // 1B start page 1B number of pages
+  {CommandCode::READ_PAGES, handleReadPagesCommand, 2, 2, 0, NULL},
+  // 1B page 4B data
+  {CommandCode::WRITE_PAGE, handleWritePageCommand, 1 + 4, 1 + 4, 0, NULL},
+  // 4B password
+  {CommandCode::PAGE_AUTH, handlePageAuthCommand, 4, 4, 0, NULL},
+  {CommandCode::READ_NDEF, handleReadNdefCommand, 0, 0, 0, NULL},
+  // 2B first block 1B number of blocks
+  {CommandCode::READ_BLOCKS, handleReadBlocksCommand, 3, 3, 0, NULL},
+  // 2B first block and 16B data for each block
+  {CommandCode::WRITE_BLOCKS, handleWriteBlocksCommand, 2 + 16, 2 + 16 * MAX_BLOCKS_PER_COMMAND, COMMAND_BLOCK_DATA, handleWriteBlocksFragment},
+  // 1B first sector 1B number of sectors [1B flags]
+  {CommandCode::DIGEST, handleDigestCommand, 2, 3, 0, NULL},
+  // 2B first block and 16B target data for each block
+  {CommandCode::SYNC_BLOCKS, handleSyncBlocksCommand, 2 + 16, 2 + 16 * MAX_BLOCKS_PER_COMMAND, COMMAND_BLOCK_DATA, handleSyncBlocksFragment},
+  // 1B command code [1B flags]
+  {CommandCode::GET_STATS, handleGetStatsCommand, 1, 2, 0, NULL},
+  // 1B offset and bytecode
+  {CommandCode::MACRO_WRITE, handleMacroWriteCommand, 2, MAX_COMMAND_LENGTH - 1, 0, NULL},
+  // 1B length 1B flags
+  {CommandCode::MACRO_SETUP, handleMacroSetupCommand, 2, 2, 0, NULL},
+  {CommandCode::MACRO_RUN, handleMacroRunCommand, 0, 0, 0, NULL},
+  // 4B baud rate [1B flags]
+  {CommandCode::SET_LINK_SPEED, handleSetLinkSpeedCommand, 4, 5, 0, NULL},
+  // 1B command code 2B total length 2B offset and data
+  {CommandCode::FRAGMENT, handleFragmentCommand, 5, MAX_COMMAND_LENGTH - 1, 0, NULL},
+  // 1B window in milliseconds
+  {CommandCode::SET_COALESCING, handleSetCoalescingCommand, 1, 1, 0, NULL},
+  // 1B enabled
+  {CommandCode::SET_FLOW_CONTROL, handleSetFlowControlCommand, 1, 1, 0, NULL},
+  {CommandCode::GET_LINK_STATS, handleGetLinkStatsCommand, 0, 0, 0, NULL},
+  // [1B flags]
+  {CommandCode::TRACE_DUMP, handleTraceDumpCommand, 0, 1, 0, NULL}
+};
+
+// Checks that the command descriptors are ordered by command codes
+constexpr bool areCommandsOrdered(byte index) {
+  return (index >= COMMAND_COUNT) || ((COMMANDS[index].code == index + 1) && areCommandsOrdered(index + 1));
+}
+
+static_assert(sizeof(COMMANDS) / sizeof(COMMANDS[0]) == COMMAND_COUNT, "Command descriptor is missing.");
+static_assert(areCommandsOrdered(0), "Command descriptors must be ordered by command codes.");
+
+//----------------------------------------------------------------------
+// Reads descriptor of a command with given code from flash memory
+void readCommandDescriptor(byte commandCode, CommandDescriptor& descriptor) {
+  memcpy_P(&descriptor, &COMMANDS[commandCode - 1], sizeof(CommandDescriptor));
+}
+
+//----------------------------------------------------------------------
+// Handle fragment of a command payload. Fragments are sent as separate commands in order, every
+// fragment is acknowledged and delivered to the fragment handler of the command.
+void handleFragmentCommand(const byte* message, int messageLength, long messageTag) {
+  // validate message 1B command code 2B total length 2B offset and data
+  byte commandCode = message[0];
+  int totalLength = decodeAddress(&message[1], 2);
+  int offset = decodeAddress(&message[3], 2);
+  if ((commandCode == 0) || (commandCode > COMMAND_COUNT)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  CommandDescriptor command;
+  readCommandDescriptor(commandCode, command);
+  if (command.fragmentHandler == NULL) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // the first fragment starts a new command
+  if (offset == 0) {
+    fragmentedCommand.code = commandCode;
+    fragmentedCommand.totalLength = totalLength;
+    fragmentedCommand.receivedLength = 0;
+  }
+
+  message += 5;
+  messageLength -= 5;
+  byte result[MAX_FRAGMENT_RESULT_LENGTH];
+  byte resultLength = 0;
+  if ((fragmentedCommand.code != commandCode) || (fragmentedCommand.totalLength != totalLength)
+      || (fragmentedCommand.receivedLength != offset) || (offset + messageLength > totalLength)
+      || !command.fragmentHandler(message, messageLength, offset, totalLength, result, &resultLength)) {
+    fragmentedCommand.code = 0;
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  fragmentedCommand.receivedLength += messageLength;
+  if (fragmentedCommand.receivedLength == totalLength) {
+    fragmentedCommand.code = 0;
+  }
+
+  byte* response = beginResponse();
+  memcpy(&response[1], result, resultLength);
+  commitResponse(1 + resultLength, messageTag);
+}
+
+//----------------------------------------------------------------------
+// Executes a command
+void executeCommand(const char* message, int messageLength, long messageTag) {
+  // retrieve command code
+  byte commandCode = message[0];
+  executedCommandCRC = computeCommandCRC(message, messageLength);
+  messageLength--;
+  message++;
+  TRACE(TRACE_COMMAND_DISPATCHED, commandCode);
+
+  // reject unknown commands
+  if ((commandCode == 0) || (commandCode > COMMAND_COUNT)) {
+    sendSimpleCommandResponse(messageTag, false);
+    return;
+  }
+
+  // validate length of payload
+  CommandDescriptor command;
+  readCommandDescriptor(commandCode, command);
+  CommandStats& stats = commandStats[commandCode - 1];
+  unsigned long startTime = micros();
+  if ((messageLength < command.minLength) || (messageLength > command.maxLength)
+      || ((command.flags & COMMAND_BLOCK_DATA) && ((messageLength - 2) % 16 != 0))) {
+    sendSimpleCommandResponse(messageTag, false);
+  } else {
+    cardFailed = false;
+    command.handler((const byte*)message, messageLength, messageTag);
+  }
+
+  // update statistics
+  unsigned long executionTime = micros() - startTime;
+  if (stats.count < 0xFFFF) {
+    stats.count++;
+  }
+
+  if (commandFailed && (stats.failures < 0xFFFF)) {
+    stats.failures++;
+  }
+
+  stats.totalTime += executionTime;
+  if (executionTime > stats.maxTime) {
+    stats.maxTime = executionTime;
+  }
+}
+
+//----------------------------------------------------------------------
+// Selects the active card again after it returned to state IDLE
+bool reselectCard() {
+  byte bufferATQA[2];
+  byte bufferSize = sizeof(bufferATQA);
+  MFRC522::StatusCode status = cardReader.PICC_WakeupA(bufferATQA, &bufferSize);
+  if ((status != MFRC522::STATUS_OK) && (status != MFRC522::STATUS_COLLISION)) {
+    return false;
+  }
+
+  return cardReader.PICC_Select(&cardReader.uid) == MFRC522::STATUS_OK;
+}
+
+//----------------------------------------------------------------------
+// Realizes setup for Ultralight and NTAG cards, i.e., determines the number of pages
+void setupUltralightCard() {
+  // 8 bytes version, 2 bytes overhead for CRC checksum
+  byte buffer[18];
+  byte byteCount = sizeof(buffer);
+  MFRC522::StatusCode status = cardReader.MIFARE_Ultralight_GetVersion(buffer, &byteCount);
+  if ((status == MFRC522::STATUS_OK) && (byteCount == 10)) {
+    // storage size (byte 6) and product type (byte 2) identify the variant
+    byte productType = buffer[2];
+    switch (buffer[6]) {
+      case 0x0B: pageCount = 20; break;   // Ultralight EV1 (MF0UL11)
+      case 0x0E: pageCount = 41; break;   // Ultralight EV1 (MF0UL21)
+      case 0x0F: pageCount = 45; break;   // NTAG213
+      case 0x11: pageCount = 135; break;  // NTAG215
+      case 0x13: pageCount = 231; break;  // NTAG216
+      default: pageCount = 16; break;
+    }
+
+    fastReadSupported = true;
+    if (productType == 0x04) {
+      cardType = CardType::PICC_TYPE_NTAG;
+    }
+    return;
+  }
+
+  // GET_VERSION is not supported, the card must be selected again
+  if (!reselectCard()) {
+    resetRequired = true;
+    return;
+  }
+
+  // Ultralight C has readable page 40 (lock bytes), Ultralight responds with NAK
+  byteCount = sizeof(buffer);
+  status = cardReader.MIFARE_Read(40, buffer, &byteCount);
+  if (status == MFRC522::STATUS_OK) {
+    pageCount = 48;
+    return;
+  }
+
+  pageCount = 16;
+  if (!reselectCard()) {
+    resetRequired = true;
+  }
+}
+
+//----------------------------------------------------------------------
+// Sets geometry of active MIFARE Classic card according to its type
+void setupClassicGeometry() {
+  for (byte i = 0; i < CARD_GEOMETRY_COUNT; i++) {
+    if (CARD_GEOMETRIES[i].cardType == cardType) {
+      sectorCount = CARD_GEOMETRIES[i].sectorCount;
+      blockCount = CARD_GEOMETRIES[i].blockCount;
+      return;
+    }
+  }
+}
+
+//----------------------------------------------------------------------
+// Realizes setup for card of given type
+void setupCard(MFRC522::PICC_Type piccType) {
+  blockCount = 0;
+  sectorCount = 0;
+  pageCount = 0;
+  fastReadSupported = false;
+  cachedPage = -1;
+  cardType = CardType::UNKNOWN;
+    
+  switch (piccType) {
+    case MFRC522::PICC_Type::PICC_TYPE_ISO_14443_4: 
+      cardType = CardType::PICC_TYPE_ISO_14443_4;
+      return;
+    case MFRC522::PICC_Type::PICC_TYPE_ISO_18092: 
+      cardType = CardType::PICC_TYPE_ISO_18092;
+      return;
+    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_MINI: 
+      cardType = CardType::PICC_TYPE_MIFARE_MINI;      
+      setupClassicGeometry();
+      return;
+    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_1K: 
+      cardType = CardType::PICC_TYPE_MIFARE_1K;  
+      setupClassicGeometry();
+      return;
+    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_4K: 
+      cardType = CardType::PICC_TYPE_MIFARE_4K;      
+      setupClassicGeometry();
+      return;
+    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_UL: 
+      cardType = CardType::PICC_TYPE_MIFARE_UL;      
+      setupUltralightCard();
+      return;
+    case MFRC522::PICC_Type::PICC_TYPE_MIFARE_PLUS: 
+      cardType = CardType::PICC_TYPE_MIFARE_PLUS;
+      return;
+    case MFRC522::PICC_Type::PICC_TYPE_TNP3XXX: 
+      cardType = CardType::PICC_TYPE_TNP3XXX;                                                                  
+      return;
+    default:
+      // PICC_TYPE_NOT_COMPLETE and PICC_TYPE_UNKNOWN
+      return;
+  }
+}
+
+//----------------------------------------------------------------------
+// Event callback for cardCheckTimer.OnTick
+void onCardCheck() {
+  // postpone the check until notifications can be sent without waiting for transmission
+  if (!messenger.canSendMessage(MAX_COMMAND_LENGTH)) {
+    return;
+  }
+
+  if (resetRequired) {
+    stopCard();
+   
+    // notify client that card has been removed
+    char* response = messenger.beginMessage();
+    response[0] = ReaderMsgCode::CARD_REMOVED;
+    commitNotification(1); 
+  }
+
+  if (activeCard) {
+    return;
+  }
+  
+  if (!cardReader.PICC_IsNewCardPresent()) {
+    TRACE(TRACE_CARD_POLL, 0);
+    return;
+  }
+
+  if (!cardReader.PICC_ReadCardSerial()) {
+    TRACE(TRACE_CARD_POLL, 0);
+    return;  
+  }
+
+  TRACE(TRACE_CARD_POLL, 1);
+
+  // initialize and setup new active card
+  activeCard = true;
+  cardPresentFails = 0;
+  setupCard(cardReader.PICC_GetType(cardReader.uid.sak));
+  byte uidLen = cardReader.uid.size;
+  if (uidLen > 10) {
+    uidLen = 10;
+  }
+  
+  // notify client that a card is detected with a message:
+  // [CODE 1B][CARD TYPE 1B][NUMBER OF BLOCKS 1B][UUID 4-10B]
+  // (for Ultralight and NTAG cards, the number of pages is sent instead of the number of blocks,
+  // for 4K cards with 256 blocks, the value 255 is sent)
+  char* response = messenger.beginMessage();
+  response[0] = ReaderMsgCode::CARD_DETECTED;
+  response[1] = cardType;
+  response[2] = (pageCount > 0) ? pageCount : min(blockCount, 255);
+  memcpy(&response[3], cardReader.uid.uidByte, uidLen);
+  commitNotification(3+uidLen);
+
+  // execute macro and notify client about its result with a message:
+  // [CODE 1B][COMMAND_OK or COMMAND_FAILED 1B][EMITTED BYTES]
+  if ((getMacroLength() > 0) && (EEPROM.read(MACRO_EEPROM_ADDRESS + 1) & MACRO_AUTORUN)) {
+    char* result = messenger.beginMessage();
+    byte outputLength;
+    result[0] = ReaderMsgCode::MACRO_EXECUTED;
+    result[1] = runMacro((byte*)&result[2], &outputLength) ? ReaderMsgCode::COMMAND_OK : ReaderMsgCode::COMMAND_FAILED;
+    commitNotification(2 + outputLength);
+  }
+}
+
@@ -7,6 +7,7 @@
 //----------------------------------------------------------------------
 // Summary of available objects:
 // cardCheckTimer (acp.common.timer)
+// commandTimer (acp.common.timer)
 // cardReader (acp.rfid.mfrc522)
 // messenger (acp.messenger.gep_stream_messenger)
 //----------------------------------------------------------------------
@@ -23,6 +24,12 @@ void onCardCheck() {
   // TODO Auto-generated callback stub
 }
 
+//----------------------------------------------------------------------
+// Event callback for commandTimer.OnTick
+void onCommandProcess() {
+  // TODO Auto-generated callback stub
+}
+
 //----------------------------------------------------------------------
 // Event callback for messenger.OnMessageReceived
 void onMessageReceived(const char* message, int messageLength, long messageTag) {
@@ -11,6 +11,7 @@
 //----------------------------------------------------------------------
 // Declarations of component views
 extern acp_common_timer::TTimer cardCheckTimer;
+extern acp_common_timer::TTimer commandTimer;
 extern MFRC522 cardReader;
 extern acp_messenger_gep_stream::TGEPStreamMessenger<0, 50> messenger;
 //----------------------------------------------------------------------
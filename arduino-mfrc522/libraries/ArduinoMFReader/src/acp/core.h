@@ -7,6 +7,9 @@
 // Indicates whether the debug mode is enabled
 #define ACP_DEBUG 0
 
+// Indicates whether the MCU sleeps in idle mode when no looper is due
+#define ACP_IDLE_SLEEP 1
+
 // Default event handler
 typedef void (*ACPEventHandler)();
 
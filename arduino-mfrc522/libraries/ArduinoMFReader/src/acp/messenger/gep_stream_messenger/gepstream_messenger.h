@@ -5,23 +5,49 @@
 
 namespace acp_messenger_gep_stream {
 
-	template <int MESSENGER_ID, int MAX_MESSAGE_SIZE> class TGEPStreamMessenger;
+	template <int MESSENGER_ID, int MAX_MESSAGE_SIZE, int TX_BUFFER_SIZE, int RX_QUEUE_SIZE> class TGEPStreamMessenger;
 
 	// Byte indicating start of a new message
 	const uint8_t MESSAGE_START_BYTE = 0x0C;
 
+	// Byte indicating start of a new message in compact framing (message bytes are not encoded as nibbles,
+	// only special bytes are escaped)
+	const uint8_t MESSAGE_START_COMPACT_BYTE = 0x0E;
+
+	// Byte preceding an escaped special byte in compact framing
+	const uint8_t ESCAPE_BYTE = 0x1B;
+
+	// Mask applied to escaped special bytes in compact framing
+	const uint8_t ESCAPE_XOR = 0x20;
+
 	// Byte indicating end of the message without tag
 	const uint8_t MESSAGE_END_BYTE = 0x03;
 
 	// Byte indicating end of the message with tag
 	const uint8_t MESSAGE_END_WITH_TAG_BYTE = 0x06;
 
+	// Default size of buffer for encoded frames waiting for transmission (fits a frame with 50 bytes of message)
+	const int DEFAULT_TX_BUFFER_SIZE = 128;
+
+	// Default number of received messages waiting for dispatch
+	const int DEFAULT_RX_QUEUE_SIZE = 2;
+
 	/********************************************************************************
 	 * Controller for a stream messenger using a GEP protocol: error checking protocol
 	 * based on http://www.gammon.com.au/forum/?id=11428
+	 * Encoded frames are stored in a transmit ring buffer and written to the stream
+	 * without blocking, i.e., only as many bytes as availableForWrite() of the stream
+	 * allows (the stream must implement availableForWrite(), as HardwareSerial does).
+	 * Received messages are parsed into a queue of RX_QUEUE_SIZE messages and dispatched
+	 * after all available bytes are parsed. Bytes are not read from the stream while the
+	 * queue is full (they wait in the buffer of the stream, so flow control of the host
+	 * applies) and a message is dispatched only when a response of MAX_MESSAGE_SIZE bytes
+	 * fits in the transmit buffer.
+	 * Messages are received in both classic and compact framing, messages are sent in
+	 * the framing of the last received message (old clients use classic framing only).
 	 ********************************************************************************/
-	template<int MESSENGER_ID, int MAX_MESSAGE_SIZE> class GEPStreamController {
-		friend class TGEPStreamMessenger<MESSENGER_ID, MAX_MESSAGE_SIZE>;
+	template<int MESSENGER_ID, int MAX_MESSAGE_SIZE, int TX_BUFFER_SIZE = DEFAULT_TX_BUFFER_SIZE, int RX_QUEUE_SIZE = DEFAULT_RX_QUEUE_SIZE> class GEPStreamController {
+		friend class TGEPStreamMessenger<MESSENGER_ID, MAX_MESSAGE_SIZE, TX_BUFFER_SIZE, RX_QUEUE_SIZE>;
 	private:
 		// Communication stream for sending and receiving messages
 		Stream* stream;
@@ -29,14 +55,102 @@ namespace acp_messenger_gep_stream {
 		// Destination ID of the received message
 		uint8_t messageDestinationId;
 
-		// Buffer for receiving messages
-		uint8_t message[MAX_MESSAGE_SIZE+2];
+		// Received message (with space for tag)
+		struct ReceivedMessage {
+			uint8_t data[MAX_MESSAGE_SIZE+2];
+			int length;
+			long tag;
+		};
+
+		// Ring of received messages waiting for dispatch and the message being received (the slot after the queued messages)
+		ReceivedMessage rxQueue[RX_QUEUE_SIZE + 1];
+
+		// Index of the first message waiting for dispatch in rxQueue
+		uint8_t rxStart;
+
+		// Number of messages waiting for dispatch
+		uint8_t rxCount;
+
+		// Number of received messages dropped because the receive queue was full (reading stops when the queue is full,
+		// so the counter guards the invariant only)
+		unsigned long rxOverflowCount;
+
+		// Number of malformed frames (invalid bytes, invalid checksum, too long or interrupted frames)
+		unsigned long rxMalformedCount;
+
+		// Buffer of the message being received
+		uint8_t* message;
 
 		// Number of received message bytes
 		int messageLength;
 
+		// Slot for constructing an outgoing message in place
+		uint8_t txSlot[MAX_MESSAGE_SIZE];
+
+		// Ring buffer of encoded frames waiting for transmission
+		uint8_t txBuffer[TX_BUFFER_SIZE];
+
+		// Position of the first byte waiting for transmission in txBuffer
+		int txStart;
+
+		// Number of bytes waiting for transmission in txBuffer
+		int txLength;
+
+		// Indicates whether the message being received uses compact framing
+		bool rxCompact;
+
+		// Indicates whether the previous byte of message in compact framing was ESCAPE_BYTE
+		bool rxEscaped;
+
+		// Indicates whether messages are sent using compact framing
+		bool compactFraming;
+
 		// State of the receive process
-		enum {WAIT_START, WAIT_DESTINATION_ID, WAIT_MESSAGE_BYTE_HIGH, WAIT_MESSAGE_BYTE_LOW, WAIT_CRC, WAIT_CRC_WITH_TAG, MESSAGE_RECEIVED, MESSAGE_RECEIVED_WITH_TAG}state;
+		enum {WAIT_START, WAIT_DESTINATION_ID, WAIT_MESSAGE_BYTE_HIGH, WAIT_MESSAGE_BYTE_LOW, WAIT_CRC, WAIT_CRC_WITH_TAG}state;
+
+		//--------------------------------------------------------------------------------
+		// Returns index of the slot in rxQueue for the message being received
+		inline uint8_t getRxSlot() {
+			uint8_t slot = rxStart + rxCount;
+			return (slot > RX_QUEUE_SIZE) ? slot - (RX_QUEUE_SIZE + 1) : slot;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Sets destination ID of the received message and returns whether the message should be received
+		inline bool acceptDestination(uint8_t destinationId) {
+			messageDestinationId = destinationId;
+
+			// Check whether the message is targeted for this messenger
+			if (MESSENGER_ID > 0) {
+				if ((messageDestinationId > 0) && (messageDestinationId != MESSENGER_ID)) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Resets receive of a malformed frame
+		inline void abortReceive() {
+			state = WAIT_START;
+			rxMalformedCount++;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Appends the received message to the queue (or drops it, if the queue is full)
+		void enqueueReceivedMessage(long tag) {
+			if (rxCount == RX_QUEUE_SIZE) {
+				rxOverflowCount++;
+				return;
+			}
+
+			ReceivedMessage& receivedMessage = rxQueue[getRxSlot()];
+			receivedMessage.length = messageLength;
+			receivedMessage.tag = tag;
+			rxCount++;
+			message = rxQueue[getRxSlot()].data;
+		}
 
 		//--------------------------------------------------------------------------------
 		// Computes CRC checksum of given data
@@ -60,66 +174,173 @@ namespace acp_messenger_gep_stream {
 		}
 
 		//--------------------------------------------------------------------------------
-		// Sends a byte encoded as two nibbles
-		inline void sendByte(uint8_t dataByte) {
-			uint8_t encodedByte[2];
+		// Appends a raw byte to the transmit buffer. Returns false, if the buffer is full (the byte is not written).
+		inline bool writeRaw(uint8_t dataByte) {
+			if (txLength >= TX_BUFFER_SIZE) {
+				return false;
+			}
+
+			int position = txStart + txLength;
+			if (position >= TX_BUFFER_SIZE) {
+				position -= TX_BUFFER_SIZE;
+			}
+
+			txBuffer[position] = dataByte;
+			txLength++;
+			return true;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Writes bytes from the transmit buffer to the stream without blocking
+		void drainTxBuffer() {
+			if (stream == NULL) {
+				return;
+			}
+
+			int writable = stream->availableForWrite();
+			while ((txLength > 0) && (writable > 0)) {
+				// write continuous part of the ring buffer
+				int count = TX_BUFFER_SIZE - txStart;
+				if (count > txLength) {
+					count = txLength;
+				}
+				if (count > writable) {
+					count = writable;
+				}
+
+				stream->write(&txBuffer[txStart], count);
+				txStart += count;
+				if (txStart == TX_BUFFER_SIZE) {
+					txStart = 0;
+				}
+				txLength -= count;
+				writable -= count;
+			}
+		}
+
+		//--------------------------------------------------------------------------------
+		// Writes all bytes from the transmit buffer to the stream (blocks until the bytes are written)
+		void flushTxBuffer() {
+			while ((stream != NULL) && (txLength > 0)) {
+				int count = TX_BUFFER_SIZE - txStart;
+				if (count > txLength) {
+					count = txLength;
+				}
+
+				stream->write(&txBuffer[txStart], count);
+				txStart += count;
+				if (txStart == TX_BUFFER_SIZE) {
+					txStart = 0;
+				}
+				txLength -= count;
+			}
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns size of encoded frame with message of given length
+		inline static int getFrameLength(int messageLength, bool withTag) {
+			// start byte, encoded destination id, encoded message, encoded tag, end byte and CRC
+			// (upper bound for compact framing, where only special bytes take two bytes)
+			return 1 + 2 + 2 * messageLength + (withTag ? 4 : 0) + 2;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns whether a frame of given length fits in the transmit buffer
+		inline bool hasTxSpace(int frameLength) {
+			if (TX_BUFFER_SIZE - txLength >= frameLength) {
+				return true;
+			}
+
+			drainTxBuffer();
+			return TX_BUFFER_SIZE - txLength >= frameLength;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Appends a byte encoded as two nibbles (or escaped, if it is a special byte of compact framing) to the transmit buffer.
+		// Returns false, if the transmit buffer is full.
+		inline bool sendByte(uint8_t dataByte) {
+			if (compactFraming) {
+				if ((dataByte == MESSAGE_START_BYTE) || (dataByte == MESSAGE_START_COMPACT_BYTE) || (dataByte == MESSAGE_END_BYTE)
+						|| (dataByte == MESSAGE_END_WITH_TAG_BYTE) || (dataByte == ESCAPE_BYTE)) {
+					return writeRaw(ESCAPE_BYTE) && writeRaw(dataByte ^ ESCAPE_XOR);
+				}
+
+				return writeRaw(dataByte);
+			}
+
 			uint8_t nibble;
 
 			// Encode high nibble
 			nibble = dataByte / 16;
-			encodedByte[0] = (nibble << 4) | (nibble ^ 0x0F);
+			if (!writeRaw((nibble << 4) | (nibble ^ 0x0F))) {
+				return false;
+			}
 
 			// Encode low nibble
 			nibble = dataByte % 16;
-			encodedByte[1] = (nibble << 4) | (nibble ^ 0x0F);
-
-			stream->write(encodedByte, 2);
+			return writeRaw((nibble << 4) | (nibble ^ 0x0F));
 		}
 
 		//--------------------------------------------------------------------------------
 		// Sends a message (if tag is negative, no tag is attached to the message). If destination ID is 0, message is broadcasted.
-		void sendMessage(uint8_t destinationId, const char* message, int messageLength, long tag) {
+		// The message is encoded and the CRC checksum computed in a single pass into the transmit buffer. Returns false, if the
+		// message is invalid or the transmit buffer is full (the message is not sent).
+		bool sendMessage(uint8_t destinationId, const char* message, int messageLength, long tag) {
 			if ((stream == NULL) || (messageLength < 0) || ((messageLength > 0) && (message == NULL))) {
-				return;
+				return false;
+			}
+
+			if (!hasTxSpace(getFrameLength(messageLength, tag >= 0))) {
+				return false;
 			}
 
 			// Accumulator for crc checksum
 			uint8_t crcChecksum = 0;
 
+			// Length of the transmit buffer before the frame (restored, if the frame does not fit)
+			const int initialTxLength = txLength;
+			bool written = true;
+
 			// Encode receiver ID and update crc-checksum accordingly
 			if (destinationId >= 16) {
 				destinationId = 0;
 			}
 			crcChecksum = computeCRC8(crcChecksum, &destinationId, 1);
-			destinationId = (destinationId << 4) | (destinationId ^ 0x0F);
 
 			// Send encoded message content
-			stream->write(MESSAGE_START_BYTE);
-			stream->write(destinationId);
-			const char* msgPtr = message;
-			for (int i=0; i<messageLength; i++) {
-				sendByte(*msgPtr);
+			if (compactFraming) {
+				written = writeRaw(MESSAGE_START_COMPACT_BYTE) && sendByte(destinationId);
+			} else {
+				written = writeRaw(MESSAGE_START_BYTE) && writeRaw((destinationId << 4) | (destinationId ^ 0x0F));
+			}
+			const uint8_t* msgPtr = (const uint8_t*)message;
+			for (int i=0; written && (i<messageLength); i++) {
+				written = sendByte(*msgPtr);
+				crcChecksum = computeCRC8(crcChecksum, msgPtr, 1);
 				msgPtr++;
 			}
 
-			// Compute CRC checksum
-			crcChecksum = computeCRC8(crcChecksum, (const uint8_t*)message, messageLength);
-
 			// Send tail of message (eventually with encoded tag)
 			if (tag < 0) {
-				stream->write(MESSAGE_END_BYTE);
+				written = written && writeRaw(MESSAGE_END_BYTE);
 			} else {
 				uint8_t tagBuffer[2];
 				tagBuffer[0] = tag / 256;
 				tagBuffer[1] = tag % 256;
-				sendByte(tagBuffer[0]);
-				sendByte(tagBuffer[1]);
+				written = written && sendByte(tagBuffer[0]) && sendByte(tagBuffer[1]) && writeRaw(MESSAGE_END_WITH_TAG_BYTE);
 				crcChecksum = computeCRC8(crcChecksum, tagBuffer, 2);
-				stream->write(MESSAGE_END_WITH_TAG_BYTE);
 			}
 
 			// Send CRC checksum
-			stream->write(crcChecksum);
+			written = written && writeRaw(crcChecksum);
+			if (!written) {
+				// discard the incomplete frame
+				txLength = initialTxLength;
+				return false;
+			}
+
+			drainTxBuffer();
+			return true;
 		}
 
 	public:
@@ -133,49 +354,68 @@ namespace acp_messenger_gep_stream {
 			messageReceivedEvent = NULL;
 			state = WAIT_START;
 			messageLength = 0;
+			rxStart = 0;
+			rxCount = 0;
+			rxOverflowCount = 0;
+			rxMalformedCount = 0;
+			rxCompact = false;
+			rxEscaped = false;
+			compactFraming = false;
+			message = rxQueue[0].data;
+			txStart = 0;
+			txLength = 0;
 		}
 
 		//--------------------------------------------------------------------------------
-		// Loop code for reading message data from stream
+		// Loop code for writing pending frames and reading message data from stream
 		void loop() {
-			while ((stream != NULL) && (stream->available() > 0)) {
+			drainTxBuffer();
+
+			while ((stream != NULL) && (rxCount < RX_QUEUE_SIZE) && (stream->available() > 0)) {
 				const int dataByte = stream->read();
 				if (dataByte < 0) {
 					break;
 				}
 
-				// Ignore all bytes received in state WAIT_START different than MESSAGE_START_BYTE
-				if ((state == WAIT_START) && (dataByte != MESSAGE_START_BYTE)) {
+				// Ignore all bytes received in state WAIT_START different than MESSAGE_START_BYTE or MESSAGE_START_COMPACT_BYTE
+				if ((state == WAIT_START) && (dataByte != MESSAGE_START_BYTE) && (dataByte != MESSAGE_START_COMPACT_BYTE)) {
 					continue;
 				}
 
-				// Process waiting - we change state to WAIT_START or break the loop (if a correct message is received)
+				// Process waiting - we change state to WAIT_START (a correct message is appended to the receive queue)
 				// CRC byte must be processed before other actions, indeed, the value of this byte can be MESSAGE_START_BYTE
 				if ((state == WAIT_CRC) || (state == WAIT_CRC_WITH_TAG)) {
 					// Check CRC of received data
 					const uint8_t crcInitialValue = computeCRC8(0, &messageDestinationId, 1);
 					if (dataByte != computeCRC8(crcInitialValue, (const byte*)message, messageLength)) {
 						// Invalid state (reset receive) - invalid checksum
-						state = WAIT_START;
+						abortReceive();
 					} else {
+						// Reply in the framing used by the client
+						compactFraming = rxCompact;
 						if (state == WAIT_CRC_WITH_TAG) {
 							messageLength -= 2;
-							state = MESSAGE_RECEIVED_WITH_TAG;
-						} else {
-							// Invalid state (reset receive) - too long message
-							if (messageLength > MAX_MESSAGE_SIZE) {
-								state = WAIT_START;
-							}
-							state = MESSAGE_RECEIVED;
+							enqueueReceivedMessage(message[messageLength] * 256L + message[messageLength + 1]);
+						} else if (messageLength <= MAX_MESSAGE_SIZE) {
+							enqueueReceivedMessage(-1);
 						}
 
-						break;
+						// Wait for the next message (too long message without a tag is ignored)
+						state = WAIT_START;
+						continue;
 					}
 				}
 
-				// After receiving MESSAGE_START_BYTE, the receive of the message is restarted
-				if (dataByte == MESSAGE_START_BYTE) {
+				// After receiving MESSAGE_START_BYTE or MESSAGE_START_COMPACT_BYTE, the receive of the message is restarted
+				if ((dataByte == MESSAGE_START_BYTE) || (dataByte == MESSAGE_START_COMPACT_BYTE)) {
+					// Interrupted frame
+					if (state != WAIT_START) {
+						rxMalformedCount++;
+					}
+
 					state = WAIT_DESTINATION_ID;
+					rxCompact = (dataByte == MESSAGE_START_COMPACT_BYTE);
+					rxEscaped = false;
 					continue;
 				}
 
@@ -184,22 +424,63 @@ namespace acp_messenger_gep_stream {
 					continue;
 				}
 
+				// Process data bytes of message in compact framing (end bytes are processed as in classic framing)
+				if (rxCompact && ((state == WAIT_DESTINATION_ID) || (state == WAIT_MESSAGE_BYTE_HIGH))
+						&& (rxEscaped || ((dataByte != MESSAGE_END_BYTE) && (dataByte != MESSAGE_END_WITH_TAG_BYTE)))) {
+					if (dataByte == ESCAPE_BYTE) {
+						// Invalid state (reset receive) - escaped escape byte
+						if (rxEscaped) {
+							abortReceive();
+						}
+
+						rxEscaped = !rxEscaped;
+						continue;
+					}
+
+					const uint8_t inByte = rxEscaped ? (dataByte ^ ESCAPE_XOR) : dataByte;
+					rxEscaped = false;
+					if (state == WAIT_DESTINATION_ID) {
+						// Check whether received byte is valid destination id (if not, reset receive)
+						if (inByte >= 16) {
+							abortReceive();
+							continue;
+						}
+
+						// Check whether the message is targeted for this messenger (if not, reset receive)
+						if (!acceptDestination(inByte)) {
+							state = WAIT_START;
+							continue;
+						}
+
+						state = WAIT_MESSAGE_BYTE_HIGH;
+						messageLength = 0;
+						continue;
+					}
+
+					if (messageLength >= MAX_MESSAGE_SIZE+2) {
+						// Invalid state (reset receive) - message buffer is full
+						abortReceive();
+						continue;
+					}
+
+					message[messageLength] = inByte;
+					messageLength++;
+					continue;
+				}
+
 				if (state == WAIT_DESTINATION_ID) {
 					const uint8_t inByte = (uint8_t)dataByte;
-					messageDestinationId = inByte / 16;
 
 					// Check whether received byte is well formed data byte (if not, reset receive)
-					if (messageDestinationId != ((inByte ^ 0x0F) & 0x0F)) {
-						state = WAIT_START;
+					if (inByte / 16 != ((inByte ^ 0x0F) & 0x0F)) {
+						abortReceive();
 						continue;
 					}
 
 					// Check whether the message is targeted for this messenger (if not, reset receive)
-					if (MESSENGER_ID > 0) {
-						if ((messageDestinationId > 0) && (messageDestinationId != MESSENGER_ID)) {
-							state = WAIT_START;
-							continue;
-						}
+					if (!acceptDestination(inByte / 16)) {
+						state = WAIT_START;
+						continue;
 					}
 
 					state = WAIT_MESSAGE_BYTE_HIGH;
@@ -217,7 +498,7 @@ namespace acp_messenger_gep_stream {
 						state = WAIT_CRC_WITH_TAG;
 					} else {
 						// Invalid state (reset receive)
-						state = WAIT_START;
+						abortReceive();
 					}
 					continue;
 				}
@@ -228,14 +509,14 @@ namespace acp_messenger_gep_stream {
 
 					// Check whether received byte is well formed data byte (if not, reset receive)
 					if (nibble != ((inByte ^ 0x0F) & 0x0F)) {
-						state = WAIT_START;
+						abortReceive();
 						continue;
 					}
 
 					if (state == WAIT_MESSAGE_BYTE_HIGH) {
 						if (messageLength >= MAX_MESSAGE_SIZE+2) {
 							// Invalid state (reset receive) - message buffer is full
-							state = WAIT_START;
+							abortReceive();
 							continue;
 						}
 
@@ -251,30 +532,17 @@ namespace acp_messenger_gep_stream {
 				}
 			}
 
-			// Notify new message without a tag
-			if (state == MESSAGE_RECEIVED) {
-				if (messageReceivedEvent != NULL) {
-					// Terminate the message with null (in the case when message processor requires it)
-					message[messageLength] = 0;
-					// Handle message
-					messageReceivedEvent((const char*)message, messageLength, -1);
-				}
-				state = WAIT_START;
-			}
-
-			// Notify new message with a tag
-			if (state == MESSAGE_RECEIVED_WITH_TAG) {
+			// Dispatch received messages (the handler sends a response)
+			while ((rxCount > 0) && hasTxSpace(getFrameLength(MAX_MESSAGE_SIZE, true))) {
+				ReceivedMessage& receivedMessage = rxQueue[rxStart];
+				rxStart = (rxStart == RX_QUEUE_SIZE) ? 0 : rxStart + 1;
+				rxCount--;
 				if (messageReceivedEvent != NULL) {
-					// Compute tag
-					const uint8_t* tagStart = message + messageLength;
-					const unsigned int tag = tagStart[0] * 256L + tagStart[1];
-
 					// Terminate the message with null (in the case when message processor requires it)
-					message[messageLength] = 0;
+					receivedMessage.data[receivedMessage.length] = 0;
 					// Handle message
-					messageReceivedEvent((const char*)message, messageLength, tag);
+					messageReceivedEvent((const char*)receivedMessage.data, receivedMessage.length, receivedMessage.tag);
 				}
-				state = WAIT_START;
 			}
 		}
 	};
@@ -282,14 +550,14 @@ namespace acp_messenger_gep_stream {
 	/********************************************************************************
 	 * View for a stream messenger using a GEP protocol
 	 ********************************************************************************/
-	template<int MESSENGER_ID, int MAX_MESSAGE_SIZE> class TGEPStreamMessenger {
+	template<int MESSENGER_ID, int MAX_MESSAGE_SIZE, int TX_BUFFER_SIZE = DEFAULT_TX_BUFFER_SIZE, int RX_QUEUE_SIZE = DEFAULT_RX_QUEUE_SIZE> class TGEPStreamMessenger {
 	private:
 		// The controller
-		GEPStreamController<MESSENGER_ID, MAX_MESSAGE_SIZE>& controller;
+		GEPStreamController<MESSENGER_ID, MAX_MESSAGE_SIZE, TX_BUFFER_SIZE, RX_QUEUE_SIZE>& controller;
 	public:
 		//--------------------------------------------------------------------------------
 		// Constructs view associated with a controller
-		inline TGEPStreamMessenger(GEPStreamController<MESSENGER_ID, MAX_MESSAGE_SIZE>& controller): controller(controller) {
+		inline TGEPStreamMessenger(GEPStreamController<MESSENGER_ID, MAX_MESSAGE_SIZE, TX_BUFFER_SIZE, RX_QUEUE_SIZE>& controller): controller(controller) {
 			// Nothing to do
 		}
 
@@ -306,15 +574,77 @@ namespace acp_messenger_gep_stream {
 		}
 
 		//--------------------------------------------------------------------------------
-		// Sends a message without a tag
-		inline void sendMessage(uint8_t destinationId, const char* message, int messageLength) {
-			controller.sendMessage(destinationId, message, messageLength, -1);
+		// Sends a message without a tag (returns false, if the transmit buffer is full)
+		inline bool sendMessage(uint8_t destinationId, const char* message, int messageLength) {
+			return controller.sendMessage(destinationId, message, messageLength, -1);
+		}
+
+		//--------------------------------------------------------------------------------
+		// Sends a message with a tag (returns false, if the transmit buffer is full)
+		inline bool sendMessage(uint8_t destinationId, const char* message, int messageLength, unsigned int tag) {
+			return controller.sendMessage(destinationId, message, messageLength, tag);
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns whether a message with a tag of given length can be sent without waiting
+		inline bool canSendMessage(int messageLength) {
+			return controller.hasTxSpace(controller.getFrameLength(messageLength, true));
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns whether messages are sent using compact framing (the framing of the last received message)
+		inline bool isCompactFraming() {
+			return controller.compactFraming;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns the number of received messages dropped because the receive queue was full
+		inline unsigned long getReceiveOverflowCount() {
+			return controller.rxOverflowCount;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns the number of free slots of the receive queue
+		inline int getFreeReceiveSlots() {
+			return RX_QUEUE_SIZE - controller.rxCount;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns the number of malformed frames (invalid bytes, invalid checksum, too long or interrupted frames)
+		inline unsigned long getMalformedFrameCount() {
+			return controller.rxMalformedCount;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns the number of encoded bytes waiting in the transmit buffer for writing to the stream
+		inline int getPendingLength() {
+			return controller.txLength;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Writes all pending messages to the stream (blocks until the messages are written)
+		inline void flushMessages() {
+			controller.flushTxBuffer();
+		}
+
+		//--------------------------------------------------------------------------------
+		// Returns transmit slot for constructing a message of up to MAX_MESSAGE_SIZE bytes in place.
+		// The message is sent by commitMessage. The slot is shared, i.e., the message must be
+		// committed before the slot is requested again.
+		inline char* beginMessage() {
+			return (char*)controller.txSlot;
+		}
+
+		//--------------------------------------------------------------------------------
+		// Sends message constructed in the transmit slot without a tag (returns false, if the transmit buffer is full)
+		inline bool commitMessage(uint8_t destinationId, int messageLength) {
+			return controller.sendMessage(destinationId, (const char*)controller.txSlot, messageLength, -1);
 		}
 
 		//--------------------------------------------------------------------------------
-		// Sends a message with a tag
-		inline void sendMessage(uint8_t destinationId, const char* message, int messageLength, unsigned int tag) {
-			controller.sendMessage(destinationId, message, messageLength, tag);
+		// Sends message constructed in the transmit slot with a tag (returns false, if the transmit buffer is full)
+		inline bool commitMessage(uint8_t destinationId, int messageLength, unsigned int tag) {
+			return controller.sendMessage(destinationId, (const char*)controller.txSlot, messageLength, tag);
 		}
 	};
 
@@ -262,7 +262,10 @@ public:
 		PICC_CMD_MF_TRANSFER	= 0xB0,		// Writes the contents of the internal data register to a block.
 		// The commands used for MIFARE Ultralight (from http://www.nxp.com/documents/data_sheet/MF0ICU1.pdf, Section 8.6)
 		// The PICC_CMD_MF_READ and PICC_CMD_MF_WRITE can also be used for MIFARE Ultralight.
-		PICC_CMD_UL_WRITE		= 0xA2		// Writes one 4 byte page to the PICC.
+		PICC_CMD_UL_WRITE		= 0xA2,		// Writes one 4 byte page to the PICC.
+		// The commands used for MIFARE Ultralight EV1 and NTAG21x (from http://www.nxp.com/documents/data_sheet/NTAG213_215_216.pdf, Section 10)
+		PICC_CMD_UL_GET_VERSION	= 0x60,		// Returns 8 bytes identifying the product, including the size of the memory.
+		PICC_CMD_UL_FAST_READ	= 0x3A		// Reads all pages between a start and an end page (both inclusive).
 	};
 	
 	// MIFARE constants that does not fit anywhere else
@@ -312,8 +315,23 @@ public:
 		byte		keyByte[MF_KEY_SIZE];
 	} MIFARE_Key;
 	
+	// Hook invoked when communication with a PICC starts and ends (NULL if not set). At the start, the
+	// value is the first byte sent to the PICC, at the end, the value is the resulting StatusCode.
+	typedef void (*CommunicationHook)(byte command, bool completed, byte value);
+	
+#ifdef MFRC522_SPI_RECORDER
+	// Recorder of register accesses (recording mode, enabled by defining MFRC522_SPI_RECORDER) invoked
+	// after each SPI transaction. The address is the first byte sent (MSB set for reads), the values are
+	// the bytes written to or read from the register.
+	typedef void (*SpiRecorder)(byte address, const byte *values, byte count);
+#endif
+	
 	// Member variables
 	Uid uid;								// Used by PICC_ReadCardSerial().
+	CommunicationHook communicationHook = NULL;	// Used by PCD_CommunicateWithPICC().
+#ifdef MFRC522_SPI_RECORDER
+	SpiRecorder spiRecorder = NULL;			// Used by PCD_WriteRegister() and PCD_ReadRegister().
+#endif
 	
 	// Size of the MFRC522 FIFO
 	static const byte FIFO_SIZE = 64;		// The FIFO is 64 bytes.
@@ -367,6 +385,8 @@ public:
 	StatusCode MIFARE_Read(byte blockAddr, byte *buffer, byte *bufferSize);
 	StatusCode MIFARE_Write(byte blockAddr, byte *buffer, byte bufferSize);
 	StatusCode MIFARE_Ultralight_Write(byte page, byte *buffer, byte bufferSize);
+	StatusCode MIFARE_Ultralight_GetVersion(byte *buffer, byte *bufferSize);
+	StatusCode MIFARE_Ultralight_FastRead(byte startPage, byte endPage, byte *buffer, byte *bufferSize);
 	StatusCode MIFARE_Decrement(byte blockAddr, long delta);
 	StatusCode MIFARE_Increment(byte blockAddr, long delta);
 	StatusCode MIFARE_Restore(byte blockAddr);
@@ -411,6 +431,7 @@ private:
 	byte _chipSelectPin;		// Arduino pin connected to MFRC522's SPI slave select input (Pin 24, NSS, active low)
 	byte _resetPowerDownPin;	// Arduino pin connected to MFRC522's reset and power down input (Pin 6, NRSTPD, active low)
 	StatusCode MIFARE_TwoStepHelper(byte command, byte blockAddr, long data);
+	StatusCode PCD_ExchangeWithPICC(byte command, byte waitIRq, byte *sendData, byte sendLen, byte *backData, byte *backLen, byte *validBits, byte rxAlign, bool checkCRC);
 };
 
 #endif
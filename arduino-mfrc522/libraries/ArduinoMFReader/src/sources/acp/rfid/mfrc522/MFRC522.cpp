@@ -7,6 +7,13 @@
 #include <Arduino.h>
 #include <acp/rfid/mfrc522/MFRC522.h>
 
+// Records a register access in the recording mode
+#ifdef MFRC522_SPI_RECORDER
+#define RECORD_SPI(address, values, count) if (spiRecorder != NULL) spiRecorder(address, values, count)
+#else
+#define RECORD_SPI(address, values, count)
+#endif
+
 
 /////////////////////////////////////////////////////////////////////////////////////
 // Functions for setting up the Arduino
@@ -45,6 +52,7 @@ void MFRC522::PCD_WriteRegister(	byte reg,		///< The register to write to. One o
 	SPI.transfer(value);
 	digitalWrite(_chipSelectPin, HIGH);		// Release slave again
 	SPI.endTransaction(); // Stop using the SPI bus
+	RECORD_SPI(reg & 0x7E, &value, 1);
 } // End PCD_WriteRegister()
 
 /**
@@ -63,6 +71,7 @@ void MFRC522::PCD_WriteRegister(	byte reg,		///< The register to write to. One o
 	}
 	digitalWrite(_chipSelectPin, HIGH);		// Release slave again
 	SPI.endTransaction(); // Stop using the SPI bus
+	RECORD_SPI(reg & 0x7E, values, count);
 } // End PCD_WriteRegister()
 
 /**
@@ -78,6 +87,7 @@ byte MFRC522::PCD_ReadRegister(	byte reg	///< The register to read from. One of
 	value = SPI.transfer(0);					// Read the value back. Send 0 to stop reading.
 	digitalWrite(_chipSelectPin, HIGH);			// Release slave again
 	SPI.endTransaction(); // Stop using the SPI bus
+	RECORD_SPI(0x80 | (reg & 0x7E), &value, 1);
 	return value;
 } // End PCD_ReadRegister()
 
@@ -120,6 +130,7 @@ void MFRC522::PCD_ReadRegister(	byte reg,		///< The register to read from. One o
 	values[index] = SPI.transfer(0);			// Read the final byte. Send 0 to stop reading.
 	digitalWrite(_chipSelectPin, HIGH);			// Release slave again
 	SPI.endTransaction(); // Stop using the SPI bus
+	RECORD_SPI(address, values, count + 1);
 } // End PCD_ReadRegister()
 
 /**
@@ -389,6 +400,7 @@ MFRC522::StatusCode MFRC522::PCD_TransceiveData(	byte *sendData,		///< Pointer t
 /**
  * Transfers data to the MFRC522 FIFO, executes a command, waits for completion and transfers data back from the FIFO.
  * CRC validation can only be done if backData and backLen are specified.
+ * The communication hook (if set) is invoked before and after the exchange.
  *
  * @return STATUS_OK on success, STATUS_??? otherwise.
  */
@@ -402,6 +414,31 @@ MFRC522::StatusCode MFRC522::PCD_CommunicateWithPICC(	byte command,		///< The co
 														byte rxAlign,		///< In: Defines the bit position in backData[0] for the first bit received. Default 0.
 														bool checkCRC		///< In: True => The last two bytes of the response is assumed to be a CRC_A that must be validated.
 									 ) {
+	if (communicationHook == NULL) {
+		return PCD_ExchangeWithPICC(command, waitIRq, sendData, sendLen, backData, backLen, validBits, rxAlign, checkCRC);
+	}
+	
+	communicationHook(command, false, (sendLen > 0) ? sendData[0] : 0);
+	MFRC522::StatusCode status = PCD_ExchangeWithPICC(command, waitIRq, sendData, sendLen, backData, backLen, validBits, rxAlign, checkCRC);
+	communicationHook(command, true, status);
+	return status;
+} // End PCD_CommunicateWithPICC()
+
+/**
+ * Executes the exchange of PCD_CommunicateWithPICC().
+ *
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+MFRC522::StatusCode MFRC522::PCD_ExchangeWithPICC(	byte command,		///< The command to execute. One of the PCD_Command enums.
+													byte waitIRq,		///< The bits in the ComIrqReg register that signals successful completion of the command.
+													byte *sendData,		///< Pointer to the data to transfer to the FIFO.
+													byte sendLen,		///< Number of bytes to transfer to the FIFO.
+													byte *backData,		///< NULL or pointer to buffer if data should be read back after executing the command.
+													byte *backLen,		///< In: Max number of bytes to write to *backData. Out: The number of bytes returned.
+													byte *validBits,	///< In/Out: The number of valid bits in the last byte. 0 for 8 valid bits.
+													byte rxAlign,		///< In: Defines the bit position in backData[0] for the first bit received. Default 0.
+													bool checkCRC		///< In: True => The last two bytes of the response is assumed to be a CRC_A that must be validated.
+								   ) {
 	byte n, _validBits;
 	unsigned int i;
 	
@@ -483,7 +520,7 @@ MFRC522::StatusCode MFRC522::PCD_CommunicateWithPICC(	byte command,		///< The co
 	}
 	
 	return STATUS_OK;
-} // End PCD_CommunicateWithPICC()
+} // End PCD_ExchangeWithPICC()
 
 /**
  * Transmits a REQuest command, Type A. Invites PICCs in state IDLE to go to READY and prepare for anticollision or selection. 7 bit frame.
@@ -956,6 +993,88 @@ MFRC522::StatusCode MFRC522::MIFARE_Ultralight_Write(	byte page, 		///< The page
 	return STATUS_OK;
 } // End MIFARE_Ultralight_Write()
 
+/**
+ * Reads version information of a MIFARE Ultralight EV1 or NTAG21x PICC.
+ * 
+ * The PICC responds with 8 bytes: fixed header, vendor ID, product type, product subtype,
+ * major and minor product version, storage size and protocol type.
+ * Older MIFARE Ultralight PICCs do not support the command and respond with a NAK (or do not respond at all).
+ * In that case the PICC returns to state IDLE and must be selected again.
+ * 
+ * The buffer must be at least 10 bytes because a CRC_A is also returned.
+ * Checks the CRC_A before returning STATUS_OK.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+MFRC522::StatusCode MFRC522::MIFARE_Ultralight_GetVersion(	byte *buffer,		///< The buffer to store the data in
+															byte *bufferSize	///< Buffer size, at least 10 bytes. Also number of bytes returned if STATUS_OK.
+														) {
+	MFRC522::StatusCode result;
+	
+	// Sanity check
+	if (buffer == NULL || *bufferSize < 10) {
+		return STATUS_NO_ROOM;
+	}
+	
+	// Build command buffer
+	buffer[0] = PICC_CMD_UL_GET_VERSION;
+	// Calculate CRC_A
+	result = PCD_CalculateCRC(buffer, 1, &buffer[1]);
+	if (result != STATUS_OK) {
+		return result;
+	}
+	
+	// Transmit the buffer and receive the response, validate CRC_A.
+	return PCD_TransceiveData(buffer, 3, buffer, bufferSize, NULL, 0, true);
+} // End MIFARE_Ultralight_GetVersion()
+
+/**
+ * Reads pages startPage..endPage (both inclusive) from the active MIFARE Ultralight EV1 or NTAG21x PICC
+ * using a single FAST_READ command.
+ * 
+ * The response must fit into the FIFO, i.e., at most 15 pages can be read at once.
+ * The buffer must be at least 4 * (endPage - startPage + 1) + 2 bytes because a CRC_A is also returned.
+ * Checks the CRC_A before returning STATUS_OK.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+MFRC522::StatusCode MFRC522::MIFARE_Ultralight_FastRead(	byte startPage,		///< The first page to read.
+															byte endPage,		///< The last page to read.
+															byte *buffer,		///< The buffer to store the data in
+															byte *bufferSize	///< Buffer size. Also number of bytes returned if STATUS_OK.
+														) {
+	MFRC522::StatusCode result;
+	
+	// Sanity check
+	if (endPage < startPage || endPage - startPage >= (FIFO_SIZE - 2) / 4) {
+		return STATUS_INVALID;
+	}
+	byte expectedSize = 4 * (endPage - startPage + 1) + 2;
+	if (buffer == NULL || *bufferSize < expectedSize) {
+		return STATUS_NO_ROOM;
+	}
+	
+	// Build command buffer
+	buffer[0] = PICC_CMD_UL_FAST_READ;
+	buffer[1] = startPage;
+	buffer[2] = endPage;
+	// Calculate CRC_A
+	result = PCD_CalculateCRC(buffer, 3, &buffer[3]);
+	if (result != STATUS_OK) {
+		return result;
+	}
+	
+	// Transmit the buffer and receive the response, validate CRC_A.
+	result = PCD_TransceiveData(buffer, 5, buffer, bufferSize, NULL, 0, true);
+	if (result != STATUS_OK) {
+		return result;
+	}
+	if (*bufferSize != expectedSize) {
+		return STATUS_ERROR;
+	}
+	return STATUS_OK;
+} // End MIFARE_Ultralight_FastRead()
+
 /**
  * MIFARE Decrement subtracts the delta from the value of the addressed block, and stores the result in a volatile memory.
  * For MIFARE Classic only. The sector containing the block must be authenticated before calling this function.
@@ -1134,7 +1253,6 @@ MFRC522::StatusCode MFRC522::PCD_NTAG216_AUTH(byte* passWord, byte pACK[]) //Aut
 	
 	// Transceive the data, store the reply in cmdBuffer[]
 	byte waitIRq		= 0x30;	// RxIRq and IdleIRq
-	byte cmdBufferSize	= sizeof(cmdBuffer);
 	byte validBits		= 0;
 	byte rxlength		= 5;
 	result = PCD_CommunicateWithPICC(PCD_Transceive, waitIRq, cmdBuffer, 7, cmdBuffer, &rxlength, &validBits);
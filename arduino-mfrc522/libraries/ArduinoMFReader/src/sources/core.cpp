@@ -2,6 +2,9 @@
 #include <acp/rfid/mfrc522/MFRC522.h>
 #include <acp/messenger/gep_stream_messenger/gepstream_messenger.h>
 #include <avr/wdt.h>
+#if ACP_IDLE_SLEEP
+#include <avr/sleep.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -15,6 +18,7 @@ void loop();
 extern void onStart();
 extern void onMessageReceived(const char*, int, long);
 extern void onCardCheck();
+extern void onCommandProcess();
 // End of user defined event handlers
 //----------------------------------------------------------------------
 
@@ -23,16 +27,19 @@ extern void onCardCheck();
 namespace acp_private {
   // Controller for cardCheckTimer
   acp_common_timer::TimerController controller_0;
+  // Controller for commandTimer
+  acp_common_timer::TimerController controller_1;
   // Controller for messenger
-  acp_messenger_gep_stream::GEPStreamController<0, 50> controller_1;
+  acp_messenger_gep_stream::GEPStreamController<0, 50> controller_2;
 }
 //----------------------------------------------------------------------
 
 //----------------------------------------------------------------------
 // Component views (public objects)
 acp_common_timer::TTimer cardCheckTimer(acp_private::controller_0);
+acp_common_timer::TTimer commandTimer(acp_private::controller_1);
 MFRC522 cardReader(10, 9);
-acp_messenger_gep_stream::TGEPStreamMessenger<0, 50> messenger(acp_private::controller_1);
+acp_messenger_gep_stream::TGEPStreamMessenger<0, 50> messenger(acp_private::controller_2);
 // End of component views (public objects)
 //----------------------------------------------------------------------
 
@@ -72,12 +79,17 @@ struct Looper {
 	byte state;
 	// Handler of looper
 	LooperHandler handler;
+	// Position of the looper in the priority queue
+	int pqIndex;
 };
 
 // Generated looper handlers
 unsigned long looper_handler_0() {
   return acp_private::controller_0.looper();
 }
+unsigned long looper_handler_1() {
+  return acp_private::controller_1.looper();
+}
 // End of looper handlers
 
 #define ENABLED 1
@@ -86,12 +98,86 @@ unsigned long looper_handler_0() {
 #define EXECUTED_DISABLED 3
 
 // Loopers
-#define LOOPERS_COUNT 1
-Looper loopers[LOOPERS_COUNT] = {   {0, ENABLED, looper_handler_0} };
-Looper* pq[LOOPERS_COUNT] = {loopers + 0};
-int pqSize = LOOPERS_COUNT;
+#define LOOPERS_COUNT 2
+Looper loopers[LOOPERS_COUNT] = {   {0, DISABLED, looper_handler_0, 0},   {0, DISABLED, looper_handler_1, 0} };
+// Priority queue of enabled loopers (binary min-heap ordered by time of the next call)
+Looper* pq[LOOPERS_COUNT];
+int pqSize = 0;
 unsigned long now = 0;
 
+// Returns whether the time precedes the reference time (safe across overflow of millis())
+inline bool isBefore(unsigned long time, unsigned long reference) {
+	return (long)(time - reference) < 0;
+}
+
+// Stores looper at given position of the priority queue
+inline void placeLooper(Looper* looper, int index) {
+	pq[index] = looper;
+	looper->pqIndex = index;
+}
+
+// Moves looper towards the top of the priority queue
+void siftUp(Looper* looper) {
+	int index = looper->pqIndex;
+	while (index > 0) {
+		const int parent = (index - 1) / 2;
+		if (!isBefore(looper->nextCall, pq[parent]->nextCall)) {
+			break;
+		}
+
+		placeLooper(pq[parent], index);
+		index = parent;
+	}
+
+	placeLooper(looper, index);
+}
+
+// Moves looper towards the bottom of the priority queue
+void siftDown(Looper* looper) {
+	int index = looper->pqIndex;
+	while (true) {
+		int child = 2 * index + 1;
+		if (child >= pqSize) {
+			break;
+		}
+
+		if ((child + 1 < pqSize) && isBefore(pq[child + 1]->nextCall, pq[child]->nextCall)) {
+			child++;
+		}
+
+		if (!isBefore(pq[child]->nextCall, looper->nextCall)) {
+			break;
+		}
+
+		placeLooper(pq[child], index);
+		index = child;
+	}
+
+	placeLooper(looper, index);
+}
+
+// Inserts looper to the priority queue
+void insertLooper(Looper* looper) {
+	looper->pqIndex = pqSize;
+	pqSize++;
+	siftUp(looper);
+}
+
+// Removes looper from the priority queue
+void removeLooper(Looper* looper) {
+	pqSize--;
+	Looper* const last = pq[pqSize];
+	if (last == looper) {
+		return;
+	}
+
+	// the last looper replaces the removed looper and it is moved to its position in the priority queue
+	last->pqIndex = looper->pqIndex;
+	pq[last->pqIndex] = last;
+	siftUp(last);
+	siftDown(last);
+}
+
 // Process loopers
 inline void processLoopers() {
 	if (pqSize == 0) {
@@ -102,51 +188,51 @@ inline void processLoopers() {
 	now = millis();
 
 	// Process expired handlers
-	while (true) {
+	while (pqSize > 0) {
 		Looper* activeLooper = pq[0];
 
 		// Check the first expected looper
-		if ((pqSize == 0) || (activeLooper->nextCall > now)) {
+		if (isBefore(now, activeLooper->nextCall)) {
 			break;
 		}
 
-		// Execute handler and store time of the next call
+		// Execute handler and store time of the next call (handler can enable or disable loopers)
 		activeLooper->state = EXECUTED_ENABLED;
 		activeLooper->nextCall = now + activeLooper->handler();
 
-		// Move readPos to position of active looper
-		Looper** readPos = pq;
-		while (*readPos != activeLooper) {
-			readPos++;
-		}
-
-		// Set writePos to position of active looper and readPos to position of next looper
-		Looper** writePos = readPos;
-		readPos++;
-		Looper** const end = pq + pqSize;
-
 		if (activeLooper->state == EXECUTED_ENABLED) {
-			// EXECUTED_ENABLED
-			const unsigned long nextCall = activeLooper->nextCall;
-			while ((readPos != end) && ((*readPos)->nextCall <= nextCall)) {
-				*writePos = *readPos;
-				writePos++;
-				readPos++;
-			}
-			*writePos = activeLooper;
+			// EXECUTED_ENABLED (the next call is not before the previous one)
+			siftDown(activeLooper);
 			activeLooper->state = ENABLED;
 		} else {
 			// EXECUTED_DISABLED
-			while (readPos != end) {
-				*writePos = *readPos;
-				writePos++;
-				readPos++;
-			}
-			pqSize--;
+			removeLooper(activeLooper);
 			activeLooper->state = DISABLED;
 		}
 	}
 }
+
+#if ACP_IDLE_SLEEP
+// Sleeps in idle mode until the next interrupt if no looper is due and no byte was received. The
+// USART, SPI and timers run in idle mode: received bytes are stored by the interrupt handler of
+// Serial and the overflow of timer 0 (millis) wakes the MCU at least every 1.024 ms, so the watchdog
+// is reset by the loop as before.
+inline void sleepUntilInterrupt() {
+	set_sleep_mode(SLEEP_MODE_IDLE);
+	noInterrupts();
+	if (((pqSize > 0) && !isBefore(millis(), pq[0]->nextCall)) || (Serial.available() > 0)) {
+		interrupts();
+		return;
+	}
+
+	// interrupts are enabled by the instruction preceding sleep, an interrupt pending since the
+	// check wakes the MCU immediately
+	sleep_enable();
+	interrupts();
+	sleep_cpu();
+	sleep_disable();
+}
+#endif
 }
 
 // Accessible controller methods
@@ -168,17 +254,7 @@ void enableLooper(int looperId) {
 
 	looper->state = ENABLED;
 	looper->nextCall = now;
-
-	Looper** writePos = pq + pqSize;
-	Looper** readPos = writePos - 1;
-	while (writePos != pq) {
-		*writePos = *readPos;
-		writePos--;
-		readPos--;
-	}
-
-	pqSize++;
-	pq[0] = looper;
+	insertLooper(looper);
 }
 
 // Disables a looper
@@ -194,21 +270,7 @@ void disableLooper(int looperId) {
 	}
 
 	looper->state = DISABLED;
-
-	Looper** readPos = pq;
-	while (*readPos != looper) {
-		readPos++;
-	}
-
-	Looper** const end = pq + pqSize;
-	Looper** writePos = readPos;
-	readPos++;
-	while (readPos != end) {
-		*writePos = *readPos;
-		writePos++;
-		readPos++;
-	}
-	pqSize--;
+	removeLooper(looper);
 }
 }
 
@@ -216,12 +278,18 @@ void disableLooper(int looperId) {
 // Autogenerated setup
 void setup() {
   wdt_disable();
+  // Loopers enabled by controllers are scheduled from the current time
+  acp_private::now = millis();
   // Controller for cardCheckTimer
   acp_private::controller_0.looperId = 0;
   acp_private::controller_0.tickEvent = onCardCheck;
   acp_private::controller_0.init(250ul, true);
+  // Controller for commandTimer
+  acp_private::controller_1.looperId = 1;
+  acp_private::controller_1.tickEvent = onCommandProcess;
+  acp_private::controller_1.init(1ul, true);
   // Controller for messenger
-  acp_private::controller_1.messageReceivedEvent = onMessageReceived;
+  acp_private::controller_2.messageReceivedEvent = onMessageReceived;
   // Call of the OnStart event
   onStart();
   wdt_enable(9);
@@ -230,7 +298,11 @@ void setup() {
 // Autogenerated loop
 void loop() {
   wdt_reset();
-  acp_private::controller_1.loop();
+  acp_private::controller_2.loop();
   // Process loopers
   acp_private::processLoopers();
+#if ACP_IDLE_SLEEP
+  // Sleep until the next looper deadline or interrupt
+  acp_private::sleepUntilInterrupt();
+#endif
 }
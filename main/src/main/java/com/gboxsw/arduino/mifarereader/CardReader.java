@@ -1,6 +1,8 @@
 package com.gboxsw.arduino.mifarereader;
 
+import java.io.*;
 import java.util.*;
+import java.util.zip.CRC32;
 
 import com.gboxsw.acpmod.gep.GEPMessenger;
 import com.gboxsw.acpmod.gep.GEPMessenger.*;
@@ -17,6 +19,57 @@ public class CardReader {
 	 */
 	private static final long DEFAULT_TIMEOUT = 500;
 
+	/**
+	 * Maximal number of pages read by a single command.
+	 */
+	private static final int MAX_PAGES_PER_COMMAND = 12;
+
+	/**
+	 * Maximal number of blocks read or written by a single command.
+	 */
+	private static final int MAX_BLOCKS_PER_COMMAND = 2;
+
+	/**
+	 * Maximal number of blocks read or written by a fragmented command or a
+	 * command with chunked response.
+	 */
+	private static final int MAX_BLOCKS_PER_STREAM = 16;
+
+	/**
+	 * Maximal number of payload bytes in a fragment of command (command code,
+	 * code of fragmented command, total length and offset precede the data).
+	 */
+	private static final int MAX_FRAGMENT_DATA_SIZE = MAX_MESSAGE_LENGTH - 6;
+
+	/**
+	 * Maximal number of sector digests returned by a single command.
+	 */
+	private static final int MAX_DIGESTS_PER_COMMAND = 12;
+
+	/**
+	 * Default number of commands sent to the reader without waiting for their
+	 * responses (size of command queue in the reader).
+	 */
+	private static final int DEFAULT_COMMAND_WINDOW = 3;
+
+	/**
+	 * Default number of repeated sends of a command whose response has not
+	 * been received in time.
+	 */
+	private static final int DEFAULT_COMMAND_RETRIES = 2;
+
+	/**
+	 * Maximal value of a command tag (tags are transmitted as 16-bit values,
+	 * tag 0 is reserved for events).
+	 */
+	private static final int MAX_COMMAND_TAG = 0xFFFF;
+
+	/**
+	 * Length of credits appended to responses: free command slots and free
+	 * bytes of the receive buffer of the reader.
+	 */
+	private static final int CREDITS_LENGTH = 2;
+
 	/**
 	 * Empty byte array.
 	 */
@@ -55,8 +108,181 @@ public class CardReader {
 		 * Write sector trailer.
 		 */
 		static final int WRITE_SECTOR_TRAILER = 6;
+
+		/**
+		 * Read value of a value block.
+		 */
+		static final int VALUE_GET = 7;
+
+		/**
+		 * Format block as a value block with given value.
+		 */
+		static final int VALUE_SET = 8;
+
+		/**
+		 * Increment value block and transfer the result.
+		 */
+		static final int VALUE_ADD = 9;
+
+		/**
+		 * Decrement value block and transfer the result.
+		 */
+		static final int VALUE_SUB = 10;
+
+		/**
+		 * Copy value block to another block of the same sector.
+		 */
+		static final int VALUE_COPY = 11;
+
+		/**
+		 * Debit value block and return the new balance.
+		 */
+		static final int VALUE_DEBIT = 12;
+
+		/**
+		 * Read pages of Ultralight or NTAG card.
+		 */
+		static final int READ_PAGES = 13;
+
+		/**
+		 * Write page of Ultralight or NTAG card.
+		 */
+		static final int WRITE_PAGE = 14;
+
+		/**
+		 * Authenticate to Ultralight EV1 or NTAG card using a password.
+		 */
+		static final int PAGE_AUTH = 15;
+
+		/**
+		 * Read NDEF message from NFC Forum Type 2 tag.
+		 */
+		static final int READ_NDEF = 16;
+
+		/**
+		 * Read consecutive blocks (16-bit addressing).
+		 */
+		static final int READ_BLOCKS = 17;
+
+		/**
+		 * Write consecutive blocks (16-bit addressing).
+		 */
+		static final int WRITE_BLOCKS = 18;
+
+		/**
+		 * Compute digests of sectors.
+		 */
+		static final int DIGEST = 19;
+
+		/**
+		 * Write blocks whose content differs from the target content.
+		 */
+		static final int SYNC_BLOCKS = 20;
+
+		/**
+		 * Read execution statistics of a command.
+		 */
+		static final int GET_STATS = 21;
+
+		/**
+		 * Store a part of macro bytecode.
+		 */
+		static final int MACRO_WRITE = 22;
+
+		/**
+		 * Set length and flags of the stored macro.
+		 */
+		static final int MACRO_SETUP = 23;
+
+		/**
+		 * Execute the stored macro.
+		 */
+		static final int MACRO_RUN = 24;
+
+		/**
+		 * Switch speed of the serial link.
+		 */
+		static final int SET_LINK_SPEED = 25;
+
+		/**
+		 * Fragment of payload of another command.
+		 */
+		static final int FRAGMENT = 26;
+
+		/**
+		 * Set time window for coalescing messages into envelopes.
+		 */
+		static final int SET_COALESCING = 27;
+
+		/**
+		 * Enable or disable sending of credits (flow control).
+		 */
+		static final int SET_FLOW_CONTROL = 28;
+
+		/**
+		 * Read statistics of the link.
+		 */
+		static final int GET_LINK_STATS = 29;
+
+		/**
+		 * Read trace of recent events recorded by the reader.
+		 */
+		static final int TRACE_DUMP = 30;
 	}
 
+	/**
+	 * Number of command codes supported by the reader.
+	 */
+	private static final int COMMAND_COUNT = 30;
+
+	/**
+	 * Maximal number of bytecode bytes stored by a single command.
+	 */
+	private static final int MAX_MACRO_CHUNK_SIZE = MAX_MESSAGE_LENGTH - 2;
+
+	/**
+	 * Flag of macro that is executed automatically when a card is detected.
+	 */
+	private static final int MACRO_AUTORUN = 0x01;
+
+	/**
+	 * Flag of GET_STATS command: statistics are reset after reading.
+	 */
+	private static final int STATS_RESET = 0x01;
+
+	/**
+	 * Flag of TRACE_DUMP command: trace is cleared after reading.
+	 */
+	private static final int TRACE_CLEAR = 0x01;
+
+	/**
+	 * Length of a record of the trace.
+	 */
+	private static final int TRACE_RECORD_LENGTH = 6;
+
+	/**
+	 * Flag of SET_LINK_SPEED command: the link speed is persisted by the
+	 * reader.
+	 */
+	private static final int LINK_SPEED_PERSIST = 0x01;
+
+	/**
+	 * Link speed used by the reader without persisted link speed and after
+	 * failed switch of link speed.
+	 */
+	public static final int DEFAULT_LINK_SPEED = 9600;
+
+	/**
+	 * Time in milliseconds after which the reader falls back to the default
+	 * link speed, if no valid message is received at the new link speed.
+	 */
+	private static final long LINK_SPEED_TIMEOUT = 1000;
+
+	/**
+	 * Flag of DIGEST command: sector trailers are not included in digests.
+	 */
+	private static final int DIGEST_SKIP_TRAILERS = 0x01;
+
 	/**
 	 * Codes of messages send by the reader.
 	 */
@@ -80,6 +306,32 @@ public class CardReader {
 		 * Notification that the card was removed.
 		 */
 		static final int CARD_REMOVED = 4;
+
+		/**
+		 * Notification about result of macro executed automatically.
+		 */
+		static final int MACRO_EXECUTED = 5;
+
+		/**
+		 * Envelope with coalesced messages.
+		 */
+		static final int ENVELOPE = 6;
+
+		/**
+		 * Credits available after execution of a command (sent when the
+		 * credits do not fit in the response).
+		 */
+		static final int CREDITS = 7;
+
+		/**
+		 * Response with status COMMAND_OK and appended credits.
+		 */
+		static final int COMMAND_OK_CREDITS = 8;
+
+		/**
+		 * Response with status COMMAND_FAILED and appended credits.
+		 */
+		static final int COMMAND_FAILED_CREDITS = 9;
 	}
 
 	/**
@@ -87,7 +339,7 @@ public class CardReader {
 	 */
 	public enum CardType {
 		ISO_14443_4(1), ISO_18092(2), MIFARE_MINI(3), MIFARE_1K(4), MIFARE_4K(5), MIFARE_UL(6), MIFARE_PLUS(7), TNP3XXX(
-				8);
+				8), NTAG(9);
 
 		/**
 		 * Internal code of the card.
@@ -121,6 +373,40 @@ public class CardReader {
 		public void cardChanged(CardReader reader, boolean cardPresent);
 	}
 
+	/**
+	 * The listener interface for receiving results of macros executed
+	 * automatically by the reader when a card is detected.
+	 */
+	public interface MacroListener {
+		/**
+		 * Invoked when the reader executed the stored macro.
+		 * 
+		 * @param reader
+		 *            the reader.
+		 * @param success
+		 *            true, if the macro completed successfully, false
+		 *            otherwise.
+		 * @param output
+		 *            the bytes emitted by the macro.
+		 */
+		public void macroExecuted(CardReader reader, boolean success, byte[] output);
+	}
+
+	/**
+	 * Controller of the host side of the serial link to the reader.
+	 */
+	public interface LinkSpeedControl {
+		/**
+		 * Changes the baud rate of the serial port connected to the reader.
+		 * 
+		 * @param baudRate
+		 *            the baud rate.
+		 * @throws IOException
+		 *             if the baud rate cannot be changed.
+		 */
+		public void setBaudRate(int baudRate) throws IOException;
+	}
+
 	/**
 	 * Sector trailer.
 	 */
@@ -147,15 +433,142 @@ public class CardReader {
 	}
 
 	/**
-	 * Messenger utilized to communicate with the reader.
+	 * Execution statistics of a command measured by the reader.
+	 */
+	public static class CommandStatistics {
+		/**
+		 * Number of executions.
+		 */
+		public long count;
+
+		/**
+		 * Number of failed executions.
+		 */
+		public long failures;
+
+		/**
+		 * Total execution time in microseconds.
+		 */
+		public long totalTime;
+
+		/**
+		 * Maximal execution time in microseconds.
+		 */
+		public long maxTime;
+	}
+
+	/**
+	 * Statistics of the link measured by the reader.
+	 */
+	public static class LinkStatistics {
+		/**
+		 * Number of received frames dropped because the receive queue of the
+		 * reader was full.
+		 */
+		public long droppedFrames;
+
+		/**
+		 * Number of malformed frames (invalid bytes, invalid checksum, too long
+		 * or interrupted frames).
+		 */
+		public long malformedFrames;
+
+		/**
+		 * Number of commands rejected because the command queue of the reader
+		 * was full (always 0, current readers keep waiting commands in the
+		 * serial receive buffer instead of rejecting them).
+		 */
+		public long rejectedCommands;
+	}
+
+	/**
+	 * Event recorded in the trace of the reader.
+	 */
+	public static class TraceRecord {
+		/**
+		 * Frame with command received (data: command code).
+		 */
+		public static final int FRAME_RECEIVED = 1;
+
+		/**
+		 * Execution of command started (data: command code).
+		 */
+		public static final int COMMAND_DISPATCHED = 2;
+
+		/**
+		 * Authentication with card started (data: authentication command).
+		 */
+		public static final int AUTH_START = 3;
+
+		/**
+		 * Authentication with card completed (data: status code of driver).
+		 */
+		public static final int AUTH_END = 4;
+
+		/**
+		 * Exchange with card started (data: command of card).
+		 */
+		public static final int TRANSCEIVE_START = 5;
+
+		/**
+		 * Exchange with card completed (data: status code of driver).
+		 */
+		public static final int TRANSCEIVE_END = 6;
+
+		/**
+		 * Message queued for sending (data: message code).
+		 */
+		public static final int RESPONSE_QUEUED = 7;
+
+		/**
+		 * All queued messages were passed to the serial port.
+		 */
+		public static final int RESPONSE_FLUSHED = 8;
+
+		/**
+		 * Card detection (data: 1, if a card is detected, 0 otherwise).
+		 */
+		public static final int CARD_POLL = 9;
+
+		/**
+		 * Time of event in microseconds (time of the reader that wraps around
+		 * after 2^32 microseconds).
+		 */
+		public long time;
+
+		/**
+		 * Type of event.
+		 */
+		public int event;
+
+		/**
+		 * Data of event.
+		 */
+		public int data;
+	}
+
+	/**
+	 * Messenger utilized to communicate with the reader (null, if the reader
+	 * is accessed by a stream link).
 	 */
 	private final GEPMessenger messenger;
 
+	/**
+	 * Stream link utilized to communicate with the reader (null, if the reader
+	 * is accessed by a messenger).
+	 */
+	private final GEPStreamLink link;
+
 	/**
 	 * Registered card listeners.
 	 */
 	private final List<CardListener> cardListeners = new ArrayList<>();
 
+	/**
+	 * Registered macro listeners.
+	 */
+	private final List<MacroListener> macroListeners = new ArrayList<>();
+
 	/**
 	 * Type of active card.
 	 */
@@ -187,61 +600,310 @@ public class CardReader {
 	private final Object commandLock = new Object();
 
 	/**
-	 * Counter for generating command tags.
+	 * Counter for generating command tags. The counter starts at a random
+	 * value, because the reader replays responses to repeated tags and a new
+	 * session must not repeat tags of the previous session.
 	 */
-	private int tagCounter = 1;
+	private int tagCounter = new Random().nextInt(MAX_COMMAND_TAG);
 
 	/**
-	 * Response data from reader as a result of executing command.
+	 * Maximal number of commands sent to the reader without waiting for their
+	 * responses.
 	 */
-	private byte[] commandResponseData = null;
+	private int commandWindow = DEFAULT_COMMAND_WINDOW;
 
 	/**
-	 * Indicated whether response to sent command has been received.
+	 * Number of repeated sends of a command whose response has not been
+	 * received in time.
 	 */
-	private boolean commandResponseReceived = false;
+	private int commandRetries = DEFAULT_COMMAND_RETRIES;
 
 	/**
-	 * Tag of executing command.
+	 * Sequence number of the last sent command.
 	 */
-	private int commandTag = -1;
+	private long sendSequence = 0;
 
 	/**
-	 * Constructs the card reader.
-	 * 
-	 * @param socket
-	 *            the socket providing access to device using the GEP protocol.
+	 * Sequence number of the command after whose execution the last credits
+	 * were sent by the reader (-1, if flow control is disabled).
 	 */
-	public CardReader(FullDuplexStreamSocket socket) {
-		messenger = new GEPMessenger(socket, 0, MAX_MESSAGE_LENGTH, new MessageListener() {
-			public void onMessageReceived(int tag, byte[] message) {
-				handleReceivedMessage(tag, message);
-			}
-		});
-	}
+	private long creditSequence = -1;
 
 	/**
-	 * Starts the reader.
+	 * Number of commands the reader can accept after the command identified by
+	 * creditSequence.
 	 */
-	public void start() {
-		messenger.start(true);
-	}
+	private int creditCommands;
 
 	/**
-	 * Stops the reader.
+	 * Number of bytes the reader can accept after the command identified by
+	 * creditSequence.
 	 */
-	public void stop() {
-		try {
-			messenger.stop(true);
-		} catch (InterruptedException ignore) {
+	private int creditBytes;
 
-		}
-	}
+	/**
+	 * Tag of the last command whose response has been received.
+	 */
+	private int lastResponseTag;
 
-	public void addCardListener(CardListener listener) {
-		if (listener == null) {
-			throw new NullPointerException("Listener cannot be null.");
-		}
+	/**
+	 * Sequence number of the last command whose response has been received.
+	 */
+	private long lastResponseSequence = -1;
+
+	/**
+	 * Indicates whether the credit based flow control is enabled.
+	 */
+	private boolean flowControl;
+
+	/**
+	 * Commands sent to the reader waiting for response (indexed by tag).
+	 */
+	private final Map<Integer, PendingCommand> pendingCommands = new HashMap<>();
+
+	/**
+	 * Command sent to the reader that waits for response.
+	 */
+	private static class PendingCommand {
+		/**
+		 * Tag of the command.
+		 */
+		final int tag;
+
+		/**
+		 * Message with the command (resent with the same tag when the response
+		 * is not received in time).
+		 */
+		final byte[] message;
+
+		/**
+		 * Indicates whether the response is sent in chunks.
+		 */
+		final boolean chunked;
+
+		/**
+		 * Sequence number of the command.
+		 */
+		final long sequence;
+
+		/**
+		 * Maximal length of the frame with the command.
+		 */
+		final int frameLength;
+
+		/**
+		 * Number of remaining repeated sends of the command.
+		 */
+		int retriesLeft;
+
+		/**
+		 * Time when the command was sent (or the last chunk of response was
+		 * received) as system nanoseconds.
+		 */
+		long progressNanoTime;
+
+		/**
+		 * Response data from reader as a result of executing command.
+		 */
+		byte[] responseData;
+
+		/**
+		 * Number of bytes of chunked response received so far.
+		 */
+		int chunkedResponseLength;
+
+		/**
+		 * Indicates whether response to the command has been received.
+		 */
+		boolean responseReceived;
+
+		/**
+		 * Constructs the pending command.
+		 * 
+		 * @param tag
+		 *            the tag of command.
+		 * @param message
+		 *            the message with the command.
+		 * @param chunked
+		 *            true, if the response is sent in chunks, false otherwise.
+		 * @param retries
+		 *            the number of repeated sends of the command.
+		 * @param sequence
+		 *            the sequence number of the command.
+		 */
+		PendingCommand(int tag, byte[] message, boolean chunked, int retries, long sequence) {
+			this.tag = tag;
+			this.message = message;
+			this.chunked = chunked;
+			this.sequence = sequence;
+			this.frameLength = getFrameLength(message.length);
+			this.retriesLeft = retries;
+			this.progressNanoTime = System.nanoTime();
+		}
+	}
+
+	/**
+	 * Constructs the card reader.
+	 * 
+	 * @param socket
+	 *            the socket providing access to device using the GEP protocol.
+	 */
+	public CardReader(FullDuplexStreamSocket socket) {
+		messenger = new GEPMessenger(socket, 0, MAX_MESSAGE_LENGTH, createMessageListener());
+		link = null;
+	}
+
+	/**
+	 * Constructs the card reader accessed by a pair of streams. In contrast to
+	 * the socket based reader, the reader supports compact framing (see
+	 * {@link #enableCompactFraming()}).
+	 * 
+	 * @param input
+	 *            the input stream with bytes received from device.
+	 * @param output
+	 *            the output stream for bytes sent to device.
+	 */
+	public CardReader(InputStream input, OutputStream output) {
+		messenger = null;
+		link = new GEPStreamLink(input, output, MAX_MESSAGE_LENGTH, createMessageListener());
+	}
+
+	/**
+	 * Creates listener forwarding received messages to the reader.
+	 */
+	private MessageListener createMessageListener() {
+		return new MessageListener() {
+			public void onMessageReceived(int tag, byte[] message) {
+				handleReceivedMessage(tag, message);
+			}
+		};
+	}
+
+	/**
+	 * Starts the reader.
+	 */
+	public void start() {
+		if (link != null) {
+			link.start();
+		} else {
+			messenger.start(true);
+		}
+	}
+
+	/**
+	 * Stops the reader.
+	 */
+	public void stop() {
+		try {
+			if (link != null) {
+				link.stop();
+			} else {
+				messenger.stop(true);
+			}
+		} catch (InterruptedException ignore) {
+
+		}
+	}
+
+	/**
+	 * Switches communication with the reader to compact framing, in which
+	 * message bytes are not encoded as nibbles. The reader replies in the
+	 * framing of received commands, so the switch is negotiated by a probe
+	 * command sent in compact framing: readers that do not support compact
+	 * framing ignore it and the classic framing is restored. The method should
+	 * be invoked after start of the reader before other commands are sent.
+	 * 
+	 * @return true, if compact framing is used, false otherwise.
+	 */
+	public boolean enableCompactFraming() {
+		if (link == null) {
+			return false;
+		}
+
+		link.setCompactFraming(true);
+		if (!probe()) {
+			link.setCompactFraming(false);
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Switches speed of the serial link to the reader. The reader acknowledges
+	 * the command at the current speed and switches, the host port is
+	 * switched by the link speed control and the new speed is confirmed by a
+	 * probe command. If the probe fails, the reader falls back to the default
+	 * link speed and so does the host port.
+	 * 
+	 * @param baudRate
+	 *            the new baud rate.
+	 * @param persist
+	 *            true, if the reader should use the link speed after restart.
+	 * @param control
+	 *            the control of the host serial port.
+	 * @return true, if the link speed has been switched, false otherwise.
+	 * @throws IOException
+	 *             if the baud rate of the host port cannot be changed.
+	 */
+	public boolean setLinkSpeed(int baudRate, boolean persist, LinkSpeedControl control) throws IOException {
+		if (control == null) {
+			throw new NullPointerException("Link speed control cannot be null.");
+		}
+
+		byte[] commandData = new byte[] { (byte) (baudRate >> 24), (byte) (baudRate >> 16), (byte) (baudRate >> 8),
+				(byte) baudRate, (byte) (persist ? LINK_SPEED_PERSIST : 0) };
+		if (sendCommand(CommandCode.SET_LINK_SPEED, commandData, timeout) == null) {
+			return false;
+		}
+
+		control.setBaudRate(baudRate);
+		if (probe()) {
+			return true;
+		}
+
+		// wait until the reader falls back to the default link speed
+		try {
+			Thread.sleep(LINK_SPEED_TIMEOUT);
+		} catch (InterruptedException ignore) {
+			Thread.currentThread().interrupt();
+		}
+
+		control.setBaudRate(DEFAULT_LINK_SPEED);
+		return false;
+	}
+
+	/**
+	 * Sets time window in which the reader coalesces responses and
+	 * notifications into a single envelope message. Coalescing reduces
+	 * framing overhead of pipelined commands at the cost of latency.
+	 * 
+	 * @param windowMillis
+	 *            the time window in milliseconds (0-255), 0 disables
+	 *            coalescing.
+	 * @return true, if the time window has been set, false otherwise.
+	 */
+	public boolean setCoalescingWindow(int windowMillis) {
+		if ((windowMillis < 0) || (windowMillis > 255)) {
+			throw new IllegalArgumentException("Window must be between 0 and 255 milliseconds.");
+		}
+
+		return sendCommand(CommandCode.SET_COALESCING, new byte[] { (byte) windowMillis }, timeout) != null;
+	}
+
+	/**
+	 * Sends a command without side effects and returns whether the reader
+	 * responded.
+	 */
+	private boolean probe() {
+		byte[] probe = new byte[] { (byte) CommandCode.RESET, 0 };
+		return sendCommand(CommandCode.GET_STATS, probe, timeout) != null;
+	}
+
+	public void addCardListener(CardListener listener) {
+		if (listener == null) {
+			throw new NullPointerException("Listener cannot be null.");
+		}
 
 		synchronized (lock) {
 			cardListeners.add(listener);
@@ -254,12 +916,34 @@ public class CardReader {
 		}
 	}
 
+	public void addMacroListener(MacroListener listener) {
+		if (listener == null) {
+			throw new NullPointerException("Listener cannot be null.");
+		}
+
+		synchronized (lock) {
+			macroListeners.add(listener);
+		}
+	}
+
+	public void removeMacroListener(MacroListener listener) {
+		synchronized (lock) {
+			macroListeners.remove(listener);
+		}
+	}
+
 	public CardType getCardType() {
 		synchronized (lock) {
 			return cardType;
 		}
 	}
 
+	/**
+	 * Returns number of blocks of MIFARE Classic card or number of pages of
+	 * Ultralight and NTAG card.
+	 * 
+	 * @return the number of blocks or pages.
+	 */
 	public int getBlockCount() {
 		synchronized (lock) {
 			return blockCount;
@@ -276,6 +960,67 @@ public class CardReader {
 		}
 	}
 
+	/**
+	 * Returns the maximal number of commands sent to the reader without
+	 * waiting for their responses.
+	 * 
+	 * @return the number of commands.
+	 */
+	public int getCommandWindow() {
+		synchronized (commandLock) {
+			return commandWindow;
+		}
+	}
+
+	/**
+	 * Sets the maximal number of commands sent to the reader without waiting
+	 * for their responses. The window should not exceed the size of command
+	 * queue in the reader.
+	 * 
+	 * @param commandWindow
+	 *            the number of commands (at least 1).
+	 */
+	public void setCommandWindow(int commandWindow) {
+		if (commandWindow < 1) {
+			throw new IllegalArgumentException("Command window must be at least 1.");
+		}
+
+		synchronized (commandLock) {
+			this.commandWindow = commandWindow;
+			commandLock.notifyAll();
+		}
+	}
+
+	/**
+	 * Returns the number of repeated sends of a command whose response has
+	 * not been received in time.
+	 * 
+	 * @return the number of retries.
+	 */
+	public int getCommandRetries() {
+		synchronized (commandLock) {
+			return commandRetries;
+		}
+	}
+
+	/**
+	 * Sets the number of repeated sends of a command whose response has not
+	 * been received in time. A repeated command is sent with the same tag, so
+	 * the reader does not execute it twice and replays the response instead.
+	 * 
+	 * @param commandRetries
+	 *            the number of retries (0 to disable retries).
+	 */
+	public void setCommandRetries(int commandRetries) {
+		if (commandRetries < 0) {
+			throw new IllegalArgumentException("Number of retries cannot be negative.");
+		}
+
+		synchronized (commandLock) {
+			this.commandRetries = commandRetries;
+		}
+	}
+
 	public boolean setKeyA(byte[] key) {
 		return setKey(key, true);
 	}
@@ -316,82 +1061,856 @@ public class CardReader {
 			throw new NullPointerException("Data cannot be null.");
 		}
 
-		if ((block < 0) || (block > 255)) {
-			throw new IllegalArgumentException("Block must be between 0 and 255.");
+		if ((block < 0) || (block > 255)) {
+			throw new IllegalArgumentException("Block must be between 0 and 255.");
+		}
+
+		byte[] commandData = new byte[1 + data.length];
+		commandData[0] = (byte) block;
+		System.arraycopy(data, 0, commandData, 1, data.length);
+
+		return sendCommand(CommandCode.WRITE_BLOCK, commandData, timeout) != null;
+	}
+
+	/**
+	 * Reads consecutive blocks. The reader authenticates each sector only
+	 * once, up to a sector of blocks is read by a single command with
+	 * chunked response.
+	 * 
+	 * @param block
+	 *            the first block.
+	 * @param count
+	 *            the number of blocks.
+	 * @return the content of blocks (16 bytes per block) or null, if the
+	 *         execution of command failed.
+	 */
+	public byte[] readBlocks(int block, int count) {
+		if ((block < 0) || (count < 0) || (block + count > 65536)) {
+			throw new IllegalArgumentException("Blocks must be between 0 and 65535.");
+		}
+
+		if (count <= MAX_BLOCKS_PER_COMMAND) {
+			List<byte[]> commands = new ArrayList<>();
+			for (int offset = 0; offset < count; offset += MAX_BLOCKS_PER_COMMAND) {
+				int blocksToRead = Math.min(count - offset, MAX_BLOCKS_PER_COMMAND);
+				int firstBlock = block + offset;
+				commands.add(new byte[] { (byte) (firstBlock >> 8), (byte) firstBlock, (byte) blocksToRead });
+			}
+
+			byte[] result = new byte[16 * count];
+			List<byte[]> responses = sendCommands(CommandCode.READ_BLOCKS, commands, timeout);
+			for (int i = 0; i < responses.size(); i++) {
+				byte[] response = responses.get(i);
+				if ((response == null) || (response.length != 16 * (commands.get(i)[2] & 0xFF))) {
+					return null;
+				}
+
+				System.arraycopy(response, 0, result, 16 * i * MAX_BLOCKS_PER_COMMAND, response.length);
+			}
+
+			return result;
+		}
+
+		// larger reads are sent with chunked responses
+		byte[] result = new byte[16 * count];
+		for (int offset = 0; offset < count; offset += MAX_BLOCKS_PER_STREAM) {
+			int blocksToRead = Math.min(count - offset, MAX_BLOCKS_PER_STREAM);
+			int firstBlock = block + offset;
+			byte[] commandData = new byte[] { (byte) (firstBlock >> 8), (byte) firstBlock, (byte) blocksToRead };
+			byte[] response = sendCommand(CommandCode.READ_BLOCKS, commandData, timeout,
+					blocksToRead > MAX_BLOCKS_PER_COMMAND);
+			if ((response == null) || (response.length != 16 * blocksToRead)) {
+				return null;
+			}
+
+			System.arraycopy(response, 0, result, 16 * offset, response.length);
+		}
+
+		return result;
+	}
+
+	/**
+	 * Writes consecutive blocks. Sector trailers cannot be written using this
+	 * method. More than {@value #MAX_BLOCKS_PER_COMMAND} blocks are written by
+	 * fragmented commands, up to a sector of blocks each.
+	 * 
+	 * @param block
+	 *            the first block.
+	 * @param data
+	 *            the data (16 bytes per block).
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean writeBlocks(int block, byte[] data) {
+		if (data == null) {
+			throw new NullPointerException("Data cannot be null.");
+		}
+
+		if (data.length % 16 != 0) {
+			throw new IllegalArgumentException("Length of data must be a multiple of 16.");
+		}
+
+		int count = data.length / 16;
+		if ((block < 0) || (block + count > 65536)) {
+			throw new IllegalArgumentException("Blocks must be between 0 and 65535.");
+		}
+
+		int blocksPerCommand = (count <= MAX_BLOCKS_PER_COMMAND) ? MAX_BLOCKS_PER_COMMAND : MAX_BLOCKS_PER_STREAM;
+		List<byte[]> commands = new ArrayList<>();
+		for (int offset = 0; offset < count; offset += blocksPerCommand) {
+			int blocksToWrite = Math.min(count - offset, blocksPerCommand);
+			int firstBlock = block + offset;
+			byte[] commandData = new byte[2 + 16 * blocksToWrite];
+			commandData[0] = (byte) (firstBlock >> 8);
+			commandData[1] = (byte) firstBlock;
+			System.arraycopy(data, 16 * offset, commandData, 2, 16 * blocksToWrite);
+			commands.add(commandData);
+		}
+
+		if (blocksPerCommand == MAX_BLOCKS_PER_STREAM) {
+			for (byte[] commandData : commands) {
+				if (sendFragmentedCommand(CommandCode.WRITE_BLOCKS, commandData, timeout) == null) {
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		for (byte[] response : sendCommands(CommandCode.WRITE_BLOCKS, commands, timeout)) {
+			if (response == null) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Stores macro bytecode in the reader (in EEPROM, so the macro survives
+	 * restart of the reader).
+	 * 
+	 * @param bytecode
+	 *            the bytecode, see {@link CardScriptCompiler}.
+	 * @param autoRun
+	 *            true, if the macro should be executed automatically when a
+	 *            card is detected, false otherwise.
+	 * @return true, if the macro has been stored, false otherwise.
+	 */
+	public boolean uploadMacro(byte[] bytecode, boolean autoRun) {
+		if ((bytecode == null) || (bytecode.length == 0) || (bytecode.length > CardScriptCompiler.MAX_BYTECODE_LENGTH)) {
+			throw new IllegalArgumentException("Invalid bytecode.");
+		}
+
+		// disable the stored macro while it is rewritten
+		if (sendCommand(CommandCode.MACRO_SETUP, new byte[] { 0, 0 }, timeout) == null) {
+			return false;
+		}
+
+		List<byte[]> commands = new ArrayList<>();
+		for (int offset = 0; offset < bytecode.length; offset += MAX_MACRO_CHUNK_SIZE) {
+			int chunkSize = Math.min(bytecode.length - offset, MAX_MACRO_CHUNK_SIZE);
+			byte[] commandData = new byte[1 + chunkSize];
+			commandData[0] = (byte) offset;
+			System.arraycopy(bytecode, offset, commandData, 1, chunkSize);
+			commands.add(commandData);
+		}
+
+		for (byte[] response : sendCommands(CommandCode.MACRO_WRITE, commands, timeout)) {
+			if (response == null) {
+				return false;
+			}
+		}
+
+		byte[] commandData = new byte[] { (byte) bytecode.length, (byte) (autoRun ? MACRO_AUTORUN : 0) };
+		return sendCommand(CommandCode.MACRO_SETUP, commandData, timeout) != null;
+	}
+
+	/**
+	 * Removes the macro stored in the reader.
+	 * 
+	 * @return true, if the macro has been removed, false otherwise.
+	 */
+	public boolean removeMacro() {
+		return sendCommand(CommandCode.MACRO_SETUP, new byte[] { 0, 0 }, timeout) != null;
+	}
+
+	/**
+	 * Executes the macro stored in the reader.
+	 * 
+	 * @return the bytes emitted by the macro or null, if the macro failed.
+	 */
+	public byte[] runMacro() {
+		return sendCommand(CommandCode.MACRO_RUN, EMPTY_COMMAND_DATA, timeout);
+	}
+
+	/**
+	 * Reads execution statistics of all commands measured by the reader. The
+	 * execution time covers the communication with the card and sending the
+	 * response, so comparing it with the round trip time observed by the host
+	 * separates delays of the card from delays of the serial link.
+	 * 
+	 * @param reset
+	 *            true, if the statistics in the reader should be reset after
+	 *            reading.
+	 * @return the statistics indexed by command codes or null, if the
+	 *         execution of command failed.
+	 */
+	public Map<Integer, CommandStatistics> readCommandStatistics(boolean reset) {
+		List<byte[]> commands = new ArrayList<>();
+		for (int code = 1; code <= COMMAND_COUNT; code++) {
+			commands.add(new byte[] { (byte) code, (byte) (reset ? STATS_RESET : 0) });
+		}
+
+		Map<Integer, CommandStatistics> result = new HashMap<>();
+		int code = 1;
+		for (byte[] response : sendCommands(CommandCode.GET_STATS, commands, timeout)) {
+			if ((response == null) || (response.length != 16)) {
+				return null;
+			}
+
+			CommandStatistics statistics = new CommandStatistics();
+			statistics.count = decodeUnsignedInt(response, 0);
+			statistics.failures = decodeUnsignedInt(response, 4);
+			statistics.totalTime = decodeUnsignedInt(response, 8);
+			statistics.maxTime = decodeUnsignedInt(response, 12);
+			result.put(code, statistics);
+			code++;
+		}
+
+		return result;
+	}
+
+	/**
+	 * Decodes 32-bit unsigned integer stored in big endian order.
+	 */
+	private static long decodeUnsignedInt(byte[] data, int offset) {
+		return ((data[offset] & 0xFFL) << 24) | ((data[offset + 1] & 0xFFL) << 16) | ((data[offset + 2] & 0xFFL) << 8)
+				| (data[offset + 3] & 0xFFL);
+	}
+
+	/**
+	 * Reads CRC-32 digests of sectors computed by the reader. The digest of a
+	 * sector covers all its blocks (including the sector trailer) as they are
+	 * read with the active key.
+	 * 
+	 * @param firstSector
+	 *            the first sector.
+	 * @param count
+	 *            the number of sectors.
+	 * @return the digests or null, if the execution of command failed.
+	 * @see #computeSectorDigest(byte[])
+	 */
+	public long[] readSectorDigests(int firstSector, int count) {
+		return readSectorDigests(firstSector, count, 0);
+	}
+
+	/**
+	 * Reads CRC-32 digests of sectors computed by the reader.
+	 * 
+	 * @param firstSector
+	 *            the first sector.
+	 * @param count
+	 *            the number of sectors.
+	 * @param flags
+	 *            the flags of DIGEST command.
+	 * @return the digests or null, if the execution of command failed.
+	 */
+	private long[] readSectorDigests(int firstSector, int count, int flags) {
+		if ((firstSector < 0) || (count < 0) || (firstSector + count > 256)) {
+			throw new IllegalArgumentException("Sectors must be between 0 and 255.");
+		}
+
+		List<byte[]> commands = new ArrayList<>();
+		for (int offset = 0; offset < count; offset += MAX_DIGESTS_PER_COMMAND) {
+			int sectorsToDigest = Math.min(count - offset, MAX_DIGESTS_PER_COMMAND);
+			commands.add(new byte[] { (byte) (firstSector + offset), (byte) sectorsToDigest, (byte) flags });
+		}
+
+		long[] result = new long[count];
+		List<byte[]> responses = sendCommands(CommandCode.DIGEST, commands, timeout);
+		for (int c = 0; c < responses.size(); c++) {
+			byte[] response = responses.get(c);
+			int sectorsToDigest = commands.get(c)[1] & 0xFF;
+			if ((response == null) || (response.length != 4 * sectorsToDigest)) {
+				return null;
+			}
+
+			for (int i = 0; i < sectorsToDigest; i++) {
+				long digest = 0;
+				for (int j = 0; j < 4; j++) {
+					digest = (digest << 8) | (response[4 * i + j] & 0xFF);
+				}
+				result[c * MAX_DIGESTS_PER_COMMAND + i] = digest;
+			}
+		}
+
+		return result;
+	}
+
+	/**
+	 * Synchronizes data blocks of consecutive sectors with the target image.
+	 * Digests of sectors are compared first and only blocks of differing
+	 * sectors are transferred. The reader writes only blocks whose content
+	 * differs from the target content. Sector trailers are not changed.
+	 * 
+	 * @param firstSector
+	 *            the first sector.
+	 * @param image
+	 *            the target content of data blocks (all blocks except sector
+	 *            trailers) of consecutive sectors.
+	 * @return the number of written blocks or -1, if the synchronization
+	 *         failed.
+	 */
+	public int synchronizeSectors(int firstSector, byte[] image) {
+		if (image == null) {
+			throw new NullPointerException("Image cannot be null.");
+		}
+
+		// determine the number of sectors covered by the image
+		int sectorCount = 0;
+		int imageLength = 0;
+		while (imageLength < image.length) {
+			imageLength += 16 * (getBlockCountOfSector(firstSector + sectorCount) - 1);
+			sectorCount++;
+		}
+
+		if (imageLength != image.length) {
+			throw new IllegalArgumentException("Image must cover data blocks of whole sectors.");
+		}
+
+		long[] digests = readSectorDigests(firstSector, sectorCount, DIGEST_SKIP_TRAILERS);
+		if (digests == null) {
+			return -1;
+		}
+
+		int changedBlocks = 0;
+		int offset = 0;
+		for (int i = 0; i < sectorCount; i++) {
+			int sector = firstSector + i;
+			int dataBlockCount = getBlockCountOfSector(sector) - 1;
+			byte[] sectorImage = Arrays.copyOfRange(image, offset, offset + 16 * dataBlockCount);
+			offset += sectorImage.length;
+			if (computeSectorDigest(sectorImage) == digests[i]) {
+				continue;
+			}
+
+			// data blocks of the sector are synchronized by a single (fragmented) command
+			int firstBlock = getFirstBlockOfSector(sector);
+			byte[] commandData = new byte[2 + sectorImage.length];
+			commandData[0] = (byte) (firstBlock >> 8);
+			commandData[1] = (byte) firstBlock;
+			System.arraycopy(sectorImage, 0, commandData, 2, sectorImage.length);
+			byte[] response;
+			if (dataBlockCount <= MAX_BLOCKS_PER_COMMAND) {
+				response = sendCommand(CommandCode.SYNC_BLOCKS, commandData, timeout);
+			} else {
+				response = sendFragmentedCommand(CommandCode.SYNC_BLOCKS, commandData, timeout);
+			}
+
+			// 2B mask of changed blocks
+			if ((response == null) || (response.length != 2)) {
+				return -1;
+			}
+
+			changedBlocks += Integer.bitCount(((response[0] & 0xFF) << 8) | (response[1] & 0xFF));
+		}
+
+		return changedBlocks;
+	}
+
+	/**
+	 * Returns the number of blocks of a MIFARE Classic sector.
+	 */
+	private static int getBlockCountOfSector(int sector) {
+		return (sector < 32) ? 4 : 16;
+	}
+
+	/**
+	 * Returns the first block of a MIFARE Classic sector.
+	 */
+	private static int getFirstBlockOfSector(int sector) {
+		return (sector < 32) ? 4 * sector : 128 + 16 * (sector - 32);
+	}
+
+	/**
+	 * Computes digest of sector content in the same way as the reader.
+	 * 
+	 * @param sectorData
+	 *            the content of all blocks of the sector.
+	 * @return the digest.
+	 */
+	public static long computeSectorDigest(byte[] sectorData) {
+		CRC32 crc = new CRC32();
+		crc.update(sectorData);
+		return crc.getValue();
+	}
+
+	public SectorTrailer readSectorTrailer(int sector) {
+		if ((sector < 0) || (sector > 255)) {
+			throw new IllegalArgumentException("Sector must be between 0 and 255.");
+		}
+
+		byte[] commandData = new byte[1];
+		commandData[0] = (byte) sector;
+
+		byte[] response = sendCommand(CommandCode.READ_SECTOR_TRAILER, commandData, timeout);
+		if ((response == null) || (response.length != 17)) {
+			return null;
+		}
+
+		SectorTrailer result = new SectorTrailer();
+		for (int i = 0; i < 4; i++) {
+			result.accessFlags[i] = response[i];
+		}
+
+		System.arraycopy(response, 4, result.keyA, 0, 6);
+		System.arraycopy(response, 10, result.keyB, 0, 6);
+		result.generalPurposeByte = response[16];
+
+		return result;
+	}
+
+	public boolean writeSectorTrailer(int sector, SectorTrailer sectorTrailer) {
+		if (sectorTrailer == null) {
+			throw new NullPointerException("Sector trailer cannot be null.");
+		}
+
+		if ((sector < 0) || (sector > 255)) {
+			throw new IllegalArgumentException("Sector must be between 0 and 255.");
+		}
+
+		byte[] commandData = new byte[1 + 17];
+		commandData[0] = (byte) sector;
+		System.arraycopy(sectorTrailer.accessFlags, 0, commandData, 1, 4);
+		System.arraycopy(sectorTrailer.keyA, 0, commandData, 5, 6);
+		System.arraycopy(sectorTrailer.keyB, 0, commandData, 11, 6);
+		commandData[17] = sectorTrailer.generalPurposeByte;
+
+		return sendCommand(CommandCode.WRITE_SECTOR_TRAILER, commandData, timeout) != null;
+	}
+
+	/**
+	 * Reads value of a value block.
+	 * 
+	 * @param block
+	 *            the value block.
+	 * @return the value or null, if the execution of command failed.
+	 */
+	public Integer getValue(int block) {
+		checkBlock(block);
+
+		byte[] response = sendCommand(CommandCode.VALUE_GET, new byte[] { (byte) block }, timeout);
+		return decodeValue(response);
+	}
+
+	/**
+	 * Formats a block as a value block storing given value.
+	 * 
+	 * @param block
+	 *            the block.
+	 * @param value
+	 *            the value.
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean setValue(int block, int value) {
+		checkBlock(block);
+
+		byte[] commandData = new byte[1 + 4];
+		commandData[0] = (byte) block;
+		encodeValue(value, commandData, 1);
+
+		return sendCommand(CommandCode.VALUE_SET, commandData, timeout) != null;
+	}
+
+	/**
+	 * Increments a value block and stores the result in the same block.
+	 * 
+	 * @param block
+	 *            the value block.
+	 * @param delta
+	 *            the non-negative increment.
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean addValue(int block, int delta) {
+		return changeValue(CommandCode.VALUE_ADD, block, delta, block);
+	}
+
+	/**
+	 * Increments a value block and stores the result in a target block of the
+	 * same sector.
+	 * 
+	 * @param block
+	 *            the value block.
+	 * @param delta
+	 *            the non-negative increment.
+	 * @param targetBlock
+	 *            the block where the result is stored.
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean addValue(int block, int delta, int targetBlock) {
+		return changeValue(CommandCode.VALUE_ADD, block, delta, targetBlock);
+	}
+
+	/**
+	 * Decrements a value block and stores the result in the same block.
+	 * 
+	 * @param block
+	 *            the value block.
+	 * @param delta
+	 *            the non-negative decrement.
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean subtractValue(int block, int delta) {
+		return changeValue(CommandCode.VALUE_SUB, block, delta, block);
+	}
+
+	/**
+	 * Decrements a value block and stores the result in a target block of the
+	 * same sector.
+	 * 
+	 * @param block
+	 *            the value block.
+	 * @param delta
+	 *            the non-negative decrement.
+	 * @param targetBlock
+	 *            the block where the result is stored.
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean subtractValue(int block, int delta, int targetBlock) {
+		return changeValue(CommandCode.VALUE_SUB, block, delta, targetBlock);
+	}
+
+	/**
+	 * Copies a value block to another block of the same sector.
+	 * 
+	 * @param block
+	 *            the source value block.
+	 * @param targetBlock
+	 *            the target block.
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean copyValue(int block, int targetBlock) {
+		checkBlock(block);
+		checkBlock(targetBlock);
+
+		byte[] commandData = new byte[] { (byte) block, (byte) targetBlock };
+		return sendCommand(CommandCode.VALUE_COPY, commandData, timeout) != null;
+	}
+
+	/**
+	 * Debits a value block, if its value is at least the debited amount.
+	 * 
+	 * @param block
+	 *            the value block.
+	 * @param amount
+	 *            the non-negative amount to debit.
+	 * @return the new balance or null, if the execution of command failed.
+	 */
+	public Integer debitValue(int block, int amount) {
+		checkBlock(block);
+		if (amount < 0) {
+			throw new IllegalArgumentException("Amount cannot be negative.");
+		}
+
+		byte[] commandData = new byte[1 + 4];
+		commandData[0] = (byte) block;
+		encodeValue(amount, commandData, 1);
+
+		return decodeValue(sendCommand(CommandCode.VALUE_DEBIT, commandData, timeout));
+	}
+
+	/**
+	 * Sends command that increments or decrements a value block.
+	 */
+	private boolean changeValue(int commandCode, int block, int delta, int targetBlock) {
+		checkBlock(block);
+		checkBlock(targetBlock);
+		if (delta < 0) {
+			throw new IllegalArgumentException("Delta cannot be negative.");
+		}
+
+		byte[] commandData = new byte[1 + 4 + 1];
+		commandData[0] = (byte) block;
+		encodeValue(delta, commandData, 1);
+		commandData[5] = (byte) targetBlock;
+
+		return sendCommand(commandCode, commandData, timeout) != null;
+	}
+
+	/**
+	 * Checks whether the block number can be sent to the reader.
+	 */
+	private static void checkBlock(int block) {
+		if ((block < 0) || (block > 255)) {
+			throw new IllegalArgumentException("Block must be between 0 and 255.");
+		}
+	}
+
+	/**
+	 * Encodes a 32-bit value in little endian order used by value blocks.
+	 */
+	private static void encodeValue(int value, byte[] data, int offset) {
+		for (int i = 0; i < 4; i++) {
+			data[offset + i] = (byte) (value >> (8 * i));
+		}
+	}
+
+	/**
+	 * Decodes a 32-bit value from response of reader.
+	 * 
+	 * @return the value or null, if the response is not valid.
+	 */
+	private static Integer decodeValue(byte[] response) {
+		if ((response == null) || (response.length != 4)) {
+			return null;
+		}
+
+		int value = 0;
+		for (int i = 3; i >= 0; i--) {
+			value = (value << 8) | (response[i] & 0xFF);
+		}
+
+		return value;
+	}
+
+	/**
+	 * Reads pages of Ultralight or NTAG card.
+	 * 
+	 * @param startPage
+	 *            the first page to read.
+	 * @param count
+	 *            the number of pages to read.
+	 * @return the content of pages (4 bytes per page) or null, if the
+	 *         execution of command failed.
+	 */
+	public byte[] readPages(int startPage, int count) {
+		if ((startPage < 0) || (count < 0) || (startPage + count > 256)) {
+			throw new IllegalArgumentException("Pages must be between 0 and 255.");
+		}
+
+		List<byte[]> commands = new ArrayList<>();
+		for (int offset = 0; offset < count; offset += MAX_PAGES_PER_COMMAND) {
+			int pagesToRead = Math.min(count - offset, MAX_PAGES_PER_COMMAND);
+			commands.add(new byte[] { (byte) (startPage + offset), (byte) pagesToRead });
+		}
+
+		byte[] result = new byte[4 * count];
+		List<byte[]> responses = sendCommands(CommandCode.READ_PAGES, commands, timeout);
+		for (int i = 0; i < responses.size(); i++) {
+			byte[] response = responses.get(i);
+			if ((response == null) || (response.length != 4 * (commands.get(i)[1] & 0xFF))) {
+				return null;
+			}
+
+			System.arraycopy(response, 0, result, 4 * i * MAX_PAGES_PER_COMMAND, response.length);
+		}
+
+		return result;
+	}
+
+	/**
+	 * Writes a page of Ultralight or NTAG card.
+	 * 
+	 * @param page
+	 *            the page.
+	 * @param data
+	 *            the data (4 bytes).
+	 * @return true, if the command was executed successfully, false otherwise.
+	 */
+	public boolean writePage(int page, byte[] data) {
+		if ((data == null) || (data.length != 4)) {
+			throw new IllegalArgumentException("Data must have the length 4.");
+		}
+
+		if ((page < 0) || (page > 255)) {
+			throw new IllegalArgumentException("Page must be between 0 and 255.");
+		}
+
+		byte[] commandData = new byte[1 + 4];
+		commandData[0] = (byte) page;
+		System.arraycopy(data, 0, commandData, 1, 4);
+
+		return sendCommand(CommandCode.WRITE_PAGE, commandData, timeout) != null;
+	}
+
+	/**
+	 * Authenticates to password protected Ultralight EV1 or NTAG card.
+	 * 
+	 * @param password
+	 *            the password (4 bytes).
+	 * @return the password acknowledge (PACK) returned by card or null, if
+	 *         the authentication failed.
+	 */
+	public byte[] authenticatePages(byte[] password) {
+		if ((password == null) || (password.length != 4)) {
+			throw new IllegalArgumentException("Password must have the length 4.");
 		}
 
-		byte[] commandData = new byte[1 + data.length];
-		commandData[0] = (byte) block;
-		System.arraycopy(data, 0, commandData, 1, data.length);
+		byte[] response = sendCommand(CommandCode.PAGE_AUTH, password, timeout);
+		if ((response == null) || (response.length != 2)) {
+			return null;
+		}
 
-		return sendCommand(CommandCode.WRITE_BLOCK, commandData, timeout) != null;
+		return response;
 	}
 
-	public SectorTrailer readSectorTrailer(int sector) {
-		if ((sector < 0) || (sector > 255)) {
-			throw new IllegalArgumentException("Sector must be between 0 and 255.");
-		}
+	/**
+	 * Reads NDEF message stored on NFC Forum Type 2 tag (Ultralight or NTAG).
+	 * 
+	 * @return the NDEF message or null, if the execution of command failed.
+	 */
+	public byte[] readNdefMessage() {
+		return sendCommand(CommandCode.READ_NDEF, EMPTY_COMMAND_DATA, timeout, true);
+	}
 
-		byte[] commandData = new byte[1];
-		commandData[0] = (byte) sector;
+	/**
+	 * Sends a command to execute by card reader.
+	 * 
+	 * @param commandCode
+	 *            the code of command.
+	 * @param commandData
+	 *            the data.
+	 * @param timeout
+	 *            the timeout to complete command in milliseconds.
+	 * @return response of command or null, if the execution of command failed.
+	 */
+	private byte[] sendCommand(int commandCode, byte[] commandData, long timeout) {
+		return sendCommand(commandCode, commandData, timeout, false);
+	}
 
-		byte[] response = sendCommand(CommandCode.READ_SECTOR_TRAILER, commandData, timeout);
-		if ((response == null) || (response.length != 17)) {
+	/**
+	 * Sends a command to execute by card reader.
+	 * 
+	 * @param commandCode
+	 *            the code of command.
+	 * @param commandData
+	 *            the data.
+	 * @param timeout
+	 *            the timeout to complete command (or to receive the next chunk
+	 *            of response) in milliseconds.
+	 * @param chunked
+	 *            true, if the response is sent in chunks with header
+	 *            [TOTAL LENGTH 2B][OFFSET 2B], false otherwise.
+	 * @return response of command or null, if the execution of command failed.
+	 */
+	private byte[] sendCommand(int commandCode, byte[] commandData, long timeout, boolean chunked) {
+		long startNanoTime = System.nanoTime();
+		PendingCommand command = submitCommand(commandCode, commandData, chunked, startNanoTime, timeout);
+		if (command == null) {
 			return null;
 		}
 
-		SectorTrailer result = new SectorTrailer();
-		for (int i = 0; i < 4; i++) {
-			result.accessFlags[i] = response[i];
+		return awaitResponse(command, timeout);
+	}
+
+	/**
+	 * Sends commands with the same command code to the reader. Commands are
+	 * sent without waiting for responses of previous commands (within the
+	 * command window), so that the transfer of a command overlaps the
+	 * execution of the previous one.
+	 * 
+	 * @param commandCode
+	 *            the code of commands.
+	 * @param commandDataList
+	 *            the data of commands.
+	 * @param timeout
+	 *            the timeout to complete each command in milliseconds.
+	 * @return responses of commands (null for commands whose execution
+	 *         failed).
+	 */
+	private List<byte[]> sendCommands(int commandCode, List<byte[]> commandDataList, long timeout) {
+		List<PendingCommand> commands = new ArrayList<>(commandDataList.size());
+		List<byte[]> result = new ArrayList<>(commandDataList.size());
+		int nextResult = 0;
+		for (byte[] commandData : commandDataList) {
+			long startNanoTime = System.nanoTime();
+			PendingCommand command = submitCommand(commandCode, commandData, false, startNanoTime, timeout);
+			// if the window is still full, wait for the oldest command
+			while ((command == null) && (nextResult < commands.size())) {
+				PendingCommand oldestCommand = commands.get(nextResult);
+				result.add((oldestCommand != null) ? awaitResponse(oldestCommand, timeout) : null);
+				nextResult++;
+				command = submitCommand(commandCode, commandData, false, System.nanoTime(), timeout);
+			}
+
+			commands.add(command);
 		}
 
-		System.arraycopy(response, 4, result.keyA, 0, 6);
-		System.arraycopy(response, 10, result.keyB, 0, 6);
-		result.generalPurposeByte = response[16];
+		for (int i = nextResult; i < commands.size(); i++) {
+			PendingCommand command = commands.get(i);
+			result.add((command != null) ? awaitResponse(command, timeout) : null);
+		}
 
 		return result;
 	}
 
-	public boolean writeSectorTrailer(int sector, SectorTrailer sectorTrailer) {
-		if (sectorTrailer == null) {
-			throw new NullPointerException("Sector trailer cannot be null.");
-		}
+	/**
+	 * Sends a command whose payload is split into fragments sent as FRAGMENT
+	 * commands. The fragments are pipelined, the reader delivers them in order
+	 * to the command.
+	 * 
+	 * @param commandCode
+	 *            the code of command.
+	 * @param commandData
+	 *            the payload of command.
+	 * @param timeout
+	 *            the timeout in milliseconds.
+	 * @return response to the last fragment or null, if the execution of
+	 *         command failed.
+	 */
+	private byte[] sendFragmentedCommand(int commandCode, byte[] commandData, long timeout) {
+		List<byte[]> fragments = new ArrayList<>();
+		int offset = 0;
+		do {
+			int fragmentLength = Math.min(commandData.length - offset, MAX_FRAGMENT_DATA_SIZE);
+			byte[] fragment = new byte[5 + fragmentLength];
+			fragment[0] = (byte) commandCode;
+			fragment[1] = (byte) (commandData.length >> 8);
+			fragment[2] = (byte) commandData.length;
+			fragment[3] = (byte) (offset >> 8);
+			fragment[4] = (byte) offset;
+			System.arraycopy(commandData, offset, fragment, 5, fragmentLength);
+			fragments.add(fragment);
+			offset += fragmentLength;
+		} while (offset < commandData.length);
+
+		byte[] response = null;
+		for (byte[] fragmentResponse : sendCommands(CommandCode.FRAGMENT, fragments, timeout)) {
+			if (fragmentResponse == null) {
+				return null;
+			}
 
-		if ((sector < 0) || (sector > 255)) {
-			throw new IllegalArgumentException("Sector must be between 0 and 255.");
+			response = fragmentResponse;
 		}
 
-		byte[] commandData = new byte[1 + 17];
-		commandData[0] = (byte) sector;
-		System.arraycopy(sectorTrailer.accessFlags, 0, commandData, 1, 4);
-		System.arraycopy(sectorTrailer.keyA, 0, commandData, 5, 6);
-		System.arraycopy(sectorTrailer.keyB, 0, commandData, 11, 6);
-		commandData[17] = sectorTrailer.generalPurposeByte;
-
-		return sendCommand(CommandCode.WRITE_SECTOR_TRAILER, commandData, timeout) != null;
+		return response;
 	}
 
 	/**
-	 * Sends a command to execute by card reader.
+	 * Sends a command to the reader, if the command window allows it.
 	 * 
 	 * @param commandCode
 	 *            the code of command.
 	 * @param commandData
 	 *            the data.
+	 * @param chunked
+	 *            true, if the response is sent in chunks, false otherwise.
+	 * @param startNanoTime
+	 *            the time when waiting for the command window started.
 	 * @param timeout
-	 *            the timeout to complete command in milliseconds.
-	 * @return response of command or null, if the execution of command failed.
+	 *            the timeout to wait for the command window in milliseconds.
+	 * @return the sent command or null, if the command could not be sent.
 	 */
-	private byte[] sendCommand(int commandCode, byte[] commandData, long timeout) {
+	private PendingCommand submitCommand(int commandCode, byte[] commandData, boolean chunked, long startNanoTime,
+			long timeout) {
 		// construct message
 		byte[] message = new byte[commandData.length + 1];
 		message[0] = (byte) commandCode;
 		System.arraycopy(commandData, 0, message, 1, commandData.length);
 
-		long startNanoTime = System.nanoTime();
 		synchronized (commandLock) {
-			// wait for "free" reader (no executing command)
-			while (commandTag != -1) {
+			// wait for free slot in the command window and for credits
+			while ((pendingCommands.size() >= commandWindow) || !hasCredits(getFrameLength(message.length))) {
 				try {
 					long remainingMillis = computeRemainingTimeInMillis(startNanoTime, timeout);
 					if (remainingMillis <= 0) {
@@ -404,31 +1923,52 @@ public class CardReader {
 				}
 			}
 
-			// increment command tag
-			tagCounter++;
-			if (tagCounter > 10000) {
-				tagCounter = 1;
-			}
+			// increment command tag (skip tags of pending commands)
+			do {
+				tagCounter++;
+				if (tagCounter > MAX_COMMAND_TAG) {
+					tagCounter = 1;
+				}
+			} while (pendingCommands.containsKey(tagCounter));
 
 			// send command to reader
+			sendSequence++;
+			PendingCommand command = new PendingCommand(tagCounter, message, chunked, commandRetries, sendSequence);
+			pendingCommands.put(command.tag, command);
 			try {
-				commandResponseData = null;
-				commandResponseReceived = false;
-				commandTag = tagCounter;
-				messenger.sendMessage(0, message, tagCounter);
+				sendMessage(message, command.tag);
 			} catch (Exception e) {
 				// clear execution
-				commandTag = -1;
+				pendingCommands.remove(command.tag);
 				commandLock.notifyAll();
 				return null;
 			}
 
-			// wait for response
-			while (!commandResponseReceived) {
+			return command;
+		}
+	}
+
+	/**
+	 * Waits for response of a sent command.
+	 * 
+	 * @param command
+	 *            the sent command.
+	 * @param timeout
+	 *            the timeout to receive the response (or the next chunk of
+	 *            response) in milliseconds.
+	 * @return response of command or null, if the execution of command failed.
+	 */
+	private byte[] awaitResponse(PendingCommand command, long timeout) {
+		synchronized (commandLock) {
+			while (!command.responseReceived) {
 				try {
-					long remainingMillis = computeRemainingTimeInMillis(startNanoTime, timeout);
+					long remainingMillis = computeRemainingTimeInMillis(command.progressNanoTime, timeout);
 					if (remainingMillis <= 0) {
-						break;
+						if ((command.retriesLeft <= 0) || !resendCommand(command)) {
+							break;
+						}
+
+						continue;
 					}
 
 					commandLock.wait(remainingMillis);
@@ -437,12 +1977,54 @@ public class CardReader {
 				}
 			}
 
-			byte[] result = commandResponseData;
-			commandResponseData = null;
-			commandResponseReceived = false;
-			commandTag = -1;
+			if (pendingCommands.get(command.tag) == command) {
+				pendingCommands.remove(command.tag);
+				commandLock.notifyAll();
+			}
 
-			return result;
+			return command.responseReceived ? command.responseData : null;
+		}
+	}
+
+	/**
+	 * Sends a pending command again with the same tag. Must be invoked with
+	 * commandLock held.
+	 * 
+	 * @param command
+	 *            the command.
+	 * @return true, if the command has been sent, false otherwise.
+	 */
+	private boolean resendCommand(PendingCommand command) {
+		if (pendingCommands.get(command.tag) != command) {
+			return false;
+		}
+
+		command.retriesLeft--;
+		command.responseData = null;
+		command.chunkedResponseLength = 0;
+		command.progressNanoTime = System.nanoTime();
+		try {
+			sendMessage(command.message, command.tag);
+		} catch (Exception e) {
+			return false;
+		}
+
+		return true;
+	}
+
+	/**
+	 * Sends a message to the reader.
+	 * 
+	 * @param message
+	 *            the message.
+	 * @param tag
+	 *            the tag of message.
+	 */
+	private void sendMessage(byte[] message, int tag) throws Exception {
+		if (link != null) {
+			link.sendMessage(0, message, tag);
+		} else {
+			messenger.sendMessage(0, message, tag);
 		}
 	}
 
@@ -461,22 +2043,315 @@ public class CardReader {
 
 		int messageCode = message[0] & 0xFF;
 
+		// credits appended to the response are removed before the response is processed
+		if ((messageCode == MessageCode.COMMAND_OK_CREDITS) || (messageCode == MessageCode.COMMAND_FAILED_CREDITS)) {
+			if (message.length < 1 + CREDITS_LENGTH) {
+				return;
+			}
+
+			handleAppendedCredits(tag, message[message.length - 2] & 0xFF, message[message.length - 1] & 0xFF);
+			messageCode = (messageCode == MessageCode.COMMAND_OK_CREDITS) ? MessageCode.COMMAND_OK : MessageCode.COMMAND_FAILED;
+			message = Arrays.copyOf(message, message.length - CREDITS_LENGTH);
+			message[0] = (byte) messageCode;
+		}
+
 		if (messageCode == MessageCode.CARD_DETECTED) {
 			handleCardDetected(message);
 		} else if (messageCode == MessageCode.CARD_REMOVED) {
 			handleCardRemoved();
+		} else if (messageCode == MessageCode.MACRO_EXECUTED) {
+			handleMacroExecuted(message);
+		} else if (messageCode == MessageCode.ENVELOPE) {
+			handleEnvelope(message);
 		} else if ((messageCode == MessageCode.COMMAND_OK) || (messageCode == MessageCode.COMMAND_FAILED)) {
 			synchronized (commandLock) {
-				if (tag == commandTag) {
-					commandResponseReceived = true;
+				PendingCommand command = pendingCommands.get(tag);
+				if (command == null) {
+					return;
+				}
+
+				if (command.chunked && (messageCode == MessageCode.COMMAND_OK)) {
+					handleResponseChunk(command, message);
+				} else {
+					command.responseReceived = true;
 					if (messageCode == MessageCode.COMMAND_OK) {
-						commandResponseData = new byte[message.length - 1];
-						System.arraycopy(message, 1, commandResponseData, 0, commandResponseData.length);
+						command.responseData = new byte[message.length - 1];
+						System.arraycopy(message, 1, command.responseData, 0, command.responseData.length);
+					} else {
+						command.responseData = null;
 					}
+				}
 
-					commandLock.notifyAll();
+				if (command.responseReceived) {
+					pendingCommands.remove(tag);
+					lastResponseTag = tag;
+					lastResponseSequence = command.sequence;
 				}
+
+				commandLock.notifyAll();
+			}
+		} else if (messageCode == MessageCode.CREDITS) {
+			handleCredits(message);
+		}
+	}
+
+	/**
+	 * Returns maximal length of frame with a message: start byte, destination
+	 * id, message and tag as nibbles (or escaped bytes), end byte and CRC.
+	 */
+	private static int getFrameLength(int messageLength) {
+		return 1 + 2 + 2 * (messageLength + 2) + 2;
+	}
+
+	/**
+	 * Returns whether credits of the reader allow to send a command. Commands
+	 * sent after the command identified by creditSequence consume credits
+	 * (commands received by the reader before the credits were sent are
+	 * counted twice, which is safe). A command is always allowed when no such
+	 * command waits for response. Must be invoked with commandLock held.
+	 * 
+	 * @param frameLength
+	 *            the length of frame with the command.
+	 * @return true, if the command can be sent, false otherwise.
+	 */
+	private boolean hasCredits(int frameLength) {
+		if (creditSequence < 0) {
+			return true;
+		}
+
+		int commands = 0;
+		int bytes = 0;
+		for (PendingCommand command : pendingCommands.values()) {
+			if (command.sequence > creditSequence) {
+				commands++;
+				bytes += command.frameLength;
+			}
+		}
+
+		return (commands == 0) || ((commands < creditCommands) && (bytes + frameLength <= creditBytes));
+	}
+
+	/**
+	 * Handles credits sent in a separate message after execution of a
+	 * command.
+	 * 
+	 * @param message
+	 *            the message with credits.
+	 */
+	private void handleCredits(byte[] message) {
+		if (message.length < 3 + CREDITS_LENGTH) {
+			return;
+		}
+
+		int tag = ((message[1] & 0xFF) << 8) | (message[2] & 0xFF);
+		synchronized (commandLock) {
+			// credits are sent after the response to the command
+			if ((tag != lastResponseTag) || (lastResponseSequence < 0)) {
+				return;
+			}
+
+			updateCredits(lastResponseSequence, message[3] & 0xFF, message[4] & 0xFF);
+		}
+	}
+
+	/**
+	 * Handles credits appended to a response.
+	 * 
+	 * @param tag
+	 *            the tag of the response.
+	 * @param commands
+	 *            the number of free command slots.
+	 * @param bytes
+	 *            the number of free bytes of the receive buffer.
+	 */
+	private void handleAppendedCredits(int tag, int commands, int bytes) {
+		synchronized (commandLock) {
+			PendingCommand command = pendingCommands.get(tag);
+			if (command != null) {
+				updateCredits(command.sequence, commands, bytes);
+			}
+		}
+	}
+
+	/**
+	 * Updates credits sent by the reader after the command with given
+	 * sequence number (credits of an older command are ignored). Must be
+	 * invoked with commandLock held.
+	 * 
+	 * @param sequence
+	 *            the sequence number of the command.
+	 * @param commands
+	 *            the number of free command slots.
+	 * @param bytes
+	 *            the number of free bytes of the receive buffer.
+	 */
+	private void updateCredits(long sequence, int commands, int bytes) {
+		if (!flowControl || (sequence < creditSequence)) {
+			return;
+		}
+
+		creditSequence = sequence;
+		creditCommands = commands;
+		creditBytes = bytes;
+		commandLock.notifyAll();
+	}
+
+	/**
+	 * Enables or disables credit based flow control. The reader appends credits
+	 * (free command slots and free bytes of its receive buffer) to responses,
+	 * commands exceeding them are not sent.
+	 * 
+	 * @param enabled
+	 *            true to enable flow control, false to disable it.
+	 * @return true, if the flow control has been set, false otherwise.
+	 */
+	public boolean setFlowControl(boolean enabled) {
+		// credits are accepted as soon as the reader can send them
+		setFlowControlState(true);
+		boolean result = sendCommand(CommandCode.SET_FLOW_CONTROL, new byte[] { (byte) (enabled ? 1 : 0) },
+				timeout) != null;
+		setFlowControlState(result ? enabled : false);
+		return result;
+	}
+
+	/**
+	 * Sets whether credits sent by the reader are applied.
+	 */
+	private void setFlowControlState(boolean enabled) {
+		synchronized (commandLock) {
+			flowControl = enabled;
+			if (!enabled) {
+				creditSequence = -1;
+				commandLock.notifyAll();
+			}
+		}
+	}
+
+	/**
+	 * Reads statistics of the link measured by the reader.
+	 * 
+	 * @return the statistics or null, if the execution of command failed.
+	 */
+	public LinkStatistics readLinkStatistics() {
+		byte[] response = sendCommand(CommandCode.GET_LINK_STATS, EMPTY_COMMAND_DATA, timeout);
+		if ((response == null) || (response.length != 12)) {
+			return null;
+		}
+
+		LinkStatistics statistics = new LinkStatistics();
+		statistics.droppedFrames = decodeUnsignedInt(response, 0);
+		statistics.malformedFrames = decodeUnsignedInt(response, 4);
+		statistics.rejectedCommands = decodeUnsignedInt(response, 8);
+		return statistics;
+	}
+
+	/**
+	 * Reads trace of recent events recorded by the reader. The reader does not
+	 * record events while the trace is read.
+	 * 
+	 * @param clear
+	 *            true, if the trace in the reader should be cleared after
+	 *            reading.
+	 * @return the events ordered from the oldest one or null, if the execution
+	 *         of command failed.
+	 */
+	public List<TraceRecord> readTrace(boolean clear) {
+		byte[] response = sendCommand(CommandCode.TRACE_DUMP, new byte[] { (byte) (clear ? TRACE_CLEAR : 0) },
+				timeout, true);
+		if ((response == null) || (response.length % TRACE_RECORD_LENGTH != 0)) {
+			return null;
+		}
+
+		List<TraceRecord> result = new ArrayList<>();
+		for (int offset = 0; offset < response.length; offset += TRACE_RECORD_LENGTH) {
+			TraceRecord record = new TraceRecord();
+			record.time = decodeUnsignedInt(response, offset);
+			record.event = response[offset + 4] & 0xFF;
+			record.data = response[offset + 5] & 0xFF;
+			result.add(record);
+		}
+
+		return result;
+	}
+
+	/**
+	 * Handles envelope with coalesced messages, each message is preceded by
+	 * its length (1 byte) and tag (2 bytes).
+	 * 
+	 * @param message
+	 *            the envelope.
+	 */
+	private void handleEnvelope(byte[] message) {
+		int offset = 1;
+		while (offset + 3 <= message.length) {
+			int length = message[offset] & 0xFF;
+			int tag = ((message[offset + 1] & 0xFF) << 8) | (message[offset + 2] & 0xFF);
+			offset += 3;
+			if ((length == 0) || (offset + length > message.length)) {
+				return;
 			}
+
+			handleReceivedMessage(tag, Arrays.copyOfRange(message, offset, offset + length));
+			offset += length;
+		}
+	}
+
+	/**
+	 * Handles a chunk of response to a sent command. Must be invoked with
+	 * commandLock held.
+	 * 
+	 * @param command
+	 *            the command.
+	 * @param message
+	 *            the message with chunk of response.
+	 */
+	private void handleResponseChunk(PendingCommand command, byte[] message) {
+		if (message.length < 5) {
+			return;
+		}
+
+		int totalLength = ((message[1] & 0xFF) << 8) | (message[2] & 0xFF);
+		int offset = ((message[3] & 0xFF) << 8) | (message[4] & 0xFF);
+		int chunkLength = message.length - 5;
+
+		if (command.responseData == null) {
+			command.responseData = new byte[totalLength];
+		}
+
+		// ignore chunks that are out of order or inconsistent
+		if ((command.responseData.length != totalLength) || (offset != command.chunkedResponseLength)
+				|| (offset + chunkLength > totalLength)) {
+			return;
+		}
+
+		System.arraycopy(message, 5, command.responseData, offset, chunkLength);
+		command.chunkedResponseLength += chunkLength;
+		command.progressNanoTime = System.nanoTime();
+		if (command.chunkedResponseLength == totalLength) {
+			command.responseReceived = true;
+		}
+	}
+
+	/**
+	 * Handles notification about result of macro executed automatically.
+	 * 
+	 * @param message
+	 *            the notification data.
+	 */
+	private void handleMacroExecuted(byte[] message) {
+		if (message.length < 2) {
+			return;
+		}
+
+		List<MacroListener> listenersToFire;
+		synchronized (lock) {
+			listenersToFire = new ArrayList<>(macroListeners);
+		}
+
+		boolean success = ((message[1] & 0xFF) == MessageCode.COMMAND_OK);
+		byte[] output = Arrays.copyOfRange(message, 2, message.length);
+		for (MacroListener macroListener : listenersToFire) {
+			macroListener.macroExecuted(this, success, output);
 		}
 	}
 
@@ -509,8 +2384,11 @@ public class CardReader {
 				return;
 			}
 
-			// decode block count
+			// decode block count (4K card reports 255 instead of 256 blocks)
 			blockCount = message[2] & 0xFF;
+			if (cardType == CardType.MIFARE_4K) {
+				blockCount = 256;
+			}
 
 			// retrieve UID of the card
 			cardUID = new byte[message.length - 3];
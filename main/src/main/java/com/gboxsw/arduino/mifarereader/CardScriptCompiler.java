@@ -0,0 +1,278 @@
+package com.gboxsw.arduino.mifarereader;
+
+import java.io.ByteArrayOutputStream;
+import java.util.*;
+
+/**
+ * Compiler of card scripts to macro bytecode executed by the reader. The
+ * compiler accepts the syntax of {@link CardScriptExecutor} extended with
+ * statements for writing, comparing, branching and value operations:
+ *
+ * <pre>
+ * SetKeyA|SetKeyB key            set key for authentication
+ * ReadBlock block                read block and emit its content
+ * LoadBlock block                read block to the data register
+ * StoreBlock block               write the data register to block
+ * WriteBlock block data          write 16 bytes of data to block
+ * SetData offset data            store data to the data register
+ * Compare offset data            test whether the data register contains data
+ * GetValue block                 read value block to the value register
+ * CompareValue value             test whether the value register is at least value
+ * AddValue|SubtractValue block delta
+ * Emit offset length             emit bytes of the data register
+ * EmitValue                      emit the value register
+ * Jump|JumpIf|JumpIfNot label    jump (if the last test passed or failed)
+ * label:                         define a label
+ * End|Fail                       stop execution with success or failure
+ * </pre>
+ *
+ * Keys and data are written in hex, lines starting with # are comments.
+ */
+public class CardScriptCompiler {
+
+	/**
+	 * Maximal length of bytecode supported by the reader.
+	 */
+	public static final int MAX_BYTECODE_LENGTH = 200;
+
+	/**
+	 * Instruction codes of macro bytecode.
+	 */
+	private static final class Op {
+		static final int END = 0;
+		static final int FAIL = 1;
+		static final int KEY = 2;
+		static final int READ = 3;
+		static final int WRITE = 4;
+		static final int LOAD = 5;
+		static final int COMPARE = 6;
+		static final int JUMP = 7;
+		static final int JUMP_IF = 8;
+		static final int JUMP_IF_NOT = 9;
+		static final int VALUE_GET = 10;
+		static final int VALUE_COMPARE = 11;
+		static final int VALUE_ADD = 12;
+		static final int VALUE_SUB = 13;
+		static final int EMIT = 14;
+		static final int EMIT_VALUE = 15;
+	}
+
+	/**
+	 * Generated bytecode.
+	 */
+	private final ByteArrayOutputStream bytecode = new ByteArrayOutputStream();
+
+	/**
+	 * Offsets of defined labels.
+	 */
+	private final Map<String, Integer> labels = new HashMap<>();
+
+	/**
+	 * Labels referenced by jump instructions (indexed by offset of the jump
+	 * target in bytecode).
+	 */
+	private final Map<Integer, String> jumpTargets = new HashMap<>();
+
+	/**
+	 * Constructs the compiler, use {@link #compile(String)}.
+	 */
+	private CardScriptCompiler() {
+
+	}
+
+	/**
+	 * Compiles a script to macro bytecode.
+	 *
+	 * @param script
+	 *            the script.
+	 * @return the bytecode.
+	 * @throws IllegalArgumentException
+	 *             if the script is invalid.
+	 */
+	public static byte[] compile(String script) {
+		CardScriptCompiler compiler = new CardScriptCompiler();
+		try (Scanner lineScanner = new Scanner(script)) {
+			while (lineScanner.hasNextLine()) {
+				String line = lineScanner.nextLine().trim();
+				if (line.isEmpty() || line.startsWith("#")) {
+					continue;
+				}
+
+				compiler.compileStatement(line);
+			}
+		}
+
+		return compiler.link();
+	}
+
+	/**
+	 * Compiles a single statement.
+	 *
+	 * @param statement
+	 *            the statement.
+	 */
+	private void compileStatement(String statement) {
+		if (statement.endsWith(":")) {
+			String label = statement.substring(0, statement.length() - 1).trim();
+			if (label.isEmpty() || labels.containsKey(label)) {
+				throw new IllegalArgumentException("Invalid or duplicated label: " + statement);
+			}
+
+			labels.put(label, bytecode.size());
+			return;
+		}
+
+		try (Scanner scanner = new Scanner(statement)) {
+			switch (scanner.next()) {
+			case "SetKeyA":
+				emitKey(1, scanner);
+				break;
+			case "SetKeyB":
+				emitKey(2, scanner);
+				break;
+			case "ReadBlock":
+				emit(Op.READ, readByte(scanner));
+				emit(Op.EMIT, 0, 16);
+				break;
+			case "LoadBlock":
+				emit(Op.READ, readByte(scanner));
+				break;
+			case "StoreBlock":
+				emit(Op.WRITE, readByte(scanner));
+				break;
+			case "WriteBlock": {
+				int block = readByte(scanner);
+				byte[] data = CardScriptExecutor.readHexData(scanner.next());
+				if (data.length != 16) {
+					throw new IllegalArgumentException("The length of block data must be 16.");
+				}
+
+				emitData(Op.LOAD, 0, data);
+				emit(Op.WRITE, block);
+				break;
+			}
+			case "SetData":
+				emitData(Op.LOAD, readByte(scanner), CardScriptExecutor.readHexData(scanner.next()));
+				break;
+			case "Compare":
+				emitData(Op.COMPARE, readByte(scanner), CardScriptExecutor.readHexData(scanner.next()));
+				break;
+			case "GetValue":
+				emit(Op.VALUE_GET, readByte(scanner));
+				break;
+			case "CompareValue":
+				emit(Op.VALUE_COMPARE);
+				emitValue(readValue(scanner));
+				break;
+			case "AddValue":
+				emit(Op.VALUE_ADD, readByte(scanner));
+				emitValue(readValue(scanner));
+				break;
+			case "SubtractValue":
+				emit(Op.VALUE_SUB, readByte(scanner));
+				emitValue(readValue(scanner));
+				break;
+			case "Emit":
+				emit(Op.EMIT, readByte(scanner), readByte(scanner));
+				break;
+			case "EmitValue":
+				emit(Op.EMIT_VALUE);
+				break;
+			case "Jump":
+				emitJump(Op.JUMP, scanner.next());
+				break;
+			case "JumpIf":
+				emitJump(Op.JUMP_IF, scanner.next());
+				break;
+			case "JumpIfNot":
+				emitJump(Op.JUMP_IF_NOT, scanner.next());
+				break;
+			case "End":
+				emit(Op.END);
+				break;
+			case "Fail":
+				emit(Op.FAIL);
+				break;
+			default:
+				throw new IllegalArgumentException("Unknown command: " + statement);
+			}
+		} catch (NoSuchElementException e) {
+			throw new IllegalArgumentException("Missing argument: " + statement);
+		}
+	}
+
+	/**
+	 * Resolves jump targets and returns the final bytecode.
+	 */
+	private byte[] link() {
+		byte[] result = bytecode.toByteArray();
+		if (result.length > MAX_BYTECODE_LENGTH) {
+			throw new IllegalArgumentException("The compiled script is too long (" + result.length + " bytes).");
+		}
+
+		for (Map.Entry<Integer, String> jumpTarget : jumpTargets.entrySet()) {
+			Integer target = labels.get(jumpTarget.getValue());
+			if (target == null) {
+				throw new IllegalArgumentException("Undefined label: " + jumpTarget.getValue());
+			}
+
+			result[jumpTarget.getKey()] = (byte) (int) target;
+		}
+
+		return result;
+	}
+
+	private void emit(int... bytes) {
+		for (int b : bytes) {
+			bytecode.write(b);
+		}
+	}
+
+	private void emitKey(int keyType, Scanner scanner) {
+		byte[] key = CardScriptExecutor.readHexData(scanner.next());
+		if (key.length != 6) {
+			throw new IllegalArgumentException("The length of the key must 6.");
+		}
+
+		emit(Op.KEY, keyType);
+		bytecode.write(key, 0, key.length);
+	}
+
+	private void emitData(int op, int offset, byte[] data) {
+		if ((data.length == 0) || (offset + data.length > 16)) {
+			throw new IllegalArgumentException("Data exceed the block.");
+		}
+
+		emit(op, offset, data.length);
+		bytecode.write(data, 0, data.length);
+	}
+
+	private void emitValue(int value) {
+		// little endian as in value blocks
+		emit(value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, (value >> 24) & 0xFF);
+	}
+
+	private void emitJump(int op, String label) {
+		emit(op);
+		jumpTargets.put(bytecode.size(), label);
+		emit(0);
+	}
+
+	private static int readByte(Scanner scanner) {
+		int value = scanner.nextInt();
+		if ((value < 0) || (value > 255)) {
+			throw new IllegalArgumentException("Invalid argument: " + value);
+		}
+
+		return value;
+	}
+
+	private static int readValue(Scanner scanner) {
+		int value = scanner.nextInt();
+		if (value < 0) {
+			throw new IllegalArgumentException("Value cannot be negative.");
+		}
+
+		return value;
+	}
+}
@@ -84,7 +84,7 @@ public class CardScriptExecutor {
 		return true;
 	}
 
-	private static byte[] readHexData(String hexData) {
+	static byte[] readHexData(String hexData) {
 		hexData = hexData.trim().toUpperCase().replaceAll("_", "");
 		if (hexData.length() % 2 != 0) {
 			throw new IllegalArgumentException("Invalid hex data.");
@@ -0,0 +1,486 @@
+package com.gboxsw.arduino.mifarereader;
+
+import java.io.*;
+
+import com.gboxsw.acpmod.gep.GEPMessenger.MessageListener;
+
+/**
+ * Messenger implementing GEP framing over a pair of streams. Besides the
+ * classic framing (each byte is sent as two nibbles), the messenger supports
+ * compact framing in which bytes are sent as they are and only special bytes
+ * are escaped. Messages are received in both framings, the framing of sent
+ * messages is selected by {@link #setCompactFraming(boolean)}.
+ */
+public class GEPStreamLink {
+
+	/**
+	 * Byte indicating start of a new message.
+	 */
+	private static final int MESSAGE_START_BYTE = 0x0C;
+
+	/**
+	 * Byte indicating start of a new message in compact framing.
+	 */
+	private static final int MESSAGE_START_COMPACT_BYTE = 0x0E;
+
+	/**
+	 * Byte indicating end of a message.
+	 */
+	private static final int MESSAGE_END_BYTE = 0x03;
+
+	/**
+	 * Byte indicating end of a message with tag.
+	 */
+	private static final int MESSAGE_END_WITH_TAG_BYTE = 0x06;
+
+	/**
+	 * Byte preceding an escaped special byte in compact framing.
+	 */
+	private static final int ESCAPE_BYTE = 0x1B;
+
+	/**
+	 * Mask applied to escaped special bytes in compact framing.
+	 */
+	private static final int ESCAPE_XOR = 0x20;
+
+	/**
+	 * States of the receive process.
+	 */
+	private enum ReceiveState {
+		WAIT_START, WAIT_DESTINATION_ID, WAIT_MESSAGE_BYTE_HIGH, WAIT_MESSAGE_BYTE_LOW, WAIT_CRC, WAIT_CRC_WITH_TAG
+	}
+
+	/**
+	 * Input stream with received bytes.
+	 */
+	private final InputStream input;
+
+	/**
+	 * Output stream for sent bytes.
+	 */
+	private final OutputStream output;
+
+	/**
+	 * Maximal length of received message.
+	 */
+	private final int maxMessageLength;
+
+	/**
+	 * Listener of received messages.
+	 */
+	private final MessageListener listener;
+
+	/**
+	 * Indicates whether messages are sent using compact framing.
+	 */
+	private volatile boolean compactFraming;
+
+	/**
+	 * Thread receiving bytes from the input stream.
+	 */
+	private Thread receiveThread;
+
+	/**
+	 * Indicates whether the link is running.
+	 */
+	private volatile boolean running;
+
+	/**
+	 * Buffer of the message being received (including tag).
+	 */
+	private final byte[] message;
+
+	/**
+	 * Number of received bytes of the message.
+	 */
+	private int messageLength;
+
+	/**
+	 * Destination id of the message being received.
+	 */
+	private int messageDestinationId;
+
+	/**
+	 * High nibble of the byte being received in classic framing.
+	 */
+	private int highNibble;
+
+	/**
+	 * Indicates whether the message being received uses compact framing.
+	 */
+	private boolean rxCompact;
+
+	/**
+	 * Indicates whether the previous byte of message in compact framing was
+	 * ESCAPE_BYTE.
+	 */
+	private boolean rxEscaped;
+
+	/**
+	 * State of the receive process.
+	 */
+	private ReceiveState state = ReceiveState.WAIT_START;
+
+	/**
+	 * Constructs the link.
+	 *
+	 * @param input
+	 *            the input stream with bytes received from the device.
+	 * @param output
+	 *            the output stream for bytes sent to the device.
+	 * @param maxMessageLength
+	 *            the maximal length of received message.
+	 * @param listener
+	 *            the listener of received messages.
+	 */
+	public GEPStreamLink(InputStream input, OutputStream output, int maxMessageLength, MessageListener listener) {
+		if ((input == null) || (output == null) || (listener == null)) {
+			throw new NullPointerException("Streams and listener cannot be null.");
+		}
+
+		this.input = input;
+		this.output = output;
+		this.maxMessageLength = maxMessageLength;
+		this.listener = listener;
+		this.message = new byte[maxMessageLength + 2];
+	}
+
+	/**
+	 * Starts the thread receiving messages.
+	 */
+	public synchronized void start() {
+		if (running) {
+			return;
+		}
+
+		running = true;
+		receiveThread = new Thread(new Runnable() {
+			public void run() {
+				receiveLoop();
+			}
+		}, "GEPStreamLink");
+		receiveThread.setDaemon(true);
+		receiveThread.start();
+	}
+
+	/**
+	 * Stops the thread receiving messages and closes the streams.
+	 *
+	 * @throws InterruptedException
+	 *             if the current thread is interrupted while waiting for the
+	 *             receive thread.
+	 */
+	public void stop() throws InterruptedException {
+		Thread thread;
+		synchronized (this) {
+			if (!running) {
+				return;
+			}
+
+			running = false;
+			thread = receiveThread;
+			receiveThread = null;
+		}
+
+		try {
+			input.close();
+		} catch (IOException ignore) {
+
+		}
+
+		try {
+			output.close();
+		} catch (IOException ignore) {
+
+		}
+
+		thread.join();
+	}
+
+	/**
+	 * Returns whether messages are sent using compact framing.
+	 *
+	 * @return true, if compact framing is used, false otherwise.
+	 */
+	public boolean isCompactFraming() {
+		return compactFraming;
+	}
+
+	/**
+	 * Sets whether messages are sent using compact framing. Devices reply in
+	 * the framing of the last received message, so compact framing should be
+	 * enabled only after the device has been found to support it.
+	 *
+	 * @param compactFraming
+	 *            true to send messages using compact framing, false to use
+	 *            classic framing.
+	 */
+	public void setCompactFraming(boolean compactFraming) {
+		this.compactFraming = compactFraming;
+	}
+
+	/**
+	 * Sends a message.
+	 *
+	 * @param destinationId
+	 *            the destination id (0-15).
+	 * @param message
+	 *            the message.
+	 * @param tag
+	 *            the tag of message (0-65535) or a negative value to send the
+	 *            message without tag.
+	 * @throws IOException
+	 *             if the message cannot be written to the output stream.
+	 */
+	public void sendMessage(int destinationId, byte[] message, int tag) throws IOException {
+		if ((destinationId < 0) || (destinationId > 15)) {
+			throw new IllegalArgumentException("Invalid destination id.");
+		}
+
+		if (tag > 0xFFFF) {
+			throw new IllegalArgumentException("Invalid tag.");
+		}
+
+		boolean compact = compactFraming;
+		ByteArrayOutputStream frame = new ByteArrayOutputStream(2 * message.length + 8);
+		int crc = updateCRC8(0, destinationId);
+		if (compact) {
+			frame.write(MESSAGE_START_COMPACT_BYTE);
+			writeCompactByte(frame, destinationId);
+		} else {
+			frame.write(MESSAGE_START_BYTE);
+			writeClassicByte(frame, destinationId);
+		}
+
+		for (byte b : message) {
+			crc = updateCRC8(crc, b & 0xFF);
+			writeByte(frame, b & 0xFF, compact);
+		}
+
+		if (tag >= 0) {
+			crc = updateCRC8(crc, tag >> 8);
+			writeByte(frame, tag >> 8, compact);
+			crc = updateCRC8(crc, tag & 0xFF);
+			writeByte(frame, tag & 0xFF, compact);
+			frame.write(MESSAGE_END_WITH_TAG_BYTE);
+		} else {
+			frame.write(MESSAGE_END_BYTE);
+		}
+
+		frame.write(crc);
+
+		synchronized (output) {
+			frame.writeTo(output);
+			output.flush();
+		}
+	}
+
+	/**
+	 * Writes a byte encoded in the given framing.
+	 */
+	private static void writeByte(ByteArrayOutputStream frame, int b, boolean compact) {
+		if (compact) {
+			writeCompactByte(frame, b);
+		} else {
+			writeClassicByte(frame, b);
+		}
+	}
+
+	/**
+	 * Writes a byte encoded as two nibbles.
+	 */
+	private static void writeClassicByte(ByteArrayOutputStream frame, int b) {
+		int nibble = (b >> 4) & 0x0F;
+		frame.write((nibble << 4) | (nibble ^ 0x0F));
+		nibble = b & 0x0F;
+		frame.write((nibble << 4) | (nibble ^ 0x0F));
+	}
+
+	/**
+	 * Writes a byte as it is or escaped, if it is a special byte.
+	 */
+	private static void writeCompactByte(ByteArrayOutputStream frame, int b) {
+		if (isSpecialByte(b)) {
+			frame.write(ESCAPE_BYTE);
+			frame.write(b ^ ESCAPE_XOR);
+		} else {
+			frame.write(b);
+		}
+	}
+
+	/**
+	 * Returns whether the byte must be escaped in compact framing.
+	 */
+	private static boolean isSpecialByte(int b) {
+		return (b == MESSAGE_START_BYTE) || (b == MESSAGE_START_COMPACT_BYTE) || (b == MESSAGE_END_BYTE)
+				|| (b == MESSAGE_END_WITH_TAG_BYTE) || (b == ESCAPE_BYTE);
+	}
+
+	/**
+	 * Updates the CRC-8 checksum (polynomial 0x8C) with a byte.
+	 */
+	private static int updateCRC8(int crc, int b) {
+		for (int i = 0; i < 8; i++) {
+			int mix = (crc ^ b) & 0x01;
+			crc >>= 1;
+			if (mix != 0) {
+				crc ^= 0x8C;
+			}
+			b >>= 1;
+		}
+
+		return crc;
+	}
+
+	/**
+	 * Body of the receive thread.
+	 */
+	private void receiveLoop() {
+		while (running) {
+			int b;
+			try {
+				b = input.read();
+			} catch (IOException e) {
+				if (!running) {
+					break;
+				}
+
+				continue;
+			}
+
+			if (b < 0) {
+				break;
+			}
+
+			receiveByte(b);
+		}
+	}
+
+	/**
+	 * Processes a received byte.
+	 *
+	 * @param dataByte
+	 *            the received byte.
+	 */
+	private void receiveByte(int dataByte) {
+		// Ignore all bytes received in state WAIT_START different than start bytes
+		if ((state == ReceiveState.WAIT_START) && (dataByte != MESSAGE_START_BYTE)
+				&& (dataByte != MESSAGE_START_COMPACT_BYTE)) {
+			return;
+		}
+
+		// Check CRC of the received message (the last byte of message)
+		if ((state == ReceiveState.WAIT_CRC) || (state == ReceiveState.WAIT_CRC_WITH_TAG)) {
+			int crc = updateCRC8(0, messageDestinationId);
+			for (int i = 0; i < messageLength; i++) {
+				crc = updateCRC8(crc, message[i] & 0xFF);
+			}
+
+			int tag = 0;
+			int length = messageLength;
+			if (state == ReceiveState.WAIT_CRC_WITH_TAG) {
+				length -= 2;
+				tag = ((message[length] & 0xFF) << 8) | (message[length + 1] & 0xFF);
+			}
+
+			state = ReceiveState.WAIT_START;
+			if ((crc == dataByte) && (length >= 0) && (length <= maxMessageLength)) {
+				byte[] receivedMessage = new byte[length];
+				System.arraycopy(message, 0, receivedMessage, 0, length);
+				listener.onMessageReceived(tag, receivedMessage);
+			}
+
+			return;
+		}
+
+		// Restart receive of the message
+		if ((dataByte == MESSAGE_START_BYTE) || (dataByte == MESSAGE_START_COMPACT_BYTE)) {
+			state = ReceiveState.WAIT_DESTINATION_ID;
+			rxCompact = (dataByte == MESSAGE_START_COMPACT_BYTE);
+			rxEscaped = false;
+			return;
+		}
+
+		// Process data bytes of message in compact framing
+		if (rxCompact
+				&& ((state == ReceiveState.WAIT_DESTINATION_ID) || (state == ReceiveState.WAIT_MESSAGE_BYTE_HIGH))
+				&& (rxEscaped || ((dataByte != MESSAGE_END_BYTE) && (dataByte != MESSAGE_END_WITH_TAG_BYTE)))) {
+			if (dataByte == ESCAPE_BYTE) {
+				state = rxEscaped ? ReceiveState.WAIT_START : state;
+				rxEscaped = !rxEscaped;
+				return;
+			}
+
+			int inByte = rxEscaped ? (dataByte ^ ESCAPE_XOR) : dataByte;
+			rxEscaped = false;
+			if (state == ReceiveState.WAIT_DESTINATION_ID) {
+				acceptDestination(inByte);
+			} else {
+				storeMessageByte(inByte);
+			}
+
+			return;
+		}
+
+		// End of message
+		if ((dataByte == MESSAGE_END_BYTE) || (dataByte == MESSAGE_END_WITH_TAG_BYTE)) {
+			if (state != ReceiveState.WAIT_MESSAGE_BYTE_HIGH) {
+				state = ReceiveState.WAIT_START;
+				return;
+			}
+
+			state = (dataByte == MESSAGE_END_BYTE) ? ReceiveState.WAIT_CRC : ReceiveState.WAIT_CRC_WITH_TAG;
+			return;
+		}
+
+		// Classic framing: check whether received byte is well formed data byte
+		int nibble = (dataByte >> 4) & 0x0F;
+		if (nibble != ((dataByte ^ 0x0F) & 0x0F)) {
+			state = ReceiveState.WAIT_START;
+			return;
+		}
+
+		switch (state) {
+		case WAIT_DESTINATION_ID:
+			acceptDestination(nibble);
+			break;
+		case WAIT_MESSAGE_BYTE_HIGH:
+			highNibble = nibble;
+			state = ReceiveState.WAIT_MESSAGE_BYTE_LOW;
+			break;
+		case WAIT_MESSAGE_BYTE_LOW:
+			state = ReceiveState.WAIT_MESSAGE_BYTE_HIGH;
+			storeMessageByte((highNibble << 4) | nibble);
+			break;
+		default:
+			state = ReceiveState.WAIT_START;
+		}
+	}
+
+	/**
+	 * Sets destination id of the message being received.
+	 */
+	private void acceptDestination(int destinationId) {
+		if (destinationId > 15) {
+			state = ReceiveState.WAIT_START;
+			return;
+		}
+
+		messageDestinationId = destinationId;
+		messageLength = 0;
+		state = ReceiveState.WAIT_MESSAGE_BYTE_HIGH;
+	}
+
+	/**
+	 * Stores a byte of the message being received.
+	 */
+	private void storeMessageByte(int b) {
+		if (messageLength >= message.length) {
+			state = ReceiveState.WAIT_START;
+			return;
+		}
+
+		message[messageLength] = (byte) b;
+		messageLength++;
+	}
+}
@@ -0,0 +1,404 @@
+// Profile of SPI bus traffic of the MFRC522 driver. The driver is compiled in the recording mode and a
+// scenario of high level calls (detection, selection, authentication, reads and writes of MIFARE
+// Classic and NTAG cards) is executed against the register level model of the emulator or replayed
+// from a recording. Transactions, transferred bytes and polling iterations (repeated reads of a status
+// register) are summarized per call and compared with a baseline. Polling depends on timing of the
+// chip, so the baseline limits transactions and bytes without polling iterations.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "board.h"
+#include "card.h"
+#include "mfrc522_model.h"
+#include "spi_recording.h"
+#include "uart.h"
+
+#include <Arduino.h>
+#include <acp/rfid/mfrc522/MFRC522.h>
+
+#undef long
+#undef min
+#undef max
+
+using namespace mfreader::emulator;
+
+namespace {
+
+// Scenario executed in each iteration, steps "place INDEX" place cards into the field
+const char* const SCENARIO[] = {
+	"place 0",
+	"PICC_IsNewCardPresent",
+	"PICC_Select",
+	"PCD_Authenticate",
+	"MIFARE_Read",
+	"MIFARE_Write",
+	"MIFARE_SetValue",
+	"MIFARE_Increment",
+	"MIFARE_Transfer",
+	"MIFARE_GetValue",
+	"PICC_HaltA",
+	"PCD_StopCrypto1",
+	"place 1",
+	"PICC_IsNewCardPresent",
+	"PICC_Select",
+	"MIFARE_Ultralight_GetVersion",
+	"MIFARE_Ultralight_FastRead",
+	"MIFARE_Ultralight_Write",
+	"PCD_NTAG216_AUTH",
+	"PICC_HaltA"
+};
+
+struct Options {
+	std::string recordPath;
+	std::string replayPath;
+	std::string baselinePath;
+	std::string writeBaselinePath;
+	int iterations = 5;
+};
+
+/********************************************************************************
+ * Traffic of a high level call summarized over all its executions.
+ ********************************************************************************/
+struct CallSummary {
+	std::string name;
+	int count = 0;
+	int transactions = 0;
+	int bytes = 0;
+	int polls = 0;
+	uint64_t time = 0;
+
+	// Maximal traffic of an execution without polling iterations
+	int maxTransactions = 0;
+	int maxBytes = 0;
+};
+
+// Recording of the running scenario
+SpiRecording* recording = nullptr;
+
+void recordTransaction(byte address, const byte* values, byte count) {
+	SpiTransaction transaction;
+	transaction.time = micros();
+	transaction.address = address;
+	transaction.values.assign(values, values + count);
+	recording->add(transaction);
+}
+
+void printUsage() {
+	std::fprintf(stderr,
+			"usage: mfrc522_bus_profile [options]\n"
+			"  --record PATH           writes the recording of register accesses\n"
+			"  --replay PATH           replays the recording instead of running the model of the chip\n"
+			"  --baseline PATH         fails if a call has more transactions or bytes than the baseline\n"
+			"  --write-baseline PATH   writes the measured traffic as a new baseline\n"
+			"  --iterations N          iterations of the scenario (default 5)\n");
+}
+
+/********************************************************************************
+ * High level calls of the driver executed by the scenario.
+ ********************************************************************************/
+class Calls {
+public:
+	explicit Calls(MFRC522& reader) : driver(reader) {
+		for (byte& value : key.keyByte) {
+			value = 0xFF;
+		}
+
+		calls["PCD_Init"] = [this] {
+			driver.PCD_Init(Board::READER_SELECT_PIN, Board::READER_RESET_PIN);
+			return true;
+		};
+		calls["PICC_IsNewCardPresent"] = [this] {
+			return driver.PICC_IsNewCardPresent();
+		};
+		calls["PICC_Select"] = [this] {
+			return driver.PICC_Select(&driver.uid) == MFRC522::STATUS_OK;
+		};
+		calls["PCD_Authenticate"] = [this] {
+			return driver.PCD_Authenticate(MFRC522::PICC_CMD_MF_AUTH_KEY_A, 7, &key, &driver.uid) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_Read"] = [this] {
+			byte size = sizeof(buffer);
+			return driver.MIFARE_Read(4, buffer, &size) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_Write"] = [this] {
+			for (int i = 0; i < 16; i++) {
+				buffer[i] = (byte)i;
+			}
+			return driver.MIFARE_Write(4, buffer, 16) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_SetValue"] = [this] {
+			return driver.MIFARE_SetValue(5, 100) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_Increment"] = [this] {
+			return driver.MIFARE_Increment(5, 1) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_Transfer"] = [this] {
+			return driver.MIFARE_Transfer(5) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_GetValue"] = [this] {
+			int32_t value;
+			return (driver.MIFARE_GetValue(5, &value) == MFRC522::STATUS_OK) && (value == 101);
+		};
+		calls["PICC_HaltA"] = [this] {
+			return driver.PICC_HaltA() == MFRC522::STATUS_OK;
+		};
+		calls["PCD_StopCrypto1"] = [this] {
+			driver.PCD_StopCrypto1();
+			return true;
+		};
+		calls["MIFARE_Ultralight_GetVersion"] = [this] {
+			byte size = sizeof(buffer);
+			return driver.MIFARE_Ultralight_GetVersion(buffer, &size) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_Ultralight_FastRead"] = [this] {
+			byte size = sizeof(buffer);
+			return driver.MIFARE_Ultralight_FastRead(4, 7, buffer, &size) == MFRC522::STATUS_OK;
+		};
+		calls["MIFARE_Ultralight_Write"] = [this] {
+			byte page[4] = {1, 2, 3, 4};
+			return driver.MIFARE_Ultralight_Write(10, page, sizeof(page)) == MFRC522::STATUS_OK;
+		};
+		calls["PCD_NTAG216_AUTH"] = [this] {
+			byte password[4] = {0xFF, 0xFF, 0xFF, 0xFF};
+			byte pack[2];
+			return driver.PCD_NTAG216_AUTH(password, pack) == MFRC522::STATUS_OK;
+		};
+	}
+
+	// Executes a call in a new call of the recording, returns false if the call failed or it is unknown
+	bool execute(const std::string& name) {
+		recording->beginCall(name);
+		auto call = calls.find(name);
+		if (call == calls.end()) {
+			std::fprintf(stderr, "unknown call %s\n", name.c_str());
+			return false;
+		}
+
+		if (!call->second()) {
+			std::fprintf(stderr, "call %s failed\n", name.c_str());
+			return false;
+		}
+
+		return true;
+	}
+
+private:
+	MFRC522& driver;
+	MFRC522::MIFARE_Key key;
+	byte buffer[64];
+	std::map<std::string, std::function<bool()>> calls;
+};
+
+// Runs the scenario against the model of the chip with virtual cards, returns number of failed calls
+int runScenario(Calls& calls, Field& field, int iterations) {
+	int failures = calls.execute("PCD_Init") ? 0 : 1;
+	for (int i = 0; i < iterations; i++) {
+		for (const char* step : SCENARIO) {
+			const std::string name = step;
+			if (name.compare(0, 6, "place ") == 0) {
+				field.place(std::atoi(name.c_str() + 6));
+			} else if (!calls.execute(name)) {
+				failures++;
+			}
+		}
+	}
+
+	return failures;
+}
+
+// Replays calls of the recording, returns number of failed calls
+int replayCalls(Calls& calls, const SpiRecording& replayed) {
+	int failures = 0;
+	for (const SpiCall& call : replayed.getCalls()) {
+		if (!calls.execute(call.name)) {
+			failures++;
+		}
+	}
+
+	return failures;
+}
+
+// Summarizes traffic of calls, polling iterations are reads of the register read by the previous transaction
+std::vector<CallSummary> summarize(const SpiRecording& recording) {
+	std::vector<CallSummary> result;
+	for (const SpiCall& call : recording.getCalls()) {
+		auto summary = std::find_if(result.begin(), result.end(), [&call](const CallSummary& summary) {
+			return summary.name == call.name;
+		});
+		if (summary == result.end()) {
+			result.push_back(CallSummary());
+			result.back().name = call.name;
+			summary = result.end() - 1;
+		}
+
+		int transactions = 0;
+		int bytes = 0;
+		for (size_t i = 0; i < call.transactions.size(); i++) {
+			const SpiTransaction& transaction = call.transactions[i];
+			summary->transactions++;
+			summary->bytes += transaction.getByteCount();
+			if (transaction.isRead() && (i > 0) && (call.transactions[i - 1].address == transaction.address)) {
+				summary->polls++;
+			} else {
+				transactions++;
+				bytes += transaction.getByteCount();
+			}
+		}
+
+		if (!call.transactions.empty()) {
+			summary->time += call.transactions.back().time - call.transactions.front().time;
+		}
+
+		summary->count++;
+		summary->maxTransactions = std::max(summary->maxTransactions, transactions);
+		summary->maxBytes = std::max(summary->maxBytes, bytes);
+	}
+
+	return result;
+}
+
+void printSummary(const std::vector<CallSummary>& summaries) {
+	std::printf("%-30s %6s %13s %10s %11s %12s %10s\n", "call", "count", "transactions", "bytes", "polls", "no polling", "time [us]");
+	for (const CallSummary& summary : summaries) {
+		std::printf("%-30s %6d %13.1f %10.1f %11.1f %5d/%6d %10.1f\n", summary.name.c_str(), summary.count,
+				(double)summary.transactions / summary.count, (double)summary.bytes / summary.count,
+				(double)summary.polls / summary.count, summary.maxTransactions, summary.maxBytes,
+				(double)summary.time / summary.count);
+	}
+}
+
+bool writeBaseline(const std::string& path, const std::vector<CallSummary>& summaries) {
+	std::ofstream file(path);
+	file << "# Bus traffic of high level calls of the MFRC522 driver: transactions and bytes of an execution\n"
+			<< "# without polling iterations, regenerate with mfrc522_bus_profile --write-baseline PATH\n";
+	for (const CallSummary& summary : summaries) {
+		file << summary.name << " " << summary.maxTransactions << " " << summary.maxBytes << "\n";
+	}
+
+	return (bool)file;
+}
+
+// Compares traffic with the baseline, returns number of calls whose traffic increased
+int checkBaseline(const std::string& path, const std::vector<CallSummary>& summaries) {
+	std::ifstream file(path);
+	if (!file) {
+		std::fprintf(stderr, "cannot read baseline %s\n", path.c_str());
+		return 1;
+	}
+
+	int regressions = 0;
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || (line[0] == '#')) {
+			continue;
+		}
+
+		std::istringstream fields(line);
+		std::string name;
+		int transactions;
+		int bytes;
+		if (!(fields >> name >> transactions >> bytes)) {
+			std::fprintf(stderr, "invalid baseline line: %s\n", line.c_str());
+			regressions++;
+			continue;
+		}
+
+		auto summary = std::find_if(summaries.begin(), summaries.end(), [&name](const CallSummary& summary) {
+			return summary.name == name;
+		});
+		if (summary == summaries.end()) {
+			continue;
+		}
+
+		if ((summary->maxTransactions > transactions) || (summary->maxBytes > bytes)) {
+			std::printf("REGRESSION %s: %d transactions, %d bytes (baseline %d transactions, %d bytes)\n", name.c_str(),
+					summary->maxTransactions, summary->maxBytes, transactions, bytes);
+			regressions++;
+		} else if ((summary->maxTransactions < transactions) || (summary->maxBytes < bytes)) {
+			std::printf("improved %s: %d transactions, %d bytes (baseline %d transactions, %d bytes), update the baseline\n",
+					name.c_str(), summary->maxTransactions, summary->maxBytes, transactions, bytes);
+		}
+	}
+
+	return regressions;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		const std::string option = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if ((option == "--record") && hasValue) {
+			options.recordPath = argv[++i];
+		} else if ((option == "--replay") && hasValue) {
+			options.replayPath = argv[++i];
+		} else if ((option == "--baseline") && hasValue) {
+			options.baselinePath = argv[++i];
+		} else if ((option == "--write-baseline") && hasValue) {
+			options.writeBaselinePath = argv[++i];
+		} else if ((option == "--iterations") && hasValue) {
+			options.iterations = std::atoi(argv[++i]);
+		} else {
+			printUsage();
+			return 2;
+		}
+	}
+
+	SpiRecording replayed;
+	if (!options.replayPath.empty() && !replayed.load(options.replayPath)) {
+		std::fprintf(stderr, "cannot read recording %s\n", options.replayPath.c_str());
+		return 1;
+	}
+
+	// the board is attached to the model of the chip or to the replayed recording, the serial link is not used
+	Field field;
+	field.addCard(createCard("1k", {}));
+	field.addCard(createCard("ntag213", {}));
+	Mfrc522Model model(field, Mfrc522Model::Options());
+	SpiReplay replay(replayed.getTransactions());
+	Uart uart(-1, Uart::Options());
+	Board board(uart, options.replayPath.empty() ? (SpiDevice&)model : (SpiDevice&)replay, Board::Options());
+
+	SpiRecording result;
+	recording = &result;
+	MFRC522 driver;
+	driver.spiRecorder = recordTransaction;
+	Calls calls(driver);
+	const int failures = options.replayPath.empty() ? runScenario(calls, field, options.iterations) : replayCalls(calls, replayed);
+
+	if (!options.replayPath.empty() && (replay.hasDiverged() || !replay.isCompleted())) {
+		std::fprintf(stderr, "driver diverged from the recording: %s\n",
+				replay.hasDiverged() ? replay.getDivergence().c_str() : "recorded transactions were not replayed");
+		return 1;
+	}
+
+	if (!options.recordPath.empty() && !result.save(options.recordPath)) {
+		std::fprintf(stderr, "cannot write recording %s\n", options.recordPath.c_str());
+		return 1;
+	}
+
+	const std::vector<CallSummary> summaries = summarize(result);
+	printSummary(summaries);
+	if (!options.writeBaselinePath.empty() && !writeBaseline(options.writeBaselinePath, summaries)) {
+		std::fprintf(stderr, "cannot write baseline %s\n", options.writeBaselinePath.c_str());
+		return 1;
+	}
+
+	const int regressions = options.baselinePath.empty() ? 0 : checkBaseline(options.baselinePath, summaries);
+	if ((failures > 0) || (regressions > 0)) {
+		std::fprintf(stderr, "%d call(s) failed, bus traffic of %d call(s) increased\n", failures, regressions);
+		return 1;
+	}
+
+	return 0;
+}
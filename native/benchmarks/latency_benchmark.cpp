@@ -0,0 +1,480 @@
+// End-to-end latency benchmark of the reader: detection of a card, single block reads and writes,
+// reads of sector trailers and a full dump of a MIFARE Classic 1K card. Commands are executed one at
+// a time against the emulator (simulated link speed and RF timing) or a reader attached to a serial
+// port. Percentiles are printed as a table and optionally written to a JSON file.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <mfreader/card_reader.h>
+
+#include "emulator_process.h"
+
+using namespace mfreader;
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+// Time to wait for the emulator, detection of a card in the emulator and presentation of a real card
+const std::chrono::milliseconds EMULATOR_TIMEOUT {5000};
+const std::chrono::milliseconds DETECTION_TIMEOUT {5000};
+const std::chrono::milliseconds PRESENTATION_TIMEOUT {30000};
+
+// Number of blocks of MIFARE Classic 1K
+const int BLOCK_COUNT_1K = 64;
+
+struct Options {
+	std::string emulatorPath;
+	std::vector<std::string> emulatorArguments;
+	std::string portPath;
+	std::string outputPath;
+	uint32_t linkSpeed = 115200;
+	int iterations = 100;
+	int detections = -1;
+	int block = 4;
+	std::array<uint8_t, 6> key {{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}};
+};
+
+/********************************************************************************
+ * Samples of a benchmark in microseconds.
+ ********************************************************************************/
+struct Benchmark {
+	std::string name;
+	std::vector<double> samples;
+	int failures = 0;
+
+	// Mean execution time reported by the reader per sample (negative if not available)
+	double deviceTime = -1;
+
+	// Transmission time of the command and its response at the link speed (negative if not available)
+	double wireTime = -1;
+
+	// Returns percentile of samples by nearest rank
+	double getPercentile(double percentile) const {
+		std::vector<double> sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		const size_t rank = (size_t)std::ceil(percentile / 100 * sorted.size());
+		return sorted[std::max<size_t>(rank, 1) - 1];
+	}
+
+	double getMean() const {
+		double sum = 0;
+		for (double sample : samples) {
+			sum += sample;
+		}
+		return sum / samples.size();
+	}
+};
+
+/********************************************************************************
+ * Times of detection of cards reported by the reader.
+ ********************************************************************************/
+class Detections {
+public:
+	void add(const CardInfo* card) {
+		if (card == nullptr) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		detections.push_back(std::make_pair(*card, Clock::now()));
+		condition.notify_all();
+	}
+
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		detections.clear();
+	}
+
+	// Waits for detection of a card, returns whether a card has been detected
+	bool waitFor(std::chrono::milliseconds timeout, CardInfo& card, Clock::time_point& time) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!condition.wait_for(lock, timeout, [this] {
+			return !detections.empty();
+		})) {
+			return false;
+		}
+
+		card = detections.front().first;
+		time = detections.front().second;
+		detections.erase(detections.begin());
+		return true;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<std::pair<CardInfo, Clock::time_point>> detections;
+};
+
+double getMicroseconds(Clock::duration duration) {
+	return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+void printUsage() {
+	std::fprintf(stderr,
+			"usage: latency_benchmark (--emulator PATH | --port PATH) [options] [-- EMULATOR OPTIONS]\n"
+			"  --emulator PATH         runs the emulator with a MIFARE Classic 1K card (emulator options\n"
+			"                          such as --rf-latency follow --)\n"
+			"  --port PATH             uses a reader attached to the serial port (the card is presented\n"
+			"                          when prompted)\n"
+			"  --link-speed N          link speed during the benchmark (default 115200)\n"
+			"  --iterations N          samples of each benchmark (default 100)\n"
+			"  --detections N          samples of detection (default iterations with the emulator,\n"
+			"                          0 with a reader)\n"
+			"  --block N               data block that is read and written (default 4)\n"
+			"  --key HEX               key A of the card (default FFFFFFFFFFFF)\n"
+			"  --output PATH           writes results as JSON\n");
+}
+
+bool parseKey(const std::string& text, std::array<uint8_t, 6>& key) {
+	if (text.size() != 2 * key.size()) {
+		return false;
+	}
+
+	for (size_t i = 0; i < key.size(); i++) {
+		char* end;
+		const std::string byte = text.substr(2 * i, 2);
+		key[i] = (uint8_t)std::strtoul(byte.c_str(), &end, 16);
+		if (*end != '\0') {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+	for (int i = 1; i < argc; i++) {
+		const std::string option = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (option == "--") {
+			options.emulatorArguments.assign(argv + i + 1, argv + argc);
+			break;
+		} else if ((option == "--emulator") && hasValue) {
+			options.emulatorPath = argv[++i];
+		} else if ((option == "--port") && hasValue) {
+			options.portPath = argv[++i];
+		} else if ((option == "--link-speed") && hasValue) {
+			options.linkSpeed = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+		} else if ((option == "--iterations") && hasValue) {
+			options.iterations = std::atoi(argv[++i]);
+		} else if ((option == "--detections") && hasValue) {
+			options.detections = std::atoi(argv[++i]);
+		} else if ((option == "--block") && hasValue) {
+			options.block = std::atoi(argv[++i]);
+		} else if ((option == "--key") && hasValue) {
+			if (!parseKey(argv[++i], options.key)) {
+				return false;
+			}
+		} else if ((option == "--output") && hasValue) {
+			options.outputPath = argv[++i];
+		} else {
+			return false;
+		}
+	}
+
+	// a data block of the 1K card (manufacturer block and sector trailers are excluded)
+	const bool validBlock = (options.block > 0) && (options.block < BLOCK_COUNT_1K) && ((options.block % 4) != 3);
+	return (options.emulatorPath.empty() != options.portPath.empty()) && validBlock && (options.iterations > 0)
+			&& SerialPort::isSupportedBaudRate(options.linkSpeed);
+}
+
+/********************************************************************************
+ * Benchmark of the reader.
+ ********************************************************************************/
+class LatencyBenchmark {
+public:
+	LatencyBenchmark(CardReader& reader, SerialPort& port, Detections& detections, const Options& options) :
+			reader(reader), port(port), detections(detections), options(options) {
+	}
+
+	// Measures detection of the card and the first read after detection. The card is presented by
+	// the callback, samples of detection are recorded if the time of presentation is known.
+	bool measureDetection(int count, std::function<bool(int index, Clock::time_point& presentationTime)> present) {
+		Benchmark detection;
+		detection.name = "DETECTION";
+		Benchmark firstData;
+		firstData.name = "DETECTION_TO_FIRST_DATA";
+		for (int i = 0; i < std::max(count, 1); i++) {
+			// the active card is released and the key is set for the next card
+			reader.resetCard().get();
+			if (!reader.setKey(KeyType::KEY_A, options.key).get().ok()) {
+				return false;
+			}
+
+			detections.clear();
+			Clock::time_point presentationTime {};
+			if (!present(i, presentationTime)) {
+				return false;
+			}
+
+			CardInfo card;
+			Clock::time_point detectionTime;
+			if (!detections.waitFor(options.emulatorPath.empty() ? PRESENTATION_TIMEOUT : DETECTION_TIMEOUT, card, detectionTime)) {
+				std::fprintf(stderr, "no card detected\n");
+				return false;
+			}
+
+			if (card.type != CardType::MIFARE_1K) {
+				std::fprintf(stderr, "card is not MIFARE Classic 1K\n");
+				return false;
+			}
+
+			const bool ok = reader.readBlock(options.block).get().ok();
+			if (count == 0) {
+				return ok;
+			}
+
+			if (presentationTime != Clock::time_point()) {
+				detection.samples.push_back(getMicroseconds(detectionTime - presentationTime));
+			}
+
+			firstData.samples.push_back(getMicroseconds(Clock::now() - detectionTime));
+			firstData.failures += ok ? 0 : 1;
+		}
+
+		if (!detection.samples.empty()) {
+			results.push_back(detection);
+		}
+
+		results.push_back(firstData);
+		return true;
+	}
+
+	// Measures a command executed by the function (only one command is in flight)
+	void measureCommand(const std::string& name, CommandCode code, size_t requestLength, size_t responseLength,
+			std::function<std::vector<std::future<Response>>(int iteration)> execute) {
+		Benchmark benchmark;
+		benchmark.name = name;
+		reader.readCommandStatistics(code, true).get();
+		for (int i = 0; i < options.iterations; i++) {
+			const Clock::time_point start = Clock::now();
+			std::vector<std::future<Response>> responses = execute(i);
+			bool ok = true;
+			for (std::future<Response>& response : responses) {
+				ok = response.get().ok() && ok;
+			}
+
+			benchmark.samples.push_back(getMicroseconds(Clock::now() - start));
+			benchmark.failures += ok ? 0 : 1;
+		}
+
+		CommandStatistics statistics;
+		if (CommandStatistics::decode(reader.readCommandStatistics(code).get(), statistics)) {
+			benchmark.deviceTime = (double)statistics.totalTime / options.iterations;
+		}
+
+		// classic framing: 10 bits per byte of both frames (messages of chunked responses are not estimated)
+		if (requestLength > 0) {
+			const size_t bytes = gep::getFrameLength(requestLength, true) + gep::getFrameLength(responseLength, true);
+			benchmark.wireTime = bytes * 10 * 1e6 / port.getBaudRate();
+		}
+
+		results.push_back(benchmark);
+	}
+
+	const std::vector<Benchmark>& getResults() const {
+		return results;
+	}
+
+private:
+	CardReader& reader;
+	SerialPort& port;
+	Detections& detections;
+	const Options& options;
+	std::vector<Benchmark> results;
+};
+
+std::string formatTime(double microseconds) {
+	char buffer[32];
+	if (microseconds < 0) {
+		return "-";
+	}
+
+	std::snprintf(buffer, sizeof(buffer), "%.2f", microseconds / 1000);
+	return buffer;
+}
+
+void printResults(const std::vector<Benchmark>& results) {
+	std::printf("%-24s %7s %5s %9s %9s %9s %9s %9s %9s %9s %9s\n", "benchmark (ms)", "samples", "fail", "min", "p50", "p90",
+			"p99", "max", "mean", "device", "wire");
+	for (const Benchmark& benchmark : results) {
+		std::printf("%-24s %7zu %5d %9s %9s %9s %9s %9s %9s %9s %9s\n", benchmark.name.c_str(), benchmark.samples.size(),
+				benchmark.failures, formatTime(benchmark.getPercentile(0)).c_str(), formatTime(benchmark.getPercentile(50)).c_str(),
+				formatTime(benchmark.getPercentile(90)).c_str(), formatTime(benchmark.getPercentile(99)).c_str(),
+				formatTime(benchmark.getPercentile(100)).c_str(), formatTime(benchmark.getMean()).c_str(),
+				formatTime(benchmark.deviceTime).c_str(), formatTime(benchmark.wireTime).c_str());
+	}
+}
+
+// Writes results in microseconds (null if a value is not available)
+bool writeResults(const std::string& path, const Options& options, const std::vector<Benchmark>& results) {
+	FILE* file = std::fopen(path.c_str(), "w");
+	if (file == nullptr) {
+		return false;
+	}
+
+	const auto formatValue = [](double value) {
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), (value < 0) ? "null" : "%.1f", value);
+		return std::string(buffer);
+	};
+
+	std::fprintf(file, "{\n");
+	std::fprintf(file, "  \"target\": \"%s\",\n", options.emulatorPath.empty() ? "reader" : "emulator");
+	std::fprintf(file, "  \"linkSpeed\": %u,\n", options.linkSpeed);
+	std::fprintf(file, "  \"unit\": \"us\",\n");
+	std::fprintf(file, "  \"benchmarks\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const Benchmark& benchmark = results[i];
+		std::fprintf(file, "    {\"name\": \"%s\", \"samples\": %zu, \"failures\": %d, \"min\": %s, \"p50\": %s, \"p90\": %s, "
+				"\"p99\": %s, \"max\": %s, \"mean\": %s, \"device\": %s, \"wire\": %s}%s\n", benchmark.name.c_str(),
+				benchmark.samples.size(), benchmark.failures, formatValue(benchmark.getPercentile(0)).c_str(),
+				formatValue(benchmark.getPercentile(50)).c_str(), formatValue(benchmark.getPercentile(90)).c_str(),
+				formatValue(benchmark.getPercentile(99)).c_str(), formatValue(benchmark.getPercentile(100)).c_str(),
+				formatValue(benchmark.getMean()).c_str(), formatValue(benchmark.deviceTime).c_str(),
+				formatValue(benchmark.wireTime).c_str(), (i + 1 < results.size()) ? "," : "");
+	}
+
+	std::fprintf(file, "  ]\n");
+	std::fprintf(file, "}\n");
+	return std::fclose(file) == 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		printUsage();
+		return 2;
+	}
+
+	if (options.detections < 0) {
+		options.detections = options.emulatorPath.empty() ? 0 : options.iterations;
+	}
+
+	// the emulator starts with the card outside of the field, its placement is measured
+	std::unique_ptr<EmulatorProcess> emulator;
+	std::string portPath = options.portPath;
+	if (!options.emulatorPath.empty()) {
+		std::vector<std::string> arguments = {"--card", "1k", "--place", "-1"};
+		arguments.insert(arguments.end(), options.emulatorArguments.begin(), options.emulatorArguments.end());
+		emulator.reset(new EmulatorProcess(options.emulatorPath, arguments));
+		portPath = emulator->waitForLink(EMULATOR_TIMEOUT);
+		if (portPath.empty()) {
+			std::fprintf(stderr, "emulator failed to start\n");
+			return 1;
+		}
+	}
+
+	std::unique_ptr<SerialPort> port;
+	try {
+		port.reset(new SerialPort(portPath, DEFAULT_LINK_SPEED));
+	} catch (const std::system_error& error) {
+		std::fprintf(stderr, "%s: %s\n", portPath.c_str(), error.what());
+		return 1;
+	}
+
+	IoLoop loop;
+	loop.start();
+	CardReader reader(loop, *port);
+	Detections detections;
+	reader.setCardListener([&detections](const CardInfo* card) {
+		detections.add(card);
+	});
+
+	if ((options.linkSpeed != DEFAULT_LINK_SPEED) && !reader.setLinkSpeed(options.linkSpeed, false).get().ok()) {
+		std::fprintf(stderr, "failed to switch link speed\n");
+		return 1;
+	}
+
+	LatencyBenchmark benchmark(reader, *port, detections, options);
+	bool ok;
+	if (emulator) {
+		ok = benchmark.measureDetection(options.detections, [&emulator](int index, Clock::time_point& presentationTime) {
+			emulator->send("remove");
+			emulator->readLine(EMULATOR_TIMEOUT);
+			presentationTime = Clock::now();
+			emulator->send("place 0");
+			return !emulator->readLine(EMULATOR_TIMEOUT).empty();
+		});
+	} else {
+		// the time of presentation of a real card is not known, only the first read is measured
+		ok = benchmark.measureDetection(options.detections, [&options](int index, Clock::time_point& presentationTime) {
+			std::fprintf(stderr, "present MIFARE Classic 1K card (%d/%d)\n", index + 1, std::max(options.detections, 1));
+			return true;
+		});
+	}
+
+	if (!ok) {
+		return 1;
+	}
+
+	const int block = options.block;
+	const int sectorCount = BLOCK_COUNT_1K / 4;
+	benchmark.measureCommand("READ_BLOCK", CommandCode::READ_BLOCK, 3, 17, [&reader, block](int iteration) {
+		std::vector<std::future<Response>> responses;
+		responses.push_back(reader.readBlock(block));
+		return responses;
+	});
+
+	benchmark.measureCommand("WRITE_BLOCK", CommandCode::WRITE_BLOCK, 19, 1, [&reader, block](int iteration) {
+		std::vector<uint8_t> data(16);
+		for (size_t i = 0; i < data.size(); i++) {
+			data[i] = (uint8_t)(iteration + i);
+		}
+
+		std::vector<std::future<Response>> responses;
+		responses.push_back(reader.writeBlock(block, data));
+		return responses;
+	});
+
+	benchmark.measureCommand("READ_SECTOR_TRAILER", CommandCode::READ_SECTOR_TRAILER, 3, 18, [&reader, sectorCount](int iteration) {
+		std::vector<std::future<Response>> responses;
+		responses.push_back(reader.readSectorTrailer(iteration % sectorCount));
+		return responses;
+	});
+
+	// the dump is read by pipelined commands with chunked responses
+	benchmark.measureCommand("DUMP_1K", CommandCode::READ_BLOCKS, 0, 0, [&reader](int iteration) {
+		std::vector<std::future<Response>> responses;
+		for (int block = 0; block < BLOCK_COUNT_1K; block += MAX_BLOCKS_PER_STREAM) {
+			responses.push_back(reader.readBlocks(block, MAX_BLOCKS_PER_STREAM));
+		}
+		return responses;
+	});
+
+	if (options.linkSpeed != DEFAULT_LINK_SPEED) {
+		reader.setLinkSpeed(DEFAULT_LINK_SPEED, false).get();
+	}
+
+	printResults(benchmark.getResults());
+	if (!options.outputPath.empty() && !writeResults(options.outputPath, options, benchmark.getResults())) {
+		std::fprintf(stderr, "cannot write %s\n", options.outputPath.c_str());
+		return 1;
+	}
+
+	// failed commands are reported as failure of the benchmark
+	for (const Benchmark& result : benchmark.getResults()) {
+		if (result.failures > 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,161 @@
+#ifndef MFREADER_EMULATOR_ARDUINO_H
+#define MFREADER_EMULATOR_ARDUINO_H
+
+// Subset of the Arduino core used by the firmware, implemented by the emulated board
+
+// Standard headers are included before the data model is adjusted below
+#include <ctype.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint16_t word;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// Program memory is ordinary memory
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(address) (*(const uint8_t*)(address))
+#define pgm_read_word(address) (*(const uint16_t*)(address))
+#define memcpy_P memcpy
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+// Time (32-bit counters wrap around as on the board)
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(unsigned int us);
+
+// Interrupts (the emulated board has no concurrent interrupt handlers)
+#define interrupts()
+#define noInterrupts()
+
+// Digital pins
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+/********************************************************************************
+ * Output of text and binary data.
+ ********************************************************************************/
+class Print {
+public:
+	virtual ~Print() {
+	}
+
+	virtual size_t write(uint8_t value) = 0;
+	virtual size_t write(const uint8_t* buffer, size_t size);
+
+	size_t write(const char* text) {
+		return (text == nullptr) ? 0 : write((const uint8_t*)text, strlen(text));
+	}
+
+	size_t write(const char* buffer, size_t size) {
+		return write((const uint8_t*)buffer, size);
+	}
+
+	virtual int availableForWrite() {
+		return 0;
+	}
+
+	virtual void flush() {
+	}
+
+	size_t print(const __FlashStringHelper* text);
+	size_t print(const char* text);
+	size_t print(char value);
+	size_t print(unsigned char value, int base = DEC);
+	size_t print(int value, int base = DEC);
+	size_t print(unsigned int value, int base = DEC);
+	size_t print(long value, int base = DEC);
+	size_t print(unsigned long value, int base = DEC);
+	size_t print(double value, int digits = 2);
+
+	size_t println();
+	size_t println(const __FlashStringHelper* text);
+	size_t println(const char* text);
+	size_t println(char value);
+	size_t println(unsigned char value, int base = DEC);
+	size_t println(int value, int base = DEC);
+	size_t println(unsigned int value, int base = DEC);
+	size_t println(long value, int base = DEC);
+	size_t println(unsigned long value, int base = DEC);
+	size_t println(double value, int digits = 2);
+
+private:
+	size_t printNumber(unsigned long value, int base);
+};
+
+/********************************************************************************
+ * Stream of bytes.
+ ********************************************************************************/
+class Stream: public Print {
+public:
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() = 0;
+};
+
+/********************************************************************************
+ * Serial port of the board (backed by the emulated UART).
+ ********************************************************************************/
+class HardwareSerial: public Stream {
+public:
+	void begin(unsigned long baudRate);
+	void begin(unsigned long baudRate, uint8_t config) {
+		begin(baudRate);
+	}
+
+	void end();
+	int available() override;
+	int read() override;
+	int peek() override;
+	int availableForWrite() override;
+	void flush() override;
+	size_t write(uint8_t value) override;
+	using Print::write;
+
+	operator bool() {
+		return true;
+	}
+};
+
+extern HardwareSerial Serial;
+
+#ifndef min
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+#define constrain(x, low, high) ((x) < (low) ? (low) : ((x) > (high) ? (high) : (x)))
+
+// The firmware is written for AVR where long has 32 bits (e.g., 4-byte values of MIFARE value
+// blocks rely on sign extension of long), int is used as the 32-bit type on the LP64 host. No
+// header may be included after this point (all standard headers are included above).
+#define long int
+
+#endif
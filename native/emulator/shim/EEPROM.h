@@ -0,0 +1,19 @@
+#ifndef MFREADER_EMULATOR_EEPROM_H
+#define MFREADER_EMULATOR_EEPROM_H
+
+#include <Arduino.h>
+
+/********************************************************************************
+ * EEPROM of the board.
+ ********************************************************************************/
+class EEPROMClass {
+public:
+	uint8_t read(int address);
+	void write(int address, uint8_t value);
+	void update(int address, uint8_t value);
+	uint16_t length();
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
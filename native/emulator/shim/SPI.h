@@ -0,0 +1,48 @@
+#ifndef MFREADER_EMULATOR_SPI_H
+#define MFREADER_EMULATOR_SPI_H
+
+#include <Arduino.h>
+
+#define SPI_CLOCK_DIV4 0x00
+#define SPI_CLOCK_DIV16 0x01
+#define SPI_CLOCK_DIV64 0x02
+#define SPI_CLOCK_DIV128 0x03
+#define SPI_CLOCK_DIV2 0x04
+#define SPI_CLOCK_DIV8 0x05
+#define SPI_CLOCK_DIV32 0x06
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+/********************************************************************************
+ * Settings of SPI transaction (the emulated bus ignores them).
+ ********************************************************************************/
+class SPISettings {
+public:
+	SPISettings() {
+	}
+
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {
+	}
+};
+
+/********************************************************************************
+ * SPI bus of the board (bytes are exchanged with the selected emulated device).
+ ********************************************************************************/
+class SPIClass {
+public:
+	void begin();
+	void end();
+	void beginTransaction(SPISettings settings);
+	void endTransaction();
+	uint8_t transfer(uint8_t data);
+};
+
+extern SPIClass SPI;
+
+#endif
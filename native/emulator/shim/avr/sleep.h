@@ -0,0 +1,20 @@
+#ifndef MFREADER_EMULATOR_AVR_SLEEP_H
+#define MFREADER_EMULATOR_AVR_SLEEP_H
+
+#include <stdint.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+#define SLEEP_MODE_PWR_DOWN 2
+#define SLEEP_MODE_PWR_SAVE 3
+#define SLEEP_MODE_STANDBY 6
+#define SLEEP_MODE_EXT_STANDBY 7
+
+// Sleep modes of the board (the board sleeps in idle mode until the next interrupt: overflow of timer 0,
+// reception or transmission of a byte)
+void set_sleep_mode(uint8_t mode);
+void sleep_enable();
+void sleep_disable();
+void sleep_cpu();
+
+#endif
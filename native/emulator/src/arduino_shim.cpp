@@ -0,0 +1,263 @@
+// The board is included first: headers of the shim adjust the data model for the firmware
+#include "board.h"
+
+#include <cstdio>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <SPI.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#undef long
+#undef min
+#undef max
+
+using mfreader::emulator::Board;
+
+HardwareSerial Serial;
+SPIClass SPI;
+EEPROMClass EEPROM;
+
+//----------------------------------------------------------------------
+// Time and pins
+//----------------------------------------------------------------------
+
+uint32_t millis() {
+	return Board::getInstance().getMillis();
+}
+
+uint32_t micros() {
+	return Board::getInstance().getMicros();
+}
+
+void delay(uint32_t ms) {
+	Board::getInstance().delay(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+	Board::getInstance().delay(std::chrono::microseconds(us));
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+	Board::getInstance().writePin(pin, value);
+}
+
+int digitalRead(uint8_t pin) {
+	return Board::getInstance().readPin(pin);
+}
+
+//----------------------------------------------------------------------
+// Print
+//----------------------------------------------------------------------
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+	size_t count = 0;
+	while (size-- > 0) {
+		count += write(*buffer++);
+	}
+
+	return count;
+}
+
+size_t Print::printNumber(unsigned long value, int base) {
+	char buffer[8 * sizeof(value) + 1];
+	char* text = &buffer[sizeof(buffer) - 1];
+	*text = '\0';
+	if (base < 2) {
+		base = 10;
+	}
+
+	do {
+		const int digit = (int)(value % base);
+		value /= base;
+		*--text = (char)((digit < 10) ? '0' + digit : 'A' + digit - 10);
+	} while (value > 0);
+
+	return write(text);
+}
+
+size_t Print::print(const __FlashStringHelper* text) {
+	return write(reinterpret_cast<const char*>(text));
+}
+
+size_t Print::print(const char* text) {
+	return write(text);
+}
+
+size_t Print::print(char value) {
+	return write((uint8_t)value);
+}
+
+size_t Print::print(unsigned char value, int base) {
+	return printNumber(value, base);
+}
+
+size_t Print::print(int value, int base) {
+	return print((long)value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+	return printNumber(value, base);
+}
+
+size_t Print::print(long value, int base) {
+	if ((base == 10) && (value < 0)) {
+		return write('-') + printNumber(-(unsigned long)value, 10);
+	}
+
+	// numbers in other bases are printed as unsigned 32-bit numbers of the board
+	return printNumber((base == 10) ? (unsigned long)value : (uint32_t)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+	return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits) {
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+	return write(buffer);
+}
+
+size_t Print::println() {
+	return write("\r\n");
+}
+
+size_t Print::println(const __FlashStringHelper* text) {
+	return print(text) + println();
+}
+
+size_t Print::println(const char* text) {
+	return print(text) + println();
+}
+
+size_t Print::println(char value) {
+	return print(value) + println();
+}
+
+size_t Print::println(unsigned char value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(int value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(unsigned int value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(long value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(unsigned long value, int base) {
+	return print(value, base) + println();
+}
+
+size_t Print::println(double value, int digits) {
+	return print(value, digits) + println();
+}
+
+//----------------------------------------------------------------------
+// HardwareSerial
+//----------------------------------------------------------------------
+
+void HardwareSerial::begin(unsigned long baudRate) {
+	Board::getInstance().getUart().begin((uint32_t)baudRate);
+}
+
+void HardwareSerial::end() {
+	Board::getInstance().getUart().end();
+}
+
+int HardwareSerial::available() {
+	return Board::getInstance().getUart().available();
+}
+
+int HardwareSerial::read() {
+	return Board::getInstance().getUart().read();
+}
+
+int HardwareSerial::peek() {
+	return Board::getInstance().getUart().peek();
+}
+
+int HardwareSerial::availableForWrite() {
+	return Board::getInstance().getUart().availableForWrite();
+}
+
+void HardwareSerial::flush() {
+	Board::getInstance().getUart().flush();
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+	return Board::getInstance().getUart().write(value);
+}
+
+//----------------------------------------------------------------------
+// SPI, EEPROM, watchdog and sleep
+//----------------------------------------------------------------------
+
+void SPIClass::begin() {
+}
+
+void SPIClass::end() {
+}
+
+void SPIClass::beginTransaction(SPISettings settings) {
+}
+
+void SPIClass::endTransaction() {
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+	return Board::getInstance().transferSpi(data);
+}
+
+uint8_t EEPROMClass::read(int address) {
+	return Board::getInstance().readEeprom(address);
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+	Board::getInstance().writeEeprom(address, value);
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+	if (read(address) != value) {
+		write(address, value);
+	}
+}
+
+uint16_t EEPROMClass::length() {
+	return Board::EEPROM_SIZE;
+}
+
+void wdt_enable(uint8_t timeout) {
+	Board::getInstance().enableWatchdog(timeout);
+}
+
+void wdt_disable() {
+	Board::getInstance().disableWatchdog();
+}
+
+void wdt_reset() {
+	Board::getInstance().resetWatchdog();
+}
+
+void set_sleep_mode(uint8_t mode) {
+}
+
+void sleep_enable() {
+}
+
+void sleep_disable() {
+}
+
+void sleep_cpu() {
+	Board::getInstance().sleep();
+}
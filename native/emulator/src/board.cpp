@@ -0,0 +1,126 @@
+#include "board.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+
+namespace mfreader {
+namespace emulator {
+
+Board* Board::instance = nullptr;
+
+Board::Board(Uart& uart, SpiDevice& reader, Options options) :
+		uart(uart), reader(reader), options(options), startTime(Clock::now()), eeprom(EEPROM_SIZE, 0xFF) {
+	if (!options.eepromPath.empty()) {
+		FILE* file = std::fopen(options.eepromPath.c_str(), "rb");
+		if (file != nullptr) {
+			const size_t count = std::fread(eeprom.data(), 1, eeprom.size(), file);
+			std::fclose(file);
+			if (count != eeprom.size()) {
+				throw std::runtime_error("invalid EEPROM file " + options.eepromPath);
+			}
+		}
+	}
+
+	instance = this;
+}
+
+Board::~Board() {
+	instance = nullptr;
+}
+
+Board& Board::getInstance() {
+	return *instance;
+}
+
+uint32_t Board::getMillis() const {
+	return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - startTime + options.uptime).count();
+}
+
+uint32_t Board::getMicros() const {
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - startTime + options.uptime).count();
+}
+
+void Board::delay(std::chrono::microseconds time) {
+	std::this_thread::sleep_for(time);
+	checkWatchdog();
+}
+
+void Board::writePin(uint8_t pin, uint8_t value) {
+	if (pin >= pins.size()) {
+		return;
+	}
+
+	const uint8_t previousValue = pins[pin];
+	pins[pin] = value;
+	if (pin == READER_SELECT_PIN) {
+		// slave select is active low
+		reader.select(value == 0);
+	} else if ((pin == READER_RESET_PIN) && (previousValue != value)) {
+		reader.setResetPin(value != 0);
+	}
+}
+
+int Board::readPin(uint8_t pin) const {
+	return (pin < pins.size()) ? pins[pin] : 0;
+}
+
+uint8_t Board::transferSpi(uint8_t value) {
+	spinUntil(Clock::now() + options.spiByteTime);
+	return reader.transfer(value);
+}
+
+uint8_t Board::readEeprom(int address) const {
+	return ((address >= 0) && (address < EEPROM_SIZE)) ? eeprom[address] : 0;
+}
+
+void Board::writeEeprom(int address, uint8_t value) {
+	if ((address < 0) || (address >= EEPROM_SIZE)) {
+		return;
+	}
+
+	eeprom[address] = value;
+	if (options.eepromPath.empty()) {
+		return;
+	}
+
+	// the file is written through to survive termination of the emulator
+	FILE* file = std::fopen(options.eepromPath.c_str(), "wb");
+	if (file != nullptr) {
+		std::fwrite(eeprom.data(), 1, eeprom.size(), file);
+		std::fclose(file);
+	}
+}
+
+void Board::enableWatchdog(uint8_t timeout) {
+	watchdogEnabled = true;
+	watchdogTimeout = std::chrono::milliseconds(15 << timeout);
+	watchdogDeadline = Clock::now() + watchdogTimeout;
+}
+
+void Board::disableWatchdog() {
+	watchdogEnabled = false;
+}
+
+void Board::resetWatchdog() {
+	watchdogDeadline = Clock::now() + watchdogTimeout;
+}
+
+void Board::sleep() {
+	const Clock::time_point start = Clock::now();
+	uart.waitForEvent(std::min(start + TIMER_OVERFLOW_PERIOD, uart.getNextEventTime()));
+	sleepCount++;
+	sleepTime += Clock::now() - start;
+}
+
+void Board::checkWatchdog() {
+	if (watchdogEnabled && (Clock::now() > watchdogDeadline)) {
+		std::fprintf(stderr, "watchdog expired, the firmware is not responsive\n");
+		std::exit(3);
+	}
+}
+
+} // namespace emulator
+} // namespace mfreader
@@ -0,0 +1,123 @@
+#ifndef MFREADER_EMULATOR_BOARD_H
+#define MFREADER_EMULATOR_BOARD_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "clock.h"
+#include "spi_device.h"
+#include "uart.h"
+
+namespace mfreader {
+namespace emulator {
+
+/********************************************************************************
+ * Emulated Arduino board with the MFRC522 attached to the SPI bus (slave select
+ * on pin 10, reset on pin 9 as wired by the sketch). The functions of the
+ * Arduino core used by the firmware are implemented by the board.
+ ********************************************************************************/
+class Board {
+public:
+	struct Options {
+		// Time of transfer of a byte over SPI including overhead of the core (SPI_CLOCK_DIV4 on 16 MHz
+		// board), the driver of MFRC522 counts polls of registers to detect unresponsive chip
+		std::chrono::nanoseconds spiByteTime {6000};
+
+		// File backing the EEPROM (empty - the EEPROM is erased at start)
+		std::string eepromPath;
+
+		// Time of the board at start (time counters of the board overflow after 2^32 ms or us)
+		std::chrono::milliseconds uptime {0};
+	};
+
+	// Period of overflow interrupts of timer 0 (millis() of the Arduino core at 16 MHz)
+	static constexpr std::chrono::microseconds TIMER_OVERFLOW_PERIOD {1024};
+
+	// Pins of the MFRC522
+	static constexpr uint8_t READER_SELECT_PIN = 10;
+	static constexpr uint8_t READER_RESET_PIN = 9;
+
+	// Size of EEPROM of ATmega328P
+	static constexpr int EEPROM_SIZE = 1024;
+
+	// Constructs the board (the board is used by the Arduino core while it exists)
+	Board(Uart& uart, SpiDevice& reader, Options options);
+	~Board();
+
+	Board(const Board&) = delete;
+	Board& operator=(const Board&) = delete;
+
+	// Returns the board used by the Arduino core
+	static Board& getInstance();
+
+	Uart& getUart() {
+		return uart;
+	}
+
+	// Time since start of the board
+	uint32_t getMillis() const;
+	uint32_t getMicros() const;
+	void delay(std::chrono::microseconds time);
+
+	// Digital pins
+	void writePin(uint8_t pin, uint8_t value);
+	int readPin(uint8_t pin) const;
+
+	// Exchanges a byte over SPI
+	uint8_t transferSpi(uint8_t value);
+
+	// EEPROM
+	uint8_t readEeprom(int address) const;
+	void writeEeprom(int address, uint8_t value);
+
+	// Watchdog (timeout is the prescaler index of WDTO_* constants)
+	void enableWatchdog(uint8_t timeout);
+	void disableWatchdog();
+	void resetWatchdog();
+
+	// Terminates the emulator if the watchdog expired
+	void checkWatchdog();
+
+	// Sleeps in idle mode until the next interrupt (overflow of timer 0, reception or transmission of a byte)
+	void sleep();
+
+	// Returns number of sleeps and total time spent sleeping
+	uint64_t getSleepCount() const {
+		return sleepCount;
+	}
+
+	Clock::duration getSleepTime() const {
+		return sleepTime;
+	}
+
+	// Returns time since start of the emulator
+	Clock::duration getRunTime() const {
+		return Clock::now() - startTime;
+	}
+
+private:
+	static Board* instance;
+
+	Uart& uart;
+	SpiDevice& reader;
+	Options options;
+	Clock::time_point startTime;
+
+	std::array<uint8_t, 20> pins {};
+	std::vector<uint8_t> eeprom;
+
+	uint64_t sleepCount = 0;
+	Clock::duration sleepTime {};
+
+	bool watchdogEnabled = false;
+	Clock::duration watchdogTimeout {};
+	Clock::time_point watchdogDeadline;
+};
+
+} // namespace emulator
+} // namespace mfreader
+
+#endif
@@ -0,0 +1,870 @@
+#include "card.h"
+
+#include <cstring>
+
+namespace mfreader {
+namespace emulator {
+
+namespace {
+
+// Commands of ISO/IEC 14443-3 and MIFARE cards
+const uint8_t CMD_REQA = 0x26;
+const uint8_t CMD_WUPA = 0x52;
+const uint8_t CMD_HLTA = 0x50;
+const uint8_t CMD_CASCADE_TAG = 0x88;
+const uint8_t CMD_SEL_CL1 = 0x93;
+const uint8_t CMD_SEL_CL2 = 0x95;
+const uint8_t CMD_SEL_CL3 = 0x97;
+const uint8_t CMD_MF_AUTH_KEY_B = 0x61;
+const uint8_t CMD_MF_READ = 0x30;
+const uint8_t CMD_MF_WRITE = 0xA0;
+const uint8_t CMD_MF_DECREMENT = 0xC0;
+const uint8_t CMD_MF_INCREMENT = 0xC1;
+const uint8_t CMD_MF_RESTORE = 0xC2;
+const uint8_t CMD_MF_TRANSFER = 0xB0;
+const uint8_t CMD_UL_WRITE = 0xA2;
+const uint8_t CMD_UL_GET_VERSION = 0x60;
+const uint8_t CMD_UL_FAST_READ = 0x3A;
+const uint8_t CMD_UL_PWD_AUTH = 0x1B;
+
+// NVB of select frame (7 bytes of the frame are sent)
+const uint8_t NVB_SELECT = 0x70;
+
+// SAK of incomplete uid (cascade bit)
+const uint8_t SAK_CASCADE = 0x04;
+
+// NAK of an operation denied by access conditions or authentication state
+const uint8_t NAK_NOT_ALLOWED = 0x04;
+
+// Times of programming the memory of cards
+const std::chrono::microseconds CLASSIC_WRITE_TIME {2500};
+const std::chrono::microseconds ULTRALIGHT_WRITE_TIME {4100};
+
+// Access conditions of data blocks indexed by C1 C2 C3 (masks of keys: 1 - key A, 2 - key B)
+const uint8_t DATA_READ[8] = {3, 3, 3, 2, 3, 2, 3, 0};
+const uint8_t DATA_WRITE[8] = {3, 0, 0, 2, 2, 0, 2, 0};
+const uint8_t DATA_INCREMENT[8] = {3, 0, 0, 0, 0, 0, 2, 0};
+const uint8_t DATA_DECREMENT[8] = {3, 3, 0, 0, 0, 0, 3, 0};
+
+// Access conditions of sector trailers indexed by C1 C2 C3
+const uint8_t TRAILER_KEY_A_WRITE[8] = {1, 1, 0, 2, 2, 0, 0, 0};
+const uint8_t TRAILER_ACCESS_READ[8] = {1, 1, 1, 3, 3, 3, 3, 3};
+const uint8_t TRAILER_ACCESS_WRITE[8] = {0, 1, 0, 2, 0, 2, 0, 0};
+const uint8_t TRAILER_KEY_B_READ[8] = {1, 1, 1, 0, 0, 0, 0, 0};
+const uint8_t TRAILER_KEY_B_WRITE[8] = {1, 1, 0, 2, 2, 0, 0, 0};
+
+// Default NDEF message of Ultralight and NTAG cards in TLV (URI record https://example.com)
+const uint8_t DEFAULT_NDEF_TLV[] = {
+	0x03, 0x10, 0xD1, 0x01, 0x0C, 0x55, 0x04,
+	'e', 'x', 'a', 'm', 'p', 'l', 'e', '.', 'c', 'o', 'm',
+	0xFE
+};
+
+int32_t decodeInt32(const uint8_t* data) {
+	return (int32_t)((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+}
+
+} // namespace
+
+uint16_t computeCrcA(const uint8_t* data, size_t length) {
+	uint16_t crc = 0x6363;
+	for (size_t i = 0; i < length; i++) {
+		uint8_t value = data[i] ^ (uint8_t)(crc & 0xFF);
+		value ^= (uint8_t)(value << 4);
+		crc = (crc >> 8) ^ ((uint16_t)value << 8) ^ ((uint16_t)value << 3) ^ (value >> 4);
+	}
+
+	return crc;
+}
+
+void appendCrcA(std::vector<uint8_t>& data) {
+	const uint16_t crc = computeCrcA(data.data(), data.size());
+	data.push_back((uint8_t)(crc & 0xFF));
+	data.push_back((uint8_t)(crc >> 8));
+}
+
+//----------------------------------------------------------------------
+// VirtualCard
+//----------------------------------------------------------------------
+
+VirtualCard::VirtualCard(const std::vector<uint8_t>& uid, uint16_t atqa, uint8_t sak) :
+		uid(uid), atqa(atqa), sak(sak) {
+}
+
+void VirtualCard::powerOn() {
+	state = State::IDLE;
+	halted = false;
+	cascadeLevel = 0;
+	resetSession();
+}
+
+void VirtualCard::fail() {
+	state = halted ? State::HALT : State::IDLE;
+	cascadeLevel = 0;
+	resetSession();
+}
+
+bool VirtualCard::ack(CardReply& reply) {
+	reply.data.assign(1, ACK);
+	reply.lastBits = 4;
+	return true;
+}
+
+bool VirtualCard::nak(CardReply& reply, uint8_t code) {
+	fail();
+	reply.data.assign(1, code);
+	reply.lastBits = 4;
+	return true;
+}
+
+bool VirtualCard::replyWithCrc(CardReply& reply, const uint8_t* data, size_t length) {
+	reply.data.assign(data, data + length);
+	appendCrcA(reply.data);
+	reply.lastBits = 0;
+	return true;
+}
+
+bool VirtualCard::transceive(const uint8_t* frame, size_t length, uint8_t lastBits, bool crypto1, CardReply& reply) {
+	reply = CardReply();
+	if (length == 0) {
+		return false;
+	}
+
+	// short frames (REQA and WUPA)
+	if ((lastBits == 7) && (length == 1)) {
+		const uint8_t command = frame[0] & 0x7F;
+		if (((command == CMD_REQA) && (state == State::IDLE)) || ((command == CMD_WUPA) && ((state == State::IDLE) || (state == State::HALT)))) {
+			halted = state == State::HALT;
+			state = State::READY;
+			cascadeLevel = 0;
+			resetSession();
+			reply.data = {(uint8_t)(atqa & 0xFF), (uint8_t)(atqa >> 8)};
+			return true;
+		}
+
+		if ((state == State::READY) || (state == State::ACTIVE)) {
+			fail();
+		}
+
+		return false;
+	}
+
+	switch (state) {
+		case State::IDLE:
+		case State::HALT:
+			return false;
+		case State::READY:
+			return handleCascadeLevel(frame, length, lastBits, reply);
+		case State::ACTIVE:
+			break;
+	}
+
+	// frames encrypted differently than expected by the card are garbage for the card
+	if ((lastBits != 0) || (crypto1 != isCrypto1Active()) || (length < 3)) {
+		fail();
+		return false;
+	}
+
+	if (computeCrcA(frame, length - 2) != (uint16_t)(frame[length - 2] | (frame[length - 1] << 8))) {
+		return nak(reply, NAK_CRC_ERROR);
+	}
+
+	if ((frame[0] == CMD_HLTA) && (length == 4) && (frame[1] == 0)) {
+		state = State::HALT;
+		halted = true;
+		resetSession();
+		return false;
+	}
+
+	return handleCommand(frame, length - 2, reply);
+}
+
+std::array<uint8_t, 4> VirtualCard::getCascadeLevelBytes(int level) const {
+	const int levels = (uid.size() == 4) ? 1 : ((uid.size() == 7) ? 2 : 3);
+	const uint8_t* levelUid = &uid[3 * level];
+	if (level < levels - 1) {
+		return {{CMD_CASCADE_TAG, levelUid[0], levelUid[1], levelUid[2]}};
+	}
+
+	return {{levelUid[0], levelUid[1], levelUid[2], levelUid[3]}};
+}
+
+bool VirtualCard::handleCascadeLevel(const uint8_t* frame, size_t length, uint8_t lastBits, CardReply& reply) {
+	const uint8_t selectCodes[3] = {CMD_SEL_CL1, CMD_SEL_CL2, CMD_SEL_CL3};
+	if ((length < 2) || (frame[0] != selectCodes[cascadeLevel])) {
+		fail();
+		return false;
+	}
+
+	// uid bytes of the level followed by BCC
+	const std::array<uint8_t, 4> levelBytes = getCascadeLevelBytes(cascadeLevel);
+	uint8_t levelData[5];
+	std::memcpy(levelData, levelBytes.data(), 4);
+	levelData[4] = levelBytes[0] ^ levelBytes[1] ^ levelBytes[2] ^ levelBytes[3];
+
+	const uint8_t nvb = frame[1];
+	if (nvb == NVB_SELECT) {
+		if ((lastBits != 0) || (length != 9) || (computeCrcA(frame, 7) != (uint16_t)(frame[7] | (frame[8] << 8)))
+				|| (std::memcmp(frame + 2, levelData, 5) != 0)) {
+			fail();
+			return false;
+		}
+
+		const int levels = (uid.size() == 4) ? 1 : ((uid.size() == 7) ? 2 : 3);
+		uint8_t replySak = SAK_CASCADE;
+		if (cascadeLevel + 1 < levels) {
+			cascadeLevel++;
+		} else {
+			state = State::ACTIVE;
+			replySak = sak;
+		}
+
+		return replyWithCrc(reply, &replySak, 1);
+	}
+
+	// anticollision: the reader sends known bits of the level, the card replies with the rest
+	const int knownBytes = (nvb >> 4) - 2;
+	const int knownBits = nvb & 0x0F;
+	if ((knownBytes < 0) || (knownBits > 7) || (knownBytes * 8 + knownBits >= 40) || (lastBits != knownBits)
+			|| (length != (size_t)(2 + knownBytes + (knownBits > 0 ? 1 : 0)))) {
+		fail();
+		return false;
+	}
+
+	if (std::memcmp(frame + 2, levelData, knownBytes) != 0) {
+		return false;
+	}
+
+	const uint8_t knownMask = (uint8_t)((1 << knownBits) - 1);
+	if ((knownBits > 0) && (((frame[2 + knownBytes] ^ levelData[knownBytes]) & knownMask) != 0)) {
+		return false;
+	}
+
+	// the first byte is aligned by the reader (RxAlign), its known bits are not sent
+	reply.data.assign(levelData + knownBytes, levelData + 5);
+	reply.data[0] &= (uint8_t)~knownMask;
+	reply.lastBits = 0;
+	return true;
+}
+
+//----------------------------------------------------------------------
+// ClassicCard
+//----------------------------------------------------------------------
+
+namespace {
+
+uint16_t getClassicAtqa(ClassicCard::Variant variant, size_t uidSize) {
+	const uint16_t uidSizeBits = (uidSize == 4) ? 0x00 : ((uidSize == 7) ? 0x40 : 0x80);
+	return ((variant == ClassicCard::Variant::CLASSIC_4K) ? 0x0002 : 0x0004) | uidSizeBits;
+}
+
+uint8_t getClassicSak(ClassicCard::Variant variant) {
+	switch (variant) {
+		case ClassicCard::Variant::MINI:
+			return 0x09;
+		case ClassicCard::Variant::CLASSIC_1K:
+			return 0x08;
+		case ClassicCard::Variant::CLASSIC_4K:
+			return 0x18;
+	}
+
+	return 0x08;
+}
+
+} // namespace
+
+ClassicCard::ClassicCard(Variant variant, const std::vector<uint8_t>& uid) :
+		VirtualCard(uid, getClassicAtqa(variant, uid.size()), getClassicSak(variant)), variant(variant) {
+	const int blockCount = (variant == Variant::MINI) ? 20 : ((variant == Variant::CLASSIC_1K) ? 64 : 256);
+	blocks.resize(blockCount);
+	for (std::array<uint8_t, 16>& block : blocks) {
+		block.fill(0);
+	}
+
+	// transport configuration of sector trailers (keys FF..FF, access bits FF 07 80, GPB 69)
+	const uint8_t transportTrailer[16] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x07, 0x80, 0x69, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+	for (int sector = 0; getTrailer(sector) < blockCount; sector++) {
+		std::memcpy(blocks[getTrailer(sector)].data(), transportTrailer, 16);
+	}
+
+	// manufacturer block
+	const uint16_t atqa = getClassicAtqa(variant, uid.size());
+	std::array<uint8_t, 16>& manufacturerBlock = blocks[0];
+	size_t position = 0;
+	for (uint8_t value : uid) {
+		manufacturerBlock[position++] = value;
+	}
+
+	if (uid.size() == 4) {
+		manufacturerBlock[position++] = uid[0] ^ uid[1] ^ uid[2] ^ uid[3];
+	}
+
+	manufacturerBlock[position++] = getClassicSak(variant);
+	manufacturerBlock[position++] = (uint8_t)(atqa & 0xFF);
+	manufacturerBlock[position++] = (uint8_t)(atqa >> 8);
+	while (position < 16) {
+		manufacturerBlock[position] = (uint8_t)(0x60 + position);
+		position++;
+	}
+}
+
+const char* ClassicCard::getTypeName() const {
+	switch (variant) {
+		case Variant::MINI:
+			return "MIFARE Mini";
+		case Variant::CLASSIC_1K:
+			return "MIFARE Classic 1K";
+		case Variant::CLASSIC_4K:
+			return "MIFARE Classic 4K";
+	}
+
+	return "MIFARE Classic";
+}
+
+void ClassicCard::resetSession() {
+	authenticatedSector = -1;
+	authenticatedWithKeyB = false;
+	pendingCommand = 0;
+	pendingBlock = -1;
+	transferBufferValid = false;
+}
+
+int ClassicCard::getSector(int block) const {
+	return (block < 128) ? block / 4 : 32 + (block - 128) / 16;
+}
+
+int ClassicCard::getTrailer(int sector) const {
+	return (sector < 32) ? sector * 4 + 3 : 128 + (sector - 32) * 16 + 15;
+}
+
+int ClassicCard::getAccessCondition(int block) const {
+	const int sector = getSector(block);
+	const std::array<uint8_t, 16>& trailer = blocks[getTrailer(sector)];
+
+	// access bits are stored together with their inverted copies
+	const bool valid = ((trailer[6] & 0x0F) == ((~trailer[7] >> 4) & 0x0F)) && ((trailer[6] >> 4) == (~trailer[8] & 0x0F))
+			&& ((trailer[7] & 0x0F) == ((~trailer[8] >> 4) & 0x0F));
+	if (!valid) {
+		return -1;
+	}
+
+	// large sectors of 4K cards share access conditions for groups of 5 blocks
+	int group = block - (getTrailer(sector) - 3);
+	if (sector >= 32) {
+		const int index = block - (getTrailer(sector) - 15);
+		group = (index == 15) ? 3 : index / 5;
+	}
+
+	const int c1 = (trailer[7] >> (4 + group)) & 0x01;
+	const int c2 = (trailer[8] >> group) & 0x01;
+	const int c3 = (trailer[8] >> (4 + group)) & 0x01;
+	return (c1 << 2) | (c2 << 1) | c3;
+}
+
+bool ClassicCard::isKeyAllowed(uint8_t mask, int sector) const {
+	if (authenticatedWithKeyB) {
+		// readable key B cannot serve for authentication
+		const int trailerCondition = getAccessCondition(getTrailer(sector));
+		if ((trailerCondition < 0) || (TRAILER_KEY_B_READ[trailerCondition] != 0)) {
+			return false;
+		}
+
+		return (mask & 0x02) != 0;
+	}
+
+	return (mask & 0x01) != 0;
+}
+
+bool ClassicCard::isAllowed(int block, Operation operation) const {
+	const int sector = getSector(block);
+	const int condition = getAccessCondition(block);
+	if ((condition < 0) || (block == getTrailer(sector))) {
+		return false;
+	}
+
+	switch (operation) {
+		case Operation::READ:
+			return isKeyAllowed(DATA_READ[condition], sector);
+		case Operation::WRITE:
+			return isKeyAllowed(DATA_WRITE[condition], sector);
+		case Operation::INCREMENT:
+			return isKeyAllowed(DATA_INCREMENT[condition], sector);
+		case Operation::DECREMENT:
+			return isKeyAllowed(DATA_DECREMENT[condition], sector);
+	}
+
+	return false;
+}
+
+bool ClassicCard::isValueBlock(int block) const {
+	const std::array<uint8_t, 16>& data = blocks[block];
+	for (int i = 0; i < 4; i++) {
+		if ((data[i] != data[i + 8]) || (data[i] != (uint8_t)~data[i + 4])) {
+			return false;
+		}
+	}
+
+	return (data[12] == data[14]) && (data[13] == data[15]) && (data[12] == (uint8_t)~data[13]);
+}
+
+bool ClassicCard::authenticate(uint8_t command, uint8_t block, const uint8_t* key, const uint8_t* uid) {
+	// the reader uses the last 4 bytes of uid
+	if (!isActive() || (block >= blocks.size()) || (std::memcmp(uid, &this->uid[this->uid.size() - 4], 4) != 0)) {
+		fail();
+		return false;
+	}
+
+	const int sector = getSector(block);
+	const std::array<uint8_t, 16>& trailer = blocks[getTrailer(sector)];
+	const bool keyB = command == CMD_MF_AUTH_KEY_B;
+	if (std::memcmp(key, keyB ? &trailer[10] : &trailer[0], 6) != 0) {
+		fail();
+		return false;
+	}
+
+	pendingCommand = 0;
+	authenticatedSector = sector;
+	authenticatedWithKeyB = keyB;
+	return true;
+}
+
+bool ClassicCard::handleCommand(const uint8_t* frame, size_t length, CardReply& reply) {
+	if (pendingCommand != 0) {
+		return handlePendingOperation(frame, length, reply);
+	}
+
+	if (length != 2) {
+		return nak(reply, NAK_INVALID_ARGUMENT);
+	}
+
+	const uint8_t command = frame[0];
+	const int block = frame[1];
+	if ((authenticatedSector < 0) || (block >= (int)blocks.size()) || (getSector(block) != authenticatedSector)) {
+		return nak(reply, NAK_NOT_ALLOWED);
+	}
+
+	const int sector = getSector(block);
+	const bool trailer = block == getTrailer(sector);
+	switch (command) {
+		case CMD_MF_READ: {
+			uint8_t data[16] = {0};
+			if (trailer) {
+				// key A is never readable
+				const int condition = getAccessCondition(block);
+				if (condition < 0) {
+					return nak(reply, NAK_NOT_ALLOWED);
+				}
+
+				if (isKeyAllowed(TRAILER_ACCESS_READ[condition], sector)) {
+					std::memcpy(data + 6, &blocks[block][6], 4);
+				}
+
+				if (isKeyAllowed(TRAILER_KEY_B_READ[condition], sector)) {
+					std::memcpy(data + 10, &blocks[block][10], 6);
+				}
+			} else {
+				if (!isAllowed(block, Operation::READ)) {
+					return nak(reply, NAK_NOT_ALLOWED);
+				}
+
+				std::memcpy(data, blocks[block].data(), 16);
+			}
+
+			return replyWithCrc(reply, data, 16);
+		}
+
+		case CMD_MF_WRITE: {
+			bool allowed;
+			if (trailer) {
+				const int condition = getAccessCondition(block);
+				allowed = (condition >= 0) && (isKeyAllowed(TRAILER_KEY_A_WRITE[condition], sector)
+						|| isKeyAllowed(TRAILER_ACCESS_WRITE[condition], sector) || isKeyAllowed(TRAILER_KEY_B_WRITE[condition], sector));
+			} else {
+				// manufacturer block is read-only
+				allowed = (block != 0) && isAllowed(block, Operation::WRITE);
+			}
+
+			if (!allowed) {
+				return nak(reply, NAK_NOT_ALLOWED);
+			}
+
+			break;
+		}
+
+		case CMD_MF_INCREMENT:
+			if (!isAllowed(block, Operation::INCREMENT) || !isValueBlock(block)) {
+				return nak(reply, NAK_NOT_ALLOWED);
+			}
+
+			break;
+
+		case CMD_MF_DECREMENT:
+		case CMD_MF_RESTORE:
+			if (!isAllowed(block, Operation::DECREMENT) || !isValueBlock(block)) {
+				return nak(reply, NAK_NOT_ALLOWED);
+			}
+
+			break;
+
+		case CMD_MF_TRANSFER: {
+			if (!transferBufferValid || (block == 0) || !isAllowed(block, Operation::DECREMENT)) {
+				return nak(reply, NAK_NOT_ALLOWED);
+			}
+
+			std::array<uint8_t, 16>& data = blocks[block];
+			for (int i = 0; i < 4; i++) {
+				const uint8_t value = (uint8_t)((uint32_t)transferValue >> (8 * i));
+				data[i] = value;
+				data[i + 4] = (uint8_t)~value;
+				data[i + 8] = value;
+			}
+
+			data[12] = transferAddress;
+			data[13] = (uint8_t)~transferAddress;
+			data[14] = transferAddress;
+			data[15] = (uint8_t)~transferAddress;
+			reply.processingTime = CLASSIC_WRITE_TIME;
+			return ack(reply);
+		}
+
+		default:
+			return nak(reply, NAK_INVALID_ARGUMENT);
+	}
+
+	pendingCommand = command;
+	pendingBlock = block;
+	return ack(reply);
+}
+
+bool ClassicCard::handlePendingOperation(const uint8_t* frame, size_t length, CardReply& reply) {
+	const uint8_t command = pendingCommand;
+	const int block = pendingBlock;
+	pendingCommand = 0;
+	pendingBlock = -1;
+
+	if (command == CMD_MF_WRITE) {
+		if (length != 16) {
+			return nak(reply, NAK_INVALID_ARGUMENT);
+		}
+
+		if (block == getTrailer(getSector(block))) {
+			writeTrailer(block, frame);
+		} else {
+			std::memcpy(blocks[block].data(), frame, 16);
+		}
+
+		reply.processingTime = CLASSIC_WRITE_TIME;
+		return ack(reply);
+	}
+
+	// value operations: 4-byte operand, the card does not reply
+	if (length != 4) {
+		return nak(reply, NAK_INVALID_ARGUMENT);
+	}
+
+	const uint32_t operand = (uint32_t)decodeInt32(frame);
+	uint32_t value = (uint32_t)decodeInt32(blocks[block].data());
+	if (command == CMD_MF_INCREMENT) {
+		value += operand;
+	} else if (command == CMD_MF_DECREMENT) {
+		value -= operand;
+	}
+
+	transferValue = (int32_t)value;
+	transferAddress = blocks[block][12];
+	transferBufferValid = true;
+	return false;
+}
+
+bool ClassicCard::writeTrailer(int block, const uint8_t* data) {
+	const int sector = getSector(block);
+	const int condition = getAccessCondition(block);
+	if (condition < 0) {
+		return false;
+	}
+
+	// parts of the trailer without write access are not changed
+	std::array<uint8_t, 16>& trailer = blocks[block];
+	if (isKeyAllowed(TRAILER_KEY_A_WRITE[condition], sector)) {
+		std::memcpy(&trailer[0], data, 6);
+	}
+
+	if (isKeyAllowed(TRAILER_KEY_B_WRITE[condition], sector)) {
+		std::memcpy(&trailer[10], data + 10, 6);
+	}
+
+	if (isKeyAllowed(TRAILER_ACCESS_WRITE[condition], sector)) {
+		std::memcpy(&trailer[6], data + 6, 4);
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------
+// UltralightCard
+//----------------------------------------------------------------------
+
+UltralightCard::UltralightCard(Variant variant, const std::vector<uint8_t>& uid) :
+		VirtualCard(uid, 0x0044, 0x00), variant(variant) {
+	int pageCount = 16;
+	uint8_t dataAreaSize = 0x06;
+	switch (variant) {
+		case Variant::ULTRALIGHT:
+			break;
+		case Variant::NTAG213:
+			pageCount = 45;
+			dataAreaSize = 0x12;
+			break;
+		case Variant::NTAG215:
+			pageCount = 135;
+			dataAreaSize = 0x3E;
+			break;
+		case Variant::NTAG216:
+			pageCount = 231;
+			dataAreaSize = 0x6D;
+			break;
+	}
+
+	pages.resize(pageCount);
+	for (std::array<uint8_t, 4>& page : pages) {
+		page.fill(0);
+	}
+
+	// uid with check bytes, internal byte and lock bytes
+	pages[0] = {{uid[0], uid[1], uid[2], (uint8_t)(CMD_CASCADE_TAG ^ uid[0] ^ uid[1] ^ uid[2])}};
+	pages[1] = {{uid[3], uid[4], uid[5], uid[6]}};
+	pages[2] = {{(uint8_t)(uid[3] ^ uid[4] ^ uid[5] ^ uid[6]), (uint8_t)(isNtag() ? 0x48 : 0x00), 0x00, 0x00}};
+
+	// capability container and NDEF message
+	pages[3] = {{0xE1, 0x10, dataAreaSize, 0x00}};
+	for (size_t i = 0; i < sizeof(DEFAULT_NDEF_TLV); i++) {
+		pages[4 + i / 4][i % 4] = DEFAULT_NDEF_TLV[i];
+	}
+
+	// configuration pages: protection disabled (AUTH0 beyond the last page), password FF..FF
+	if (isNtag()) {
+		const int configurationPage = getConfigurationPage();
+		pages[configurationPage - 1] = {{0x00, 0x00, 0x00, 0xBD}};
+		pages[configurationPage] = {{0x04, 0x00, 0x00, 0xFF}};
+		pages[configurationPage + 1] = {{0x00, 0x05, 0x00, 0x00}};
+		pages[configurationPage + 2] = {{0xFF, 0xFF, 0xFF, 0xFF}};
+		pages[configurationPage + 3] = {{0x00, 0x00, 0x00, 0x00}};
+	}
+}
+
+const char* UltralightCard::getTypeName() const {
+	switch (variant) {
+		case Variant::ULTRALIGHT:
+			return "MIFARE Ultralight";
+		case Variant::NTAG213:
+			return "NTAG213";
+		case Variant::NTAG215:
+			return "NTAG215";
+		case Variant::NTAG216:
+			return "NTAG216";
+	}
+
+	return "MIFARE Ultralight";
+}
+
+void UltralightCard::resetSession() {
+	passwordVerified = false;
+	pendingCompatibilityWrite = -1;
+}
+
+bool UltralightCard::isReadable(int page) const {
+	if (!isNtag() || passwordVerified) {
+		return true;
+	}
+
+	const int configurationPage = getConfigurationPage();
+	const bool readProtected = (pages[configurationPage + 1][0] & 0x80) != 0;
+	return !readProtected || (page < pages[configurationPage][3]);
+}
+
+bool UltralightCard::isWritable(int page) const {
+	if ((page < 2) || (page >= (int)pages.size())) {
+		return false;
+	}
+
+	// static lock bits of pages 3 to 15
+	if ((page >= 3) && (page < 8) && ((pages[2][2] >> page) & 0x01)) {
+		return false;
+	}
+
+	if ((page >= 8) && (page < 16) && ((pages[2][3] >> (page - 8)) & 0x01)) {
+		return false;
+	}
+
+	return !isNtag() || passwordVerified || (page < pages[getConfigurationPage()][3]);
+}
+
+void UltralightCard::readPage(int page, uint8_t* data) const {
+	if (!isReadable(page) || (isNtag() && (page >= getConfigurationPage() + 2))) {
+		std::memset(data, 0, 4);
+		return;
+	}
+
+	std::memcpy(data, pages[page].data(), 4);
+}
+
+void UltralightCard::writePage(int page, const uint8_t* data) {
+	std::array<uint8_t, 4>& content = pages[page];
+	if (page == 2) {
+		content[2] |= data[2];
+		content[3] |= data[3];
+	} else if (page == 3) {
+		for (int i = 0; i < 4; i++) {
+			content[i] |= data[i];
+		}
+	} else {
+		std::memcpy(content.data(), data, 4);
+	}
+}
+
+bool UltralightCard::handleCommand(const uint8_t* frame, size_t length, CardReply& reply) {
+	const int pageCount = (int)pages.size();
+	if (pendingCompatibilityWrite >= 0) {
+		// only the first 4 bytes of the 16-byte frame are written
+		const int page = pendingCompatibilityWrite;
+		pendingCompatibilityWrite = -1;
+		if (length != 16) {
+			return nak(reply, NAK_INVALID_ARGUMENT);
+		}
+
+		writePage(page, frame);
+		reply.processingTime = ULTRALIGHT_WRITE_TIME;
+		return ack(reply);
+	}
+
+	switch (frame[0]) {
+		case CMD_MF_READ: {
+			// 4 pages with roll over to page 0
+			if ((length != 2) || (frame[1] >= pageCount) || !isReadable(frame[1])) {
+				return nak(reply, NAK_INVALID_ARGUMENT);
+			}
+
+			uint8_t data[16];
+			for (int i = 0; i < 4; i++) {
+				readPage((frame[1] + i) % pageCount, data + 4 * i);
+			}
+
+			return replyWithCrc(reply, data, sizeof(data));
+		}
+
+		case CMD_UL_WRITE:
+			if ((length != 6) || !isWritable(frame[1])) {
+				return nak(reply, NAK_INVALID_ARGUMENT);
+			}
+
+			writePage(frame[1], frame + 2);
+			reply.processingTime = ULTRALIGHT_WRITE_TIME;
+			return ack(reply);
+
+		case CMD_MF_WRITE:
+			if ((length != 2) || !isWritable(frame[1])) {
+				return nak(reply, NAK_INVALID_ARGUMENT);
+			}
+
+			pendingCompatibilityWrite = frame[1];
+			return ack(reply);
+
+		case CMD_UL_GET_VERSION: {
+			if (!isNtag() || (length != 1)) {
+				return nak(reply, NAK_INVALID_ARGUMENT);
+			}
+
+			const uint8_t storageSize = (variant == Variant::NTAG213) ? 0x0F : ((variant == Variant::NTAG215) ? 0x11 : 0x13);
+			const uint8_t version[8] = {0x00, 0x04, 0x04, 0x02, 0x01, 0x00, storageSize, 0x03};
+			return replyWithCrc(reply, version, sizeof(version));
+		}
+
+		case CMD_UL_FAST_READ: {
+			if (!isNtag() || (length != 3) || (frame[1] > frame[2]) || (frame[2] >= pageCount)) {
+				return nak(reply, NAK_INVALID_ARGUMENT);
+			}
+
+			std::vector<uint8_t> data(4 * (frame[2] - frame[1] + 1));
+			for (int page = frame[1]; page <= frame[2]; page++) {
+				if (!isReadable(page)) {
+					return nak(reply, NAK_INVALID_ARGUMENT);
+				}
+
+				readPage(page, &data[4 * (page - frame[1])]);
+			}
+
+			return replyWithCrc(reply, data.data(), data.size());
+		}
+
+		case CMD_UL_PWD_AUTH: {
+			const int configurationPage = getConfigurationPage();
+			if (!isNtag() || (length != 5) || (std::memcmp(frame + 1, pages[configurationPage + 2].data(), 4) != 0)) {
+				return nak(reply, NAK_NOT_ALLOWED);
+			}
+
+			passwordVerified = true;
+			return replyWithCrc(reply, pages[configurationPage + 3].data(), 2);
+		}
+
+		default:
+			return nak(reply, NAK_INVALID_ARGUMENT);
+	}
+}
+
+//----------------------------------------------------------------------
+// Creation of cards
+//----------------------------------------------------------------------
+
+std::unique_ptr<VirtualCard> createCard(const std::string& type, const std::vector<uint8_t>& uid) {
+	const std::vector<uint8_t> classicUid = uid.empty() ? std::vector<uint8_t>{0xA1, 0xB2, 0xC3, 0xD4} : uid;
+	const std::vector<uint8_t> ultralightUid = uid.empty() ? std::vector<uint8_t>{0x04, 0xA1, 0xB2, 0xC3, 0xD4, 0xE5, 0xF6} : uid;
+	const bool validClassicUid = (classicUid.size() == 4) || (classicUid.size() == 7);
+	const bool validUltralightUid = ultralightUid.size() == 7;
+
+	if ((type == "mini") && validClassicUid) {
+		return std::unique_ptr<VirtualCard>(new ClassicCard(ClassicCard::Variant::MINI, classicUid));
+	} else if ((type == "1k") && validClassicUid) {
+		return std::unique_ptr<VirtualCard>(new ClassicCard(ClassicCard::Variant::CLASSIC_1K, classicUid));
+	} else if ((type == "4k") && validClassicUid) {
+		return std::unique_ptr<VirtualCard>(new ClassicCard(ClassicCard::Variant::CLASSIC_4K, classicUid));
+	} else if ((type == "ultralight") && validUltralightUid) {
+		return std::unique_ptr<VirtualCard>(new UltralightCard(UltralightCard::Variant::ULTRALIGHT, ultralightUid));
+	} else if ((type == "ntag213") && validUltralightUid) {
+		return std::unique_ptr<VirtualCard>(new UltralightCard(UltralightCard::Variant::NTAG213, ultralightUid));
+	} else if ((type == "ntag215") && validUltralightUid) {
+		return std::unique_ptr<VirtualCard>(new UltralightCard(UltralightCard::Variant::NTAG215, ultralightUid));
+	} else if ((type == "ntag216") && validUltralightUid) {
+		return std::unique_ptr<VirtualCard>(new UltralightCard(UltralightCard::Variant::NTAG216, ultralightUid));
+	}
+
+	return nullptr;
+}
+
+//----------------------------------------------------------------------
+// Field
+//----------------------------------------------------------------------
+
+void Field::place(int index) {
+	if ((index < 0) || (index >= (int)cards.size())) {
+		placedCard = -1;
+		return;
+	}
+
+	placedCard = index;
+	cards[index]->powerOn();
+}
+
+void Field::setEnabled(bool enabled) {
+	if (enabled && !this->enabled && (placedCard >= 0)) {
+		cards[placedCard]->powerOn();
+	}
+
+	this->enabled = enabled;
+}
+
+VirtualCard* Field::getActiveCard() {
+	return (enabled && (placedCard >= 0)) ? cards[placedCard].get() : nullptr;
+}
+
+} // namespace emulator
+} // namespace mfreader
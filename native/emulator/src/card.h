@@ -0,0 +1,311 @@
+#ifndef MFREADER_EMULATOR_CARD_H
+#define MFREADER_EMULATOR_CARD_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace mfreader {
+namespace emulator {
+
+// Computes CRC_A (ISO/IEC 14443-3) of the data
+uint16_t computeCrcA(const uint8_t* data, size_t length);
+
+// Appends CRC_A of the data to the data
+void appendCrcA(std::vector<uint8_t>& data);
+
+/********************************************************************************
+ * Reply of a card to a frame sent by the reader.
+ ********************************************************************************/
+struct CardReply {
+	std::vector<uint8_t> data;
+
+	// Number of valid bits in the last byte (0 - all 8 bits are valid)
+	uint8_t lastBits = 0;
+
+	// Time spent by the card before it starts to reply (e.g., programming of its memory)
+	std::chrono::microseconds processingTime {0};
+};
+
+/********************************************************************************
+ * Virtual ISO/IEC 14443 type A card. The base class realizes activation of the
+ * card (REQA/WUPA, anticollision and select for all cascade levels, HLTA),
+ * subclasses handle commands received in state ACTIVE.
+ ********************************************************************************/
+class VirtualCard {
+public:
+	virtual ~VirtualCard() {
+	}
+
+	// Returns name of type of the card
+	virtual const char* getTypeName() const = 0;
+
+	const std::vector<uint8_t>& getUid() const {
+		return uid;
+	}
+
+	// Resets the card to state IDLE (the card enters the field of the reader)
+	void powerOn();
+
+	// Handles frame sent by the reader and returns whether the card replies. Frames with
+	// lastBits equal to 0 consist of whole bytes, crypto1 is whether the reader encrypts the
+	// communication.
+	bool transceive(const uint8_t* frame, size_t length, uint8_t lastBits, bool crypto1, CardReply& reply);
+
+	// Handles three pass authentication of MIFARE Classic cards (MFAuthent command of the reader)
+	// and returns whether the card is authenticated
+	virtual bool authenticate(uint8_t command, uint8_t block, const uint8_t* key, const uint8_t* uid) {
+		return false;
+	}
+
+	// Returns whether the communication with the card is encrypted by crypto1
+	virtual bool isCrypto1Active() const {
+		return false;
+	}
+
+protected:
+	// States of the card
+	enum class State {
+		IDLE,
+		READY,
+		ACTIVE,
+		HALT
+	};
+
+	// Constructs the card with uid of 4, 7 or 10 bytes, ATQA and SAK sent after completed selection
+	VirtualCard(const std::vector<uint8_t>& uid, uint16_t atqa, uint8_t sak);
+
+	// Handles command (with verified CRC) in state ACTIVE and returns whether the card replies
+	virtual bool handleCommand(const uint8_t* frame, size_t length, CardReply& reply) = 0;
+
+	// Clears state of commands and authentication (the card leaves state ACTIVE)
+	virtual void resetSession() {
+	}
+
+	// Returns to state IDLE (or HALT if the card was woken up from state HALT)
+	void fail();
+
+	// Replies with 4-bit ACK
+	bool ack(CardReply& reply);
+
+	// Replies with 4-bit NAK and leaves state ACTIVE
+	bool nak(CardReply& reply, uint8_t code);
+
+	// Replies with the data followed by CRC_A
+	bool replyWithCrc(CardReply& reply, const uint8_t* data, size_t length);
+
+	// Returns whether the card is in state ACTIVE
+	bool isActive() const {
+		return state == State::ACTIVE;
+	}
+
+	// 4-bit codes of ACK and NAK
+	static constexpr uint8_t ACK = 0x0A;
+	static constexpr uint8_t NAK_INVALID_ARGUMENT = 0x00;
+	static constexpr uint8_t NAK_CRC_ERROR = 0x01;
+
+	std::vector<uint8_t> uid;
+
+private:
+	// Handles anticollision or select frame of the current cascade level in state READY
+	bool handleCascadeLevel(const uint8_t* frame, size_t length, uint8_t lastBits, CardReply& reply);
+
+	// Returns 4 bytes of uid (including cascade tag) for the cascade level
+	std::array<uint8_t, 4> getCascadeLevelBytes(int level) const;
+
+	uint16_t atqa;
+	uint8_t sak;
+	State state = State::IDLE;
+	bool halted = false;
+	int cascadeLevel = 0;
+};
+
+/********************************************************************************
+ * MIFARE Classic Mini, 1K or 4K card with sector trailers and access conditions
+ * evaluated as by the card. Crypto1 is not modeled: authentication compares keys
+ * and the reader passes frames unencrypted.
+ ********************************************************************************/
+class ClassicCard: public VirtualCard {
+public:
+	enum class Variant {
+		MINI,
+		CLASSIC_1K,
+		CLASSIC_4K
+	};
+
+	ClassicCard(Variant variant, const std::vector<uint8_t>& uid);
+
+	const char* getTypeName() const override;
+
+	bool authenticate(uint8_t command, uint8_t block, const uint8_t* key, const uint8_t* uid) override;
+
+	bool isCrypto1Active() const override {
+		return authenticatedSector >= 0;
+	}
+
+	int getBlockCount() const {
+		return (int)blocks.size();
+	}
+
+	std::array<uint8_t, 16>& getBlock(int block) {
+		return blocks[block];
+	}
+
+protected:
+	bool handleCommand(const uint8_t* frame, size_t length, CardReply& reply) override;
+	void resetSession() override;
+
+private:
+	// Operations restricted by access conditions
+	enum class Operation {
+		READ,
+		WRITE,
+		INCREMENT,
+		DECREMENT
+	};
+
+	// Returns sector of the block
+	int getSector(int block) const;
+
+	// Returns trailer block of the sector
+	int getTrailer(int sector) const;
+
+	// Returns access condition (C1 C2 C3) of the block or -1 if access bits of its sector are invalid
+	int getAccessCondition(int block) const;
+
+	// Returns whether the operation with the authenticated key is allowed for a data block
+	bool isAllowed(int block, Operation operation) const;
+
+	// Returns whether mask of keys (1 - key A, 2 - key B) allows access with the authenticated key
+	bool isKeyAllowed(uint8_t mask, int sector) const;
+
+	// Returns whether the block is a valid value block
+	bool isValueBlock(int block) const;
+
+	// Handles the second part of WRITE command or of value operation
+	bool handlePendingOperation(const uint8_t* frame, size_t length, CardReply& reply);
+
+	// Writes the sector trailer respecting access conditions
+	bool writeTrailer(int block, const uint8_t* data);
+
+	Variant variant;
+	std::vector<std::array<uint8_t, 16>> blocks;
+	int authenticatedSector = -1;
+	bool authenticatedWithKeyB = false;
+
+	// Command waiting for its second part (0 - none)
+	uint8_t pendingCommand = 0;
+	int pendingBlock = -1;
+
+	// Transfer buffer of value operations
+	bool transferBufferValid = false;
+	int32_t transferValue = 0;
+	uint8_t transferAddress = 0;
+};
+
+/********************************************************************************
+ * MIFARE Ultralight or NTAG213/215/216 card. NTAG cards support GET_VERSION,
+ * FAST_READ and password protection of pages starting at AUTH0.
+ ********************************************************************************/
+class UltralightCard: public VirtualCard {
+public:
+	enum class Variant {
+		ULTRALIGHT,
+		NTAG213,
+		NTAG215,
+		NTAG216
+	};
+
+	UltralightCard(Variant variant, const std::vector<uint8_t>& uid);
+
+	const char* getTypeName() const override;
+
+	int getPageCount() const {
+		return (int)pages.size();
+	}
+
+	std::array<uint8_t, 4>& getPage(int page) {
+		return pages[page];
+	}
+
+protected:
+	bool handleCommand(const uint8_t* frame, size_t length, CardReply& reply) override;
+	void resetSession() override;
+
+private:
+	bool isNtag() const {
+		return variant != Variant::ULTRALIGHT;
+	}
+
+	// Returns first configuration page (NTAG cards only)
+	int getConfigurationPage() const {
+		return (int)pages.size() - 4;
+	}
+
+	// Returns whether the page can be read (protection by password)
+	bool isReadable(int page) const;
+
+	// Returns whether the page can be written (lock bits and protection by password)
+	bool isWritable(int page) const;
+
+	// Reads the page as seen by the reader (password and PACK are never readable)
+	void readPage(int page, uint8_t* data) const;
+
+	// Writes the page (lock bytes and capability container are one-time programmable)
+	void writePage(int page, const uint8_t* data);
+
+	Variant variant;
+	std::vector<std::array<uint8_t, 4>> pages;
+	bool passwordVerified = false;
+	int pendingCompatibilityWrite = -1;
+};
+
+// Creates card of the type (mini, 1k, 4k, ultralight, ntag213, ntag215, ntag216) with the uid (the
+// default uid of the type is used if the uid is empty), returns nullptr if the type is unknown
+std::unique_ptr<VirtualCard> createCard(const std::string& type, const std::vector<uint8_t>& uid);
+
+/********************************************************************************
+ * RF field of the reader with a population of cards, at most one of them is in
+ * the field at a time.
+ ********************************************************************************/
+class Field {
+public:
+	void addCard(std::unique_ptr<VirtualCard> card) {
+		cards.push_back(std::move(card));
+	}
+
+	size_t getCardCount() const {
+		return cards.size();
+	}
+
+	VirtualCard& getCard(size_t index) {
+		return *cards[index];
+	}
+
+	// Places the card into the field (-1 removes the card in the field)
+	void place(int index);
+
+	// Returns index of the card in the field or -1
+	int getPlacedCard() const {
+		return placedCard;
+	}
+
+	// Switches the field on or off (cards are reset when the field is switched on)
+	void setEnabled(bool enabled);
+
+	// Returns the powered card in the field or nullptr
+	VirtualCard* getActiveCard();
+
+private:
+	std::vector<std::unique_ptr<VirtualCard>> cards;
+	int placedCard = -1;
+	bool enabled = false;
+};
+
+} // namespace emulator
+} // namespace mfreader
+
+#endif
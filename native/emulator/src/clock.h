@@ -0,0 +1,21 @@
+#ifndef MFREADER_EMULATOR_CLOCK_H
+#define MFREADER_EMULATOR_CLOCK_H
+
+#include <chrono>
+
+namespace mfreader {
+namespace emulator {
+
+// Clock of the emulated board (the firmware runs in real time)
+typedef std::chrono::steady_clock Clock;
+
+// Waits actively until the time (for waits shorter than resolution of sleeping)
+inline void spinUntil(Clock::time_point time) {
+	while (Clock::now() < time) {
+	}
+}
+
+} // namespace emulator
+} // namespace mfreader
+
+#endif
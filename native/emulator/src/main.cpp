@@ -0,0 +1,273 @@
+// Emulator of the reader: the firmware (sketch, its library and the MFRC522 driver) runs against
+// an emulated board with virtual cards, the serial link of the reader is a pseudo terminal.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <mfreader/serial_port.h>
+
+#include "board.h"
+#include "card.h"
+#include "mfrc522_model.h"
+#include "uart.h"
+
+// Entry points of the firmware (C linkage as declared by the core)
+extern "C" {
+void setup();
+void loop();
+}
+
+using namespace mfreader;
+using namespace mfreader::emulator;
+
+namespace {
+
+// Longest sleep between iterations of the loop of the firmware
+const std::chrono::microseconds IDLE_TIME {1000};
+
+volatile std::sig_atomic_t stopRequested = 0;
+
+void handleSignal(int) {
+	stopRequested = 1;
+}
+
+void printUsage() {
+	std::cerr << "usage: mfreader_emulator [options]\n"
+			<< "  --card TYPE[:UID]       adds virtual card (mini, 1k, 4k, ultralight, ntag213, ntag215, ntag216),\n"
+			<< "                          UID in hex (4 or 7 bytes)\n"
+			<< "  --place INDEX           card placed in the field at start (default 0, -1 - empty field)\n"
+			<< "  --link PATH             creates symbolic link to the pseudo terminal\n"
+			<< "  --eeprom PATH           file backing the EEPROM\n"
+			<< "  --rf-latency US         additional latency of exchanges with cards in microseconds\n"
+			<< "  --rf-error-rate P       probability of a failed exchange with a card\n"
+			<< "  --uart-error-rate P     probability of a corrupted byte received by the reader\n"
+			<< "  --spi-byte-time NS      time of transfer of a byte over SPI in nanoseconds\n"
+			<< "  --ignore-baud-rate      does not corrupt bytes if speeds of the host and the reader differ\n"
+			<< "  --seed N                seed of error injection\n"
+			<< "  --uptime MS             time of the board at start (overflow of millis() after 4294967296 ms)\n"
+			<< "commands on standard input: place INDEX, remove, list, stats, quit (the emulator stops at the end of input)\n";
+}
+
+bool parseUid(const std::string& text, std::vector<uint8_t>& uid) {
+	if ((text.size() % 2) != 0) {
+		return false;
+	}
+
+	for (size_t i = 0; i < text.size(); i += 2) {
+		char* end;
+		const std::string byte = text.substr(i, 2);
+		const unsigned long value = std::strtoul(byte.c_str(), &end, 16);
+		if (*end != '\0') {
+			return false;
+		}
+
+		uid.push_back((uint8_t)value);
+	}
+
+	return true;
+}
+
+std::string formatUid(const std::vector<uint8_t>& uid) {
+	std::string text;
+	char buffer[3];
+	for (uint8_t value : uid) {
+		std::snprintf(buffer, sizeof(buffer), "%02X", value);
+		text += buffer;
+	}
+
+	return text;
+}
+
+// Handles a command read from the standard input
+void handleCommand(const std::string& line, Field& field, Mfrc522Model& reader, Uart& uart, Board& board) {
+	std::istringstream input(line);
+	std::string command;
+	input >> command;
+	if (command == "place") {
+		int index = -1;
+		if (!(input >> index) || (index < 0) || (index >= (int)field.getCardCount())) {
+			std::cout << "error: invalid card" << std::endl;
+			return;
+		}
+
+		field.place(index);
+		std::cout << "placed " << index << std::endl;
+	} else if (command == "remove") {
+		field.place(-1);
+		std::cout << "removed" << std::endl;
+	} else if (command == "list") {
+		for (size_t i = 0; i < field.getCardCount(); i++) {
+			VirtualCard& card = field.getCard(i);
+			std::cout << i << " " << card.getTypeName() << " " << formatUid(card.getUid())
+					<< (((int)i == field.getPlacedCard()) ? " (in field)" : "") << std::endl;
+		}
+	} else if (command == "stats") {
+		std::cout << "rf exchanges " << reader.getExchangeCount() << ", injected rf errors " << reader.getInjectedErrorCount()
+				<< ", dropped uart bytes " << uart.getDroppedByteCount() << ", corrupted uart bytes "
+				<< uart.getCorruptedByteCount() << ", idle sleep "
+				<< (int)(100 * std::chrono::duration<double>(board.getSleepTime()).count()
+						/ std::chrono::duration<double>(board.getRunTime()).count()) << "%" << std::endl;
+	} else if (command == "quit") {
+		stopRequested = 1;
+	} else if (!command.empty()) {
+		std::cout << "error: unknown command" << std::endl;
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	Field field;
+	int placedCard = 0;
+	std::string linkPath;
+	Board::Options boardOptions;
+	Mfrc522Model::Options readerOptions;
+	Uart::Options uartOptions;
+
+	for (int i = 1; i < argc; i++) {
+		const std::string option = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (option == "--ignore-baud-rate") {
+			uartOptions.checkBaudRate = false;
+		} else if ((option == "--card") && hasValue) {
+			const std::string value = argv[++i];
+			const size_t separator = value.find(':');
+			std::vector<uint8_t> uid;
+			if ((separator != std::string::npos) && !parseUid(value.substr(separator + 1), uid)) {
+				std::cerr << "invalid uid: " << value << std::endl;
+				return 2;
+			}
+
+			std::unique_ptr<VirtualCard> card = createCard(value.substr(0, separator), uid);
+			if (!card) {
+				std::cerr << "invalid card: " << value << std::endl;
+				return 2;
+			}
+
+			field.addCard(std::move(card));
+		} else if ((option == "--place") && hasValue) {
+			placedCard = std::atoi(argv[++i]);
+		} else if ((option == "--link") && hasValue) {
+			linkPath = argv[++i];
+		} else if ((option == "--eeprom") && hasValue) {
+			boardOptions.eepromPath = argv[++i];
+		} else if ((option == "--rf-latency") && hasValue) {
+			readerOptions.rfLatency = std::chrono::microseconds(std::atol(argv[++i]));
+		} else if ((option == "--rf-error-rate") && hasValue) {
+			readerOptions.rfErrorRate = std::atof(argv[++i]);
+		} else if ((option == "--uart-error-rate") && hasValue) {
+			uartOptions.errorRate = std::atof(argv[++i]);
+		} else if ((option == "--spi-byte-time") && hasValue) {
+			boardOptions.spiByteTime = std::chrono::nanoseconds(std::atol(argv[++i]));
+		} else if ((option == "--uptime") && hasValue) {
+			boardOptions.uptime = std::chrono::milliseconds(std::strtoull(argv[++i], nullptr, 10));
+		} else if ((option == "--seed") && hasValue) {
+			readerOptions.seed = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+			uartOptions.seed = readerOptions.seed + 1;
+		} else {
+			printUsage();
+			return 2;
+		}
+	}
+
+	field.place(placedCard);
+
+	// serial link of the reader: raw pseudo terminal at the default speed of the firmware, the slave
+	// side is kept open so that the link does not hang up when the host closes the port
+	PseudoTerminal terminal;
+	const int fd = terminal.getMasterFd();
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	termios settings;
+	tcgetattr(fd, &settings);
+	cfmakeraw(&settings);
+	cfsetispeed(&settings, B9600);
+	cfsetospeed(&settings, B9600);
+	tcsetattr(fd, TCSANOW, &settings);
+	const int slaveFd = open(terminal.getSlavePath().c_str(), O_RDWR | O_NOCTTY | O_CLOEXEC);
+
+	if (!linkPath.empty()) {
+		unlink(linkPath.c_str());
+		if (symlink(terminal.getSlavePath().c_str(), linkPath.c_str()) < 0) {
+			std::perror("symlink");
+			return 1;
+		}
+	}
+
+	Uart uart(fd, uartOptions);
+	Mfrc522Model reader(field, readerOptions);
+	Board board(uart, reader, boardOptions);
+
+	std::signal(SIGINT, handleSignal);
+	std::signal(SIGTERM, handleSignal);
+	std::signal(SIGPIPE, SIG_IGN);
+
+	std::cout << "pty " << terminal.getSlavePath() << std::endl;
+
+	fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+	std::string stdinLine;
+
+	setup();
+	while (!stopRequested) {
+		const uint64_t sleepCount = board.getSleepCount();
+		loop();
+		board.checkWatchdog();
+
+		// sleep until the next byte of the link, input of the host or the end of the idle time (only
+		// input of the host is checked if the firmware slept in the loop)
+		uart.service();
+		const Clock::time_point now = Clock::now();
+		const Clock::time_point wakeup = (board.getSleepCount() != sleepCount) ? now : std::min(now + IDLE_TIME, uart.getNextEventTime());
+		pollfd fds[2] = {
+			{fd, (short)(POLLIN | (uart.isOutputPending() ? POLLOUT : 0)), 0},
+			{STDIN_FILENO, POLLIN, 0}
+		};
+
+		const timespec timeout = {0, (long)std::chrono::duration_cast<std::chrono::nanoseconds>(std::max(wakeup - now, Clock::duration::zero())).count()};
+		if (ppoll(fds, 2, &timeout, nullptr) <= 0) {
+			continue;
+		}
+
+		if (fds[1].revents != 0) {
+			// the emulator stops with its controlling process (end of standard input)
+			char buffer[256];
+			const ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+			if (count == 0) {
+				stopRequested = 1;
+			}
+
+			for (ssize_t i = 0; i < count; i++) {
+				if (buffer[i] != '\n') {
+					stdinLine += buffer[i];
+					continue;
+				}
+
+				handleCommand(stdinLine, field, reader, uart, board);
+				stdinLine.clear();
+			}
+		}
+	}
+
+	if (!linkPath.empty()) {
+		unlink(linkPath.c_str());
+	}
+
+	if (slaveFd >= 0) {
+		close(slaveFd);
+	}
+
+	return 0;
+}
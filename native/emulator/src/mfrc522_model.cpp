@@ -0,0 +1,392 @@
+#include "mfrc522_model.h"
+
+#include <vector>
+
+namespace mfreader {
+namespace emulator {
+
+namespace {
+
+// Registers
+const uint8_t COMMAND_REG = 0x01;
+const uint8_t COM_IRQ_REG = 0x04;
+const uint8_t DIV_IRQ_REG = 0x05;
+const uint8_t ERROR_REG = 0x06;
+const uint8_t STATUS2_REG = 0x08;
+const uint8_t FIFO_DATA_REG = 0x09;
+const uint8_t FIFO_LEVEL_REG = 0x0A;
+const uint8_t WATER_LEVEL_REG = 0x0B;
+const uint8_t CONTROL_REG = 0x0C;
+const uint8_t BIT_FRAMING_REG = 0x0D;
+const uint8_t COLL_REG = 0x0E;
+const uint8_t MODE_REG = 0x11;
+const uint8_t TX_CONTROL_REG = 0x14;
+const uint8_t CRC_RESULT_REG_H = 0x21;
+const uint8_t CRC_RESULT_REG_L = 0x22;
+const uint8_t T_MODE_REG = 0x2A;
+const uint8_t T_PRESCALER_REG = 0x2B;
+const uint8_t T_RELOAD_REG_H = 0x2C;
+const uint8_t T_RELOAD_REG_L = 0x2D;
+const uint8_t VERSION_REG = 0x37;
+
+// Commands
+const uint8_t PCD_IDLE = 0x00;
+const uint8_t PCD_CALC_CRC = 0x03;
+const uint8_t PCD_NO_CMD_CHANGE = 0x07;
+const uint8_t PCD_TRANSCEIVE = 0x0C;
+const uint8_t PCD_MF_AUTHENT = 0x0E;
+const uint8_t PCD_SOFT_RESET = 0x0F;
+
+// Bits of registers
+const uint8_t IRQ_SET = 0x80;
+const uint8_t COM_IRQ_RX = 0x20;
+const uint8_t COM_IRQ_IDLE = 0x10;
+const uint8_t COM_IRQ_ERR = 0x02;
+const uint8_t COM_IRQ_TIMER = 0x01;
+const uint8_t DIV_IRQ_CRC = 0x04;
+const uint8_t ERROR_BUFFER_OVERFLOW = 0x10;
+const uint8_t ERROR_PARITY = 0x02;
+const uint8_t STATUS2_CRYPTO1_ON = 0x08;
+const uint8_t FIFO_FLUSH = 0x80;
+const uint8_t START_SEND = 0x80;
+
+// Version of the chip (MFRC522 version 2.0)
+const uint8_t CHIP_VERSION = 0x92;
+
+const size_t FIFO_SIZE = 64;
+
+// Carrier frequency and bit duration (128 carrier periods at 106 kbit/s)
+const double CARRIER_FREQUENCY = 13.56e6;
+const double BIT_TIME = 128 / CARRIER_FREQUENCY;
+
+// Frame delay time between the end of a frame of the reader and the reply of the card
+const std::chrono::microseconds FRAME_DELAY_TIME {91};
+
+// Returns air time of a frame with the number of data bits (parity bit of each byte, start and end of frame)
+Clock::duration getAirTime(size_t bits) {
+	const double seconds = (bits + bits / 8 + 2) * BIT_TIME;
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+// Computes CRC of the coprocessor (CRC_A polynomial with preset of ModeReg)
+uint16_t computeCrc(const std::deque<uint8_t>& data, uint16_t preset) {
+	uint16_t crc = preset;
+	for (uint8_t byte : data) {
+		uint8_t value = byte ^ (uint8_t)(crc & 0xFF);
+		value ^= (uint8_t)(value << 4);
+		crc = (crc >> 8) ^ ((uint16_t)value << 8) ^ ((uint16_t)value << 3) ^ (value >> 4);
+	}
+
+	return crc;
+}
+
+} // namespace
+
+Mfrc522Model::Mfrc522Model(Field& field, Options options) :
+		field(field), options(options), random(options.seed) {
+	reset();
+}
+
+void Mfrc522Model::reset() {
+	registers.fill(0);
+	registers[COMMAND_REG] = 0x20;
+	registers[0x02] = 0x80;
+	registers[COM_IRQ_REG] = 0x14;
+	registers[WATER_LEVEL_REG] = 0x08;
+	registers[CONTROL_REG] = 0x10;
+	registers[COLL_REG] = 0x80;
+	registers[MODE_REG] = 0x3F;
+	registers[TX_CONTROL_REG] = 0x80;
+	registers[VERSION_REG] = CHIP_VERSION;
+	fifo.clear();
+	operation = Operation::NONE;
+	field.setEnabled(false);
+}
+
+void Mfrc522Model::setResetPin(bool high) {
+	if (high && !powered) {
+		reset();
+	}
+
+	powered = high;
+	if (!powered) {
+		operation = Operation::NONE;
+		field.setEnabled(false);
+	}
+}
+
+void Mfrc522Model::select(bool selected) {
+	this->selected = selected;
+	addressPending = selected;
+}
+
+uint8_t Mfrc522Model::transfer(uint8_t value) {
+	if (!selected || !powered) {
+		return 0;
+	}
+
+	// the first byte addresses the register (bit 7 is set for reading)
+	if (addressPending) {
+		addressPending = false;
+		reading = (value & 0x80) != 0;
+		address = (value >> 1) & 0x3F;
+		return 0;
+	}
+
+	if (!reading) {
+		writeRegister(address, value);
+		return 0;
+	}
+
+	// in multi-byte reads the byte sent addresses the next register (0 terminates the read)
+	const uint8_t result = readRegister(address);
+	address = (value >> 1) & 0x3F;
+	return result;
+}
+
+uint8_t Mfrc522Model::readRegister(uint8_t reg) {
+	update();
+	switch (reg) {
+		case FIFO_DATA_REG: {
+			if (fifo.empty()) {
+				return 0;
+			}
+
+			const uint8_t value = fifo.front();
+			fifo.pop_front();
+			return value;
+		}
+
+		case FIFO_LEVEL_REG:
+			return (uint8_t)fifo.size();
+
+		default:
+			return registers[reg];
+	}
+}
+
+void Mfrc522Model::writeRegister(uint8_t reg, uint8_t value) {
+	update();
+	switch (reg) {
+		case COMMAND_REG:
+			registers[COMMAND_REG] = (registers[COMMAND_REG] & 0x0F) | (value & 0x30);
+			if ((value & 0x0F) != PCD_NO_CMD_CHANGE) {
+				executeCommand(value & 0x0F);
+			}
+
+			break;
+
+		case COM_IRQ_REG:
+		case DIV_IRQ_REG:
+			// bit 7 selects whether the marked bits are set or cleared
+			if (value & IRQ_SET) {
+				registers[reg] |= value & 0x7F;
+			} else {
+				registers[reg] &= ~value;
+			}
+
+			break;
+
+		case STATUS2_REG:
+			// crypto1 can only be switched off by software
+			registers[STATUS2_REG] = (value & 0xC0) | (registers[STATUS2_REG] & 0x07) | (value & registers[STATUS2_REG] & STATUS2_CRYPTO1_ON);
+			break;
+
+		case FIFO_DATA_REG:
+			if (fifo.size() < FIFO_SIZE) {
+				fifo.push_back(value);
+			} else {
+				registers[ERROR_REG] |= ERROR_BUFFER_OVERFLOW;
+			}
+
+			break;
+
+		case FIFO_LEVEL_REG:
+			if (value & FIFO_FLUSH) {
+				fifo.clear();
+				registers[ERROR_REG] &= ~ERROR_BUFFER_OVERFLOW;
+			}
+
+			break;
+
+		case BIT_FRAMING_REG:
+			registers[BIT_FRAMING_REG] = value & 0x7F;
+			if ((value & START_SEND) && ((registers[COMMAND_REG] & 0x0F) == PCD_TRANSCEIVE)) {
+				startTransceive();
+			}
+
+			break;
+
+		case TX_CONTROL_REG:
+			registers[TX_CONTROL_REG] = value;
+			field.setEnabled((value & 0x03) != 0);
+			break;
+
+		case ERROR_REG:
+		case CRC_RESULT_REG_H:
+		case CRC_RESULT_REG_L:
+		case VERSION_REG:
+			break;
+
+		default:
+			registers[reg] = value;
+			break;
+	}
+}
+
+void Mfrc522Model::executeCommand(uint8_t command) {
+	// a new command terminates the running command
+	operation = Operation::NONE;
+	registers[COMMAND_REG] = (registers[COMMAND_REG] & 0xF0) | command;
+	switch (command) {
+		case PCD_CALC_CRC:
+			calculateCrc();
+			break;
+
+		case PCD_TRANSCEIVE:
+			// transmission starts with StartSend
+			break;
+
+		case PCD_MF_AUTHENT:
+			startAuthentication();
+			break;
+
+		case PCD_SOFT_RESET:
+			reset();
+			break;
+
+		default:
+			// commands not used by the driver terminate immediately
+			registers[COMMAND_REG] = (registers[COMMAND_REG] & 0xF0) | PCD_IDLE;
+			if (command != PCD_IDLE) {
+				registers[COM_IRQ_REG] |= COM_IRQ_IDLE;
+			}
+
+			break;
+	}
+}
+
+void Mfrc522Model::calculateCrc() {
+	const uint16_t presets[4] = {0x0000, 0x6363, 0xA671, 0xFFFF};
+	const uint16_t crc = computeCrc(fifo, presets[registers[MODE_REG] & 0x03]);
+	fifo.clear();
+	registers[CRC_RESULT_REG_L] = (uint8_t)(crc & 0xFF);
+	registers[CRC_RESULT_REG_H] = (uint8_t)(crc >> 8);
+	registers[DIV_IRQ_REG] |= DIV_IRQ_CRC;
+}
+
+void Mfrc522Model::startTransceive() {
+	const Clock::time_point now = Clock::now();
+	const uint8_t txLastBits = registers[BIT_FRAMING_REG] & 0x07;
+	const std::vector<uint8_t> frame(fifo.begin(), fifo.end());
+	fifo.clear();
+	registers[ERROR_REG] = 0;
+	exchangeCount++;
+
+	const size_t txBits = frame.empty() ? 0 : (frame.size() - 1) * 8 + (txLastBits ? txLastBits : 8);
+	const Clock::time_point transmissionEnd = now + getAirTime(txBits);
+	const bool crypto1 = (registers[STATUS2_REG] & STATUS2_CRYPTO1_ON) != 0;
+
+	VirtualCard* card = field.getActiveCard();
+	replyReceived = (card != nullptr) && !frame.empty() && card->transceive(frame.data(), frame.size(), txLastBits, crypto1, reply);
+	replyErrors = 0;
+	if (replyReceived && injectError()) {
+		switch (random() % 3) {
+			case 0:
+				replyReceived = false;
+				break;
+			case 1:
+				reply.data[random() % reply.data.size()] ^= (uint8_t)(1 << (random() % 8));
+				break;
+			default:
+				replyErrors = ERROR_PARITY;
+				break;
+		}
+	}
+
+	// the reply must start before the timer expires
+	const Clock::duration responseTime = FRAME_DELAY_TIME + reply.processingTime + options.rfLatency;
+	if (replyReceived && (!isTimerAuto() || (responseTime < getTimerPeriod()))) {
+		const size_t rxBits = (reply.data.size() - 1) * 8 + (reply.lastBits ? reply.lastBits : 8);
+		completionTime = transmissionEnd + responseTime + getAirTime(rxBits);
+	} else {
+		replyReceived = false;
+		completionTime = isTimerAuto() ? transmissionEnd + getTimerPeriod() : Clock::time_point::max();
+	}
+
+	operation = Operation::TRANSCEIVE;
+}
+
+void Mfrc522Model::startAuthentication() {
+	const Clock::time_point now = Clock::now();
+	const std::vector<uint8_t> data(fifo.begin(), fifo.end());
+	fifo.clear();
+	registers[ERROR_REG] = 0;
+	exchangeCount++;
+
+	// authentication command, nonce of the card, answer of the reader and answer of the card
+	VirtualCard* card = field.getActiveCard();
+	replyReceived = (data.size() == 12) && (card != nullptr) && card->authenticate(data[0], data[1], &data[2], &data[8]);
+	if (replyReceived && injectError()) {
+		replyReceived = false;
+	}
+
+	if (replyReceived) {
+		completionTime = now + getAirTime(32) + getAirTime(32) + getAirTime(64) + getAirTime(32) + 3 * FRAME_DELAY_TIME + options.rfLatency;
+	} else {
+		completionTime = isTimerAuto() ? now + getAirTime(32) + getTimerPeriod() : Clock::time_point::max();
+	}
+
+	operation = Operation::AUTHENTICATION;
+}
+
+bool Mfrc522Model::injectError() {
+	if ((options.rfErrorRate <= 0) || (std::uniform_real_distribution<double>(0, 1)(random) >= options.rfErrorRate)) {
+		return false;
+	}
+
+	injectedErrorCount++;
+	return true;
+}
+
+void Mfrc522Model::update() {
+	if ((operation == Operation::NONE) || (Clock::now() < completionTime)) {
+		return;
+	}
+
+	if (!replyReceived) {
+		registers[COM_IRQ_REG] |= COM_IRQ_TIMER;
+	} else if (operation == Operation::AUTHENTICATION) {
+		registers[STATUS2_REG] |= STATUS2_CRYPTO1_ON;
+		registers[COM_IRQ_REG] |= COM_IRQ_IDLE;
+		registers[COMMAND_REG] = (registers[COMMAND_REG] & 0xF0) | PCD_IDLE;
+	} else {
+		for (uint8_t value : reply.data) {
+			if (fifo.size() < FIFO_SIZE) {
+				fifo.push_back(value);
+			} else {
+				registers[ERROR_REG] |= ERROR_BUFFER_OVERFLOW;
+			}
+		}
+
+		registers[CONTROL_REG] = (registers[CONTROL_REG] & 0xF8) | reply.lastBits;
+		registers[ERROR_REG] |= replyErrors;
+		registers[COM_IRQ_REG] |= COM_IRQ_RX | ((registers[ERROR_REG] != 0) ? COM_IRQ_ERR : 0);
+	}
+
+	operation = Operation::NONE;
+}
+
+bool Mfrc522Model::isTimerAuto() const {
+	return (registers[T_MODE_REG] & 0x80) != 0;
+}
+
+Clock::duration Mfrc522Model::getTimerPeriod() const {
+	const uint32_t prescaler = ((registers[T_MODE_REG] & 0x0F) << 8) | registers[T_PRESCALER_REG];
+	const uint32_t reload = (registers[T_RELOAD_REG_H] << 8) | registers[T_RELOAD_REG_L];
+	const double seconds = (2.0 * prescaler + 1) * (reload + 1) / CARRIER_FREQUENCY;
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+}
+
+} // namespace emulator
+} // namespace mfreader
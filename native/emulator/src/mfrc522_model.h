@@ -0,0 +1,124 @@
+#ifndef MFREADER_EMULATOR_MFRC522_MODEL_H
+#define MFREADER_EMULATOR_MFRC522_MODEL_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <random>
+
+#include "card.h"
+#include "clock.h"
+#include "spi_device.h"
+
+namespace mfreader {
+namespace emulator {
+
+/********************************************************************************
+ * Register level model of the MFRC522 reader IC attached to the SPI bus. The
+ * model realizes the commands used by the driver (CalcCRC, Transceive,
+ * MFAuthent, SoftReset) with the FIFO, interrupt, error and timer registers.
+ * Exchanges with cards take the time of the frames at 106 kbit/s, replies that
+ * do not arrive before the timer of the reader expires are lost.
+ ********************************************************************************/
+class Mfrc522Model : public SpiDevice {
+public:
+	struct Options {
+		// Additional latency of every exchange with a card
+		std::chrono::microseconds rfLatency {0};
+
+		// Probability of a failed exchange (lost or corrupted reply, parity error)
+		double rfErrorRate = 0;
+
+		// Seed of random generator of errors
+		uint32_t seed = 1;
+	};
+
+	Mfrc522Model(Field& field, Options options);
+
+	// Selects or deselects the chip (SPI slave select)
+	void select(bool selected) override;
+
+	// Exchanges a byte over SPI
+	uint8_t transfer(uint8_t value) override;
+
+	// Sets level of the reset pin (low level powers the chip down, rising edge resets it)
+	void setResetPin(bool high) override;
+
+	// Returns number of exchanges with cards
+	uint64_t getExchangeCount() const {
+		return exchangeCount;
+	}
+
+	// Returns number of exchanges failed by error injection
+	uint64_t getInjectedErrorCount() const {
+		return injectedErrorCount;
+	}
+
+private:
+	// Operations with cards in progress
+	enum class Operation {
+		NONE,
+		TRANSCEIVE,
+		AUTHENTICATION
+	};
+
+	// Resets registers to their reset values
+	void reset();
+
+	uint8_t readRegister(uint8_t reg);
+	void writeRegister(uint8_t reg, uint8_t value);
+
+	// Starts command written to CommandReg
+	void executeCommand(uint8_t command);
+
+	// Computes CRC of the FIFO content (CalcCRC command)
+	void calculateCrc();
+
+	// Transmits the FIFO content to the card in the field (StartSend of Transceive command)
+	void startTransceive();
+
+	// Authenticates the card with key in the FIFO (MFAuthent command)
+	void startAuthentication();
+
+	// Completes operation if its time elapsed
+	void update();
+
+	// Returns whether the operation fails due to error injection
+	bool injectError();
+
+	// Returns period of the timer (TModeReg, TPrescalerReg, TReloadReg)
+	Clock::duration getTimerPeriod() const;
+
+	// Returns whether the timer starts automatically at the end of transmission
+	bool isTimerAuto() const;
+
+	Field& field;
+	Options options;
+	std::mt19937 random;
+
+	std::array<uint8_t, 64> registers;
+	std::deque<uint8_t> fifo;
+	bool powered = true;
+
+	// State of SPI transaction
+	bool selected = false;
+	bool addressPending = false;
+	bool reading = false;
+	uint8_t address = 0;
+
+	// Operation in progress and its result
+	Operation operation = Operation::NONE;
+	Clock::time_point completionTime;
+	bool replyReceived = false;
+	CardReply reply;
+	uint8_t replyErrors = 0;
+
+	uint64_t exchangeCount = 0;
+	uint64_t injectedErrorCount = 0;
+};
+
+} // namespace emulator
+} // namespace mfreader
+
+#endif
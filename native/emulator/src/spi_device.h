@@ -0,0 +1,31 @@
+#ifndef MFREADER_EMULATOR_SPI_DEVICE_H
+#define MFREADER_EMULATOR_SPI_DEVICE_H
+
+#include <cstdint>
+
+namespace mfreader {
+namespace emulator {
+
+/********************************************************************************
+ * Device attached to the SPI bus of the board with its slave select and reset
+ * pins.
+ ********************************************************************************/
+class SpiDevice {
+public:
+	virtual ~SpiDevice() {
+	}
+
+	// Selects or deselects the device (SPI slave select)
+	virtual void select(bool selected) = 0;
+
+	// Exchanges a byte over SPI
+	virtual uint8_t transfer(uint8_t value) = 0;
+
+	// Sets level of the reset pin
+	virtual void setResetPin(bool high) = 0;
+};
+
+} // namespace emulator
+} // namespace mfreader
+
+#endif
@@ -0,0 +1,177 @@
+#include "spi_recording.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+namespace mfreader {
+namespace emulator {
+
+namespace {
+
+std::string formatTransaction(const SpiTransaction& transaction) {
+	char buffer[16];
+	std::snprintf(buffer, sizeof(buffer), "%c %02X", transaction.isRead() ? 'R' : 'W', transaction.getRegister());
+	std::string text = buffer;
+	for (uint8_t value : transaction.values) {
+		std::snprintf(buffer, sizeof(buffer), " %02X", value);
+		text += buffer;
+	}
+
+	return text;
+}
+
+} // namespace
+
+//----------------------------------------------------------------------
+// SpiRecording
+//----------------------------------------------------------------------
+
+void SpiRecording::beginCall(const std::string& name) {
+	calls.push_back(SpiCall());
+	calls.back().name = name;
+}
+
+void SpiRecording::add(const SpiTransaction& transaction) {
+	if (calls.empty()) {
+		beginCall("");
+	}
+
+	calls.back().transactions.push_back(transaction);
+}
+
+std::vector<SpiTransaction> SpiRecording::getTransactions() const {
+	std::vector<SpiTransaction> result;
+	for (const SpiCall& call : calls) {
+		result.insert(result.end(), call.transactions.begin(), call.transactions.end());
+	}
+
+	return result;
+}
+
+bool SpiRecording::save(const std::string& path) const {
+	std::ofstream file(path);
+	if (!file) {
+		return false;
+	}
+
+	for (const SpiCall& call : calls) {
+		file << "call " << call.name << "\n";
+		for (const SpiTransaction& transaction : call.transactions) {
+			file << transaction.time << " " << formatTransaction(transaction) << "\n";
+		}
+	}
+
+	return (bool)file;
+}
+
+bool SpiRecording::load(const std::string& path) {
+	std::ifstream file(path);
+	if (!file) {
+		return false;
+	}
+
+	calls.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || (line[0] == '#')) {
+			continue;
+		}
+
+		if (line.compare(0, 5, "call ") == 0) {
+			beginCall(line.substr(5));
+			continue;
+		}
+
+		std::istringstream fields(line);
+		SpiTransaction transaction;
+		std::string direction;
+		std::string value;
+		if (!(fields >> transaction.time >> direction >> value) || ((direction != "R") && (direction != "W"))) {
+			return false;
+		}
+
+		transaction.address = (uint8_t)((std::strtoul(value.c_str(), nullptr, 16) & 0x7E) | ((direction == "R") ? 0x80 : 0));
+		while (fields >> value) {
+			transaction.values.push_back((uint8_t)std::strtoul(value.c_str(), nullptr, 16));
+		}
+
+		add(transaction);
+	}
+
+	return true;
+}
+
+//----------------------------------------------------------------------
+// SpiReplay
+//----------------------------------------------------------------------
+
+SpiReplay::SpiReplay(std::vector<SpiTransaction> transactions) : transactions(std::move(transactions)) {
+}
+
+void SpiReplay::select(bool selected) {
+	if (!selected && this->selected && (transferred > 0) && !diverged) {
+		const SpiTransaction& expected = transactions[position];
+		if (transferred - 1 != expected.values.size()) {
+			diverge("transaction " + std::to_string(position) + " transferred " + std::to_string(transferred - 1)
+					+ " bytes instead of " + formatTransaction(expected));
+			return;
+		}
+
+		position++;
+	}
+
+	this->selected = selected;
+	transferred = 0;
+}
+
+uint8_t SpiReplay::transfer(uint8_t value) {
+	if (!selected || diverged) {
+		return 0;
+	}
+
+	transferred++;
+	if (transferred == 1) {
+		if (position >= transactions.size()) {
+			diverge("transaction " + std::to_string(position) + " is not recorded");
+		} else if (value != transactions[position].address) {
+			char buffer[16];
+			std::snprintf(buffer, sizeof(buffer), "%c %02X", (value & 0x80) ? 'R' : 'W', value & 0x7E);
+			diverge("transaction " + std::to_string(position) + " accessed " + buffer + " instead of "
+					+ formatTransaction(transactions[position]));
+		}
+
+		return 0;
+	}
+
+	const SpiTransaction& expected = transactions[position];
+	const size_t index = transferred - 2;
+	if (index >= expected.values.size()) {
+		diverge("transaction " + std::to_string(position) + " transferred more bytes than " + formatTransaction(expected));
+		return 0;
+	}
+
+	if (expected.isRead()) {
+		return expected.values[index];
+	}
+
+	if (value != expected.values[index]) {
+		diverge("transaction " + std::to_string(position) + " wrote different values than " + formatTransaction(expected));
+	}
+
+	return 0;
+}
+
+void SpiReplay::setResetPin(bool high) {
+}
+
+void SpiReplay::diverge(const std::string& description) {
+	if (!diverged) {
+		diverged = true;
+		divergence = description;
+	}
+}
+
+} // namespace emulator
+} // namespace mfreader
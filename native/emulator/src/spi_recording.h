@@ -0,0 +1,127 @@
+#ifndef MFREADER_EMULATOR_SPI_RECORDING_H
+#define MFREADER_EMULATOR_SPI_RECORDING_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "spi_device.h"
+
+namespace mfreader {
+namespace emulator {
+
+/********************************************************************************
+ * Register access of the driver (one SPI transaction).
+ ********************************************************************************/
+struct SpiTransaction {
+	// Time of the board in microseconds
+	uint32_t time = 0;
+
+	// The first byte sent (register address, MSB set for reads)
+	uint8_t address = 0;
+
+	// Bytes written to or read from the register
+	std::vector<uint8_t> values;
+
+	bool isRead() const {
+		return (address & 0x80) != 0;
+	}
+
+	// Returns register as defined by PCD_Register of the driver
+	uint8_t getRegister() const {
+		return address & 0x7E;
+	}
+
+	// Returns number of bytes transferred over SPI
+	int getByteCount() const {
+		return 1 + (int)values.size();
+	}
+};
+
+/********************************************************************************
+ * Register accesses performed by a high level call of the driver.
+ ********************************************************************************/
+struct SpiCall {
+	std::string name;
+	std::vector<SpiTransaction> transactions;
+};
+
+/********************************************************************************
+ * Recording of register accesses of the driver grouped by high level calls.
+ * Recordings are stored as text, a call starts with line "call NAME" and it
+ * is followed by its transactions "TIME R|W REGISTER VALUES" (hexadecimal).
+ ********************************************************************************/
+class SpiRecording {
+public:
+	// Starts a call, following transactions belong to the call
+	void beginCall(const std::string& name);
+
+	// Adds a transaction to the current call
+	void add(const SpiTransaction& transaction);
+
+	const std::vector<SpiCall>& getCalls() const {
+		return calls;
+	}
+
+	// Returns transactions of all calls in order
+	std::vector<SpiTransaction> getTransactions() const;
+
+	bool save(const std::string& path) const;
+	bool load(const std::string& path);
+
+private:
+	std::vector<SpiCall> calls;
+};
+
+/********************************************************************************
+ * Device attached to the SPI bus that replays recorded transactions: reads
+ * return the recorded values, addresses and written values are compared with
+ * the recording. Once the driver diverges from the recording, reads return 0.
+ ********************************************************************************/
+class SpiReplay : public SpiDevice {
+public:
+	explicit SpiReplay(std::vector<SpiTransaction> transactions);
+
+	void select(bool selected) override;
+	uint8_t transfer(uint8_t value) override;
+	void setResetPin(bool high) override;
+
+	// Returns whether the driver diverged from the recording
+	bool hasDiverged() const {
+		return diverged;
+	}
+
+	// Returns description of the divergence
+	const std::string& getDivergence() const {
+		return divergence;
+	}
+
+	// Returns whether all recorded transactions were replayed
+	bool isCompleted() const {
+		return position == transactions.size();
+	}
+
+	// Returns number of replayed transactions
+	size_t getPosition() const {
+		return position;
+	}
+
+private:
+	// Records the first divergence
+	void diverge(const std::string& description);
+
+	std::vector<SpiTransaction> transactions;
+	size_t position = 0;
+
+	// State of SPI transaction (number of bytes transferred in the transaction)
+	bool selected = false;
+	size_t transferred = 0;
+
+	bool diverged = false;
+	std::string divergence;
+};
+
+} // namespace emulator
+} // namespace mfreader
+
+#endif
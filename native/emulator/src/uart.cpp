@@ -0,0 +1,260 @@
+#include "uart.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace mfreader {
+namespace emulator {
+
+namespace {
+
+// Capacity of buffers of HardwareSerial (one slot of the ring buffer is unused)
+const size_t RX_BUFFER_CAPACITY = 63;
+const size_t TX_BUFFER_CAPACITY = 63;
+
+// Interval between checks of the speed set by the host
+const std::chrono::milliseconds HOST_BAUD_RATE_INTERVAL {5};
+
+// Mapping of termios speeds to baud rates
+struct SpeedMapping {
+	speed_t speed;
+	uint32_t baudRate;
+};
+
+const SpeedMapping SPEEDS[] = {
+	{B1200, 1200},
+	{B2400, 2400},
+	{B4800, 4800},
+	{B9600, 9600},
+	{B19200, 19200},
+	{B38400, 38400},
+	{B57600, 57600},
+	{B115200, 115200},
+	{B230400, 230400},
+	{B460800, 460800},
+	{B500000, 500000},
+	{B921600, 921600},
+	{B1000000, 1000000}
+};
+
+} // namespace
+
+Uart::Uart(int fd, Options options) :
+		fd(fd), options(options), random(options.seed) {
+}
+
+Clock::duration Uart::getByteTime(uint32_t baudRate) {
+	// start bit, 8 data bits and stop bit
+	return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(10.0 / baudRate));
+}
+
+void Uart::begin(uint32_t baudRate) {
+	enabled = true;
+	this->baudRate = baudRate;
+	receiveBuffer.clear();
+	transmitBuffer.clear();
+	transmitting = false;
+}
+
+void Uart::end() {
+	flush();
+	enabled = false;
+	receiveBuffer.clear();
+}
+
+int Uart::available() {
+	service();
+	return (int)receiveBuffer.size();
+}
+
+int Uart::read() {
+	service();
+	if (receiveBuffer.empty()) {
+		return -1;
+	}
+
+	const uint8_t value = receiveBuffer.front();
+	receiveBuffer.pop_front();
+	return value;
+}
+
+int Uart::peek() {
+	service();
+	return receiveBuffer.empty() ? -1 : receiveBuffer.front();
+}
+
+int Uart::availableForWrite() {
+	service();
+	return (int)(TX_BUFFER_CAPACITY - transmitBuffer.size());
+}
+
+size_t Uart::write(uint8_t value) {
+	if (!enabled) {
+		return 0;
+	}
+
+	// as HardwareSerial, writing to the full buffer waits for transmission of a byte
+	service();
+	while (transmitBuffer.size() >= TX_BUFFER_CAPACITY) {
+		std::this_thread::sleep_until(transmissionEnd);
+		service();
+	}
+
+	if (transmitting) {
+		transmitBuffer.push_back(value);
+	} else {
+		transmitting = true;
+		transmittedByte = value;
+		transmissionEnd = Clock::now() + getByteTime(baudRate);
+	}
+
+	return 1;
+}
+
+void Uart::flush() {
+	service();
+	while (transmitting) {
+		std::this_thread::sleep_until(transmissionEnd);
+		service();
+	}
+}
+
+void Uart::updateHostBaudRate(Clock::time_point now, bool force) {
+	if (!force && (hostBaudRate != 0) && (now - hostBaudRateTime < HOST_BAUD_RATE_INTERVAL)) {
+		return;
+	}
+
+	// speed of the slave side is read from the master side of the pseudo terminal
+	hostBaudRateTime = now;
+	termios settings;
+	if (tcgetattr(fd, &settings) < 0) {
+		return;
+	}
+
+	const speed_t speed = cfgetospeed(&settings);
+	for (const SpeedMapping& mapping : SPEEDS) {
+		if (mapping.speed == speed) {
+			hostBaudRate = mapping.baudRate;
+			return;
+		}
+	}
+}
+
+bool Uart::corrupt(uint8_t& value, bool injectErrors) {
+	if (options.checkBaudRate && (hostBaudRate != 0) && (hostBaudRate != baudRate)) {
+		// framing errors: the byte is lost or garbled
+		corruptedByteCount++;
+		value = (uint8_t)random();
+		return (random() & 0x01) != 0;
+	}
+
+	if (injectErrors && (options.errorRate > 0) && (std::uniform_real_distribution<double>(0, 1)(random) < options.errorRate)) {
+		corruptedByteCount++;
+		value ^= (uint8_t)(1 << (random() % 8));
+	}
+
+	return true;
+}
+
+void Uart::service() {
+	const Clock::time_point now = Clock::now();
+	updateHostBaudRate(now, false);
+
+	// bytes sent by the host arrive one after another at the speed of the host (the host may have
+	// changed the speed just before writing them)
+	uint8_t buffer[256];
+	ssize_t count;
+	while ((count = ::read(fd, buffer, sizeof(buffer))) > 0) {
+		updateHostBaudRate(now, true);
+		const Clock::duration byteTime = getByteTime((hostBaudRate != 0) ? hostBaudRate : baudRate);
+		Clock::time_point arrivalTime = (lastArrivalTime > now) ? lastArrivalTime : now;
+		for (ssize_t i = 0; i < count; i++) {
+			arrivalTime += byteTime;
+			incoming.emplace_back(arrivalTime, buffer[i]);
+		}
+
+		lastArrivalTime = arrivalTime;
+	}
+
+	while (!incoming.empty() && (incoming.front().first <= now)) {
+		uint8_t value = incoming.front().second;
+		incoming.pop_front();
+		if (!enabled || !corrupt(value, true)) {
+			continue;
+		}
+
+		if (receiveBuffer.size() >= RX_BUFFER_CAPACITY) {
+			droppedByteCount++;
+			continue;
+		}
+
+		receiveBuffer.push_back(value);
+	}
+
+	// bytes are transmitted back to back
+	while (transmitting && (transmissionEnd <= now)) {
+		uint8_t value = transmittedByte;
+		if (corrupt(value, false)) {
+			outgoing.push_back(value);
+		}
+
+		if (transmitBuffer.empty()) {
+			transmitting = false;
+		} else {
+			transmittedByte = transmitBuffer.front();
+			transmitBuffer.pop_front();
+			transmissionEnd += getByteTime(baudRate);
+		}
+	}
+
+	// the host does not read: transmitted bytes wait in the pseudo terminal
+	while (!outgoing.empty()) {
+		count = ::write(fd, outgoing.data(), outgoing.size());
+		if (count < 0) {
+			if ((errno != EAGAIN) && (errno != EINTR)) {
+				outgoing.clear();
+			}
+
+			break;
+		}
+
+		outgoing.erase(outgoing.begin(), outgoing.begin() + count);
+	}
+}
+
+Clock::time_point Uart::getNextEventTime() const {
+	Clock::time_point time = Clock::time_point::max();
+	if (!incoming.empty()) {
+		time = incoming.front().first;
+	}
+
+	if (transmitting && (transmissionEnd < time)) {
+		time = transmissionEnd;
+	}
+
+	return time;
+}
+
+void Uart::waitForEvent(Clock::time_point time) {
+	service();
+	Clock::time_point now = Clock::now();
+	Clock::time_point wakeup = std::min(time, getNextEventTime());
+	while (now < wakeup) {
+		// bytes written by the host are received after their transmission time (the next event)
+		pollfd descriptor = {fd, (short)(POLLIN | (outgoing.empty() ? 0 : POLLOUT)), 0};
+		const long long wait = std::chrono::duration_cast<std::chrono::nanoseconds>(wakeup - now).count();
+		const timespec timeout = {(time_t)(wait / 1000000000), (long)(wait % 1000000000)};
+		ppoll(&descriptor, 1, &timeout, nullptr);
+		service();
+		now = Clock::now();
+		wakeup = std::min(time, getNextEventTime());
+	}
+}
+
+} // namespace emulator
+} // namespace mfreader
@@ -0,0 +1,112 @@
+#ifndef MFREADER_EMULATOR_UART_H
+#define MFREADER_EMULATOR_UART_H
+
+#include <cstdint>
+#include <deque>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "clock.h"
+
+namespace mfreader {
+namespace emulator {
+
+/********************************************************************************
+ * UART of the board connected to the master side of a pseudo terminal. Bytes
+ * travel at the speed of the link (10 bits per byte) and the UART has the
+ * buffers of the Arduino core (63 bytes for reception and transmission), bytes
+ * received into a full buffer are lost. Bytes are corrupted if the speed set by
+ * the host on the pseudo terminal differs from the speed of the UART.
+ ********************************************************************************/
+class Uart {
+public:
+	struct Options {
+		// Probability of a corrupted byte received by the reader
+		double errorRate = 0;
+
+		// Whether bytes are corrupted when speeds of the host and of the UART differ
+		bool checkBaudRate = true;
+
+		// Seed of random generator of errors
+		uint32_t seed = 1;
+	};
+
+	// Constructs the UART communicating over the master side of a pseudo terminal
+	Uart(int fd, Options options);
+
+	// Interface of HardwareSerial
+	void begin(uint32_t baudRate);
+	void end();
+	int available();
+	int read();
+	int peek();
+	int availableForWrite();
+	size_t write(uint8_t value);
+	void flush();
+
+	// Receives bytes that arrived and transmits bytes whose transmission completed
+	void service();
+
+	// Returns time of the next reception or transmission of a byte (time_point::max() if none)
+	Clock::time_point getNextEventTime() const;
+
+	// Waits until the time or arrival of bytes from the host, then services the UART
+	void waitForEvent(Clock::time_point time);
+
+	// Returns whether transmitted bytes wait for the host to read from the pseudo terminal
+	bool isOutputPending() const {
+		return !outgoing.empty();
+	}
+
+	// Returns number of bytes lost due to full receive buffer
+	uint64_t getDroppedByteCount() const {
+		return droppedByteCount;
+	}
+
+	// Returns number of bytes corrupted by error injection or mismatch of speeds
+	uint64_t getCorruptedByteCount() const {
+		return corruptedByteCount;
+	}
+
+private:
+	// Returns time of transmission of a byte at the speed
+	static Clock::duration getByteTime(uint32_t baudRate);
+
+	// Reads speed set by the host (at most every few milliseconds unless forced)
+	void updateHostBaudRate(Clock::time_point now, bool force);
+
+	// Corrupts a byte if the speeds do not match or by error injection, returns false if the byte is lost
+	bool corrupt(uint8_t& value, bool injectErrors);
+
+	int fd;
+	Options options;
+	std::mt19937 random;
+
+	bool enabled = false;
+	uint32_t baudRate = 0;
+	uint32_t hostBaudRate = 0;
+	Clock::time_point hostBaudRateTime;
+
+	// Bytes sent by the host with their arrival times
+	std::deque<std::pair<Clock::time_point, uint8_t>> incoming;
+	Clock::time_point lastArrivalTime;
+	std::deque<uint8_t> receiveBuffer;
+
+	// Byte in transmission and bytes waiting for transmission
+	bool transmitting = false;
+	uint8_t transmittedByte = 0;
+	Clock::time_point transmissionEnd;
+	std::deque<uint8_t> transmitBuffer;
+
+	// Transmitted bytes not yet written to the pseudo terminal
+	std::vector<uint8_t> outgoing;
+
+	uint64_t droppedByteCount = 0;
+	uint64_t corruptedByteCount = 0;
+};
+
+} // namespace emulator
+} // namespace mfreader
+
+#endif
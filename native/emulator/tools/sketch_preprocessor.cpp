@@ -0,0 +1,66 @@
+// Converts the sketch into a C++ translation unit as the Arduino builder does: the Arduino core is
+// included and prototypes of functions defined in the sketch are inserted before the first function
+// definition, #line directives keep diagnostics at the lines of the sketch.
+
+#include <fstream>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <vector>
+
+int main(int argc, char** argv) {
+	if (argc != 3) {
+		std::cerr << "usage: sketch_preprocessor SKETCH OUTPUT" << std::endl;
+		return 2;
+	}
+
+	std::ifstream input(argv[1]);
+	if (!input) {
+		std::cerr << "cannot read " << argv[1] << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> lines;
+	std::string line;
+	while (std::getline(input, line)) {
+		lines.push_back(line);
+	}
+
+	// top level function definitions start at the beginning of a line
+	const std::regex definition(R"(^[A-Za-z_][A-Za-z0-9_:<>\*& ]* \**[A-Za-z_][A-Za-z0-9_]*\([^;]*\) *\{)");
+	std::vector<std::string> prototypes;
+	size_t firstDefinition = lines.size();
+	for (size_t i = 0; i < lines.size(); i++) {
+		std::smatch match;
+		if (std::regex_search(lines[i], match, definition)) {
+			std::string prototype = match.str();
+			prototype.erase(prototype.find_last_not_of(" {") + 1);
+			prototypes.push_back(prototype + ";");
+			if (firstDefinition == lines.size()) {
+				firstDefinition = i;
+			}
+		}
+	}
+
+	std::ofstream output(argv[2]);
+	output << "#include <Arduino.h>\n";
+	output << "#line 1 \"" << argv[1] << "\"\n";
+	for (size_t i = 0; i < lines.size(); i++) {
+		if (i == firstDefinition) {
+			for (const std::string& prototype : prototypes) {
+				output << prototype << "\n";
+			}
+
+			output << "#line " << (i + 1) << " \"" << argv[1] << "\"\n";
+		}
+
+		output << lines[i] << "\n";
+	}
+
+	if (!output) {
+		std::cerr << "cannot write " << argv[2] << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
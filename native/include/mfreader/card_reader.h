@@ -0,0 +1,329 @@
+#ifndef MFREADER_CARD_READER_H
+#define MFREADER_CARD_READER_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <vector>
+
+#include <mfreader/gep_codec.h>
+#include <mfreader/io_loop.h>
+#include <mfreader/protocol.h>
+#include <mfreader/serial_port.h>
+
+namespace mfreader {
+
+/********************************************************************************
+ * Response of the reader to a command.
+ ********************************************************************************/
+struct Response {
+	// Status of the command
+	enum class Status {
+		OK,
+		FAILED,
+		TIMEOUT,
+		DISCONNECTED
+	};
+
+	Status status = Status::FAILED;
+
+	// Data of response without the status byte (chunked responses are reassembled)
+	std::vector<uint8_t> data;
+
+	bool ok() const {
+		return status == Status::OK;
+	}
+};
+
+// Handler of a response (invoked in the loop thread)
+typedef std::function<void(const Response& response)> ResponseHandler;
+
+/********************************************************************************
+ * Decoded responses.
+ ********************************************************************************/
+struct SectorTrailer {
+	std::array<uint8_t, 4> accessFlags {};
+	std::array<uint8_t, 6> keyA {};
+	std::array<uint8_t, 6> keyB {};
+	uint8_t generalPurposeByte = 0;
+
+	// Decodes the sector trailer from response to READ_SECTOR_TRAILER
+	static bool decode(const Response& response, SectorTrailer& trailer);
+};
+
+struct CommandStatistics {
+	uint32_t count = 0;
+	uint32_t failures = 0;
+	uint32_t totalTime = 0;
+	uint32_t maxTime = 0;
+
+	// Decodes statistics from response to GET_STATS
+	static bool decode(const Response& response, CommandStatistics& statistics);
+};
+
+struct LinkStatistics {
+	uint32_t droppedFrames = 0;
+	uint32_t malformedFrames = 0;
+	// always 0, commands waiting for execution are held in the serial receive buffer of the reader
+	uint32_t rejectedCommands = 0;
+
+	// Decodes statistics from response to GET_LINK_STATS
+	static bool decode(const Response& response, LinkStatistics& statistics);
+};
+
+struct TraceRecord {
+	// Time of the event (micros() of the reader)
+	uint32_t time = 0;
+	TraceEvent event = TraceEvent::FRAME_RECEIVED;
+
+	// Data of the event (see TraceEvent in the sketch)
+	uint8_t data = 0;
+
+	// Decodes events (the oldest event first) from response to TRACE_DUMP
+	static bool decode(const Response& response, std::vector<TraceRecord>& records);
+};
+
+// Decodes value (4B little endian) from response to VALUE_GET or VALUE_DEBIT
+bool decodeValue(const Response& response, int32_t& value);
+
+// Decodes sector digests (4B big endian each) from response to DIGEST
+bool decodeDigests(const Response& response, std::vector<uint32_t>& digests);
+
+// Decodes bit mask of changed blocks (2B big endian, bit i is set if the i-th block was written) from
+// response to SYNC_BLOCKS
+bool decodeChangedBlocks(const Response& response, uint16_t& changedBlocks);
+
+/********************************************************************************
+ * Card detected by the reader.
+ ********************************************************************************/
+struct CardInfo {
+	CardType type = CardType::UNKNOWN;
+
+	// Number of blocks (number of pages for Ultralight and NTAG cards, 255 for 4K cards)
+	int blockCount = 0;
+
+	std::vector<uint8_t> uid;
+};
+
+/********************************************************************************
+ * Asynchronous client of the reader. Commands are tagged and up to the command
+ * window of them are in flight, the other commands wait in the order of
+ * submission. All callbacks are invoked in the thread of the io loop, public
+ * methods can be called from any thread.
+ ********************************************************************************/
+class CardReader {
+public:
+	struct Options {
+		// Maximal number of commands in flight
+		int commandWindow = COMMAND_QUEUE_SIZE;
+
+		// Time to wait for a response before the command is sent again
+		std::chrono::milliseconds commandTimeout {1000};
+
+		// Number of times a command is sent again before it times out
+		int commandRetries = 2;
+
+		// Tag of the first command, 0 - random (the reader replays responses to repeated tags, so sessions
+		// should not start with the same tags)
+		uint16_t firstTag = 0;
+	};
+
+	// Handler of card changes (card is nullptr when the card is removed)
+	typedef std::function<void(const CardInfo* card)> CardListener;
+
+	// Handler of results of macros executed by the reader after detection of a card
+	typedef std::function<void(bool success, const std::vector<uint8_t>& output)> MacroListener;
+
+	// Constructs the client communicating over the port (the loop must be running while the client exists)
+	CardReader(IoLoop& loop, SerialPort& port, Options options);
+
+	CardReader(IoLoop& loop, SerialPort& port) :
+			CardReader(loop, port, Options()) {
+	}
+
+	// Detaches from the loop, pending commands complete with status DISCONNECTED
+	~CardReader();
+
+	CardReader(const CardReader&) = delete;
+	CardReader& operator=(const CardReader&) = delete;
+
+	// Sets listener of card changes
+	void setCardListener(CardListener listener);
+
+	// Sets listener of executed macros
+	void setMacroListener(MacroListener listener);
+
+	// Returns whether commands are sent in compact framing
+	bool isCompactFraming() const {
+		return compactFraming;
+	}
+
+	// Submits a command, the handler is invoked with the response
+	void execute(CommandCode code, std::vector<uint8_t> payload, ResponseHandler handler);
+
+	// Submits a command and returns future response
+	std::future<Response> execute(CommandCode code, std::vector<uint8_t> payload);
+
+	// Commands (see handlers of commands in the sketch for formats of responses)
+	std::future<Response> resetCard();
+	std::future<Response> setKey(KeyType keyType, const std::array<uint8_t, 6>& key);
+	std::future<Response> readBlock(int block);
+	std::future<Response> writeBlock(int block, const std::vector<uint8_t>& data);
+	std::future<Response> readSectorTrailer(int sector);
+	std::future<Response> writeSectorTrailer(int sector, const SectorTrailer& trailer);
+	std::future<Response> getValue(int block);
+	std::future<Response> setValue(int block, int32_t value);
+	std::future<Response> addValue(int block, int32_t delta, int targetBlock = -1);
+	std::future<Response> subtractValue(int block, int32_t delta, int targetBlock = -1);
+	std::future<Response> copyValue(int block, int targetBlock);
+	std::future<Response> debitValue(int block, int32_t amount);
+	std::future<Response> readPages(int startPage, int count);
+	std::future<Response> writePage(int page, const std::array<uint8_t, 4>& data);
+	std::future<Response> authenticatePages(const std::array<uint8_t, 4>& password);
+	std::future<Response> readNdefMessage();
+	std::future<Response> readSectorDigests(int firstSector, int count, bool skipTrailers = false);
+	std::future<Response> readCommandStatistics(CommandCode code, bool reset = false);
+	std::future<Response> writeMacro(int offset, const std::vector<uint8_t>& bytecode);
+	std::future<Response> setupMacro(int length, bool autoRun);
+	std::future<Response> runMacro();
+	std::future<Response> setCoalescingWindow(int windowMillis);
+	std::future<Response> readLinkStatistics();
+	std::future<Response> dumpTrace(bool clear = false);
+
+	// Reads consecutive blocks, more than MAX_BLOCKS_PER_COMMAND blocks are read with chunked response
+	std::future<Response> readBlocks(int block, int count);
+
+	// Writes consecutive blocks, more than MAX_BLOCKS_PER_COMMAND blocks are sent in fragments
+	std::future<Response> writeBlocks(int block, const std::vector<uint8_t>& data);
+
+	// Writes consecutive blocks whose content differs from the target content (sector trailers are skipped),
+	// more than MAX_BLOCKS_PER_COMMAND blocks are sent in fragments (see decodeChangedBlocks)
+	std::future<Response> synchronizeBlocks(int block, const std::vector<uint8_t>& data);
+
+	// Enables or disables credits sent by the reader after execution of commands
+	std::future<Response> setFlowControl(bool enabled);
+
+	// Switches speed of the link and confirms it by a probe at the new speed (falls back to the
+	// default link speed if the probe fails)
+	std::future<Response> setLinkSpeed(uint32_t baudRate, bool persist);
+
+	// Switches to compact framing if the reader responds in compact framing (the response
+	// status is OK if compact framing is used)
+	std::future<Response> negotiateCompactFraming();
+
+private:
+	// Command waiting for response
+	struct PendingCommand {
+		CommandCode code;
+		uint16_t tag = 0;
+		std::vector<uint8_t> message;
+		bool chunked = false;
+		int attempts = 0;
+		int retries = 0;
+		uint64_t sequence = 0;
+		IoLoop::TimerId timer = 0;
+		std::vector<uint8_t> chunkedData;
+		int chunkedTotal = -1;
+		ResponseHandler handler;
+	};
+
+	typedef std::shared_ptr<PendingCommand> PendingCommandPtr;
+
+	// Submits command in the loop thread
+	void submit(PendingCommandPtr command);
+
+	// Sends waiting commands that fit into the command window and credits
+	void sendWaitingCommands();
+
+	// Returns whether a frame can be sent with respect to credits
+	bool hasCredits(size_t frameLength) const;
+
+	// Sends frame of a command and starts its timer
+	void transmit(PendingCommand& command);
+
+	// Handles expired timer of a command
+	void handleTimeout(uint16_t tag);
+
+	// Completes a command in flight
+	void complete(uint16_t tag, Response::Status status, std::vector<uint8_t> data);
+
+	// Handles readable or writable port
+	void handlePortEvents(uint32_t events);
+
+	// Handles received message
+	void handleMessage(const uint8_t* message, size_t length, int32_t tag);
+
+	// Handles response to a command
+	void handleResponse(const uint8_t* message, size_t length, uint16_t tag);
+
+	// Handles response to a command with credits appended by the reader
+	void handleResponseWithCredits(const uint8_t* message, size_t length, uint16_t tag);
+
+	// Handles credits sent by the reader in a separate message
+	void handleCredits(const uint8_t* message, size_t length);
+
+	// Updates credits sent by the reader after the command with given sequence number
+	void updateCredits(int64_t sequence, int commands, int bytes);
+
+	// Completes all commands with status DISCONNECTED
+	void disconnect();
+
+	// Sends payload of a command in FRAGMENT commands, the result is the response of the last fragment
+	std::future<Response> executeFragmented(CommandCode code, std::vector<uint8_t> payload);
+
+	// Sends fragment of a command and continues with the next fragment
+	void sendFragment(CommandCode code, std::shared_ptr<std::vector<uint8_t>> payload, size_t offset,
+			std::shared_ptr<std::promise<Response>> promise);
+
+	// Sends a probe command in the current framing
+	void probe(ResponseHandler handler);
+
+	// Submits command and returns future response
+	std::future<Response> executeAsync(CommandCode code, std::vector<uint8_t> payload, bool chunked);
+
+	// Creates and submits command
+	void submitCommand(CommandCode code, const std::vector<uint8_t>& payload, bool chunked, int retries,
+			ResponseHandler handler);
+
+	// Allocates tag not used by a command in flight
+	uint16_t allocateTag();
+
+	// Executes the task in the loop thread and waits for it
+	void runInLoop(std::function<void()> task);
+
+	IoLoop& loop;
+	SerialPort& port;
+	Options options;
+
+	gep::Decoder decoder;
+	std::vector<uint8_t> output;
+	bool writeWatched = false;
+	bool attached = false;
+	std::atomic<bool> compactFraming {false};
+
+	std::deque<PendingCommandPtr> waitingCommands;
+	std::map<uint16_t, PendingCommandPtr> commandsInFlight;
+	uint16_t nextTag = 0;
+	uint64_t sendSequence = 0;
+
+	// State of flow control: credits received with response to the command with the credit sequence
+	bool flowControl = false;
+	int64_t creditSequence = -1;
+	int creditCommands = 0;
+	int creditBytes = 0;
+	int32_t lastResponseTag = -1;
+	int64_t lastResponseSequence = -1;
+
+	CardListener cardListener;
+	MacroListener macroListener;
+};
+
+} // namespace mfreader
+
+#endif
@@ -0,0 +1,114 @@
+#ifndef MFREADER_GEP_CODEC_H
+#define MFREADER_GEP_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace mfreader {
+
+/********************************************************************************
+ * Encoder and streaming decoder of GEP frames, a portable form of the framing
+ * implemented by gepstream_messenger.h. Frames in classic framing carry bytes
+ * as nibbles, frames in compact framing carry bytes as they are with special
+ * bytes escaped. The decoder accepts both framings.
+ ********************************************************************************/
+namespace gep {
+
+// Byte indicating start of a new message
+constexpr uint8_t MESSAGE_START_BYTE = 0x0C;
+
+// Byte indicating start of a new message in compact framing
+constexpr uint8_t MESSAGE_START_COMPACT_BYTE = 0x0E;
+
+// Byte indicating end of a message
+constexpr uint8_t MESSAGE_END_BYTE = 0x03;
+
+// Byte indicating end of a message with tag
+constexpr uint8_t MESSAGE_END_WITH_TAG_BYTE = 0x06;
+
+// Byte preceding an escaped special byte in compact framing
+constexpr uint8_t ESCAPE_BYTE = 0x1B;
+
+// Mask applied to escaped special bytes in compact framing
+constexpr uint8_t ESCAPE_XOR = 0x20;
+
+// Value of tag of a message without tag
+constexpr int32_t NO_TAG = -1;
+
+// Updates CRC-8 checksum (polynomial 0x8C) with data
+uint8_t computeCRC8(uint8_t crc, const uint8_t* data, size_t length);
+
+// Returns maximal length of frame with a message (upper bound in both framings): start byte, encoded destination id,
+// encoded message and tag, end byte and CRC
+constexpr size_t getFrameLength(size_t messageLength, bool withTag) {
+	return 1 + 2 + 2 * messageLength + (withTag ? 4 : 0) + 2;
+}
+
+// Appends frame with a message to the output (tag 0-65535 or NO_TAG)
+void encodeFrame(std::vector<uint8_t>& output, uint8_t destinationId, const uint8_t* message, size_t length,
+		int32_t tag, bool compact);
+
+/********************************************************************************
+ * Streaming decoder of GEP frames.
+ ********************************************************************************/
+class Decoder {
+public:
+	// Handler of a received message (tag is NO_TAG for messages without tag)
+	typedef std::function<void(uint8_t destinationId, const uint8_t* message, size_t length, int32_t tag)> Handler;
+
+	// Constructs the decoder of messages up to maxMessageLength bytes
+	Decoder(size_t maxMessageLength, Handler handler);
+
+	// Processes received bytes
+	void feed(const uint8_t* data, size_t length);
+
+	// Processes a received byte
+	void feed(uint8_t dataByte);
+
+	// Returns whether the last received message used compact framing
+	bool isLastMessageCompact() const {
+		return lastMessageCompact;
+	}
+
+	// Returns the number of malformed frames (invalid bytes, invalid checksum, too long or interrupted frames)
+	unsigned long getMalformedFrameCount() const {
+		return malformedFrameCount;
+	}
+
+private:
+	// States of the receive process
+	enum State {
+		WAIT_START,
+		WAIT_DESTINATION_ID,
+		WAIT_MESSAGE_BYTE_HIGH,
+		WAIT_MESSAGE_BYTE_LOW,
+		WAIT_CRC,
+		WAIT_CRC_WITH_TAG
+	};
+
+	// Resets receive of a malformed frame
+	void abortReceive();
+
+	// Stores a byte of the message being received
+	void storeMessageByte(uint8_t dataByte);
+
+	size_t maxMessageLength;
+	Handler handler;
+
+	// Buffer of the message being received (including tag)
+	std::vector<uint8_t> message;
+
+	State state;
+	uint8_t messageDestinationId;
+	bool rxCompact;
+	bool rxEscaped;
+	bool lastMessageCompact;
+	unsigned long malformedFrameCount;
+};
+
+} // namespace gep
+} // namespace mfreader
+
+#endif
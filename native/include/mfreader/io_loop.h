@@ -0,0 +1,92 @@
+#ifndef MFREADER_IO_LOOP_H
+#define MFREADER_IO_LOOP_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace mfreader {
+
+/********************************************************************************
+ * Event loop driven by epoll. A single loop can serve many readers: file
+ * descriptors, posted tasks and timers are all handled by the loop thread.
+ ********************************************************************************/
+class IoLoop {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	// Handler of events (EPOLLIN, EPOLLOUT, ...) of a file descriptor
+	typedef std::function<void(uint32_t events)> FdHandler;
+
+	// Identifier of a scheduled timer
+	typedef uint64_t TimerId;
+
+	IoLoop();
+	~IoLoop();
+
+	IoLoop(const IoLoop&) = delete;
+	IoLoop& operator=(const IoLoop&) = delete;
+
+	// Starts the loop in a new thread
+	void start();
+
+	// Stops the loop and waits for the loop thread
+	void stop();
+
+	// Runs the loop in the calling thread until stop is requested
+	void run();
+
+	// Starts watching events of a file descriptor
+	void watch(int fd, uint32_t events, FdHandler handler);
+
+	// Changes watched events of a file descriptor
+	void modify(int fd, uint32_t events);
+
+	// Stops watching a file descriptor
+	void unwatch(int fd);
+
+	// Executes the task in the loop thread
+	void post(std::function<void()> task);
+
+	// Executes the task in the loop thread after the delay, returns identifier of the timer
+	TimerId schedule(Clock::duration delay, std::function<void()> task);
+
+	// Cancels a scheduled timer (no effect, if the timer already expired)
+	void cancel(TimerId timerId);
+
+	// Returns whether the calling thread is the loop thread
+	bool isLoopThread() const {
+		return std::this_thread::get_id() == loopThreadId.load();
+	}
+
+private:
+	// Wakes up the loop waiting in epoll_wait
+	void wakeUp();
+
+	// Executes posted tasks and expired timers
+	void runPending();
+
+	int epollFd;
+	int wakeFd;
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+	std::atomic<std::thread::id> loopThreadId;
+
+	std::mutex mutex;
+	std::unordered_map<int, std::shared_ptr<FdHandler>> handlers;
+	std::vector<std::function<void()>> tasks;
+	std::map<std::pair<Clock::time_point, TimerId>, std::function<void()>> timers;
+	std::unordered_map<TimerId, Clock::time_point> timerDeadlines;
+	TimerId nextTimerId;
+};
+
+} // namespace mfreader
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef MFREADER_PROTOCOL_H
+#define MFREADER_PROTOCOL_H
+
+#include <cstdint>
+
+namespace mfreader {
+
+// Maximal length of a message (must match MaxMessageSize of the messenger in the reader)
+constexpr int MAX_MESSAGE_LENGTH = 50;
+
+// Number of commands the reader holds: 2 in the receive queue of the messenger and 1 in execution (further
+// commands wait in the serial receive buffer of the reader)
+constexpr int COMMAND_QUEUE_SIZE = 3;
+
+// Maximal number of blocks read or written by a single command
+constexpr int MAX_BLOCKS_PER_COMMAND = 2;
+
+// Maximal number of blocks read or written by a fragmented command or a command with chunked response
+constexpr int MAX_BLOCKS_PER_STREAM = 16;
+
+// Maximal number of pages read by a single command
+constexpr int MAX_PAGES_PER_COMMAND = 12;
+
+// Maximal number of sector digests returned by a single command
+constexpr int MAX_DIGESTS_PER_COMMAND = 12;
+
+// Maximal number of payload bytes in a fragment of command
+constexpr int MAX_FRAGMENT_DATA_SIZE = MAX_MESSAGE_LENGTH - 6;
+
+// Maximal length of macro bytecode
+constexpr int MAX_MACRO_LENGTH = 200;
+
+// Link speed of the reader without persisted link speed and after failed switch of link speed
+constexpr uint32_t DEFAULT_LINK_SPEED = 9600;
+
+// Time in milliseconds after which the reader falls back to the default link speed
+constexpr int LINK_SPEED_TIMEOUT_MS = 1000;
+
+// Flags of commands
+constexpr uint8_t STATS_RESET = 0x01;
+constexpr uint8_t DIGEST_SKIP_TRAILERS = 0x01;
+constexpr uint8_t MACRO_AUTORUN = 0x01;
+constexpr uint8_t LINK_SPEED_PERSIST = 0x01;
+constexpr uint8_t TRACE_CLEAR = 0x01;
+
+// Command codes
+enum class CommandCode : uint8_t {
+	RESET = 1,
+	SET_KEY = 2,
+	READ_BLOCK = 3,
+	WRITE_BLOCK = 4,
+	READ_SECTOR_TRAILER = 5,
+	WRITE_SECTOR_TRAILER = 6,
+	VALUE_GET = 7,
+	VALUE_SET = 8,
+	VALUE_ADD = 9,
+	VALUE_SUB = 10,
+	VALUE_COPY = 11,
+	VALUE_DEBIT = 12,
+	READ_PAGES = 13,
+	WRITE_PAGE = 14,
+	PAGE_AUTH = 15,
+	READ_NDEF = 16,
+	READ_BLOCKS = 17,
+	WRITE_BLOCKS = 18,
+	DIGEST = 19,
+	SYNC_BLOCKS = 20,
+	GET_STATS = 21,
+	MACRO_WRITE = 22,
+	MACRO_SETUP = 23,
+	MACRO_RUN = 24,
+	SET_LINK_SPEED = 25,
+	FRAGMENT = 26,
+	SET_COALESCING = 27,
+	SET_FLOW_CONTROL = 28,
+	GET_LINK_STATS = 29,
+	TRACE_DUMP = 30
+};
+
+// Number of command codes
+constexpr int COMMAND_COUNT = 30;
+
+// Codes of messages sent by the reader
+enum class MessageCode : uint8_t {
+	COMMAND_OK = 1,
+	COMMAND_FAILED = 2,
+	CARD_DETECTED = 3,
+	CARD_REMOVED = 4,
+	MACRO_EXECUTED = 5,
+	ENVELOPE = 6,
+	CREDITS = 7,
+	// COMMAND_OK and COMMAND_FAILED with credits appended to the response (flow control)
+	COMMAND_OK_CREDITS = 8,
+	COMMAND_FAILED_CREDITS = 9
+};
+
+// Events recorded in the trace of the reader
+enum class TraceEvent : uint8_t {
+	FRAME_RECEIVED = 1,
+	COMMAND_DISPATCHED = 2,
+	AUTH_START = 3,
+	AUTH_END = 4,
+	TRANSCEIVE_START = 5,
+	TRANSCEIVE_END = 6,
+	RESPONSE_QUEUED = 7,
+	RESPONSE_FLUSHED = 8,
+	CARD_POLL = 9
+};
+
+// Key types
+enum class KeyType : uint8_t {
+	KEY_A = 1,
+	KEY_B = 2
+};
+
+// Card types
+enum class CardType : uint8_t {
+	UNKNOWN = 0,
+	ISO_14443_4 = 1,
+	ISO_18092 = 2,
+	MIFARE_MINI = 3,
+	MIFARE_1K = 4,
+	MIFARE_4K = 5,
+	MIFARE_UL = 6,
+	MIFARE_PLUS = 7,
+	TNP3XXX = 8,
+	NTAG = 9
+};
+
+} // namespace mfreader
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef MFREADER_SERIAL_PORT_H
+#define MFREADER_SERIAL_PORT_H
+
+#include <cstdint>
+#include <string>
+
+namespace mfreader {
+
+/********************************************************************************
+ * Serial port in raw non-blocking mode configured by termios.
+ ********************************************************************************/
+class SerialPort {
+public:
+	// Opens the serial port (throws std::system_error on failure)
+	SerialPort(const std::string& path, uint32_t baudRate);
+
+	// Takes ownership of an open file descriptor of a terminal and configures it
+	SerialPort(int fd, uint32_t baudRate);
+
+	~SerialPort();
+
+	SerialPort(const SerialPort&) = delete;
+	SerialPort& operator=(const SerialPort&) = delete;
+
+	// Changes baud rate of the port (throws std::system_error on failure)
+	void setBaudRate(uint32_t baudRate);
+
+	// Returns baud rate of the port
+	uint32_t getBaudRate() const {
+		return baudRate;
+	}
+
+	// Returns whether the baud rate is supported by termios
+	static bool isSupportedBaudRate(uint32_t baudRate);
+
+	// Returns file descriptor of the port
+	int getFd() const {
+		return fd;
+	}
+
+private:
+	// Configures raw mode and baud rate
+	void configure();
+
+	int fd;
+	uint32_t baudRate;
+};
+
+/********************************************************************************
+ * Pseudo terminal used as a loopback link to an emulated reader.
+ ********************************************************************************/
+class PseudoTerminal {
+public:
+	// Opens master side of a new pseudo terminal (throws std::system_error on failure)
+	PseudoTerminal();
+
+	~PseudoTerminal();
+
+	PseudoTerminal(const PseudoTerminal&) = delete;
+	PseudoTerminal& operator=(const PseudoTerminal&) = delete;
+
+	// Returns file descriptor of the master side
+	int getMasterFd() const {
+		return masterFd;
+	}
+
+	// Returns path of the slave side
+	const std::string& getSlavePath() const {
+		return slavePath;
+	}
+
+private:
+	int masterFd;
+	std::string slavePath;
+};
+
+} // namespace mfreader
+
+#endif
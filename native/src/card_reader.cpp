@@ -0,0 +1,877 @@
+#include <mfreader/card_reader.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <random>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace mfreader {
+
+namespace {
+
+// Identifier of the endpoint of the reader
+constexpr uint8_t ENDPOINT_ID = 0;
+
+// Length of header of an item in envelope: [1B length][2B tag]
+constexpr size_t ENVELOPE_ITEM_HEADER = 3;
+
+// Length of header of a chunked response: [1B status][2B total length][2B offset]
+constexpr size_t CHUNK_HEADER = 5;
+
+// Length of credits appended to responses: [1B free command slots][1B free bytes of receive buffer]
+constexpr size_t CREDITS_LENGTH = 2;
+
+// Size of buffer for reading from the port
+constexpr size_t READ_BUFFER_SIZE = 256;
+
+uint32_t decodeUInt32BE(const uint8_t* data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+void appendUInt16BE(std::vector<uint8_t>& data, int value) {
+	data.push_back((uint8_t)(value >> 8));
+	data.push_back((uint8_t)value);
+}
+
+void appendInt32LE(std::vector<uint8_t>& data, int32_t value) {
+	for (int i = 0; i < 4; i++) {
+		data.push_back((uint8_t)((uint32_t)value >> (8 * i)));
+	}
+}
+
+// Returns future that is already completed with the status
+std::future<Response> completedFuture(Response::Status status) {
+	std::promise<Response> promise;
+	Response response;
+	response.status = status;
+	promise.set_value(response);
+	return promise.get_future();
+}
+
+} // namespace
+
+bool SectorTrailer::decode(const Response& response, SectorTrailer& trailer) {
+	if (!response.ok() || (response.data.size() != 4 + 6 + 6 + 1)) {
+		return false;
+	}
+
+	const uint8_t* data = response.data.data();
+	std::copy(data, data + 4, trailer.accessFlags.begin());
+	std::copy(data + 4, data + 10, trailer.keyA.begin());
+	std::copy(data + 10, data + 16, trailer.keyB.begin());
+	trailer.generalPurposeByte = data[16];
+	return true;
+}
+
+bool CommandStatistics::decode(const Response& response, CommandStatistics& statistics) {
+	if (!response.ok() || (response.data.size() != 4 * 4)) {
+		return false;
+	}
+
+	const uint8_t* data = response.data.data();
+	statistics.count = decodeUInt32BE(data);
+	statistics.failures = decodeUInt32BE(data + 4);
+	statistics.totalTime = decodeUInt32BE(data + 8);
+	statistics.maxTime = decodeUInt32BE(data + 12);
+	return true;
+}
+
+bool LinkStatistics::decode(const Response& response, LinkStatistics& statistics) {
+	if (!response.ok() || (response.data.size() != 3 * 4)) {
+		return false;
+	}
+
+	const uint8_t* data = response.data.data();
+	statistics.droppedFrames = decodeUInt32BE(data);
+	statistics.malformedFrames = decodeUInt32BE(data + 4);
+	statistics.rejectedCommands = decodeUInt32BE(data + 8);
+	return true;
+}
+
+bool TraceRecord::decode(const Response& response, std::vector<TraceRecord>& records) {
+	// [4B time big endian][1B event][1B data] for each event
+	if (!response.ok() || (response.data.size() % 6 != 0)) {
+		return false;
+	}
+
+	records.clear();
+	for (size_t i = 0; i < response.data.size(); i += 6) {
+		TraceRecord record;
+		record.time = decodeUInt32BE(&response.data[i]);
+		record.event = (TraceEvent)response.data[i + 4];
+		record.data = response.data[i + 5];
+		records.push_back(record);
+	}
+
+	return true;
+}
+
+bool decodeValue(const Response& response, int32_t& value) {
+	if (!response.ok() || (response.data.size() != 4)) {
+		return false;
+	}
+
+	uint32_t result = 0;
+	for (int i = 3; i >= 0; i--) {
+		result = (result << 8) | response.data[i];
+	}
+
+	value = (int32_t)result;
+	return true;
+}
+
+bool decodeChangedBlocks(const Response& response, uint16_t& changedBlocks) {
+	if (!response.ok() || (response.data.size() != 2)) {
+		return false;
+	}
+
+	changedBlocks = (uint16_t)((response.data[0] << 8) | response.data[1]);
+	return true;
+}
+
+bool decodeDigests(const Response& response, std::vector<uint32_t>& digests) {
+	if (!response.ok() || (response.data.size() % 4 != 0)) {
+		return false;
+	}
+
+	digests.clear();
+	for (size_t i = 0; i < response.data.size(); i += 4) {
+		digests.push_back(decodeUInt32BE(&response.data[i]));
+	}
+
+	return true;
+}
+
+CardReader::CardReader(IoLoop& loop, SerialPort& port, Options options) :
+		loop(loop), port(port), options(options),
+		decoder(MAX_MESSAGE_LENGTH, [this](uint8_t destinationId, const uint8_t* message, size_t length, int32_t tag) {
+			handleMessage(message, length, (tag == gep::NO_TAG) ? 0 : tag);
+		}) {
+	if (this->options.commandWindow < 1) {
+		this->options.commandWindow = 1;
+	}
+
+	if (this->options.firstTag == 0) {
+		std::random_device random;
+		this->options.firstTag = (uint16_t)std::uniform_int_distribution<int>(1, 0xFFFF)(random);
+	}
+
+	// tags are allocated by incrementing the last tag
+	nextTag = this->options.firstTag - 1;
+
+	attached = true;
+	loop.watch(port.getFd(), EPOLLIN, [this](uint32_t events) {
+		handlePortEvents(events);
+	});
+}
+
+CardReader::~CardReader() {
+	runInLoop([this] {
+		disconnect();
+	});
+}
+
+void CardReader::runInLoop(std::function<void()> task) {
+	if (loop.isLoopThread()) {
+		task();
+		return;
+	}
+
+	std::promise<void> done;
+	loop.post([&task, &done] {
+		task();
+		done.set_value();
+	});
+	done.get_future().wait();
+}
+
+void CardReader::setCardListener(CardListener listener) {
+	runInLoop([this, &listener] {
+		cardListener = std::move(listener);
+	});
+}
+
+void CardReader::setMacroListener(MacroListener listener) {
+	runInLoop([this, &listener] {
+		macroListener = std::move(listener);
+	});
+}
+
+void CardReader::execute(CommandCode code, std::vector<uint8_t> payload, ResponseHandler handler) {
+	submitCommand(code, payload, false, options.commandRetries, std::move(handler));
+}
+
+std::future<Response> CardReader::execute(CommandCode code, std::vector<uint8_t> payload) {
+	return executeAsync(code, std::move(payload), false);
+}
+
+std::future<Response> CardReader::executeAsync(CommandCode code, std::vector<uint8_t> payload, bool chunked) {
+	std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+	std::future<Response> result = promise->get_future();
+	submitCommand(code, payload, chunked, options.commandRetries, [promise](const Response& response) {
+		promise->set_value(response);
+	});
+
+	return result;
+}
+
+void CardReader::submitCommand(CommandCode code, const std::vector<uint8_t>& payload, bool chunked, int retries,
+		ResponseHandler handler) {
+	PendingCommandPtr command = std::make_shared<PendingCommand>();
+	command->code = code;
+	command->message.reserve(1 + payload.size());
+	command->message.push_back((uint8_t)code);
+	command->message.insert(command->message.end(), payload.begin(), payload.end());
+	command->chunked = chunked;
+	command->retries = retries;
+	command->handler = std::move(handler);
+	submit(command);
+}
+
+void CardReader::submit(PendingCommandPtr command) {
+	// commands submitted in the loop thread (e.g. from handlers) are queued immediately
+	if (!loop.isLoopThread()) {
+		loop.post([this, command] {
+			submit(command);
+		});
+		return;
+	}
+
+	if (!attached) {
+		Response response;
+		response.status = Response::Status::DISCONNECTED;
+		command->handler(response);
+		return;
+	}
+
+	waitingCommands.push_back(command);
+	sendWaitingCommands();
+}
+
+uint16_t CardReader::allocateTag() {
+	// tag 0 is used by notifications
+	do {
+		nextTag = (nextTag == 0xFFFF) ? 1 : nextTag + 1;
+	} while (commandsInFlight.count(nextTag) != 0);
+
+	return nextTag;
+}
+
+bool CardReader::hasCredits(size_t frameLength) const {
+	if (!flowControl || (creditSequence < 0)) {
+		return true;
+	}
+
+	int commands = 0;
+	size_t bytes = 0;
+	for (const auto& entry : commandsInFlight) {
+		if ((int64_t)entry.second->sequence > creditSequence) {
+			commands++;
+			bytes += gep::getFrameLength(entry.second->message.size(), true);
+		}
+	}
+
+	return (commands == 0) || ((commands < creditCommands) && (bytes + frameLength <= (size_t)creditBytes));
+}
+
+void CardReader::sendWaitingCommands() {
+	while (attached && !waitingCommands.empty() && ((int)commandsInFlight.size() < options.commandWindow)
+			&& hasCredits(gep::getFrameLength(waitingCommands.front()->message.size(), true))) {
+		PendingCommandPtr command = waitingCommands.front();
+		waitingCommands.pop_front();
+		command->tag = allocateTag();
+		command->sequence = ++sendSequence;
+		commandsInFlight[command->tag] = command;
+		transmit(*command);
+	}
+}
+
+void CardReader::transmit(PendingCommand& command) {
+	command.attempts++;
+	command.chunkedData.clear();
+	command.chunkedTotal = -1;
+	gep::encodeFrame(output, ENDPOINT_ID, command.message.data(), command.message.size(), command.tag, compactFraming);
+
+	const uint16_t tag = command.tag;
+	loop.cancel(command.timer);
+	command.timer = loop.schedule(options.commandTimeout, [this, tag] {
+		handleTimeout(tag);
+	});
+
+	handlePortEvents(EPOLLOUT);
+}
+
+void CardReader::handleTimeout(uint16_t tag) {
+	auto it = commandsInFlight.find(tag);
+	if (it == commandsInFlight.end()) {
+		return;
+	}
+
+	// the reader replays cached responses to repeated commands
+	PendingCommand& command = *it->second;
+	command.timer = 0;
+	if (command.attempts <= command.retries) {
+		transmit(command);
+		return;
+	}
+
+	complete(tag, Response::Status::TIMEOUT, std::vector<uint8_t>());
+}
+
+void CardReader::complete(uint16_t tag, Response::Status status, std::vector<uint8_t> data) {
+	auto it = commandsInFlight.find(tag);
+	if (it == commandsInFlight.end()) {
+		return;
+	}
+
+	PendingCommandPtr command = it->second;
+	commandsInFlight.erase(it);
+	loop.cancel(command->timer);
+	lastResponseTag = tag;
+	lastResponseSequence = command->sequence;
+
+	Response response;
+	response.status = status;
+	response.data = std::move(data);
+	command->handler(response);
+	sendWaitingCommands();
+}
+
+void CardReader::handlePortEvents(uint32_t events) {
+	if (!attached) {
+		return;
+	}
+
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		uint8_t buffer[READ_BUFFER_SIZE];
+		while (attached) {
+			const ssize_t count = read(port.getFd(), buffer, sizeof(buffer));
+			if (count > 0) {
+				decoder.feed(buffer, count);
+				continue;
+			}
+
+			if ((count < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+				break;
+			}
+
+			// end of stream or failure of the port
+			disconnect();
+			return;
+		}
+	}
+
+	if (!attached) {
+		return;
+	}
+
+	while (!output.empty()) {
+		const ssize_t count = write(port.getFd(), output.data(), output.size());
+		if (count > 0) {
+			output.erase(output.begin(), output.begin() + count);
+			continue;
+		}
+
+		if ((count < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+			disconnect();
+			return;
+		}
+
+		break;
+	}
+
+	const bool writePending = !output.empty();
+	if (writePending != writeWatched) {
+		writeWatched = writePending;
+		loop.modify(port.getFd(), writePending ? (EPOLLIN | EPOLLOUT) : EPOLLIN);
+	}
+}
+
+void CardReader::handleMessage(const uint8_t* message, size_t length, int32_t tag) {
+	if (length == 0) {
+		return;
+	}
+
+	switch ((MessageCode)message[0]) {
+	case MessageCode::COMMAND_OK:
+	case MessageCode::COMMAND_FAILED:
+		handleResponse(message, length, tag);
+		break;
+	case MessageCode::COMMAND_OK_CREDITS:
+	case MessageCode::COMMAND_FAILED_CREDITS:
+		handleResponseWithCredits(message, length, tag);
+		break;
+	case MessageCode::CARD_DETECTED:
+		if ((length >= 3) && cardListener) {
+			CardInfo card;
+			card.type = (CardType)message[1];
+			card.blockCount = message[2];
+			card.uid.assign(message + 3, message + length);
+			cardListener(&card);
+		}
+		break;
+	case MessageCode::CARD_REMOVED:
+		if (cardListener) {
+			cardListener(nullptr);
+		}
+		break;
+	case MessageCode::MACRO_EXECUTED:
+		if ((length >= 2) && macroListener) {
+			macroListener(message[1] == (uint8_t)MessageCode::COMMAND_OK, std::vector<uint8_t>(message + 2, message + length));
+		}
+		break;
+	case MessageCode::ENVELOPE: {
+		// items [1B length][2B tag][message]
+		size_t offset = 1;
+		while (offset + ENVELOPE_ITEM_HEADER <= length) {
+			const size_t itemLength = message[offset];
+			const int32_t itemTag = (message[offset + 1] << 8) | message[offset + 2];
+			if (offset + ENVELOPE_ITEM_HEADER + itemLength > length) {
+				break;
+			}
+
+			handleMessage(&message[offset + ENVELOPE_ITEM_HEADER], itemLength, itemTag);
+			offset += ENVELOPE_ITEM_HEADER + itemLength;
+		}
+		break;
+	}
+	case MessageCode::CREDITS:
+		handleCredits(message, length);
+		break;
+	}
+}
+
+void CardReader::handleResponse(const uint8_t* message, size_t length, uint16_t tag) {
+	auto it = commandsInFlight.find(tag);
+	if (it == commandsInFlight.end()) {
+		return;
+	}
+
+	PendingCommand& command = *it->second;
+	if ((message[0] != (uint8_t)MessageCode::COMMAND_OK) || !command.chunked) {
+		const Response::Status status =
+				(message[0] == (uint8_t)MessageCode::COMMAND_OK) ? Response::Status::OK : Response::Status::FAILED;
+		complete(tag, status, std::vector<uint8_t>(message + 1, message + length));
+		return;
+	}
+
+	// chunked response [OK][2B total length][2B offset][data]
+	if (length < CHUNK_HEADER) {
+		complete(tag, Response::Status::FAILED, std::vector<uint8_t>());
+		return;
+	}
+
+	const int total = (message[1] << 8) | message[2];
+	const size_t offset = (message[3] << 8) | message[4];
+	if (offset == 0) {
+		command.chunkedData.clear();
+		command.chunkedTotal = total;
+	}
+
+	if ((total != command.chunkedTotal) || (offset != command.chunkedData.size())) {
+		return;
+	}
+
+	command.chunkedData.insert(command.chunkedData.end(), message + CHUNK_HEADER, message + length);
+	if (command.chunkedData.size() >= (size_t)total) {
+		complete(tag, Response::Status::OK, std::move(command.chunkedData));
+		return;
+	}
+
+	// the timeout applies to each chunk
+	loop.cancel(command.timer);
+	command.timer = loop.schedule(options.commandTimeout, [this, tag] {
+		handleTimeout(tag);
+	});
+}
+
+void CardReader::handleResponseWithCredits(const uint8_t* message, size_t length, uint16_t tag) {
+	// [COMMAND_OK_CREDITS or COMMAND_FAILED_CREDITS][response data][credits]
+	if (length < 1 + CREDITS_LENGTH) {
+		return;
+	}
+
+	auto it = commandsInFlight.find(tag);
+	if (it != commandsInFlight.end()) {
+		updateCredits(it->second->sequence, message[length - 2], message[length - 1]);
+	}
+
+	std::vector<uint8_t> response(message, message + length - CREDITS_LENGTH);
+	response[0] = (uint8_t)(((MessageCode)message[0] == MessageCode::COMMAND_OK_CREDITS) ? MessageCode::COMMAND_OK
+			: MessageCode::COMMAND_FAILED);
+	handleResponse(response.data(), response.size(), tag);
+}
+
+void CardReader::handleCredits(const uint8_t* message, size_t length) {
+	// [CREDITS][2B tag][credits]
+	if (length < 3 + CREDITS_LENGTH) {
+		return;
+	}
+
+	// credits are sent after the response to the command
+	const int32_t tag = (message[1] << 8) | message[2];
+	if ((tag != lastResponseTag) || (lastResponseSequence < 0)) {
+		return;
+	}
+
+	updateCredits(lastResponseSequence, message[3], message[4]);
+}
+
+void CardReader::updateCredits(int64_t sequence, int commands, int bytes) {
+	// credits of an older command may arrive later (the last response of a command without space for credits)
+	if (!flowControl || (sequence < creditSequence)) {
+		return;
+	}
+
+	creditSequence = sequence;
+	creditCommands = commands;
+	creditBytes = bytes;
+	sendWaitingCommands();
+}
+
+void CardReader::disconnect() {
+	if (!attached) {
+		return;
+	}
+
+	attached = false;
+	loop.unwatch(port.getFd());
+	output.clear();
+
+	std::vector<PendingCommandPtr> commands;
+	for (auto& entry : commandsInFlight) {
+		loop.cancel(entry.second->timer);
+		commands.push_back(entry.second);
+	}
+
+	commands.insert(commands.end(), waitingCommands.begin(), waitingCommands.end());
+	commandsInFlight.clear();
+	waitingCommands.clear();
+
+	Response response;
+	response.status = Response::Status::DISCONNECTED;
+	for (PendingCommandPtr& command : commands) {
+		command->handler(response);
+	}
+}
+
+std::future<Response> CardReader::resetCard() {
+	return execute(CommandCode::RESET, {});
+}
+
+std::future<Response> CardReader::setKey(KeyType keyType, const std::array<uint8_t, 6>& key) {
+	std::vector<uint8_t> payload(1, (uint8_t)keyType);
+	payload.insert(payload.end(), key.begin(), key.end());
+	return execute(CommandCode::SET_KEY, std::move(payload));
+}
+
+std::future<Response> CardReader::readBlock(int block) {
+	std::vector<uint8_t> payload;
+	appendUInt16BE(payload, block);
+	return execute(CommandCode::READ_BLOCK, std::move(payload));
+}
+
+std::future<Response> CardReader::writeBlock(int block, const std::vector<uint8_t>& data) {
+	if (data.size() != 16) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	std::vector<uint8_t> payload;
+	appendUInt16BE(payload, block);
+	payload.insert(payload.end(), data.begin(), data.end());
+	return execute(CommandCode::WRITE_BLOCK, std::move(payload));
+}
+
+std::future<Response> CardReader::readSectorTrailer(int sector) {
+	std::vector<uint8_t> payload;
+	appendUInt16BE(payload, sector);
+	return execute(CommandCode::READ_SECTOR_TRAILER, std::move(payload));
+}
+
+std::future<Response> CardReader::writeSectorTrailer(int sector, const SectorTrailer& trailer) {
+	std::vector<uint8_t> payload;
+	appendUInt16BE(payload, sector);
+	payload.insert(payload.end(), trailer.accessFlags.begin(), trailer.accessFlags.end());
+	payload.insert(payload.end(), trailer.keyA.begin(), trailer.keyA.end());
+	payload.insert(payload.end(), trailer.keyB.begin(), trailer.keyB.end());
+	payload.push_back(trailer.generalPurposeByte);
+	return execute(CommandCode::WRITE_SECTOR_TRAILER, std::move(payload));
+}
+
+std::future<Response> CardReader::getValue(int block) {
+	return execute(CommandCode::VALUE_GET, {(uint8_t)block});
+}
+
+std::future<Response> CardReader::setValue(int block, int32_t value) {
+	std::vector<uint8_t> payload(1, (uint8_t)block);
+	appendInt32LE(payload, value);
+	return execute(CommandCode::VALUE_SET, std::move(payload));
+}
+
+std::future<Response> CardReader::addValue(int block, int32_t delta, int targetBlock) {
+	std::vector<uint8_t> payload(1, (uint8_t)block);
+	appendInt32LE(payload, delta);
+	if (targetBlock >= 0) {
+		payload.push_back((uint8_t)targetBlock);
+	}
+
+	return execute(CommandCode::VALUE_ADD, std::move(payload));
+}
+
+std::future<Response> CardReader::subtractValue(int block, int32_t delta, int targetBlock) {
+	std::vector<uint8_t> payload(1, (uint8_t)block);
+	appendInt32LE(payload, delta);
+	if (targetBlock >= 0) {
+		payload.push_back((uint8_t)targetBlock);
+	}
+
+	return execute(CommandCode::VALUE_SUB, std::move(payload));
+}
+
+std::future<Response> CardReader::copyValue(int block, int targetBlock) {
+	return execute(CommandCode::VALUE_COPY, {(uint8_t)block, (uint8_t)targetBlock});
+}
+
+std::future<Response> CardReader::debitValue(int block, int32_t amount) {
+	std::vector<uint8_t> payload(1, (uint8_t)block);
+	appendInt32LE(payload, amount);
+	return execute(CommandCode::VALUE_DEBIT, std::move(payload));
+}
+
+std::future<Response> CardReader::readPages(int startPage, int count) {
+	if ((count < 1) || (count > MAX_PAGES_PER_COMMAND)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	return execute(CommandCode::READ_PAGES, {(uint8_t)startPage, (uint8_t)count});
+}
+
+std::future<Response> CardReader::writePage(int page, const std::array<uint8_t, 4>& data) {
+	std::vector<uint8_t> payload(1, (uint8_t)page);
+	payload.insert(payload.end(), data.begin(), data.end());
+	return execute(CommandCode::WRITE_PAGE, std::move(payload));
+}
+
+std::future<Response> CardReader::authenticatePages(const std::array<uint8_t, 4>& password) {
+	return execute(CommandCode::PAGE_AUTH, std::vector<uint8_t>(password.begin(), password.end()));
+}
+
+std::future<Response> CardReader::readNdefMessage() {
+	return executeAsync(CommandCode::READ_NDEF, {}, true);
+}
+
+std::future<Response> CardReader::readBlocks(int block, int count) {
+	if ((count < 1) || (count > MAX_BLOCKS_PER_STREAM)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	std::vector<uint8_t> payload;
+	appendUInt16BE(payload, block);
+	payload.push_back((uint8_t)count);
+	return executeAsync(CommandCode::READ_BLOCKS, std::move(payload), count > MAX_BLOCKS_PER_COMMAND);
+}
+
+std::future<Response> CardReader::writeBlocks(int block, const std::vector<uint8_t>& data) {
+	if (data.empty() || (data.size() % 16 != 0) || (data.size() > 16 * MAX_BLOCKS_PER_STREAM)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	std::vector<uint8_t> payload;
+	appendUInt16BE(payload, block);
+	payload.insert(payload.end(), data.begin(), data.end());
+	if (data.size() <= 16 * MAX_BLOCKS_PER_COMMAND) {
+		return execute(CommandCode::WRITE_BLOCKS, std::move(payload));
+	}
+
+	// fragments are sent one by one, the reader writes blocks as soon as their data are received
+	return executeFragmented(CommandCode::WRITE_BLOCKS, std::move(payload));
+}
+
+std::future<Response> CardReader::executeFragmented(CommandCode code, std::vector<uint8_t> payload) {
+	std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+	std::future<Response> result = promise->get_future();
+	sendFragment(code, std::make_shared<std::vector<uint8_t>>(std::move(payload)), 0, promise);
+	return result;
+}
+
+void CardReader::sendFragment(CommandCode code, std::shared_ptr<std::vector<uint8_t>> payload, size_t offset,
+		std::shared_ptr<std::promise<Response>> promise) {
+	// [1B command code][2B total length][2B offset][data]
+	const size_t fragmentLength = std::min(payload->size() - offset, (size_t)MAX_FRAGMENT_DATA_SIZE);
+	std::vector<uint8_t> fragment(1, (uint8_t)code);
+	appendUInt16BE(fragment, (int)payload->size());
+	appendUInt16BE(fragment, (int)offset);
+	fragment.insert(fragment.end(), payload->begin() + offset, payload->begin() + offset + fragmentLength);
+
+	const size_t nextOffset = offset + fragmentLength;
+	execute(CommandCode::FRAGMENT, std::move(fragment), [this, code, payload, nextOffset, promise](const Response& response) {
+		if (!response.ok() || (nextOffset == payload->size())) {
+			promise->set_value(response);
+			return;
+		}
+
+		sendFragment(code, payload, nextOffset, promise);
+	});
+}
+
+std::future<Response> CardReader::readSectorDigests(int firstSector, int count, bool skipTrailers) {
+	if ((count < 1) || (count > MAX_DIGESTS_PER_COMMAND)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	return execute(CommandCode::DIGEST,
+			{(uint8_t)firstSector, (uint8_t)count, (uint8_t)(skipTrailers ? DIGEST_SKIP_TRAILERS : 0)});
+}
+
+std::future<Response> CardReader::synchronizeBlocks(int block, const std::vector<uint8_t>& data) {
+	if (data.empty() || (data.size() % 16 != 0) || (data.size() > 16 * MAX_BLOCKS_PER_STREAM)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	std::vector<uint8_t> payload;
+	appendUInt16BE(payload, block);
+	payload.insert(payload.end(), data.begin(), data.end());
+	if (data.size() <= 16 * MAX_BLOCKS_PER_COMMAND) {
+		return execute(CommandCode::SYNC_BLOCKS, std::move(payload));
+	}
+
+	// the response of the last fragment contains the mask of changed blocks
+	return executeFragmented(CommandCode::SYNC_BLOCKS, std::move(payload));
+}
+
+std::future<Response> CardReader::readCommandStatistics(CommandCode code, bool reset) {
+	return execute(CommandCode::GET_STATS, {(uint8_t)code, (uint8_t)(reset ? STATS_RESET : 0)});
+}
+
+std::future<Response> CardReader::writeMacro(int offset, const std::vector<uint8_t>& bytecode) {
+	if (bytecode.empty() || (bytecode.size() > MAX_MESSAGE_LENGTH - 2) || (offset + bytecode.size() > MAX_MACRO_LENGTH)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	std::vector<uint8_t> payload(1, (uint8_t)offset);
+	payload.insert(payload.end(), bytecode.begin(), bytecode.end());
+	return execute(CommandCode::MACRO_WRITE, std::move(payload));
+}
+
+std::future<Response> CardReader::setupMacro(int length, bool autoRun) {
+	return execute(CommandCode::MACRO_SETUP, {(uint8_t)length, (uint8_t)(autoRun ? MACRO_AUTORUN : 0)});
+}
+
+std::future<Response> CardReader::runMacro() {
+	return execute(CommandCode::MACRO_RUN, {});
+}
+
+std::future<Response> CardReader::setCoalescingWindow(int windowMillis) {
+	if ((windowMillis < 0) || (windowMillis > 0xFF)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	return execute(CommandCode::SET_COALESCING, {(uint8_t)windowMillis});
+}
+
+std::future<Response> CardReader::readLinkStatistics() {
+	return execute(CommandCode::GET_LINK_STATS, {});
+}
+
+std::future<Response> CardReader::dumpTrace(bool clear) {
+	return executeAsync(CommandCode::TRACE_DUMP, {(uint8_t)(clear ? TRACE_CLEAR : 0)}, true);
+}
+
+std::future<Response> CardReader::setFlowControl(bool enabled) {
+	std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+	std::future<Response> result = promise->get_future();
+	loop.post([this, enabled, promise] {
+		// credits are accepted as soon as the reader can send them
+		flowControl = true;
+		execute(CommandCode::SET_FLOW_CONTROL, {(uint8_t)(enabled ? 1 : 0)}, [this, enabled, promise](const Response& response) {
+			flowControl = response.ok() && enabled;
+			creditSequence = -1;
+			promise->set_value(response);
+		});
+	});
+
+	return result;
+}
+
+void CardReader::probe(ResponseHandler handler) {
+	// any response confirms the link, the probe is not repeated
+	submitCommand(CommandCode::GET_LINK_STATS, {}, false, 0, std::move(handler));
+}
+
+std::future<Response> CardReader::setLinkSpeed(uint32_t baudRate, bool persist) {
+	if (!SerialPort::isSupportedBaudRate(baudRate)) {
+		return completedFuture(Response::Status::FAILED);
+	}
+
+	std::vector<uint8_t> payload;
+	for (int i = 3; i >= 0; i--) {
+		payload.push_back((uint8_t)(baudRate >> (8 * i)));
+	}
+	payload.push_back(persist ? LINK_SPEED_PERSIST : 0);
+
+	std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+	std::future<Response> result = promise->get_future();
+	execute(CommandCode::SET_LINK_SPEED, std::move(payload), [this, baudRate, promise](const Response& response) {
+		if (!response.ok()) {
+			promise->set_value(response);
+			return;
+		}
+
+		// the reader switches after the response is sent, any valid message at the new speed confirms it
+		try {
+			port.setBaudRate(baudRate);
+		} catch (const std::system_error&) {
+			Response failed;
+			promise->set_value(failed);
+			return;
+		}
+
+		probe([this, promise](const Response& probeResponse) {
+			Response confirmed;
+			if ((probeResponse.status == Response::Status::OK) || (probeResponse.status == Response::Status::FAILED)) {
+				confirmed.status = Response::Status::OK;
+			} else if (probeResponse.status == Response::Status::TIMEOUT) {
+				// the reader falls back to the default link speed
+				try {
+					port.setBaudRate(DEFAULT_LINK_SPEED);
+				} catch (const std::system_error&) {
+				}
+				confirmed.status = Response::Status::FAILED;
+			} else {
+				confirmed.status = probeResponse.status;
+			}
+
+			promise->set_value(confirmed);
+		});
+	});
+
+	return result;
+}
+
+std::future<Response> CardReader::negotiateCompactFraming() {
+	std::shared_ptr<std::promise<Response>> promise = std::make_shared<std::promise<Response>>();
+	std::future<Response> result = promise->get_future();
+	loop.post([this, promise] {
+		// the reader responds in framing of the last received frame
+		compactFraming = true;
+		probe([this, promise](const Response& response) {
+			Response negotiated;
+			if (((response.status == Response::Status::OK) || (response.status == Response::Status::FAILED))
+					&& decoder.isLastMessageCompact()) {
+				negotiated.status = Response::Status::OK;
+			} else {
+				compactFraming = false;
+				negotiated.status = (response.status == Response::Status::DISCONNECTED) ? response.status : Response::Status::FAILED;
+			}
+
+			promise->set_value(negotiated);
+		});
+	});
+
+	return result;
+}
+
+} // namespace mfreader
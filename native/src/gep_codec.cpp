@@ -0,0 +1,227 @@
+#include <mfreader/gep_codec.h>
+
+namespace mfreader {
+namespace gep {
+
+namespace {
+
+// Returns whether the byte must be escaped in compact framing
+bool isSpecialByte(uint8_t dataByte) {
+	return (dataByte == MESSAGE_START_BYTE) || (dataByte == MESSAGE_START_COMPACT_BYTE) || (dataByte == MESSAGE_END_BYTE)
+			|| (dataByte == MESSAGE_END_WITH_TAG_BYTE) || (dataByte == ESCAPE_BYTE);
+}
+
+// Appends a byte encoded as two nibbles or (in compact framing) as it is or escaped
+void encodeByte(std::vector<uint8_t>& output, uint8_t dataByte, bool compact) {
+	if (compact) {
+		if (isSpecialByte(dataByte)) {
+			output.push_back(ESCAPE_BYTE);
+			output.push_back(dataByte ^ ESCAPE_XOR);
+		} else {
+			output.push_back(dataByte);
+		}
+		return;
+	}
+
+	uint8_t nibble = dataByte >> 4;
+	output.push_back((nibble << 4) | (nibble ^ 0x0F));
+	nibble = dataByte & 0x0F;
+	output.push_back((nibble << 4) | (nibble ^ 0x0F));
+}
+
+} // namespace
+
+uint8_t computeCRC8(uint8_t crc, const uint8_t* data, size_t length) {
+	while (length > 0) {
+		uint8_t inByte = *data;
+		for (int i = 0; i < 8; i++) {
+			const uint8_t mix = (crc ^ inByte) & 0x01;
+			crc >>= 1;
+			if (mix) {
+				crc ^= 0x8C;
+			}
+			inByte >>= 1;
+		}
+
+		data++;
+		length--;
+	}
+
+	return crc;
+}
+
+void encodeFrame(std::vector<uint8_t>& output, uint8_t destinationId, const uint8_t* message, size_t length,
+		int32_t tag, bool compact) {
+	uint8_t crc = computeCRC8(0, &destinationId, 1);
+	crc = computeCRC8(crc, message, length);
+
+	if (compact) {
+		output.push_back(MESSAGE_START_COMPACT_BYTE);
+		encodeByte(output, destinationId, true);
+	} else {
+		output.push_back(MESSAGE_START_BYTE);
+		output.push_back((destinationId << 4) | (destinationId ^ 0x0F));
+	}
+
+	for (size_t i = 0; i < length; i++) {
+		encodeByte(output, message[i], compact);
+	}
+
+	if (tag >= 0) {
+		const uint8_t tagBytes[2] = {(uint8_t)(tag >> 8), (uint8_t)tag};
+		crc = computeCRC8(crc, tagBytes, 2);
+		encodeByte(output, tagBytes[0], compact);
+		encodeByte(output, tagBytes[1], compact);
+		output.push_back(MESSAGE_END_WITH_TAG_BYTE);
+	} else {
+		output.push_back(MESSAGE_END_BYTE);
+	}
+
+	output.push_back(crc);
+}
+
+Decoder::Decoder(size_t maxMessageLength, Handler handler) :
+		maxMessageLength(maxMessageLength), handler(std::move(handler)), state(WAIT_START), messageDestinationId(0),
+		rxCompact(false), rxEscaped(false), lastMessageCompact(false), malformedFrameCount(0) {
+	message.reserve(maxMessageLength + 2);
+}
+
+void Decoder::abortReceive() {
+	state = WAIT_START;
+	malformedFrameCount++;
+}
+
+void Decoder::storeMessageByte(uint8_t dataByte) {
+	if (message.size() >= maxMessageLength + 2) {
+		// Invalid state (reset receive) - message buffer is full
+		abortReceive();
+		return;
+	}
+
+	message.push_back(dataByte);
+}
+
+void Decoder::feed(const uint8_t* data, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		feed(data[i]);
+	}
+}
+
+void Decoder::feed(uint8_t dataByte) {
+	// Ignore all bytes received in state WAIT_START different than start bytes
+	if ((state == WAIT_START) && (dataByte != MESSAGE_START_BYTE) && (dataByte != MESSAGE_START_COMPACT_BYTE)) {
+		return;
+	}
+
+	// CRC byte must be processed before other actions, indeed, the value of this byte can be a start byte
+	if ((state == WAIT_CRC) || (state == WAIT_CRC_WITH_TAG)) {
+		uint8_t crc = computeCRC8(0, &messageDestinationId, 1);
+		crc = computeCRC8(crc, message.data(), message.size());
+		if (crc != dataByte) {
+			// Invalid state (reset receive) - invalid checksum
+			abortReceive();
+			return;
+		}
+
+		size_t length = message.size();
+		int32_t tag = NO_TAG;
+		if (state == WAIT_CRC_WITH_TAG) {
+			length -= 2;
+			tag = (message[length] << 8) | message[length + 1];
+		}
+
+		state = WAIT_START;
+		lastMessageCompact = rxCompact;
+
+		// too long message without a tag is ignored
+		if (length <= maxMessageLength) {
+			handler(messageDestinationId, message.data(), length, tag);
+		}
+		return;
+	}
+
+	// After receiving a start byte, the receive of the message is restarted
+	if ((dataByte == MESSAGE_START_BYTE) || (dataByte == MESSAGE_START_COMPACT_BYTE)) {
+		if (state != WAIT_START) {
+			// Interrupted frame
+			malformedFrameCount++;
+		}
+
+		state = WAIT_DESTINATION_ID;
+		rxCompact = (dataByte == MESSAGE_START_COMPACT_BYTE);
+		rxEscaped = false;
+		return;
+	}
+
+	// Process data bytes of message in compact framing (end bytes are processed as in classic framing)
+	if (rxCompact && ((state == WAIT_DESTINATION_ID) || (state == WAIT_MESSAGE_BYTE_HIGH))
+			&& (rxEscaped || ((dataByte != MESSAGE_END_BYTE) && (dataByte != MESSAGE_END_WITH_TAG_BYTE)))) {
+		if (dataByte == ESCAPE_BYTE) {
+			// Invalid state (reset receive) - escaped escape byte
+			if (rxEscaped) {
+				abortReceive();
+			}
+
+			rxEscaped = !rxEscaped;
+			return;
+		}
+
+		const uint8_t inByte = rxEscaped ? (dataByte ^ ESCAPE_XOR) : dataByte;
+		rxEscaped = false;
+		if (state == WAIT_DESTINATION_ID) {
+			if (inByte >= 16) {
+				abortReceive();
+				return;
+			}
+
+			messageDestinationId = inByte;
+			message.clear();
+			state = WAIT_MESSAGE_BYTE_HIGH;
+			return;
+		}
+
+		storeMessageByte(inByte);
+		return;
+	}
+
+	if ((state == WAIT_MESSAGE_BYTE_HIGH) && ((dataByte == MESSAGE_END_BYTE) || (dataByte == MESSAGE_END_WITH_TAG_BYTE))) {
+		if (dataByte == MESSAGE_END_BYTE) {
+			state = WAIT_CRC;
+		} else if (message.size() >= 2) {
+			state = WAIT_CRC_WITH_TAG;
+		} else {
+			abortReceive();
+		}
+		return;
+	}
+
+	// Check whether received byte is well formed data byte (if not, reset receive)
+	const uint8_t nibble = dataByte >> 4;
+	if (nibble != ((dataByte ^ 0x0F) & 0x0F)) {
+		abortReceive();
+		return;
+	}
+
+	switch (state) {
+	case WAIT_DESTINATION_ID:
+		messageDestinationId = nibble;
+		message.clear();
+		state = WAIT_MESSAGE_BYTE_HIGH;
+		break;
+	case WAIT_MESSAGE_BYTE_HIGH:
+		storeMessageByte(nibble << 4);
+		if (state != WAIT_START) {
+			state = WAIT_MESSAGE_BYTE_LOW;
+		}
+		break;
+	case WAIT_MESSAGE_BYTE_LOW:
+		message.back() |= nibble;
+		state = WAIT_MESSAGE_BYTE_HIGH;
+		break;
+	default:
+		abortReceive();
+	}
+}
+
+} // namespace gep
+} // namespace mfreader
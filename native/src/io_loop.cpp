@@ -0,0 +1,206 @@
+#include <mfreader/io_loop.h>
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace mfreader {
+
+namespace {
+
+// Maximal number of events processed by a single epoll_wait
+constexpr int MAX_EVENTS = 32;
+
+std::system_error systemError(const char* what) {
+	return std::system_error(errno, std::generic_category(), what);
+}
+
+} // namespace
+
+IoLoop::IoLoop() : stopRequested(false), loopThreadId(std::thread::id()), nextTimerId(1) {
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd < 0) {
+		throw systemError("epoll_create1");
+	}
+
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (wakeFd < 0) {
+		close(epollFd);
+		throw systemError("eventfd");
+	}
+
+	epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = wakeFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+}
+
+IoLoop::~IoLoop() {
+	stop();
+	close(wakeFd);
+	close(epollFd);
+}
+
+void IoLoop::start() {
+	if (thread.joinable()) {
+		return;
+	}
+
+	stopRequested = false;
+	thread = std::thread([this] {
+		run();
+	});
+}
+
+void IoLoop::stop() {
+	stopRequested = true;
+	wakeUp();
+	if (thread.joinable() && (thread.get_id() != std::this_thread::get_id())) {
+		thread.join();
+	}
+}
+
+void IoLoop::run() {
+	loopThreadId = std::this_thread::get_id();
+	epoll_event events[MAX_EVENTS];
+	while (!stopRequested) {
+		// wait until the nearest timer expires
+		int timeoutMillis = -1;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!tasks.empty()) {
+				timeoutMillis = 0;
+			} else if (!timers.empty()) {
+				auto delay = timers.begin()->first.first - Clock::now();
+				auto delayMillis = std::chrono::duration_cast<std::chrono::milliseconds>(delay).count() + 1;
+				timeoutMillis = (delayMillis < 0) ? 0 : (int)delayMillis;
+			}
+		}
+
+		int count = epoll_wait(epollFd, events, MAX_EVENTS, timeoutMillis);
+		if ((count < 0) && (errno != EINTR)) {
+			break;
+		}
+
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.fd == wakeFd) {
+				uint64_t value;
+				while (read(wakeFd, &value, sizeof(value)) > 0) {
+				}
+				continue;
+			}
+
+			std::shared_ptr<FdHandler> handler;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				auto it = handlers.find(events[i].data.fd);
+				if (it != handlers.end()) {
+					handler = it->second;
+				}
+			}
+
+			if (handler) {
+				(*handler)(events[i].events);
+			}
+		}
+
+		runPending();
+	}
+
+	loopThreadId = std::thread::id();
+}
+
+void IoLoop::runPending() {
+	std::vector<std::function<void()>> readyTasks;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		readyTasks.swap(tasks);
+		const Clock::time_point now = Clock::now();
+		while (!timers.empty() && (timers.begin()->first.first <= now)) {
+			readyTasks.push_back(std::move(timers.begin()->second));
+			timerDeadlines.erase(timers.begin()->first.second);
+			timers.erase(timers.begin());
+		}
+	}
+
+	for (auto& task : readyTasks) {
+		task();
+	}
+}
+
+void IoLoop::watch(int fd, uint32_t events, FdHandler handler) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		handlers[fd] = std::make_shared<FdHandler>(std::move(handler));
+	}
+
+	epoll_event event = {};
+	event.events = events;
+	event.data.fd = fd;
+	if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+		throw systemError("epoll_ctl");
+	}
+}
+
+void IoLoop::modify(int fd, uint32_t events) {
+	epoll_event event = {};
+	event.events = events;
+	event.data.fd = fd;
+	epoll_ctl(epollFd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void IoLoop::unwatch(int fd) {
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+	std::lock_guard<std::mutex> lock(mutex);
+	handlers.erase(fd);
+}
+
+void IoLoop::post(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		tasks.push_back(std::move(task));
+	}
+
+	wakeUp();
+}
+
+IoLoop::TimerId IoLoop::schedule(Clock::duration delay, std::function<void()> task) {
+	TimerId timerId;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		timerId = nextTimerId++;
+		const Clock::time_point deadline = Clock::now() + delay;
+		timers.emplace(std::make_pair(deadline, timerId), std::move(task));
+		timerDeadlines.emplace(timerId, deadline);
+	}
+
+	wakeUp();
+	return timerId;
+}
+
+void IoLoop::cancel(TimerId timerId) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = timerDeadlines.find(timerId);
+	if (it == timerDeadlines.end()) {
+		return;
+	}
+
+	timers.erase(std::make_pair(it->second, timerId));
+	timerDeadlines.erase(it);
+}
+
+void IoLoop::wakeUp() {
+	if (isLoopThread()) {
+		return;
+	}
+
+	const uint64_t value = 1;
+	ssize_t written = write(wakeFd, &value, sizeof(value));
+	(void)written;
+}
+
+} // namespace mfreader
@@ -0,0 +1,152 @@
+#include <mfreader/serial_port.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <system_error>
+
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace mfreader {
+
+namespace {
+
+// Mapping of baud rates to termios speeds
+struct BaudRateMapping {
+	uint32_t baudRate;
+	speed_t speed;
+};
+
+const BaudRateMapping BAUD_RATES[] = {
+	{1200, B1200},
+	{2400, B2400},
+	{4800, B4800},
+	{9600, B9600},
+	{19200, B19200},
+	{38400, B38400},
+	{57600, B57600},
+	{115200, B115200},
+	{230400, B230400},
+	{460800, B460800},
+	{500000, B500000},
+	{921600, B921600},
+	{1000000, B1000000}
+};
+
+bool findSpeed(uint32_t baudRate, speed_t& speed) {
+	for (const BaudRateMapping& mapping : BAUD_RATES) {
+		if (mapping.baudRate == baudRate) {
+			speed = mapping.speed;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+std::system_error systemError(int error, const char* what) {
+	return std::system_error(error, std::generic_category(), what);
+}
+
+} // namespace
+
+SerialPort::SerialPort(const std::string& path, uint32_t baudRate) : baudRate(baudRate) {
+	fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		throw systemError(errno, "open");
+	}
+
+	try {
+		configure();
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+}
+
+SerialPort::SerialPort(int fd, uint32_t baudRate) : fd(fd), baudRate(baudRate) {
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	try {
+		configure();
+	} catch (...) {
+		close(fd);
+		throw;
+	}
+}
+
+SerialPort::~SerialPort() {
+	close(fd);
+}
+
+bool SerialPort::isSupportedBaudRate(uint32_t baudRate) {
+	speed_t speed;
+	return findSpeed(baudRate, speed);
+}
+
+void SerialPort::configure() {
+	speed_t speed;
+	if (!findSpeed(baudRate, speed)) {
+		throw systemError(EINVAL, "unsupported baud rate");
+	}
+
+	termios settings;
+	if (tcgetattr(fd, &settings) < 0) {
+		throw systemError(errno, "tcgetattr");
+	}
+
+	cfmakeraw(&settings);
+	settings.c_cflag |= CLOCAL | CREAD;
+	settings.c_cflag &= ~CRTSCTS;
+	// reads of non-blocking port without data fail with EAGAIN (read returns 0 only after hang up)
+	settings.c_cc[VMIN] = 1;
+	settings.c_cc[VTIME] = 0;
+	cfsetispeed(&settings, speed);
+	cfsetospeed(&settings, speed);
+	if (tcsetattr(fd, TCSANOW, &settings) < 0) {
+		throw systemError(errno, "tcsetattr");
+	}
+}
+
+void SerialPort::setBaudRate(uint32_t baudRate) {
+	speed_t speed;
+	if (!findSpeed(baudRate, speed)) {
+		throw systemError(EINVAL, "unsupported baud rate");
+	}
+
+	termios settings;
+	if (tcgetattr(fd, &settings) < 0) {
+		throw systemError(errno, "tcgetattr");
+	}
+
+	// data sent at the previous speed must be transmitted before the switch
+	cfsetispeed(&settings, speed);
+	cfsetospeed(&settings, speed);
+	if (tcsetattr(fd, TCSADRAIN, &settings) < 0) {
+		throw systemError(errno, "tcsetattr");
+	}
+
+	this->baudRate = baudRate;
+}
+
+PseudoTerminal::PseudoTerminal() {
+	masterFd = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (masterFd < 0) {
+		throw systemError(errno, "posix_openpt");
+	}
+
+	char name[128];
+	if ((grantpt(masterFd) < 0) || (unlockpt(masterFd) < 0) || (ptsname_r(masterFd, name, sizeof(name)) != 0)) {
+		const int error = errno;
+		close(masterFd);
+		throw systemError(error, "ptsname");
+	}
+
+	slavePath = name;
+}
+
+PseudoTerminal::~PseudoTerminal() {
+	close(masterFd);
+}
+
+} // namespace mfreader
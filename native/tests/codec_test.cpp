@@ -0,0 +1,136 @@
+#include <cstdio>
+#include <vector>
+
+#include <mfreader/gep_codec.h>
+
+using namespace mfreader;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+// Received message
+struct Received {
+	uint8_t destinationId;
+	std::vector<uint8_t> message;
+	int32_t tag;
+};
+
+void decodeAll(gep::Decoder& decoder, const std::vector<uint8_t>& frames, std::vector<Received>& received) {
+	received.clear();
+	decoder.feed(frames.data(), frames.size());
+}
+
+// Round trip of messages with all byte values in both framings
+void testRoundTrip() {
+	std::vector<Received> received;
+	gep::Decoder decoder(50, [&received](uint8_t destinationId, const uint8_t* message, size_t length, int32_t tag) {
+		received.push_back({destinationId, std::vector<uint8_t>(message, message + length), tag});
+	});
+
+	for (int compact = 0; compact < 2; compact++) {
+		for (int first = 0; first < 256; first += 50) {
+			std::vector<uint8_t> message;
+			for (int i = 0; i < 50; i++) {
+				message.push_back((uint8_t)(first + i));
+			}
+
+			std::vector<uint8_t> frames;
+			gep::encodeFrame(frames, 3, message.data(), message.size(), 0x0C03, compact != 0);
+			gep::encodeFrame(frames, 0, message.data(), 1, gep::NO_TAG, compact != 0);
+			decodeAll(decoder, frames, received);
+			CHECK(received.size() == 2);
+			if (received.size() == 2) {
+				CHECK(received[0].destinationId == 3);
+				CHECK(received[0].message == message);
+				CHECK(received[0].tag == 0x0C03);
+				CHECK(received[1].destinationId == 0);
+				CHECK(received[1].message == std::vector<uint8_t>(1, message[0]));
+				CHECK(received[1].tag == gep::NO_TAG);
+			}
+
+			CHECK(decoder.isLastMessageCompact() == (compact != 0));
+			CHECK(frames.size() <= 2 * gep::getFrameLength(50, true));
+		}
+	}
+
+	CHECK(decoder.getMalformedFrameCount() == 0);
+}
+
+// Frame in compact framing matches the frame produced by the messenger of the reader
+void testCompactVector() {
+	const uint8_t message[] = {0x01, 0x0C, 0x1B, 0x03, 0x09};
+	const std::vector<uint8_t> expected = {0x0E, 0x00, 0x01, 0x1B, 0x2C, 0x1B, 0x3B, 0x1B, 0x23, 0x09, 0x00, 0x07, 0x06, 0xC9};
+	std::vector<uint8_t> frame;
+	gep::encodeFrame(frame, 0, message, sizeof(message), 7, true);
+	CHECK(frame == expected);
+}
+
+// Frame with escaped destination id and only special bytes reaches the frame length bound exactly
+void testFrameLengthBound() {
+	const std::vector<uint8_t> message(50, 0x1B);
+	std::vector<uint8_t> frame;
+	gep::encodeFrame(frame, 3, message.data(), message.size(), 0x1B1B, true);
+	CHECK(frame.size() == gep::getFrameLength(message.size(), true));
+
+	frame.clear();
+	gep::encodeFrame(frame, 3, message.data(), message.size(), gep::NO_TAG, false);
+	CHECK(frame.size() <= gep::getFrameLength(message.size(), false));
+}
+
+// Malformed frames are dropped and counted
+void testMalformedFrames() {
+	std::vector<Received> received;
+	gep::Decoder decoder(4, [&received](uint8_t destinationId, const uint8_t* message, size_t length, int32_t tag) {
+		received.push_back({destinationId, std::vector<uint8_t>(message, message + length), tag});
+	});
+
+	const uint8_t message[] = {1, 2, 3, 4, 5, 6};
+	std::vector<uint8_t> frames;
+
+	// invalid checksum
+	gep::encodeFrame(frames, 0, message, 2, 1, false);
+	frames.back() ^= 0xFF;
+	decodeAll(decoder, frames, received);
+	CHECK(received.empty());
+
+	// too long message
+	frames.clear();
+	gep::encodeFrame(frames, 0, message, 6, 1, true);
+	decodeAll(decoder, frames, received);
+	CHECK(received.empty());
+
+	// interrupted frame followed by a valid frame
+	frames.clear();
+	gep::encodeFrame(frames, 0, message, 4, 1, false);
+	frames.resize(5);
+	gep::encodeFrame(frames, 0, message, 4, 2, true);
+	decodeAll(decoder, frames, received);
+	CHECK(received.size() == 1);
+	CHECK(!received.empty() && (received[0].tag == 2));
+
+	CHECK(decoder.getMalformedFrameCount() == 3);
+}
+
+} // namespace
+
+int main() {
+	testRoundTrip();
+	testCompactVector();
+	testFrameLengthBound();
+	testMalformedFrames();
+	if (failures > 0) {
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef MFREADER_TESTS_EMULATOR_PROCESS_H
+#define MFREADER_TESTS_EMULATOR_PROCESS_H
+
+#include <chrono>
+#include <csignal>
+#include <string>
+#include <vector>
+
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace mfreader {
+
+/********************************************************************************
+ * Emulator of the reader running in a child process controlled over its
+ * standard input and output.
+ ********************************************************************************/
+class EmulatorProcess {
+public:
+	EmulatorProcess(const std::string& path, const std::vector<std::string>& arguments) {
+		int input[2];
+		int output[2];
+		if ((pipe(input) < 0) || (pipe(output) < 0)) {
+			return;
+		}
+
+		pid = fork();
+		if (pid == 0) {
+			// the emulator is terminated with the test
+			prctl(PR_SET_PDEATHSIG, SIGTERM);
+			dup2(input[0], STDIN_FILENO);
+			dup2(output[1], STDOUT_FILENO);
+			close(input[1]);
+			close(output[0]);
+			std::vector<char*> argv;
+			argv.push_back(const_cast<char*>(path.c_str()));
+			for (const std::string& argument : arguments) {
+				argv.push_back(const_cast<char*>(argument.c_str()));
+			}
+
+			argv.push_back(nullptr);
+			execv(path.c_str(), argv.data());
+			_exit(127);
+		}
+
+		close(input[0]);
+		close(output[1]);
+		inputFd = input[1];
+		outputFd = output[0];
+	}
+
+	~EmulatorProcess() {
+		if (pid <= 0) {
+			return;
+		}
+
+		kill(pid, SIGTERM);
+		int status;
+		waitpid(pid, &status, 0);
+		close(inputFd);
+		close(outputFd);
+	}
+
+	EmulatorProcess(const EmulatorProcess&) = delete;
+	EmulatorProcess& operator=(const EmulatorProcess&) = delete;
+
+	// Sends a command to the emulator, returns whether the command was sent
+	bool send(const std::string& command) {
+		const std::string line = command + "\n";
+		return write(inputFd, line.data(), line.size()) == (ssize_t)line.size();
+	}
+
+	// Reads a line printed by the emulator (empty if no line is printed within the timeout)
+	std::string readLine(std::chrono::milliseconds timeout) {
+		const auto deadline = std::chrono::steady_clock::now() + timeout;
+		std::string line;
+		while (std::chrono::steady_clock::now() < deadline) {
+			pollfd descriptor = {outputFd, POLLIN, 0};
+			if (poll(&descriptor, 1, 10) <= 0) {
+				continue;
+			}
+
+			char value;
+			if (read(outputFd, &value, 1) != 1) {
+				break;
+			}
+
+			if (value == '\n') {
+				return line;
+			}
+
+			line += value;
+		}
+
+		return std::string();
+	}
+
+	// Waits for start of the emulator and returns path of its serial link (empty if the emulator failed to start)
+	std::string waitForLink(std::chrono::milliseconds timeout) {
+		const std::string line = readLine(timeout);
+		return (line.compare(0, 4, "pty ") == 0) ? line.substr(4) : std::string();
+	}
+
+private:
+	pid_t pid = -1;
+	int inputFd = -1;
+	int outputFd = -1;
+};
+
+} // namespace mfreader
+
+#endif
@@ -0,0 +1,548 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <mfreader/card_reader.h>
+
+#include "emulator_process.h"
+
+using namespace mfreader;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+/********************************************************************************
+ * Cards reported by the reader.
+ ********************************************************************************/
+class CardEvents {
+public:
+	void add(const CardInfo* card) {
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back((card != nullptr) ? *card : CardInfo());
+		condition.notify_all();
+	}
+
+	// Waits for a card matching the predicate (a removed card has type UNKNOWN and empty uid)
+	bool waitFor(std::function<bool(const CardInfo&)> predicate, std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lock(mutex);
+		return condition.wait_for(lock, timeout, [this, &predicate] {
+			while (!events.empty()) {
+				const CardInfo card = events.front();
+				events.erase(events.begin());
+				if (predicate(card)) {
+					return true;
+				}
+			}
+
+			return false;
+		});
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<CardInfo> events;
+};
+
+/********************************************************************************
+ * Results of macros executed by the reader after detection of a card.
+ ********************************************************************************/
+class MacroResults {
+public:
+	void add(bool success, const std::vector<uint8_t>& output) {
+		std::lock_guard<std::mutex> lock(mutex);
+		results.push_back({success, output});
+		condition.notify_all();
+	}
+
+	// Waits for the next result of a macro
+	bool waitFor(bool& success, std::vector<uint8_t>& output, std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!condition.wait_for(lock, timeout, [this] {
+			return !results.empty();
+		})) {
+			return false;
+		}
+
+		success = results.front().first;
+		output = results.front().second;
+		results.erase(results.begin());
+		return true;
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::vector<std::pair<bool, std::vector<uint8_t>>> results;
+};
+
+std::vector<uint8_t> makeBlocks(int count, uint8_t seed) {
+	std::vector<uint8_t> data;
+	for (int i = 0; i < 16 * count; i++) {
+		data.push_back((uint8_t)(seed + i));
+	}
+	return data;
+}
+
+// Computes CRC-32 (IEEE 802.3) of data as sector digests of the reader
+uint32_t computeCrc32(const std::vector<uint8_t>& data) {
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint8_t value : data) {
+		crc ^= value;
+		for (int i = 0; i < 8; i++) {
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+		}
+	}
+
+	return ~crc;
+}
+
+// Stores a macro to the reader (bytecode is written in parts fitting a command)
+bool storeMacro(CardReader& reader, const std::vector<uint8_t>& bytecode, bool autoRun) {
+	const size_t partLength = MAX_MESSAGE_LENGTH - 2;
+	for (size_t offset = 0; offset < bytecode.size(); offset += partLength) {
+		const size_t length = std::min(partLength, bytecode.size() - offset);
+		if (!reader.writeMacro((int)offset, std::vector<uint8_t>(bytecode.begin() + offset, bytecode.begin() + offset + length)).get().ok()) {
+			return false;
+		}
+	}
+
+	return reader.setupMacro((int)bytecode.size(), autoRun).get().ok();
+}
+
+// Executes commands pipelined by the client and checks that every command gets its own response
+void checkPipelined(int count, std::function<std::future<Response>()> command, std::function<bool(const Response&)> check) {
+	std::vector<std::future<Response>> responses;
+	for (int i = 0; i < count; i++) {
+		responses.push_back(command());
+	}
+
+	int failed = 0;
+	for (std::future<Response>& response : responses) {
+		failed += check(response.get()) ? 0 : 1;
+	}
+
+	CHECK(failed == 0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: emulator_test EMULATOR [EMULATOR_OPTIONS]\n");
+		return 2;
+	}
+
+	std::vector<std::string> emulatorArguments = {"--card", "1k:DEADBEEF", "--card", "ntag213", "--card", "4k:0A0B0C0D",
+			"--place", "0"};
+	emulatorArguments.insert(emulatorArguments.end(), argv + 2, argv + argc);
+	EmulatorProcess emulator(argv[1], emulatorArguments);
+	const std::string link = emulator.waitForLink(std::chrono::milliseconds(5000));
+	CHECK(!link.empty());
+	if (link.empty()) {
+		return 1;
+	}
+
+	SerialPort port(link, DEFAULT_LINK_SPEED);
+	IoLoop loop;
+	loop.start();
+	Response response;
+
+	// sessions starting with the same tag: the reader replays a cached response only to the same command,
+	// so a write of the second session with a tag of the first session is executed
+	CardReader::Options sessionOptions;
+	sessionOptions.firstTag = 1000;
+	const std::vector<uint8_t> firstSessionBlock = makeBlocks(1, 50);
+	const std::vector<uint8_t> secondSessionBlock = makeBlocks(1, 51);
+	{
+		// MIFARE Classic 1K
+		CardEvents sessionEvents;
+		CardReader session(loop, port, sessionOptions);
+		session.setCardListener([&sessionEvents](const CardInfo* card) {
+			sessionEvents.add(card);
+		});
+		CHECK(sessionEvents.waitFor([](const CardInfo& card) {
+			return (card.type == CardType::MIFARE_1K) && (card.blockCount == 64) && (card.uid == std::vector<uint8_t>({0xDE, 0xAD, 0xBE, 0xEF}));
+		}, std::chrono::milliseconds(5000)));
+		CHECK(session.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+		CHECK(session.writeBlock(1, firstSessionBlock).get().ok());
+		CHECK(session.readBlock(2).get().ok());
+	}
+	{
+		CardReader session(loop, port, sessionOptions);
+		CHECK(session.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+		CHECK(session.writeBlock(1, secondSessionBlock).get().ok());
+		response = session.readBlock(1).get();
+		CHECK(response.ok() && (response.data == secondSessionBlock));
+	}
+
+	// burst of pipelined commands exceeding the credits of the reader: the client sends commands only
+	// within credits appended to responses, so no frame is dropped (commands are not retried)
+	{
+		CardReader::Options burstOptions;
+		burstOptions.commandWindow = 16;
+		burstOptions.commandRetries = 0;
+		burstOptions.commandTimeout = std::chrono::milliseconds(3000);
+		CardReader session(loop, port, burstOptions);
+		LinkStatistics initialStatistics;
+		CHECK(LinkStatistics::decode(session.readLinkStatistics().get(), initialStatistics));
+		CHECK(session.setFlowControl(true).get().ok());
+		CHECK(session.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+		const std::vector<uint8_t> burstBlock = makeBlocks(1, 52);
+		checkPipelined(30, [&session, &burstBlock] {
+			return session.writeBlock(2, burstBlock);
+		}, [](const Response& response) {
+			return response.ok();
+		});
+		checkPipelined(30, [&session] {
+			return session.readBlock(2);
+		}, [&burstBlock](const Response& response) {
+			return response.ok() && (response.data == burstBlock);
+		});
+
+		LinkStatistics statistics;
+		CHECK(LinkStatistics::decode(session.readLinkStatistics().get(), statistics));
+		CHECK((statistics.droppedFrames == initialStatistics.droppedFrames) && (statistics.malformedFrames == initialStatistics.malformedFrames)
+				&& (statistics.rejectedCommands == 0));
+		CHECK(session.setFlowControl(false).get().ok());
+	}
+
+	CardReader reader(loop, port);
+	CardEvents cardEvents;
+	reader.setCardListener([&cardEvents](const CardInfo* card) {
+		cardEvents.add(card);
+	});
+
+	CHECK(reader.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+	response = reader.readBlock(0).get();
+	CHECK(response.ok() && (response.data.size() == 16) && (response.data[0] == 0xDE) && (response.data[4] == (0xDE ^ 0xAD ^ 0xBE ^ 0xEF)));
+
+	std::vector<uint8_t> data = makeBlocks(1, 1);
+	CHECK(reader.writeBlock(4, data).get().ok());
+	response = reader.readBlock(4).get();
+	CHECK(response.ok() && (response.data == data));
+
+	data = makeBlocks(3, 9);
+	CHECK(reader.writeBlocks(8, data).get().ok());
+	response = reader.readBlocks(8, 3).get();
+	CHECK(response.ok() && (response.data == data));
+
+	// writes to the manufacturer block are refused by the card, the card returns to state IDLE and
+	// it is selected again after reset
+	CHECK(reader.writeBlock(0, makeBlocks(1, 0)).get().status == Response::Status::FAILED);
+	CHECK(reader.readBlock(4).get().status == Response::Status::FAILED);
+	CHECK(reader.resetCard().get().ok());
+	CHECK(cardEvents.waitFor([](const CardInfo& card) {
+		return card.type == CardType::MIFARE_1K;
+	}, std::chrono::milliseconds(5000)));
+	CHECK(reader.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+
+	// value blocks
+	int32_t value = 0;
+	CHECK(reader.setValue(5, 100).get().ok());
+	CHECK(reader.addValue(5, 20).get().ok());
+	CHECK(reader.subtractValue(5, 30, 6).get().ok());
+	CHECK(decodeValue(reader.getValue(5).get(), value) && (value == 120));
+	CHECK(decodeValue(reader.getValue(6).get(), value) && (value == 90));
+	CHECK(reader.setValue(5, -5).get().ok());
+	CHECK(decodeValue(reader.getValue(5).get(), value) && (value == -5));
+
+	// sector trailer in transport configuration (key A is never readable)
+	SectorTrailer trailer;
+	CHECK(SectorTrailer::decode(reader.readSectorTrailer(1).get(), trailer));
+	CHECK(trailer.keyB == (std::array<uint8_t, 6>({0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF})));
+
+	// trace of recent events contains execution of the last command
+	CHECK(reader.readBlock(4).get().ok());
+	std::vector<TraceRecord> trace;
+	CHECK(TraceRecord::decode(reader.dumpTrace(true).get(), trace));
+	CHECK(std::any_of(trace.begin(), trace.end(), [](const TraceRecord& record) {
+		return (record.event == TraceEvent::COMMAND_DISPATCHED) && (record.data == (uint8_t)CommandCode::READ_BLOCK);
+	}));
+	CHECK(std::any_of(trace.begin(), trace.end(), [](const TraceRecord& record) {
+		return (record.event == TraceEvent::TRANSCEIVE_END) && (record.data == 0);
+	}));
+	CHECK(TraceRecord::decode(reader.dumpTrace().get(), trace) && (trace.size() <= 2));
+
+	// digests of sectors match CRC-32 of their data blocks
+	std::vector<uint32_t> digests;
+	const std::vector<uint8_t> sector2 = makeBlocks(3, 9);
+	response = reader.readBlocks(12, 3).get();
+	CHECK(response.ok());
+	CHECK(decodeDigests(reader.readSectorDigests(2, 2, true).get(), digests));
+	CHECK((digests.size() == 2) && (digests[0] == computeCrc32(sector2)) && (digests[1] == computeCrc32(response.data)));
+	CHECK(reader.writeBlock(9, makeBlocks(1, 77)).get().ok());
+	CHECK(decodeDigests(reader.readSectorDigests(2, 1, true).get(), digests));
+	CHECK((digests.size() == 1) && (digests[0] != computeCrc32(sector2)));
+	CHECK(reader.writeBlock(9, std::vector<uint8_t>(sector2.begin() + 16, sector2.begin() + 32)).get().ok());
+	CHECK(reader.readSectorDigests(15, 2).get().status == Response::Status::FAILED);
+
+	// only changed blocks are written by synchronization, sector trailers are skipped
+	uint16_t changedBlocks = 0;
+	response = reader.readBlocks(12, 6).get();
+	CHECK(response.ok() && (response.data.size() == 6 * 16));
+	std::vector<uint8_t> target = response.data;
+	target.resize(6 * 16);
+	std::fill(target.begin() + 3 * 16, target.begin() + 4 * 16, 0);
+	std::copy_n(makeBlocks(1, 90).begin(), 16, target.begin() + 16);
+	std::copy_n(makeBlocks(1, 91).begin(), 16, target.begin() + 5 * 16);
+	CHECK(decodeChangedBlocks(reader.synchronizeBlocks(12, target).get(), changedBlocks) && (changedBlocks == 0x22));
+	response = reader.readBlocks(12, 6).get();
+	CHECK(response.ok() && std::equal(target.begin(), target.begin() + 3 * 16, response.data.begin())
+			&& std::equal(target.begin() + 4 * 16, target.end(), response.data.begin() + 4 * 16));
+	CHECK(decodeChangedBlocks(reader.synchronizeBlocks(12, target).get(), changedBlocks) && (changedBlocks == 0));
+	CHECK(SectorTrailer::decode(reader.readSectorTrailer(3).get(), trailer));
+	CHECK(trailer.keyB == (std::array<uint8_t, 6>({0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF})));
+	target.resize(2 * 16);
+	std::copy_n(makeBlocks(1, 92).begin(), 16, target.begin());
+	CHECK(decodeChangedBlocks(reader.synchronizeBlocks(12, target).get(), changedBlocks) && (changedBlocks == 0x01));
+
+	// faster link
+	CHECK(reader.setLinkSpeed(115200, false).get().ok());
+	CHECK(port.getBaudRate() == 115200);
+
+	// pipelined commands of different kinds
+	const std::vector<uint8_t> block4 = makeBlocks(1, 3);
+	checkPipelined(40, [&reader, &block4] {
+		return reader.writeBlock(4, block4);
+	}, [](const Response& response) {
+		return response.ok() && response.data.empty();
+	});
+	checkPipelined(40, [&reader] {
+		return reader.readBlock(4);
+	}, [&block4](const Response& response) {
+		return response.ok() && (response.data == block4);
+	});
+	checkPipelined(40, [&reader] {
+		return reader.getValue(5);
+	}, [](const Response& response) {
+		int32_t value = 0;
+		return decodeValue(response, value) && (value == -5);
+	});
+	checkPipelined(40, [&reader] {
+		return reader.readSectorTrailer(2);
+	}, [](const Response& response) {
+		SectorTrailer trailer;
+		return SectorTrailer::decode(response, trailer) && (trailer.keyB == (std::array<uint8_t, 6>({0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF})));
+	});
+	checkPipelined(10, [&reader] {
+		return reader.readBlocks(16, MAX_BLOCKS_PER_STREAM);
+	}, [](const Response& response) {
+		return response.ok() && (response.data.size() == 16 * MAX_BLOCKS_PER_STREAM);
+	});
+
+	// execution statistics of a command count executions and failures since the last reset
+	CommandStatistics statistics;
+	CHECK(CommandStatistics::decode(reader.readCommandStatistics(CommandCode::READ_BLOCK, true).get(), statistics));
+	CHECK(statistics.count >= 40);
+	for (int i = 0; i < 5; i++) {
+		CHECK(reader.readBlock(4).get().ok());
+	}
+	CHECK(reader.readBlock(64).get().status == Response::Status::FAILED);
+	CHECK(reader.readBlock(64).get().status == Response::Status::FAILED);
+	CHECK(CommandStatistics::decode(reader.readCommandStatistics(CommandCode::READ_BLOCK).get(), statistics));
+	CHECK((statistics.count == 7) && (statistics.failures == 2));
+	CHECK((statistics.totalTime > 0) && (statistics.maxTime > 0) && (statistics.maxTime <= statistics.totalTime));
+	CHECK(CommandStatistics::decode(reader.readCommandStatistics(CommandCode::WRITE_BLOCK).get(), statistics));
+	CHECK(statistics.count >= 40);
+
+	// macros compiled by CardScriptCompiler (bytecode below is the compiler output for the script in the comment)
+	//   SetKeyA FFFFFFFFFFFF
+	//   LoadBlock 4
+	//   Compare 0 03040506
+	//   JumpIfNot other
+	//   ReadBlock 8
+	//   End
+	//   other:
+	//   Emit 0 4
+	//   End
+	const std::vector<uint8_t> branchingMacro = {0x02, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x03, 0x04,
+			0x06, 0x00, 0x04, 0x03, 0x04, 0x05, 0x06, 0x09, 0x19, 0x03, 0x08, 0x0E, 0x00, 0x10, 0x00,
+			0x0E, 0x00, 0x04, 0x00};
+	CHECK(storeMacro(reader, branchingMacro, false));
+	response = reader.runMacro().get();
+	CHECK(response.ok() && (response.data == makeBlocks(1, 9)));
+	CHECK(reader.writeBlock(4, makeBlocks(1, 70)).get().ok());
+	response = reader.runMacro().get();
+	CHECK(response.ok() && (response.data == std::vector<uint8_t>({70, 71, 72, 73})));
+
+	//   SetKeyA FFFFFFFFFFFF
+	//   GetValue 5
+	//   CompareValue 10
+	//   JumpIfNot insufficient
+	//   SubtractValue 5 10
+	//   GetValue 5
+	//   EmitValue
+	//   End
+	//   insufficient:
+	//   Fail
+	const std::vector<uint8_t> debitMacro = {0x02, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x0A, 0x05,
+			0x0B, 0x0A, 0x00, 0x00, 0x00, 0x09, 0x1B, 0x0D, 0x05, 0x0A, 0x00, 0x00, 0x00, 0x0A, 0x05,
+			0x0F, 0x00, 0x01};
+	CHECK(reader.setValue(5, 25).get().ok());
+	CHECK(storeMacro(reader, debitMacro, false));
+	response = reader.runMacro().get();
+	CHECK(response.ok() && (response.data == std::vector<uint8_t>({15, 0, 0, 0})));
+	response = reader.runMacro().get();
+	CHECK(response.ok() && (response.data == std::vector<uint8_t>({5, 0, 0, 0})));
+	CHECK(reader.runMacro().get().status == Response::Status::FAILED);
+	CHECK(decodeValue(reader.getValue(5).get(), value) && (value == 5));
+
+	// emitted bytes must fit the response (28 bytes), a macro emitting more bytes fails
+	//   SetKeyA FFFFFFFFFFFF
+	//   LoadBlock 8
+	//   Emit 0 16
+	//   Emit 0 12
+	//   End
+	std::vector<uint8_t> emitMacro = {0x02, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x03, 0x08,
+			0x0E, 0x00, 0x10, 0x0E, 0x00, 0x0C, 0x00};
+	CHECK(storeMacro(reader, emitMacro, false));
+	response = reader.runMacro().get();
+	std::vector<uint8_t> expectedOutput = makeBlocks(1, 9);
+	expectedOutput.insert(expectedOutput.end(), expectedOutput.begin(), expectedOutput.begin() + 12);
+	CHECK(response.ok() && (response.data == expectedOutput));
+	emitMacro[15] = 13;
+	CHECK(storeMacro(reader, emitMacro, false));
+	CHECK(reader.runMacro().get().status == Response::Status::FAILED);
+
+	// macro executed automatically after detection of a card
+	//   SetKeyA FFFFFFFFFFFF
+	//   ReadBlock 0
+	MacroResults macroResults;
+	reader.setMacroListener([&macroResults](bool success, const std::vector<uint8_t>& output) {
+		macroResults.add(success, output);
+	});
+	CHECK(storeMacro(reader, {0x02, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x03, 0x00, 0x0E, 0x00, 0x10, 0x00}, true));
+
+	// MIFARE Classic 4K (block count of the card is reported as 255), blocks above 127 belong to sectors
+	// with 16 blocks
+	CHECK(emulator.send("place 2"));
+	CHECK(emulator.readLine(std::chrono::milliseconds(1000)) == "placed 2");
+	CHECK(reader.resetCard().get().ok());
+	CHECK(cardEvents.waitFor([](const CardInfo& card) {
+		return (card.type == CardType::MIFARE_4K) && (card.blockCount == 255) && (card.uid == std::vector<uint8_t>({0x0A, 0x0B, 0x0C, 0x0D}));
+	}, std::chrono::milliseconds(5000)));
+	bool macroSucceeded = false;
+	std::vector<uint8_t> macroOutput;
+	CHECK(macroResults.waitFor(macroSucceeded, macroOutput, std::chrono::milliseconds(5000)));
+	CHECK(macroSucceeded && (macroOutput.size() == 16) && (macroOutput[0] == 0x0A) && (macroOutput[3] == 0x0D));
+	CHECK(reader.setupMacro(0, false).get().ok());
+	CHECK(reader.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+
+	data = makeBlocks(1, 40);
+	CHECK(reader.writeBlock(254, data).get().ok());
+	response = reader.readBlock(254).get();
+	CHECK(response.ok() && (response.data == data));
+	CHECK(reader.writeBlock(255, data).get().status == Response::Status::FAILED);
+	CHECK(reader.readBlock(256).get().status == Response::Status::FAILED);
+	CHECK(SectorTrailer::decode(reader.readSectorTrailer(39).get(), trailer));
+	CHECK(trailer.keyB == (std::array<uint8_t, 6>({0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF})));
+
+	// data blocks of a sector with 16 blocks (sector 33)
+	data = makeBlocks(15, 60);
+	CHECK(reader.writeBlocks(144, data).get().ok());
+	response = reader.readBlocks(144, 15).get();
+	CHECK(response.ok() && (response.data == data));
+
+	// compact framing with responses consisting of special bytes (escaped frames reach the frame length bound)
+	CHECK(reader.negotiateCompactFraming().get().ok());
+	CHECK(reader.isCompactFraming());
+	const uint8_t specialBytes[] = {0x0C, 0x0E, 0x1B, 0x03, 0x06};
+	data.clear();
+	for (int i = 0; i < 16; i++) {
+		data.push_back(specialBytes[i % sizeof(specialBytes)]);
+	}
+	CHECK(reader.writeBlock(160, data).get().ok());
+	checkPipelined(40, [&reader] {
+		return reader.readBlock(160);
+	}, [&data](const Response& response) {
+		return response.ok() && (response.data == data);
+	});
+	checkPipelined(10, [&reader] {
+		return reader.readBlocks(144, 15);
+	}, [](const Response& response) {
+		return response.ok() && (response.data == makeBlocks(15, 60));
+	});
+
+	// NTAG213 replaces the card in the field (the firmware detects a new card after reset)
+	CHECK(emulator.send("place 1"));
+	CHECK(emulator.readLine(std::chrono::milliseconds(1000)) == "placed 1");
+	CHECK(reader.resetCard().get().ok());
+	CHECK(cardEvents.waitFor([](const CardInfo& card) {
+		return (card.type == CardType::NTAG) && (card.blockCount == 45) && (card.uid.size() == 7);
+	}, std::chrono::milliseconds(5000)));
+
+	response = reader.readNdefMessage().get();
+	const std::string uri = "example.com";
+	CHECK(response.ok() && (std::search(response.data.begin(), response.data.end(), uri.begin(), uri.end()) != response.data.end()));
+	CHECK(reader.writePage(10, {1, 2, 3, 4}).get().ok());
+	response = reader.readPages(10, 1).get();
+	CHECK(response.ok() && (response.data == std::vector<uint8_t>({1, 2, 3, 4})));
+	CHECK(reader.authenticatePages({0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+
+	checkPipelined(40, [&reader] {
+		return reader.readPages(10, 1);
+	}, [](const Response& response) {
+		return response.ok() && (response.data == std::vector<uint8_t>({1, 2, 3, 4}));
+	});
+
+	// no card is active after the card is removed
+	CHECK(emulator.send("remove"));
+	CHECK(emulator.readLine(std::chrono::milliseconds(1000)) == "removed");
+	CHECK(reader.resetCard().get().ok());
+	CHECK(reader.readPages(4, 1).get().status == Response::Status::FAILED);
+
+	// cards replaced repeatedly in the field are detected by reset, their notifications are coalesced with
+	// responses to pipelined commands into envelopes and no notification is lost
+	CHECK(reader.setCoalescingWindow(20).get().ok());
+	for (int i = 0; i < 6; i++) {
+		const int cardIndex = (i % 2 == 0) ? 0 : 2;
+		CHECK(emulator.send("place " + std::to_string(cardIndex)));
+		CHECK(emulator.readLine(std::chrono::milliseconds(1000)) == "placed " + std::to_string(cardIndex));
+		std::vector<std::future<Response>> responses;
+		for (int j = 0; j < 5; j++) {
+			responses.push_back(reader.readCommandStatistics(CommandCode::READ_BLOCK));
+		}
+		responses.push_back(reader.resetCard());
+		for (int j = 0; j < 5; j++) {
+			responses.push_back(reader.readCommandStatistics(CommandCode::READ_BLOCK));
+		}
+		for (std::future<Response>& response : responses) {
+			CHECK(response.get().ok());
+		}
+
+		CHECK(cardEvents.waitFor([cardIndex](const CardInfo& card) {
+			return card.type == ((cardIndex == 0) ? CardType::MIFARE_1K : CardType::MIFARE_4K);
+		}, std::chrono::milliseconds(5000)));
+		CHECK(reader.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+		CHECK(reader.readBlock(1).get().ok());
+	}
+
+	CHECK(emulator.send("remove"));
+	CHECK(emulator.readLine(std::chrono::milliseconds(1000)) == "removed");
+	CHECK(reader.resetCard().get().ok());
+	CHECK(reader.setCoalescingWindow(0).get().ok());
+
+	if (failures > 0) {
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
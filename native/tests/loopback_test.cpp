@@ -0,0 +1,337 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <mfreader/card_reader.h>
+
+using namespace mfreader;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+/********************************************************************************
+ * Minimal reader on the master side of a pseudo terminal. Frames received in
+ * a single read are answered in reverse order to exercise matching of tags.
+ ********************************************************************************/
+class FakeReader {
+public:
+	explicit FakeReader(int fd) :
+			fd(fd), decoder(MAX_MESSAGE_LENGTH, [this](uint8_t destinationId, const uint8_t* message, size_t length, int32_t tag) {
+				received.push_back(Frame {std::vector<uint8_t>(message, message + length), tag, decoder.isLastMessageCompact()});
+			}) {
+		memset(blocks, 0, sizeof(blocks));
+		thread = std::thread([this] {
+			run();
+		});
+	}
+
+	~FakeReader() {
+		stopped = true;
+		thread.join();
+	}
+
+	// Number of frames with tag seen more than once (repeated commands)
+	std::atomic<int> repeatedFrames {0};
+
+	// Maximal number of commands received in a single read
+	std::atomic<int> maxBatch {0};
+
+private:
+	struct Frame {
+		std::vector<uint8_t> message;
+		int32_t tag;
+		bool compact;
+	};
+
+	void run() {
+		uint8_t buffer[512];
+		while (!stopped) {
+			pollfd descriptor = {fd, POLLIN, 0};
+			if (poll(&descriptor, 1, 20) <= 0) {
+				continue;
+			}
+
+			// collect commands sent together
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			const ssize_t count = read(fd, buffer, sizeof(buffer));
+			if (count <= 0) {
+				continue;
+			}
+
+			received.clear();
+			decoder.feed(buffer, count);
+			if ((int)received.size() > maxBatch) {
+				maxBatch = received.size();
+			}
+
+			for (auto it = received.rbegin(); it != received.rend(); ++it) {
+				execute(*it);
+			}
+		}
+	}
+
+	void send(const std::vector<uint8_t>& message, int32_t tag, bool compact) {
+		std::vector<uint8_t> frame;
+		gep::encodeFrame(frame, 0, message.data(), message.size(), tag, compact);
+		ssize_t written = write(fd, frame.data(), frame.size());
+		(void)written;
+	}
+
+	void respond(const Frame& frame, bool ok, const std::vector<uint8_t>& data) {
+		std::vector<uint8_t> message(1, (uint8_t)(ok ? MessageCode::COMMAND_OK : MessageCode::COMMAND_FAILED));
+		message.insert(message.end(), data.begin(), data.end());
+
+		// credits are appended to the response as by the reader (sent separately if they do not fit)
+		const bool appendCredits = flowControl && (message.size() + 2 <= MAX_MESSAGE_LENGTH);
+		if (appendCredits) {
+			message[0] = (uint8_t)(ok ? MessageCode::COMMAND_OK_CREDITS : MessageCode::COMMAND_FAILED_CREDITS);
+			message.insert(message.end(), {2, 64});
+		}
+
+		send(message, frame.tag, frame.compact);
+		if (flowControl && !appendCredits) {
+			send({(uint8_t)MessageCode::CREDITS, (uint8_t)(frame.tag >> 8), (uint8_t)frame.tag, 2, 64}, 0, frame.compact);
+		}
+	}
+
+	void respondChunked(const Frame& frame, const std::vector<uint8_t>& data, size_t chunkSize) {
+		size_t sent = 0;
+		do {
+			const size_t length = std::min(chunkSize, data.size() - sent);
+			std::vector<uint8_t> chunk = {(uint8_t)(data.size() >> 8), (uint8_t)data.size(), (uint8_t)(sent >> 8), (uint8_t)sent};
+			chunk.insert(chunk.end(), data.begin() + sent, data.begin() + sent + length);
+			respond(frame, true, chunk);
+			sent += length;
+		} while (sent < data.size());
+	}
+
+	void execute(const Frame& frame) {
+		if (frame.message.empty() || (frame.tag < 0)) {
+			return;
+		}
+
+		const bool repeated = (frame.tag == lastTag);
+		if (repeated) {
+			repeatedFrames++;
+		}
+		lastTag = frame.tag;
+
+		const uint8_t* payload = &frame.message[1];
+		switch ((CommandCode)frame.message[0]) {
+		case CommandCode::READ_BLOCK:
+			respond(frame, true, std::vector<uint8_t>(blocks[payload[1]], blocks[payload[1]] + 16));
+			break;
+		case CommandCode::WRITE_BLOCKS: {
+			const int block = (payload[0] << 8) | payload[1];
+			memcpy(blocks[block], &payload[2], frame.message.size() - 3);
+			respond(frame, true, {});
+			break;
+		}
+		case CommandCode::FRAGMENT: {
+			const size_t offset = (payload[3] << 8) | payload[4];
+			if (offset == 0) {
+				fragments.clear();
+			}
+
+			CHECK(offset == fragments.size());
+			fragments.insert(fragments.end(), &payload[5], &payload[0] + frame.message.size() - 1);
+			const size_t total = (payload[1] << 8) | payload[2];
+			if (fragments.size() == total) {
+				const int block = (fragments[0] << 8) | fragments[1];
+				memcpy(blocks[block], &fragments[2], total - 2);
+			}
+			respond(frame, true, {});
+			break;
+		}
+		case CommandCode::READ_BLOCKS: {
+			const int block = (payload[0] << 8) | payload[1];
+			std::vector<uint8_t> data(blocks[block], blocks[block] + 16 * payload[2]);
+			if (payload[2] > MAX_BLOCKS_PER_COMMAND) {
+				respondChunked(frame, data, 16 * MAX_BLOCKS_PER_COMMAND);
+			} else {
+				respond(frame, true, data);
+			}
+			break;
+		}
+		case CommandCode::READ_NDEF: {
+			std::vector<uint8_t> ndef;
+			for (int i = 0; i < 100; i++) {
+				ndef.push_back((uint8_t)i);
+			}
+			respondChunked(frame, ndef, 40);
+			break;
+		}
+		case CommandCode::VALUE_GET:
+			respond(frame, true, {0xFE, 0xFF, 0xFF, 0xFF});
+			break;
+		case CommandCode::READ_PAGES:
+			// the first transmission is lost
+			if (repeated) {
+				respond(frame, true, std::vector<uint8_t>(4 * payload[1], 0xA5));
+			}
+			break;
+		case CommandCode::DIGEST:
+			// never answered
+			break;
+		case CommandCode::MACRO_RUN: {
+			// response coalesced with notifications: [ENVELOPE]([1B length][2B tag][message])*
+			const uint8_t cardDetected[] = {(uint8_t)MessageCode::CARD_DETECTED, (uint8_t)CardType::MIFARE_1K, 64, 1, 2, 3, 4};
+			std::vector<uint8_t> envelope(1, (uint8_t)MessageCode::ENVELOPE);
+			envelope.insert(envelope.end(), {(uint8_t)sizeof(cardDetected), 0, 0});
+			envelope.insert(envelope.end(), cardDetected, cardDetected + sizeof(cardDetected));
+			envelope.insert(envelope.end(), {3, (uint8_t)(frame.tag >> 8), (uint8_t)frame.tag, (uint8_t)MessageCode::COMMAND_OK, 0x42, 0x43});
+			send(envelope, 0, frame.compact);
+			break;
+		}
+		case CommandCode::SET_FLOW_CONTROL:
+			respond(frame, true, {});
+			flowControl = (payload[0] != 0);
+			break;
+		case CommandCode::GET_LINK_STATS:
+			respond(frame, true, {0, 0, 0, 1, 0, 0, 0, 2, 0, 0, 0, 3});
+			break;
+		default:
+			respond(frame, true, {});
+		}
+	}
+
+	int fd;
+	gep::Decoder decoder;
+	std::vector<Frame> received;
+	std::atomic<bool> stopped {false};
+	std::thread thread;
+	uint8_t blocks[64][16];
+	std::vector<uint8_t> fragments;
+	int32_t lastTag = -1;
+	bool flowControl = false;
+};
+
+std::vector<uint8_t> makeBlocks(int count, uint8_t seed) {
+	std::vector<uint8_t> data;
+	for (int i = 0; i < 16 * count; i++) {
+		data.push_back((uint8_t)(seed + i));
+	}
+	return data;
+}
+
+} // namespace
+
+int main() {
+	PseudoTerminal terminal;
+	SerialPort port(terminal.getSlavePath(), DEFAULT_LINK_SPEED);
+	FakeReader fakeReader(terminal.getMasterFd());
+
+	IoLoop loop;
+	loop.start();
+
+	CardReader::Options options;
+	options.commandTimeout = std::chrono::milliseconds(200);
+	options.commandRetries = 1;
+	CardReader reader(loop, port, options);
+
+	std::atomic<int> cardsDetected(0);
+	reader.setCardListener([&cardsDetected](const CardInfo* card) {
+		if ((card != nullptr) && (card->type == CardType::MIFARE_1K) && (card->uid.size() == 4)) {
+			cardsDetected++;
+		}
+	});
+
+	// multiple commands in flight
+	std::vector<uint8_t> data = makeBlocks(MAX_BLOCKS_PER_COMMAND, 1);
+	CHECK(reader.writeBlocks(4, data).get().ok());
+	std::vector<std::future<Response>> reads;
+	for (int i = 0; i < 6; i++) {
+		reads.push_back(reader.readBlock(4 + i % 2));
+	}
+	for (int i = 0; i < 6; i++) {
+		Response response = reads[i].get();
+		CHECK(response.ok());
+		CHECK(response.data == std::vector<uint8_t>(data.begin() + 16 * (i % 2), data.begin() + 16 * (i % 2 + 1)));
+	}
+	CHECK(fakeReader.maxBatch > 1);
+
+	// fragmented write and chunked read
+	data = makeBlocks(MAX_BLOCKS_PER_STREAM, 7);
+	CHECK(reader.writeBlocks(16, data).get().ok());
+	Response response = reader.readBlocks(16, MAX_BLOCKS_PER_STREAM).get();
+	CHECK(response.ok() && (response.data == data));
+
+	response = reader.readNdefMessage().get();
+	CHECK(response.ok() && (response.data.size() == 100) && (response.data[99] == 99));
+
+	// decoded values
+	int32_t value = 0;
+	CHECK(decodeValue(reader.getValue(5).get(), value) && (value == -2));
+	LinkStatistics statistics;
+	CHECK(LinkStatistics::decode(reader.readLinkStatistics().get(), statistics));
+	CHECK((statistics.droppedFrames == 1) && (statistics.malformedFrames == 2) && (statistics.rejectedCommands == 3));
+
+	// repeated command and command without response
+	response = reader.readPages(4, 2).get();
+	CHECK(response.ok() && (response.data.size() == 8));
+	CHECK(fakeReader.repeatedFrames >= 1);
+	CHECK(reader.readSectorDigests(0, 1).get().status == Response::Status::TIMEOUT);
+
+	// envelope with response and notification
+	response = reader.runMacro().get();
+	CHECK(response.ok() && (response.data == std::vector<uint8_t>({0x42, 0x43})));
+	CHECK(cardsDetected == 1);
+
+	// compact framing and flow control
+	CHECK(reader.negotiateCompactFraming().get().ok());
+	CHECK(reader.isCompactFraming());
+	CHECK(reader.setFlowControl(true).get().ok());
+	reads.clear();
+	for (int i = 0; i < 6; i++) {
+		reads.push_back(reader.readBlock(4));
+	}
+	for (std::future<Response>& read : reads) {
+		CHECK(read.get().ok());
+	}
+
+	CHECK(reader.setLinkSpeed(115200, false).get().ok());
+	CHECK(port.getBaudRate() == 115200);
+
+	// the other commands
+	CHECK(reader.resetCard().get().ok());
+	CHECK(reader.setKey(KeyType::KEY_A, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}).get().ok());
+	CHECK(reader.writeBlock(1, makeBlocks(1, 0)).get().ok());
+	CHECK(reader.readSectorTrailer(1).get().ok());
+	CHECK(reader.writeSectorTrailer(1, SectorTrailer()).get().ok());
+	CHECK(reader.setValue(5, 10).get().ok());
+	CHECK(reader.addValue(5, 1).get().ok());
+	CHECK(reader.subtractValue(5, 1, 6).get().ok());
+	CHECK(reader.copyValue(5, 6).get().ok());
+	CHECK(reader.debitValue(5, 1).get().ok());
+	CHECK(reader.writePage(4, {1, 2, 3, 4}).get().ok());
+	CHECK(reader.authenticatePages({1, 2, 3, 4}).get().ok());
+	CHECK(reader.synchronizeBlocks(4, makeBlocks(1, 0)).get().ok());
+	CHECK(reader.readCommandStatistics(CommandCode::READ_BLOCK, true).get().ok());
+	CHECK(reader.writeMacro(0, {1, 2, 3}).get().ok());
+	CHECK(reader.setupMacro(3, false).get().ok());
+	CHECK(reader.setCoalescingWindow(5).get().ok());
+	CHECK(reader.readBlocks(0, MAX_BLOCKS_PER_STREAM + 1).get().status == Response::Status::FAILED);
+
+	if (failures > 0) {
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,306 @@
+// Reads the trace of recent events from the reader (TRACE_DUMP) and prints it as a timeline followed
+// by histograms of latencies of phases of command execution: execution, authentication, exchanges with
+// the card and transmission of responses.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <mfreader/card_reader.h>
+
+using namespace mfreader;
+
+namespace {
+
+// Number of power of two buckets of histograms (the last bucket collects longer latencies)
+const int HISTOGRAM_BUCKETS = 20;
+
+// Width of the longest bar of histograms
+const int HISTOGRAM_WIDTH = 40;
+
+const char* const COMMAND_NAMES[] = {
+	"RESET", "SET_KEY", "READ_BLOCK", "WRITE_BLOCK", "READ_SECTOR_TRAILER", "WRITE_SECTOR_TRAILER", "VALUE_GET",
+	"VALUE_SET", "VALUE_ADD", "VALUE_SUB", "VALUE_COPY", "VALUE_DEBIT", "READ_PAGES", "WRITE_PAGE", "PAGE_AUTH",
+	"READ_NDEF", "READ_BLOCKS", "WRITE_BLOCKS", "DIGEST", "SYNC_BLOCKS", "GET_STATS", "MACRO_WRITE", "MACRO_SETUP",
+	"MACRO_RUN", "SET_LINK_SPEED", "FRAGMENT", "SET_COALESCING", "SET_FLOW_CONTROL", "GET_LINK_STATS", "TRACE_DUMP"
+};
+
+static_assert(sizeof(COMMAND_NAMES) / sizeof(COMMAND_NAMES[0]) == COMMAND_COUNT, "Name of command is missing.");
+
+const char* const MESSAGE_NAMES[] = {
+	"COMMAND_OK", "COMMAND_FAILED", "CARD_DETECTED", "CARD_REMOVED", "MACRO_EXECUTED", "ENVELOPE", "CREDITS"
+};
+
+const char* const STATUS_NAMES[] = {
+	"OK", "ERROR", "COLLISION", "TIMEOUT", "NO_ROOM", "INTERNAL_ERROR", "INVALID", "CRC_WRONG"
+};
+
+// Commands of cards (see MFRC522.h)
+struct CardCommandName {
+	uint8_t code;
+	const char* name;
+};
+
+const CardCommandName CARD_COMMAND_NAMES[] = {
+	{0x26, "REQA"}, {0x52, "WUPA"}, {0x93, "SELECT_CL1"}, {0x95, "SELECT_CL2"}, {0x97, "SELECT_CL3"}, {0x50, "HLTA"},
+	{0x30, "READ"}, {0xA0, "WRITE"}, {0xA2, "UL_WRITE"}, {0xC0, "DECREMENT"}, {0xC1, "INCREMENT"}, {0xC2, "RESTORE"},
+	{0xB0, "TRANSFER"}, {0x60, "GET_VERSION"}, {0x3A, "FAST_READ"}, {0x1B, "PWD_AUTH"}
+};
+
+// Phases of execution measured between pairs of events
+enum Phase {
+	EXECUTION,
+	AUTHENTICATION,
+	TRANSCEIVE,
+	TRANSMISSION,
+	PHASE_COUNT
+};
+
+const char* const PHASE_NAMES[] = {
+	"execution (dispatched - response queued)",
+	"authentication",
+	"exchange with card",
+	"transmission (response queued - flushed)"
+};
+
+void printUsage() {
+	std::fprintf(stderr,
+			"usage: mfreader_trace --port PATH [options]\n"
+			"  --port PATH             serial port of the reader (or link of the emulator)\n"
+			"  --link-speed N          link speed of the reader (default 9600)\n"
+			"  --clear                 clears the trace after it is read\n");
+}
+
+std::string formatHex(uint8_t value) {
+	char buffer[8];
+	std::snprintf(buffer, sizeof(buffer), "0x%02X", value);
+	return buffer;
+}
+
+std::string getCommandName(uint8_t code) {
+	return ((code >= 1) && (code <= COMMAND_COUNT)) ? COMMAND_NAMES[code - 1] : formatHex(code);
+}
+
+std::string getMessageName(uint8_t code) {
+	const int count = sizeof(MESSAGE_NAMES) / sizeof(MESSAGE_NAMES[0]);
+	return ((code >= 1) && (code <= count)) ? MESSAGE_NAMES[code - 1] : formatHex(code);
+}
+
+std::string getStatusName(uint8_t status) {
+	const int count = sizeof(STATUS_NAMES) / sizeof(STATUS_NAMES[0]);
+	if (status == 0xFF) {
+		return "MIFARE_NACK";
+	}
+
+	return (status < count) ? STATUS_NAMES[status] : formatHex(status);
+}
+
+std::string getCardCommandName(uint8_t code) {
+	for (const CardCommandName& command : CARD_COMMAND_NAMES) {
+		if (command.code == code) {
+			return command.name;
+		}
+	}
+
+	// data of the second step of two step commands
+	return formatHex(code);
+}
+
+// Returns name and decoded data of an event
+std::string describeEvent(const TraceRecord& record) {
+	switch (record.event) {
+	case TraceEvent::FRAME_RECEIVED:
+		return "FRAME_RECEIVED      " + getCommandName(record.data);
+	case TraceEvent::COMMAND_DISPATCHED:
+		return "COMMAND_DISPATCHED  " + getCommandName(record.data);
+	case TraceEvent::AUTH_START:
+		return std::string("AUTH_START          ") + ((record.data == 0x61) ? "key B" : "key A");
+	case TraceEvent::AUTH_END:
+		return "AUTH_END            " + getStatusName(record.data);
+	case TraceEvent::TRANSCEIVE_START:
+		return "TRANSCEIVE_START    " + getCardCommandName(record.data);
+	case TraceEvent::TRANSCEIVE_END:
+		return "TRANSCEIVE_END      " + getStatusName(record.data);
+	case TraceEvent::RESPONSE_QUEUED:
+		return "RESPONSE_QUEUED     " + getMessageName(record.data);
+	case TraceEvent::RESPONSE_FLUSHED:
+		return "RESPONSE_FLUSHED";
+	case TraceEvent::CARD_POLL:
+		return std::string("CARD_POLL           ") + ((record.data != 0) ? "card detected" : "no card");
+	}
+
+	return "UNKNOWN             " + formatHex(record.data);
+}
+
+/********************************************************************************
+ * Histogram of latencies with power of two buckets.
+ ********************************************************************************/
+class Histogram {
+public:
+	void add(uint32_t latency) {
+		int bucket = 0;
+		while ((bucket < HISTOGRAM_BUCKETS - 1) && (latency >= (2u << bucket))) {
+			bucket++;
+		}
+
+		buckets[bucket]++;
+		count++;
+		total += latency;
+	}
+
+	void print(const char* name) const {
+		std::printf("\n%s: %d samples", name, count);
+		if (count == 0) {
+			std::printf("\n");
+			return;
+		}
+
+		std::printf(", mean %.1f us\n", (double)total / count);
+		int maxCount = 0;
+		int first = HISTOGRAM_BUCKETS;
+		int last = 0;
+		for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+			if (buckets[i] > 0) {
+				maxCount = std::max(maxCount, buckets[i]);
+				first = std::min(first, i);
+				last = i;
+			}
+		}
+
+		for (int i = first; i <= last; i++) {
+			const unsigned long limit = 2ul << i;
+			const std::string bar(buckets[i] * HISTOGRAM_WIDTH / maxCount, '#');
+			if (i == HISTOGRAM_BUCKETS - 1) {
+				std::printf("  >= %8lu us %5d %s\n", limit / 2, buckets[i], bar.c_str());
+			} else {
+				std::printf("  <  %8lu us %5d %s\n", limit, buckets[i], bar.c_str());
+			}
+		}
+	}
+
+private:
+	int buckets[HISTOGRAM_BUCKETS] = {};
+	int count = 0;
+	uint64_t total = 0;
+};
+
+// Pairs events of the phases and adds their latencies to histograms (times of the reader wrap around)
+void computePhases(const std::vector<TraceRecord>& records, Histogram* histograms) {
+	const TraceRecord* dispatched = nullptr;
+	const TraceRecord* authStart = nullptr;
+	const TraceRecord* transceiveStart = nullptr;
+	const TraceRecord* queued = nullptr;
+	for (const TraceRecord& record : records) {
+		switch (record.event) {
+		case TraceEvent::COMMAND_DISPATCHED:
+			dispatched = &record;
+			break;
+		case TraceEvent::AUTH_START:
+			authStart = &record;
+			break;
+		case TraceEvent::AUTH_END:
+			if (authStart != nullptr) {
+				histograms[AUTHENTICATION].add(record.time - authStart->time);
+				authStart = nullptr;
+			}
+			break;
+		case TraceEvent::TRANSCEIVE_START:
+			transceiveStart = &record;
+			break;
+		case TraceEvent::TRANSCEIVE_END:
+			if (transceiveStart != nullptr) {
+				histograms[TRANSCEIVE].add(record.time - transceiveStart->time);
+				transceiveStart = nullptr;
+			}
+			break;
+		case TraceEvent::RESPONSE_QUEUED:
+			if (dispatched != nullptr) {
+				histograms[EXECUTION].add(record.time - dispatched->time);
+				dispatched = nullptr;
+			}
+
+			if (queued == nullptr) {
+				queued = &record;
+			}
+			break;
+		case TraceEvent::RESPONSE_FLUSHED:
+			if (queued != nullptr) {
+				histograms[TRANSMISSION].add(record.time - queued->time);
+				queued = nullptr;
+			}
+			break;
+		case TraceEvent::FRAME_RECEIVED:
+		case TraceEvent::CARD_POLL:
+			break;
+		}
+	}
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	std::string portPath;
+	uint32_t linkSpeed = DEFAULT_LINK_SPEED;
+	bool clear = false;
+	for (int i = 1; i < argc; i++) {
+		const std::string option = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if ((option == "--port") && hasValue) {
+			portPath = argv[++i];
+		} else if ((option == "--link-speed") && hasValue) {
+			linkSpeed = (uint32_t)std::strtoul(argv[++i], nullptr, 10);
+		} else if (option == "--clear") {
+			clear = true;
+		} else {
+			printUsage();
+			return 2;
+		}
+	}
+
+	if (portPath.empty() || !SerialPort::isSupportedBaudRate(linkSpeed)) {
+		printUsage();
+		return 2;
+	}
+
+	std::unique_ptr<SerialPort> port;
+	try {
+		port.reset(new SerialPort(portPath, linkSpeed));
+	} catch (const std::system_error& error) {
+		std::fprintf(stderr, "%s: %s\n", portPath.c_str(), error.what());
+		return 1;
+	}
+
+	IoLoop loop;
+	loop.start();
+	CardReader reader(loop, *port);
+	std::vector<TraceRecord> records;
+	if (!TraceRecord::decode(reader.dumpTrace(clear).get(), records)) {
+		std::fprintf(stderr, "failed to read the trace\n");
+		return 1;
+	}
+
+	if (records.empty()) {
+		std::printf("trace is empty (or tracing is disabled in the firmware)\n");
+		return 0;
+	}
+
+	// timeline relative to the oldest event
+	std::printf("%10s %10s  %s\n", "time [ms]", "delta [us]", "event");
+	for (size_t i = 0; i < records.size(); i++) {
+		const uint32_t time = records[i].time - records[0].time;
+		const uint32_t delta = (i > 0) ? records[i].time - records[i - 1].time : 0;
+		std::printf("%10.3f %10u  %s\n", time / 1000.0, delta, describeEvent(records[i]).c_str());
+	}
+
+	Histogram histograms[PHASE_COUNT];
+	computePhases(records, histograms);
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		histograms[i].print(PHASE_NAMES[i]);
+	}
+
+	return 0;
+}